@@ -0,0 +1,348 @@
+#include <OpenMesh/Core/IO/MeshIO.hh>
+#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <Eigen/Dense>
+#include "meshmonk.hpp"
+#include "src/JobQueue.hpp"
+#include "src/PyramidNonrigidRegistration.hpp"
+#include "src/PreparedTemplate.hpp"
+
+/*
+# GOAL
+Batch registration driver. The jobs are files in a manifest directory (see
+registration::JobQueue), so any number of workers, on one or several nodes
+sharing the directory, can run the same batch: each worker claims jobs with
+lease files, renews its lease while a job runs, and writes the result and
+timing of each job. Jobs with a result are skipped, and the jobs of a worker
+that died are claimed again once their lease expires. Failed jobs aren't
+retried until 'retry' is run (they resume from their checkpoint).
+
+Pyramid jobs write a checkpoint after every pyramid layer (and every
+checkpoint_interval iterations, if given), so a job that was interrupted
+resumes where it was instead of starting over.
+
+Pyramid jobs that register the same template can share a prepared template
+(see registration::PreparedTemplate) with prepared_template=<path>: the first
+job that needs it prepares it and writes it to the path, later jobs (of any
+worker) load it, and each worker keeps the ones it loaded in memory.
+
+# USAGE
+Add jobs (one per floating mesh):
+    ./batch add <manifest> <jobId> floating=<obj> target=<obj> output=<obj>
+                [mode=pyramid|nonrigid|affine|rigid] [num_iterations=<n>]
+                [num_pyramid_layers=<n>] [checkpoint_interval=<n>] [use_scaling=0|1]
+                [regularisation=<r>] [prepared_template=<path>]
+Run a worker (start one per node, or several per node):
+    ./batch run <manifest> [--worker <id>] [--lease <seconds>] [--max-jobs <n>]
+Show the state of the batch:
+    ./batch status <manifest>
+Run the failed jobs again (with the next 'run'):
+    ./batch retry <manifest>
+*/
+
+typedef OpenMesh::DefaultTraits MyTraits;
+typedef OpenMesh::TriMesh_ArrayKernelT<MyTraits>  TriMesh;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat;
+typedef Eigen::Matrix4f Mat4Float;
+
+
+//# Load an OBJ file into features (positions and normals) and faces
+bool load_mesh(const std::string &path, FeatureMat &outFeatures, FacesMat &outFaces){
+    TriMesh mesh;
+    if (!OpenMesh::IO::read_mesh(mesh, path)) { return false;}
+    registration::convert_mesh_to_matrices(mesh, outFeatures, outFaces);
+    const Vec3Mat positions = outFeatures.leftCols(3);
+    Vec3Mat normals = Vec3Mat::Zero(positions.rows(), 3);
+    registration::update_normals_for_altered_positions(positions, outFaces, normals);
+    outFeatures.rightCols(3) = normals;
+    return true;
+}
+
+
+bool save_mesh(const std::string &path, const FeatureMat &features, const FacesMat &faces){
+    TriMesh mesh;
+    registration::convert_matrices_to_mesh(features, faces, mesh);
+    return OpenMesh::IO::write_mesh(mesh, path);
+}
+
+
+size_t size_setting(const registration::Job &job, const std::string &key, const size_t defaultValue){
+    const std::string value = job.get(key);
+    return value.empty() ? defaultValue : size_t(std::strtoul(value.c_str(), NULL, 10));
+}
+
+
+//# Prepared templates of a worker, by path
+typedef std::map<std::string, registration::PreparedTemplate> PreparedTemplates;
+
+
+//# The prepared template at 'path' for this floating mesh and pyramid: kept
+//# from a previous job, loaded, or prepared (and saved) if it doesn't fit.
+const registration::PreparedTemplate *get_prepared_template(PreparedTemplates &preparedTemplates, const std::string &path,
+                                                            const FeatureMat &floatingFeatures, const FacesMat &floatingFaces,
+                                                            const VecDynFloat &floatingFlags, const size_t numPyramidLayers,
+                                                            const float downsampleStart, const float downsampleEnd,
+                                                            const float sigma){
+    registration::PreparedTemplate &prepared = preparedTemplates[path];
+    if (prepared.fits(floatingFeatures, floatingFaces, numPyramidLayers, downsampleStart, downsampleEnd)) { return &prepared;}
+    if (prepared.load(path)
+        && prepared.fits(floatingFeatures, floatingFaces, numPyramidLayers, downsampleStart, downsampleEnd)) {
+        return &prepared;
+    }
+    std::cout << "Preparing the template " << path << std::endl;
+    prepared.set_input(&floatingFeatures, &floatingFaces, &floatingFlags);
+    prepared.set_parameters(numPyramidLayers, downsampleStart, downsampleEnd, sigma);
+    prepared.update();
+    prepared.save(path);
+    return &prepared;
+}
+
+
+//# Run one job. Returns false (with a message) if it failed.
+bool run_job(const registration::Job &job, const std::string &checkpointPath,
+             PreparedTemplates &preparedTemplates, std::string &message){
+    const std::string floatingPath = job.get("floating");
+    const std::string targetPath = job.get("target");
+    const std::string outputPath = job.get("output");
+    const std::string mode = job.get("mode", "pyramid");
+    if (floatingPath.empty() || targetPath.empty() || outputPath.empty()) {
+        message = "the job needs floating, target and output paths";
+        return false;
+    }
+
+    //# Load the meshes
+    FeatureMat floatingFeatures, targetFeatures;
+    FacesMat floatingFaces, targetFaces;
+    if (!load_mesh(floatingPath, floatingFeatures, floatingFaces)) {
+        message = "couldn't read " + floatingPath;
+        return false;
+    }
+    if (!load_mesh(targetPath, targetFeatures, targetFaces)) {
+        message = "couldn't read " + targetPath;
+        return false;
+    }
+    const VecDynFloat floatingFlags = VecDynFloat::Ones(floatingFeatures.rows());
+    const VecDynFloat targetFlags = VecDynFloat::Ones(targetFeatures.rows());
+
+    //# Register
+    if (mode == "pyramid") {
+        //## Same parameters as meshmonk::pyramid_registration(), with checkpoints
+        registration::PyramidNonrigidRegistration registrator;
+        registrator.set_input(floatingFeatures, targetFeatures, floatingFaces, targetFaces,
+                              floatingFlags, targetFlags);
+        const size_t numPyramidLayers = size_setting(job, "num_pyramid_layers", 3);
+        registrator.set_parameters(size_setting(job, "num_iterations", 60), numPyramidLayers,
+                                   90.0f, 90.0f, 0.0f, 0.0f, true, 5, 0.99f, false, 4.0f, true,
+                                   3.0f, 50, 1, 50, 1);
+        registrator.set_checkpoint(checkpointPath, size_setting(job, "checkpoint_interval", 0), true);
+        const std::string preparedPath = job.get("prepared_template");
+        if (!preparedPath.empty()) {
+            registrator.set_prepared_template(get_prepared_template(preparedTemplates, preparedPath,
+                                                                    floatingFeatures, floatingFaces, floatingFlags,
+                                                                    numPyramidLayers, 90.0f, 0.0f, 3.0f));
+        }
+        registrator.update();
+    }
+    else if (mode == "nonrigid") {
+        meshmonk::nonrigid_registration(floatingFeatures, targetFeatures, floatingFaces, targetFaces,
+                                        floatingFlags, targetFlags,
+                                        size_setting(job, "num_iterations", 60));
+    }
+    else if (mode == "affine") {
+        Mat4Float transformationMatrix;
+        meshmonk::affine_registration(floatingFeatures, targetFeatures, floatingFaces, targetFaces,
+                                      floatingFlags, targetFlags, transformationMatrix,
+                                      size_setting(job, "num_iterations", 20),
+                                      true, 5, 0.99f, false, 4.0f, true,
+                                      float(std::atof(job.get("regularisation", "0").c_str())));
+    }
+    else if (mode == "rigid") {
+        Mat4Float transformationMatrix;
+        meshmonk::rigid_registration(floatingFeatures, targetFeatures, floatingFaces, targetFaces,
+                                     floatingFlags, targetFlags, transformationMatrix,
+                                     size_setting(job, "num_iterations", 20),
+                                     true, 5, 0.99f, false, 4.0f, true,
+                                     job.get("use_scaling", "0") == "1");
+    }
+    else {
+        message = "unknown mode " + mode;
+        return false;
+    }
+
+    //# Save the result
+    if (!save_mesh(outputPath, floatingFeatures, floatingFaces)) {
+        message = "couldn't write " + outputPath;
+        return false;
+    }
+    message = outputPath;
+    return true;
+}
+
+
+//# Renews the lease of a job in the background while it runs
+class LeaseKeeper
+{
+    public:
+        LeaseKeeper(registration::JobQueue &queue, const std::string &jobId, const double leaseSeconds)
+            : _queue(queue), _jobId(jobId), _interval(std::chrono::duration<double>(leaseSeconds / 3.0)) {
+            _thread = std::thread(&LeaseKeeper::_run, this);
+        }
+        ~LeaseKeeper() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopped = true;
+            }
+            _condition.notify_one();
+            _thread.join();
+        }
+
+    private:
+        registration::JobQueue &_queue;
+        const std::string _jobId;
+        const std::chrono::duration<double> _interval;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        bool _stopped = false;
+        std::thread _thread;
+
+        void _run() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_condition.wait_for(lock, _interval, [this]{ return _stopped;})) {
+                if (!_queue.renew(_jobId)) {
+                    std::cerr << "Lost the lease of job " << _jobId << " (it may run twice)." << std::endl;
+                    return;
+                }
+            }
+        }
+};
+
+
+int run_worker(const std::string &manifest, const std::string &workerId,
+               const double leaseSeconds, const size_t maxJobs){
+    registration::JobQueue queue;
+    queue.set_input(manifest);
+    queue.set_parameters(workerId, leaseSeconds);
+    std::cout << "Worker " << queue.get_worker_id() << " on " << manifest << std::endl;
+
+    size_t numJobs = 0;
+    size_t numFailed = 0;
+    registration::Job job;
+    PreparedTemplates preparedTemplates;
+    while (((maxJobs == 0) || (numJobs < maxJobs)) && queue.claim(job)) {
+        std::cout << "Running job " << job.id << std::endl;
+        registration::JobResult result;
+        result.worker = queue.get_worker_id();
+        result.startTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        {
+            LeaseKeeper leaseKeeper(queue, job.id, leaseSeconds);
+            result.succeeded = run_job(job, queue.get_checkpoint_path(job.id), preparedTemplates, result.message);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        queue.complete(job.id, result);
+        std::cout << "Job " << job.id << (result.succeeded ? " done" : " failed: ") << (result.succeeded ? "" : result.message)
+                  << " (" << result.seconds << " s)" << std::endl;
+        numJobs++;
+        if (!result.succeeded) { numFailed++;}
+    }
+    std::cout << "Worker " << queue.get_worker_id() << " ran " << numJobs << " jobs (" << numFailed << " failed)." << std::endl;
+    return (numFailed == 0) ? 0 : 1;
+}
+
+
+int show_status(const std::string &manifest){
+    registration::JobQueue queue;
+    queue.set_input(manifest);
+    const std::vector<std::string> jobIds = queue.list_jobs();
+    size_t numDone = 0;
+    for (size_t j = 0 ; j < jobIds.size() ; j++) {
+        registration::JobResult result;
+        if (!queue.get_result(jobIds[j], result)) {
+            std::cout << jobIds[j] << ": pending" << std::endl;
+            continue;
+        }
+        numDone++;
+        std::cout << jobIds[j] << ": " << (result.succeeded ? "ok" : "failed") << " by " << result.worker
+                  << " in " << result.seconds << " s " << result.message << std::endl;
+    }
+    std::cout << numDone << "/" << jobIds.size() << " jobs done." << std::endl;
+    return 0;
+}
+
+
+int retry_failed(const std::string &manifest){
+    registration::JobQueue queue;
+    queue.set_input(manifest);
+    std::cout << queue.retry_failed() << " failed jobs will be run again." << std::endl;
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const std::string usage = "Usage:\n"
+        "  batch add <manifest> <jobId> floating=<obj> target=<obj> output=<obj> [key=value ...]\n"
+        "  batch run <manifest> [--worker <id>] [--lease <seconds>] [--max-jobs <n>]\n"
+        "  batch status <manifest>\n"
+        "  batch retry <manifest>\n";
+    if (argc < 3) {
+        std::cerr << usage;
+        return 2;
+    }
+    const std::string command = argv[1];
+    const std::string manifest = argv[2];
+
+    if ((command == "add") && (argc >= 4)) {
+        std::map<std::string, std::string> settings;
+        for (int a = 4 ; a < argc ; a++) {
+            const std::string argument = argv[a];
+            const size_t separator = argument.find('=');
+            if (separator == std::string::npos) {
+                std::cerr << "Expected key=value, got " << argument << std::endl;
+                return 2;
+            }
+            settings[argument.substr(0, separator)] = argument.substr(separator + 1);
+        }
+        registration::JobQueue queue;
+        queue.set_input(manifest);
+        return queue.add_job(argv[3], settings) ? 0 : 1;
+    }
+    if (command == "run") {
+        std::string workerId;
+        double leaseSeconds = 3600.0;
+        size_t maxJobs = 0;
+        for (int a = 3 ; a + 1 < argc ; a += 2) {
+            const std::string option = argv[a];
+            if (option == "--worker") { workerId = argv[a+1];}
+            else if (option == "--lease") { leaseSeconds = std::atof(argv[a+1]);}
+            else if (option == "--max-jobs") { maxJobs = size_t(std::strtoul(argv[a+1], NULL, 10));}
+            else {
+                std::cerr << "Unknown option " << option << std::endl << usage;
+                return 2;
+            }
+        }
+        if (leaseSeconds <= 0.0) {
+            std::cerr << "The lease must be longer than zero seconds." << std::endl;
+            return 2;
+        }
+        return run_worker(manifest, workerId, leaseSeconds, maxJobs);
+    }
+    if (command == "status") {
+        return show_status(manifest);
+    }
+    if (command == "retry") {
+        return retry_failed(manifest);
+    }
+    std::cerr << usage;
+    return 2;
+}
@@ -2,20 +2,31 @@
 #include <meshmonk.hpp>
 #include "mystream.cpp"
 
+/*
+Two forms:
+-[featuresSampled, facesSampled, flagsSampled, originalIndices] = downsample_mesh(features, faces, flags, downsampleRatio)
+ returns outputs of exactly the downsampled size.
+-downsample_mesh(features, faces, flags, featuresSampled, facesSampled, flagsSampled, originalIndices, downsampleRatio)
+ (legacy) writes into preallocated (too large) outputs, which have to be trimmed afterwards.
+*/
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
-    
+
     //# Check input
-    //## Number of input arguments
-    if(nlhs != 0) {
+    //## Number of input and output arguments
+    const bool exactOutputs = (nrhs == 4);
+    if (!exactOutputs && (nrhs != 8)) {
+    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nrhs",
+                      "4 inputs (or 8 inputs with preallocated outputs) required.");
+    }
+    if (exactOutputs && (nlhs != 4)) {
     mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nlhs",
-                      "Zero LHS outputs required.");
+                      "4 LHS outputs required.");
     }
-    //## Number of output arguments
-    if(nrhs != 8) {
-    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nrhs",
-                      "8 inputs required.");
+    if (!exactOutputs && (nlhs != 0)) {
+    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nlhs",
+                      "Zero LHS outputs required.");
     }
-    
+
     //# Get Inputs
     //## Features
     float *features = reinterpret_cast<float *>(mxGetData(prhs[0]));
@@ -25,6 +36,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     mwSize numFaces = mxGetM(prhs[1]);
     //## Flags
     float *flags = reinterpret_cast<float *>(mxGetData(prhs[2]));
+
+    //# Exact outputs: query the downsampled sizes, allocate and fetch
+    if (exactOutputs) {
+        //## Parameters
+        //### Downsample Ratio (between 0.0 and 1.0)
+        float downsampleRatio = static_cast<float>(mxGetScalar(prhs[3]));
+
+        //## Execute c++ function
+        size_t numDownsampledElements = 0;
+        size_t numDownsampledFaces = 0;
+        size_t handle = meshmonk::downsample_mesh_query(features, numElements,
+                                                        faces, numFaces,
+                                                        flags, downsampleRatio,
+                                                        numDownsampledElements, numDownsampledFaces);
+
+        //## Set Output
+        plhs[0] = mxCreateNumericMatrix(numDownsampledElements, 6, mxSINGLE_CLASS, mxREAL);
+        plhs[1] = mxCreateNumericMatrix(numDownsampledFaces, 3, mxUINT32_CLASS, mxREAL);
+        plhs[2] = mxCreateNumericMatrix(numDownsampledElements, 1, mxSINGLE_CLASS, mxREAL);
+        plhs[3] = mxCreateNumericMatrix(numDownsampledElements, 1, mxUINT32_CLASS, mxREAL);
+        bool fetched = meshmonk::downsample_mesh_fetch(handle,
+                                                       reinterpret_cast<float *>(mxGetData(plhs[0])),
+                                                       reinterpret_cast<int *>(mxGetData(plhs[1])),
+                                                       reinterpret_cast<float *>(mxGetData(plhs[2])),
+                                                       reinterpret_cast<int *>(mxGetData(plhs[3])));
+        meshmonk::downsample_mesh_release(handle);
+        if (!fetched) {
+        mexErrMsgIdAndTxt("MyToolbox:downsample_mesh:fetch",
+                          "Couldn't fetch the downsampled mesh.");
+        }
+        return;
+    }
+
+    //# Preallocated outputs
     //## Downsampled Features (output)
     float *downsampledFeatures = reinterpret_cast<float *>(mxGetData(prhs[3]));
     mwSize numDownsampledElements = mxGetM(prhs[3]);
@@ -39,7 +84,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     //## Parameters
     //### Downsample Ratio (between 0.0 and 1.0)
     float downsampleRatio = static_cast<float>(mxGetScalar(prhs[7]));
-    
+
     //# Execute c++ function
     meshmonk::downsample_mesh_mex(features, numElements,
                                   faces, numFaces,
@@ -49,39 +94,5 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
                                   downsampledFlags,
                                   originalIndices,
                                   downsampleRatio);
-    
-//     //# Set Output
-//     //## Downsampled Features
-//     plhs[0] = mxCreateNumericMatrix(numDownsampledElements, 6, mxSINGLE_CLASS, mxREAL);
-//     auto output0 = mxGetPr(plhs[0]);
-//     //### Copy result from c++ function into the output
-//     for (unsigned i = 0 ; i < numDownsampledElements * 6 ; i++){
-//         output0[i] = downsampledFeatures[i];
-//     }
-//     
-//     //## Downsampled Faces
-//     plhs[1] = mxCreateNumericMatrix(numDownsampledElements, 3, mxUINT32_CLASS, mxREAL);
-//     auto output1 = mxGetPr(plhs[1]);
-//     //### Copy result from c++ function into the output
-//     for (unsigned i = 0 ; i < numDownsampledFaces * 3 ; i++){
-//         output1[i] = downsampledFaces[i];
-//     }
-//     
-//     //## Downsampled Flags
-//     plhs[2] = mxCreateNumericMatrix(numDownsampledElements, 1, mxSINGLE_CLASS, mxREAL);
-//     auto output2 = mxGetPr(plhs[2]);
-//     //### Copy result from c++ function into the output
-//     for (unsigned i = 0 ; i < numDownsampledElements * 1 ; i++){
-//         output2[i] = downsampledFlags[i];
-//     }
-//     
-//     //## Original Indices
-//     plhs[3] = mxCreateNumericMatrix(numDownsampledElements, 1, mxUINT32_CLASS, mxREAL);
-//     auto output3 = mxGetPr(plhs[3]);
-//     //### Copy result from c++ function into the output
-//     for (unsigned i = 0 ; i < numDownsampledElements * 1 ; i++){
-//         output3[i] = originalIndices[i];
-//     }
-    
-  
-}
\ No newline at end of file
+
+}
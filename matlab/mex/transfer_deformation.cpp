@@ -0,0 +1,52 @@
+#include "mex.h"
+#include <meshmonk.hpp>
+#include "mystream.cpp"
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    //# Check input
+    //## Number of input arguments
+    if(nlhs != 0) {
+    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nlhs",
+                      "Zero LHS output required.");
+    }
+    //## Number of output arguments
+    if(nrhs != 7) {
+    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:nrhs",
+                      "7 inputs required.");
+    }
+    
+    //# Get Inputs
+    //## Proxy Features (before registration)
+    float *proxyFeatures = reinterpret_cast<float *>(mxGetData(prhs[0]));
+    mwSize numProxyElements = mxGetM(prhs[0]);
+    //## Proxy Faces
+    int *proxyFaces = reinterpret_cast<int *>(mxGetData(prhs[1]));
+    mwSize numProxyFaces = mxGetM(prhs[1]);
+    //## Registered Proxy Features
+    float *registeredProxyFeatures = reinterpret_cast<float *>(mxGetData(prhs[2]));
+    if (mxGetM(prhs[2]) != numProxyElements) {
+    mexErrMsgIdAndTxt("MyToolbox:arrayProduct:prhs",
+                      "The registered proxy needs as many rows as the proxy.");
+    }
+    //## Bound Features
+    float *boundFeatures = reinterpret_cast<float *>(mxGetData(prhs[3]));
+    mwSize numBoundElements = mxGetM(prhs[3]);
+    //## Bound Faces
+    int *boundFaces = reinterpret_cast<int *>(mxGetData(prhs[4]));
+    mwSize numBoundFaces = mxGetM(prhs[4]);
+    //## Parameters
+    //### Distance to the proxy surface beyond which the k-nn weights are used
+    float maxDistance = static_cast<float>(mxGetScalar(prhs[5]));
+    //### Number of proxy vertices of the k-nn weights
+    mwSize numNeighbours = static_cast<mwSize>(mxGetScalar(prhs[6]));
+    
+    //# Execute c++ function
+    meshmonk::transfer_deformation_mex(proxyFeatures, numProxyElements,
+                                       proxyFaces, numProxyFaces,
+                                       registeredProxyFeatures,
+                                       boundFeatures, numBoundElements,
+                                       boundFaces, numBoundFaces,
+                                       maxDistance, numNeighbours);
+  
+}
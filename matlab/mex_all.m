@@ -12,9 +12,13 @@ disp('Mexing "nonrigid_registration"...')
 mex -I/usr/local/include/ mex/nonrigid_registration.cpp -lmeshmonk
 disp('Mexing "pyramid_registration"...')
 mex -I/usr/local/include/ mex/pyramid_registration.cpp -lmeshmonk
+disp('Mexing "affine_registration"...')
+mex -I/usr/local/include/ mex/affine_registration.cpp -lmeshmonk
 disp('Mexing "rigid_registration"...')
 mex -I/usr/local/include/ mex/rigid_registration.cpp -lmeshmonk
 disp('Mexing "scaleshift_mesh"...')
 mex -I/usr/local/include/ mex/scaleshift_mesh.cpp -lmeshmonk
+disp('Mexing "transfer_deformation"...')
+mex -I/usr/local/include/ mex/transfer_deformation.cpp -lmeshmonk
 disp('Mexing "compute_normals"...')
 mex -I/usr/local/include/ mex/compute_normals.cpp -lmeshmonk
\ No newline at end of file
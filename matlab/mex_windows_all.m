@@ -27,11 +27,17 @@ mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/nonrigid_registrat
 disp('Mexing "pyramid_registration"...')
 mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/pyramid_registration.cpp')
 
+disp('Mexing "affine_registration"...')
+mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/affine_registration.cpp')
+
 disp('Mexing "rigid_registration"...')
 mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/rigid_registration.cpp')
 
 disp('Mexing "scaleshift_mesh"...')
 mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/scaleshift_mesh.cpp')
 
+disp('Mexing "transfer_deformation"...')
+mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/transfer_deformation.cpp')
+
 disp('Mexing "compute_normals"...')
 mex(c_om, c_mesh, c_nano, c_eigen, c_math, c_lib, 'matlab/mex/compute_normals.cpp')
@@ -1,32 +1,14 @@
 function [ featuresSampled, facesSampled, flagsSampled, originalIndices ]...
     = downsample_mesh_clean( features, faces, flags, downsampleRatio )
-%DOWNSAMPLE_MESH_CLEAN Downsampling plus cleaning of output
-%   The downsampling comes from an external library (meshmonk), which
-%   requires static memory allocation. So a surplus of memory should be
-%   allocated, and in this function is cleaned up after the initial
-%   downsampling.
-
-% Data and parameters
-numElements = size(features,1);
-numFaces = size(faces,1);
-numDownsampledElements = uint32(round((1.0-downsampleRatio) * numElements));
-numDownsampledFaces = numFaces; %can't really predict this number so we'll just use the upper limit estimation!
-
-featuresSampled = single(zeros(numDownsampledElements,6));
-facesSampled = uint32(zeros(numDownsampledFaces,3));
-flagsSampled = single(zeros(numDownsampledElements,1));
-originalIndices = uint32(zeros(numDownsampledElements,1));
+%DOWNSAMPLE_MESH_CLEAN Downsampling of a mesh
+%   The downsampling comes from an external library (meshmonk). The mexed
+%   downsample_mesh function queries the size of the downsampled mesh first,
+%   so the outputs have exactly the right size and need no cleaning (the
+%   clean_downsampled_* functions are only needed for the legacy form of
+%   downsample_mesh with preallocated outputs).
 
 %# Downsample
-downsample_mesh(features, faces, flags,...
-                featuresSampled, facesSampled, flagsSampled,...
-                originalIndices, downsampleRatio);
-            
-%# Clean the output
-[featuresSampled,numDownsampledElements] = clean_downsampled_features(featuresSampled);
-facesSampled = clean_downsampled_faces(facesSampled);
-flagsSampled = flagsSampled(1:numDownsampledElements);
-originalIndices = originalIndices(1:numDownsampledElements);
+[featuresSampled, facesSampled, flagsSampled, originalIndices] = ...
+    downsample_mesh(features, faces, flags, downsampleRatio);
 
 end
-
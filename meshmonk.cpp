@@ -1,7 +1,24 @@
 #include "meshmonk.hpp"
+#include <map>
+#include <mutex>
+#include <utility>
 
 namespace meshmonk{
 
+namespace {
+    //# Downsampled meshes kept between downsample_mesh_query() and
+    //# downsample_mesh_fetch(), by handle
+    struct DownsampleResult {
+        FeatureMat features;
+        FacesMat faces;
+        VecDynFloat flags;
+        VecDynInt originalIndices;
+    };
+    std::mutex downsampleMutex;
+    std::map<size_t, DownsampleResult> downsampleResults;
+    size_t nextDownsampleHandle = 1;
+}//namespace
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -58,13 +75,13 @@ extern "C"
                                 const float transformSigma/*= 3.0f*/,
                                 const size_t transformNumViscousIterationsStart/*= 50*/, const size_t transformNumViscousIterationsEnd/*= 1*/,
                                 const size_t transformNumElasticIterationsStart/*= 50*/, const size_t transformNumElasticIterationsEnd/*= 1*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        FeatureMat floatingFeatures = Eigen::Map<FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat targetFeatures = Eigen::Map<const FeatureMat>(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
-        const FacesMat floatingFaces = Eigen::Map<const FacesMat>(floatingFacesArray, numFloatingFaces, 3);
-        const FacesMat targetFaces = Eigen::Map<const FacesMat>(targetFacesArray, numTargetFaces, 3);
-        const VecDynFloat floatingFlags = Eigen::Map<const VecDynFloat>(floatingFlagsArray, numFloatingElements);
-        const VecDynFloat targetFlags = Eigen::Map<const VecDynFloat>(targetFlagsArray, numTargetElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> targetFeatures(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> floatingFaces(floatingFacesArray, numFloatingFaces, 3);
+        const Eigen::Map<const FacesMat> targetFaces(targetFacesArray, numTargetFaces, 3);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> targetFlags(targetFlagsArray, numTargetElements);
 
         pyramid_registration(floatingFeatures, targetFeatures,
                                 floatingFaces, targetFaces,
@@ -78,10 +95,6 @@ extern "C"
                                 transformSigma,
                                 transformNumViscousIterationsStart, transformNumViscousIterationsEnd,
                                 transformNumElasticIterationsStart, transformNumElasticIterationsEnd);
-
-        //# Convert back to raw data
-        Eigen::Map<FeatureMat>(floatingFeaturesArray, floatingFeatures.rows(), floatingFeatures.cols()) = floatingFeatures;
-
     }
 
 
@@ -97,13 +110,13 @@ extern "C"
                                 const float transformSigma/*= 3.0f*/,
                                 const size_t transformNumViscousIterationsStart/*= 50*/, const size_t transformNumViscousIterationsEnd/*= 1*/,
                                 const size_t transformNumElasticIterationsStart/*= 50*/, const size_t transformNumElasticIterationsEnd/*= 1*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        FeatureMat floatingFeatures = Eigen::Map<FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat targetFeatures = Eigen::Map<const FeatureMat>(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
-        const FacesMat floatingFaces = Eigen::Map<const FacesMat>(floatingFacesArray, numFloatingFaces, 3);
-        const FacesMat targetFaces = Eigen::Map<const FacesMat>(targetFacesArray, numTargetFaces, 3);
-        const VecDynFloat floatingFlags = Eigen::Map<const VecDynFloat>(floatingFlagsArray, numFloatingElements);
-        const VecDynFloat targetFlags = Eigen::Map<const VecDynFloat>(targetFlagsArray, numTargetElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> targetFeatures(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> floatingFaces(floatingFacesArray, numFloatingFaces, 3);
+        const Eigen::Map<const FacesMat> targetFaces(targetFacesArray, numTargetFaces, 3);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> targetFlags(targetFlagsArray, numTargetElements);
 
         //# Run nonrigid registration
         nonrigid_registration(floatingFeatures, targetFeatures,
@@ -116,9 +129,6 @@ extern "C"
                                 transformSigma,
                                 transformNumViscousIterationsStart, transformNumViscousIterationsEnd,
                                 transformNumElasticIterationsStart, transformNumElasticIterationsEnd);
-
-        //# Convert back to raw data
-        Eigen::Map<FeatureMat>(floatingFeaturesArray, floatingFeatures.rows(), floatingFeatures.cols()) = floatingFeatures;
     }
 
 
@@ -133,13 +143,13 @@ extern "C"
                                 const float correspondencesFlagThreshold/* = 0.9f*/, const bool correspondencesEqualizePushPull /*= false*/,
                                 const float inlierKappa/*= 4.0f*/, const bool inlierUseOrientation/*=true*/,
                                 const bool useScaling/*= false*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        FeatureMat floatingFeatures = Eigen::Map<FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat targetFeatures = Eigen::Map<const FeatureMat>(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
-        const FacesMat floatingFaces = Eigen::Map<const FacesMat>(floatingFacesArray, numFloatingFaces, 3);
-        const FacesMat targetFaces = Eigen::Map<const FacesMat>(targetFacesArray, numTargetFaces, 3);
-        const VecDynFloat floatingFlags = Eigen::Map<const VecDynFloat>(floatingFlagsArray, numFloatingElements);
-        const VecDynFloat targetFlags = Eigen::Map<const VecDynFloat>(targetFlagsArray, numTargetElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> targetFeatures(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> floatingFaces(floatingFacesArray, numFloatingFaces, 3);
+        const Eigen::Map<const FacesMat> targetFaces(targetFacesArray, numTargetFaces, 3);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> targetFlags(targetFlagsArray, numTargetElements);
         Mat4Float transformationMatrix = Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4);
 
         //# Run rigid registration
@@ -154,7 +164,42 @@ extern "C"
                             useScaling);
 
         //# Convert back to raw data
-        Eigen::Map<FeatureMat>(floatingFeaturesArray, floatingFeatures.rows(), floatingFeatures.cols()) = floatingFeatures;
+        Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4) = transformationMatrix;
+    }
+
+
+    void affine_registration_mex(float floatingFeaturesArray[], const float targetFeaturesArray[],
+                                const size_t numFloatingElements, const size_t numTargetElements,
+                                const int floatingFacesArray[], const int targetFacesArray[],
+                                const size_t numFloatingFaces, const size_t numTargetFaces,
+                                const float floatingFlagsArray[], const float targetFlagsArray[],
+                                float transformationMatrixArray[],
+                                const size_t numIterations/*= 20*/,
+                                const bool correspondencesSymmetric/*= true*/, const size_t correspondencesNumNeighbours/*= 5*/,
+                                const float correspondencesFlagThreshold/* = 0.99f*/, const bool correspondencesEqualizePushPull /*= false*/,
+                                const float inlierKappa/*= 4.0f*/, const bool inlierUseOrientation/*=true*/,
+                                const float regularisation/*= 0.0f*/){
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> targetFeatures(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> floatingFaces(floatingFacesArray, numFloatingFaces, 3);
+        const Eigen::Map<const FacesMat> targetFaces(targetFacesArray, numTargetFaces, 3);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> targetFlags(targetFlagsArray, numTargetElements);
+        Mat4Float transformationMatrix = Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4);
+
+        //# Run affine registration
+        affine_registration(floatingFeatures, targetFeatures,
+                            floatingFaces, targetFaces,
+                            floatingFlags, targetFlags,
+                            transformationMatrix,
+                            numIterations,
+                            correspondencesSymmetric, correspondencesNumNeighbours,
+                            correspondencesFlagThreshold, correspondencesEqualizePushPull,
+                            inlierKappa, inlierUseOrientation,
+                            regularisation);
+
+        //# Convert back to raw data
         Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4) = transformationMatrix;
     }
 
@@ -165,13 +210,13 @@ extern "C"
                                     float correspondingFeaturesArray[], float correspondingFlagsArray[],
                                     const bool correspondencesSymmetric/*= true*/, const size_t correspondencesNumNeighbours/*= 5*/,
                                     const float correspondencesFlagThreshold /*= 0.9f*/, const bool correspondencesEqualizePushPull /*= false*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        const FeatureMat floatingFeatures = Eigen::Map<const FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat targetFeatures = Eigen::Map<const FeatureMat>(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
-        const VecDynFloat floatingFlags = Eigen::Map<const VecDynFloat>(floatingFlagsArray, numFloatingElements);
-        const VecDynFloat targetFlags = Eigen::Map<const VecDynFloat>(targetFlagsArray, numTargetElements);
-        FeatureMat correspondingFeatures = Eigen::Map<FeatureMat>(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        VecDynFloat correspondingFlags = Eigen::Map<VecDynFloat>(correspondingFlagsArray, numFloatingElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> targetFeatures(targetFeaturesArray, numTargetElements, registration::NUM_FEATURES);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> targetFlags(targetFlagsArray, numTargetElements);
+        Eigen::Map<FeatureMat> correspondingFeatures(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        Eigen::Map<VecDynFloat> correspondingFlags(correspondingFlagsArray, numFloatingElements);
 
         //# Compute Correspondences
         compute_correspondences(floatingFeatures, targetFeatures,
@@ -179,10 +224,6 @@ extern "C"
                                 correspondingFeatures, correspondingFlags,
                                 correspondencesSymmetric, correspondencesNumNeighbours,
                                 correspondencesFlagThreshold, correspondencesEqualizePushPull);
-
-        //# Convert back to raw data
-        Eigen::Map<FeatureMat>(correspondingFeaturesArray, correspondingFeatures.rows(), correspondingFeatures.cols()) = correspondingFeatures;
-        Eigen::Map<VecDynFloat>(correspondingFlagsArray, correspondingFlags.rows(), correspondingFlags.cols()) = correspondingFlags;
     }
 
 
@@ -190,19 +231,16 @@ extern "C"
                                     const size_t numFloatingElements,
                                     const float correspondingFlagsArray[], float inlierWeightsArray[],
                                     const float inlierKappa/*= 4.0f*/, const bool useOrientation/*= true*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        const FeatureMat floatingFeatures = Eigen::Map<const FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat correspondingFeatures = Eigen::Map<const FeatureMat>(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const VecDynFloat correspondingFlags = Eigen::Map<const VecDynFloat>(correspondingFlagsArray, numFloatingElements);
-        VecDynFloat inlierWeights = Eigen::Map<VecDynFloat>(inlierWeightsArray, numFloatingElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> correspondingFeatures(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const VecDynFloat> correspondingFlags(correspondingFlagsArray, numFloatingElements);
+        Eigen::Map<VecDynFloat> inlierWeights(inlierWeightsArray, numFloatingElements);
 
         //# Computer Inlier Weights
         compute_inlier_weights(floatingFeatures, correspondingFeatures,
                                 correspondingFlags, inlierWeights,
                                 inlierKappa, useOrientation);
-
-        //# Convert back to raw data
-        Eigen::Map<VecDynFloat>(inlierWeightsArray, inlierWeights.rows(), inlierWeights.cols()) = inlierWeights;
     }
 
 
@@ -210,10 +248,10 @@ extern "C"
                                         const float correspondingFeaturesArray[], const float inlierWeightsArray[],
                                         float transformationMatrixArray[],
                                         const bool useScaling /*= false*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        FeatureMat floatingFeatures = Eigen::Map<FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat correspondingFeatures = Eigen::Map<const FeatureMat>(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const VecDynFloat inlierWeights = Eigen::Map<const VecDynFloat>(inlierWeightsArray, numFloatingElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> correspondingFeatures(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const VecDynFloat> inlierWeights(inlierWeightsArray, numFloatingElements);
         Mat4Float transformationMatrix = Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4);
 
         //# Run nonrigid registration
@@ -222,7 +260,6 @@ extern "C"
                                     useScaling);
 
         //# Convert back to raw data
-        Eigen::Map<FeatureMat>(floatingFeaturesArray, floatingFeatures.rows(), floatingFeatures.cols()) = floatingFeatures;
         Eigen::Map<Mat4Float>(transformationMatrixArray, 4, 4) = transformationMatrix;
     }
 
@@ -233,12 +270,12 @@ extern "C"
                                             const float floatingFlagsArray[], const float inlierWeightsArray[],
                                             const size_t transformNumNeighbours/*= 10*/, const float transformSigma/*= 3.0f*/,
                                             const size_t transformNumViscousIterations/*= 50*/, const size_t transformNumElasticIterations/*= 50*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        FeatureMat floatingFeatures = Eigen::Map<FeatureMat>(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FeatureMat correspondingFeatures = Eigen::Map<const FeatureMat>(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
-        const FacesMat floatingFaces = Eigen::Map<const FacesMat>(floatingFacesArray, numFloatingFaces, 3);
-        const VecDynFloat floatingFlags = Eigen::Map<const VecDynFloat>(floatingFlagsArray, numFloatingElements);
-        const VecDynFloat inlierWeights = Eigen::Map<const VecDynFloat>(inlierWeightsArray, numFloatingElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        Eigen::Map<FeatureMat> floatingFeatures(floatingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FeatureMat> correspondingFeatures(correspondingFeaturesArray, numFloatingElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> floatingFaces(floatingFacesArray, numFloatingFaces, 3);
+        const Eigen::Map<const VecDynFloat> floatingFlags(floatingFlagsArray, numFloatingElements);
+        const Eigen::Map<const VecDynFloat> inlierWeights(inlierWeightsArray, numFloatingElements);
 
         //# Run nonrigid registration
         compute_nonrigid_transformation(floatingFeatures, correspondingFeatures,
@@ -246,9 +283,6 @@ extern "C"
                                         inlierWeights,
                                         transformNumNeighbours, transformSigma,
                                         transformNumViscousIterations, transformNumElasticIterations);
-
-        //# Convert back to raw data
-        Eigen::Map<FeatureMat>(floatingFeaturesArray, floatingFeatures.rows(), floatingFeatures.cols()) = floatingFeatures;
     }
 
 
@@ -260,10 +294,10 @@ extern "C"
                             float sampledFlagsArray[],
                             int originalIndicesArray[],
                             const float downsampleRatio/* = 0.8f*/){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        const FeatureMat features = Eigen::Map<const FeatureMat>(featuresArray, numElements, registration::NUM_FEATURES);
-        const FacesMat faces = Eigen::Map<const FacesMat>(facesArray, numFaces, 3);
-        const VecDynFloat flags = Eigen::Map<const VecDynFloat>(flagsArray, numElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const FeatureMat> features(featuresArray, numElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> faces(facesArray, numFaces, 3);
+        const Eigen::Map<const VecDynFloat> flags(flagsArray, numElements);
         FeatureMat sampledFeatures = Eigen::Map<FeatureMat>(sampledFeaturesArray, numSampledElements, registration::NUM_FEATURES);
         FacesMat sampledFaces = Eigen::Map<FacesMat>(sampledFacesArray, numSampledFaces, 3);
         VecDynFloat sampledFlags = Eigen::Map<VecDynFloat>(sampledFlagsArray, numSampledElements);
@@ -282,37 +316,106 @@ extern "C"
     }
 
 
+    size_t downsample_mesh_query(const float featuresArray[], const size_t numElements,
+                                const int facesArray[], const size_t numFaces,
+                                const float flagsArray[],
+                                const float downsampleRatio,
+                                size_t &numSampledElements, size_t &numSampledFaces){
+        const Eigen::Map<const FeatureMat> features(featuresArray, numElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> faces(facesArray, numFaces, 3);
+        const Eigen::Map<const VecDynFloat> flags(flagsArray, numElements);
+
+        //# Downsample into a result that is kept until it's released
+        DownsampleResult result;
+        downsample_mesh(features, faces, flags,
+                        result.features, result.faces, result.flags,
+                        result.originalIndices, downsampleRatio);
+        numSampledElements = result.features.rows();
+        numSampledFaces = result.faces.rows();
+
+        std::lock_guard<std::mutex> lock(downsampleMutex);
+        const size_t handle = nextDownsampleHandle++;
+        downsampleResults[handle] = std::move(result);
+        return handle;
+    }
+
+
+    bool downsample_mesh_fetch(const size_t handle,
+                               float sampledFeaturesArray[], int sampledFacesArray[],
+                               float sampledFlagsArray[], int originalIndicesArray[]){
+        std::lock_guard<std::mutex> lock(downsampleMutex);
+        std::map<size_t, DownsampleResult>::const_iterator found = downsampleResults.find(handle);
+        if (found == downsampleResults.end()) {
+            std::cerr << "downsample_mesh_fetch(): unknown (or released) handle " << handle << "!" << std::endl;
+            return false;
+        }
+        //# Copy into arrays of exactly the queried sizes (NULL skips an output)
+        const DownsampleResult &result = found->second;
+        if (sampledFeaturesArray != NULL) {
+            Eigen::Map<FeatureMat>(sampledFeaturesArray, result.features.rows(), registration::NUM_FEATURES) = result.features;
+        }
+        if (sampledFacesArray != NULL) {
+            Eigen::Map<FacesMat>(sampledFacesArray, result.faces.rows(), 3) = result.faces;
+        }
+        if (sampledFlagsArray != NULL) {
+            Eigen::Map<VecDynFloat>(sampledFlagsArray, result.flags.size()) = result.flags;
+        }
+        if (originalIndicesArray != NULL) {
+            Eigen::Map<VecDynInt>(originalIndicesArray, result.originalIndices.size()) = result.originalIndices;
+        }
+        return true;
+    }
+
+
+    void downsample_mesh_release(const size_t handle){
+        std::lock_guard<std::mutex> lock(downsampleMutex);
+        downsampleResults.erase(handle);
+    }
+
+
     void scaleshift_mesh_mex(const float oldFeaturesArray[], const size_t numOldElements,
                             const int oldIndicesArray[],
                             float newFeaturesArray[], const size_t numNewElements,
                             const int newIndicesArray[]){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        const FeatureMat oldFeatures = Eigen::Map<const FeatureMat>(oldFeaturesArray, numOldElements, registration::NUM_FEATURES);
-        const VecDynInt oldIndices = Eigen::Map<const VecDynInt>(oldIndicesArray, numOldElements);
-        FeatureMat newFeatures = Eigen::Map<FeatureMat>(newFeaturesArray, numNewElements, registration::NUM_FEATURES);
-        const VecDynInt newIndices = Eigen::Map<const VecDynInt>(newIndicesArray, numNewElements);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const FeatureMat> oldFeatures(oldFeaturesArray, numOldElements, registration::NUM_FEATURES);
+        const Eigen::Map<const VecDynInt> oldIndices(oldIndicesArray, numOldElements);
+        Eigen::Map<FeatureMat> newFeatures(newFeaturesArray, numNewElements, registration::NUM_FEATURES);
+        const Eigen::Map<const VecDynInt> newIndices(newIndicesArray, numNewElements);
 
         //# ScaleShift
         scale_shift_mesh(oldFeatures, oldIndices,
                         newFeatures, newIndices);
+    }
 
-        //# Convert back to raw data
-        Eigen::Map<FeatureMat>(newFeaturesArray, newFeatures.rows(), newFeatures.cols()) = newFeatures;
+    void transfer_deformation_mex(const float proxyFeaturesArray[], const size_t numProxyElements,
+                                const int proxyFacesArray[], const size_t numProxyFaces,
+                                const float registeredProxyFeaturesArray[],
+                                float boundFeaturesArray[], const size_t numBoundElements,
+                                const int boundFacesArray[], const size_t numBoundFaces,
+                                const float maxDistance/* = 0.0f*/, const size_t numNeighbours/* = 3*/){
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const FeatureMat> proxyFeatures(proxyFeaturesArray, numProxyElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> proxyFaces(proxyFacesArray, numProxyFaces, 3);
+        const Eigen::Map<const FeatureMat> registeredProxyFeatures(registeredProxyFeaturesArray, numProxyElements, registration::NUM_FEATURES);
+        Eigen::Map<FeatureMat> boundFeatures(boundFeaturesArray, numBoundElements, registration::NUM_FEATURES);
+        const Eigen::Map<const FacesMat> boundFaces(boundFacesArray, numBoundFaces, 3);
+
+        //# Transfer the deformation
+        transfer_deformation(proxyFeatures, proxyFaces, registeredProxyFeatures,
+                            boundFeatures, boundFaces, maxDistance, numNeighbours);
     }
 
     void compute_normals_mex(const float positionsArray[], const size_t numElements,
                             const int facesArray[], const size_t numFaces,
                             float normalsArray[]){
-        //# Convert arrays to Eigen matrices (see http://dovgalecs.com/blog/eigen-how-to-get-in-and-out-data-from-eigen-matrix/)
-        const Vec3Mat inPositions = Eigen::Map<const Vec3Mat>(positionsArray, numElements, 3);
-        const FacesMat inFaces = Eigen::Map<const FacesMat>(facesArray, numFaces, 3);
-        Vec3Mat outNormals = Eigen::Map<Vec3Mat>(normalsArray, numElements, 3);
+        //# Map the arrays to Eigen matrices (read and written in place)
+        const Eigen::Map<const Vec3Mat> inPositions(positionsArray, numElements, 3);
+        const Eigen::Map<const FacesMat> inFaces(facesArray, numFaces, 3);
+        Eigen::Map<Vec3Mat> outNormals(normalsArray, numElements, 3);
 
         //# ScaleShift
         compute_normals(inPositions, inFaces, outNormals);
-
-        //# Convert back to raw data
-        Eigen::Map<Vec3Mat>(normalsArray, outNormals.rows(), outNormals.cols()) = outNormals;
     }
 
 
@@ -324,9 +427,9 @@ extern "C"
     Full Pyramid Nonrigid Registration
     This is the function you'll normally want to call to nonrigidly register a floating mesh to a target mesh.
     */
-    void pyramid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void pyramid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 const size_t numIterations/* = 60*/, const size_t numPyramidLayers/* = 3*/,
                                 const float downsampleFloatStart/* = 90*/, const float downsampleTargetStart/* = 90*/,
                                 const float downsampleFloatEnd/* = 0*/, const float downsampleTargetEnd/* = 0*/,
@@ -335,7 +438,8 @@ extern "C"
                                 const float inlierKappa/* = 4.0f*/, const bool inlierUseOrientation/* = true*/,
                                 const float transformSigma/* = 3.0f*/,
                                 const size_t transformNumViscousIterationsStart/* = 50*/, const size_t transformNumViscousIterationsEnd/* = 1*/,
-                                const size_t transformNumElasticIterationsStart/* = 50*/, const size_t transformNumElasticIterationsEnd/* = 1*/)
+                                const size_t transformNumElasticIterationsStart/* = 50*/, const size_t transformNumElasticIterationsEnd/* = 1*/,
+                                const bool directRegularisation/* = false*/, const float radiusFactor/* = 3.0f*/)
     {
         registration::PyramidNonrigidRegistration registrator;
         registrator.set_input(floatingFeatures, targetFeatures,
@@ -350,6 +454,7 @@ extern "C"
                                     transformSigma,
                                     transformNumViscousIterationsStart, transformNumViscousIterationsEnd,
                                     transformNumElasticIterationsStart, transformNumElasticIterationsEnd);
+        registrator.set_direct_regularisation(directRegularisation, radiusFactor);
         registrator.update();
     }
 
@@ -357,22 +462,23 @@ extern "C"
     Standard Nonrigid Registration
     This is the standard nonrigid registration procedure without pyramid approach, so computationally a bit slower.
     */
-    void nonrigid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void nonrigid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 const size_t numIterations/* = 60*/,
                                 const bool correspondencesSymmetric/* = true*/, const size_t correspondencesNumNeighbours/* = 5*/,
                                 const float correspondencesFlagThreshold/* = 0.99f*/, const bool correspondencesEqualizePushPull /*= false*/,
                                 const float inlierKappa/* = 4.0f*/, const bool inlierUseOrientation/* = true*/,
                                 const float transformSigma/* = 3.0f*/,
                                 const size_t transformNumViscousIterationsStart/* = 50*/, const size_t transformNumViscousIterationsEnd/* = 1*/,
-                                const size_t transformNumElasticIterationsStart/* = 50*/, const size_t transformNumElasticIterationsEnd/* = 1*/)
+                                const size_t transformNumElasticIterationsStart/* = 50*/, const size_t transformNumElasticIterationsEnd/* = 1*/,
+                                const bool directRegularisation/* = false*/, const float radiusFactor/* = 3.0f*/)
     {
 
         registration::NonrigidRegistration registrator;
-        registrator.set_input(&floatingFeatures, &targetFeatures,
-                                &floatingFaces,
-                                &floatingFlags, &targetFlags);
+        registrator.set_input(floatingFeatures, targetFeatures,
+                                floatingFaces,
+                                floatingFlags, targetFlags);
         registrator.set_parameters(correspondencesSymmetric, correspondencesNumNeighbours,
                                     correspondencesFlagThreshold, correspondencesEqualizePushPull,
                                     inlierKappa, inlierUseOrientation,
@@ -380,15 +486,16 @@ extern "C"
                                     transformSigma,
                                     transformNumViscousIterationsStart, transformNumViscousIterationsEnd,
                                     transformNumElasticIterationsStart, transformNumElasticIterationsEnd);
+        registrator.set_direct_regularisation(directRegularisation, radiusFactor);
         registrator.update();
     }
 
     /*
     Rigid Registration
     */
-    void rigid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void rigid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 Mat4Float& transformationMatrix,
                                 const size_t numIterations/* = 20*/,
                                 const bool correspondencesSymmetric/* = true*/, const size_t correspondencesNumNeighbours/* = 5*/,
@@ -398,8 +505,8 @@ extern "C"
     {
         //# Set up rigid registration object
         registration::RigidRegistration registrator;
-        registrator.set_input(&floatingFeatures, &targetFeatures,
-                                &floatingFlags, &targetFlags);
+        registrator.set_input(floatingFeatures, targetFeatures,
+                                floatingFlags, targetFlags);
         registrator.set_parameters(correspondencesSymmetric, correspondencesNumNeighbours,
                                     correspondencesFlagThreshold, correspondencesEqualizePushPull,
                                     inlierKappa, inlierUseOrientation,
@@ -413,6 +520,36 @@ extern "C"
     }
 
 
+    /*
+    Affine Registration
+    */
+    void affine_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
+                                Mat4Float& transformationMatrix,
+                                const size_t numIterations/* = 20*/,
+                                const bool correspondencesSymmetric/* = true*/, const size_t correspondencesNumNeighbours/* = 5*/,
+                                const float correspondencesFlagThreshold/* = 0.99f*/, const bool correspondencesEqualizePushPull /*= false*/,
+                                const float inlierKappa/* = 4.0f*/, const bool inlierUseOrientation/*=true*/,
+                                const float regularisation/* = 0.0f*/)
+    {
+        //# Set up affine registration object
+        registration::AffineRegistration registrator;
+        registrator.set_input(floatingFeatures, targetFeatures,
+                                floatingFlags, targetFlags);
+        registrator.set_parameters(correspondencesSymmetric, correspondencesNumNeighbours,
+                                    correspondencesFlagThreshold, correspondencesEqualizePushPull,
+                                    inlierKappa, inlierUseOrientation,
+                                    numIterations, regularisation);
+
+        //# Perform affine registration
+        registrator.update();
+
+        //# Return final transformation matrix
+        transformationMatrix = registrator.get_transformation();
+    }
+
+
 
 
     //######################################################################################
@@ -420,11 +557,15 @@ extern "C"
     //######################################################################################
 
     //# Correspondences
-    void compute_correspondences(const FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
-                                FeatureMat& correspondingFeatures, VecDynFloat& correspondingFlags,
+    void compute_correspondences(const registration::ConstFeatureView &floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
+                                registration::FeatureView correspondingFeatures, registration::VecView correspondingFlags,
                                 const bool symmetric/* = true*/, const size_t numNeighbours/* = 5*/,
                                 const float correspondencesFlagThreshold/* = 0.99f*/, const bool correspondencesEqualizePushPull /*= false*/){
+        if ((correspondingFeatures.rows() != floatingFeatures.rows()) || (correspondingFlags.size() != floatingFeatures.rows())) {
+            std::cerr << "compute_correspondences(): the corresponding features and flags must have a row per floating element." << std::endl;
+            return;
+        }
         registration::BaseCorrespondenceFilter* correspondenceFilter = NULL;
         if (symmetric) {
             correspondenceFilter = new registration::SymmetricCorrespondenceFilter();
@@ -434,34 +575,38 @@ extern "C"
             correspondenceFilter = new registration::CorrespondenceFilter();
             correspondenceFilter->set_parameters(numNeighbours, correspondencesFlagThreshold);
         }
-        correspondenceFilter->set_floating_input(&floatingFeatures, &floatingFlags);
-        correspondenceFilter->set_target_input(&targetFeatures, &targetFlags);
-        correspondenceFilter->set_output(&correspondingFeatures, &correspondingFlags);
+        correspondenceFilter->set_floating_input(floatingFeatures, floatingFlags);
+        correspondenceFilter->set_target_input(targetFeatures, targetFlags);
+        correspondenceFilter->set_output(correspondingFeatures, correspondingFlags);
         correspondenceFilter->update();
 
         delete correspondenceFilter;
     }
 
     //# Inliers
-    void compute_inlier_weights(const FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                const VecDynFloat& correspondingFlags, VecDynFloat& inlierWeights,
+    void compute_inlier_weights(const registration::ConstFeatureView &floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                const registration::ConstVecView &correspondingFlags, registration::VecView inlierWeights,
                                 const float kappa/* = 4.0f*/, const bool useOrientation/* = true*/){
+        if (inlierWeights.size() != floatingFeatures.rows()) {
+            std::cerr << "compute_inlier_weights(): the inlier weights must have a row per floating element." << std::endl;
+            return;
+        }
         registration::InlierDetector inlierDetector;
-        inlierDetector.set_input(&floatingFeatures, &correspondingFeatures,
-                                    &correspondingFlags);
-        inlierDetector.set_output(&inlierWeights);
+        inlierDetector.set_input(floatingFeatures, correspondingFeatures,
+                                    correspondingFlags);
+        inlierDetector.set_output(inlierWeights);
         inlierDetector.set_parameters(kappa, useOrientation);
         inlierDetector.update();
     }
 
     //# Rigid Transformation
-    void compute_rigid_transformation(FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                    const VecDynFloat& inlierWeights, Mat4Float& transformationMatrix,
+    void compute_rigid_transformation(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                    const registration::ConstVecView &inlierWeights, Mat4Float& transformationMatrix,
                                     const bool useScaling/* = false*/){
         //# Set up rigid transformer
         registration::RigidTransformer rigidTransformer;
-        rigidTransformer.set_input(&correspondingFeatures, &inlierWeights);
-        rigidTransformer.set_output(&floatingFeatures);
+        rigidTransformer.set_input(correspondingFeatures, inlierWeights);
+        rigidTransformer.set_output(floatingFeatures);
         rigidTransformer.set_parameters(useScaling);
 
         //# Perform rigid transformation
@@ -472,28 +617,28 @@ extern "C"
     }
 
     //# Nonrigid Transformation
-    void compute_nonrigid_transformation(FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                        const FacesMat& floatingFaces, const VecDynFloat& floatingFlags,
-                                        const VecDynFloat& inlierWeights,
+    void compute_nonrigid_transformation(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                        const registration::ConstFacesView &floatingFaces, const registration::ConstVecView &floatingFlags,
+                                        const registration::ConstVecView &inlierWeights,
                                         const size_t numSmoothingNeighbours/* = 10*/, const float sigmaSmoothing/* = 3.0f*/,
                                         const size_t numViscousIterations/* = 50*/, const size_t numElasticIterations/* = 50*/){
         registration::ViscoElasticTransformer transformer;
-        transformer.set_input(&correspondingFeatures, &inlierWeights, &floatingFlags, &floatingFaces);
-        transformer.set_output(&floatingFeatures);
+        transformer.set_input(correspondingFeatures, inlierWeights, floatingFlags, floatingFaces);
+        transformer.set_output(floatingFeatures);
         transformer.set_parameters(numSmoothingNeighbours, sigmaSmoothing, numViscousIterations,numElasticIterations);
         transformer.update();
     }
 
 
     //# Downsampler
-    void downsample_mesh(const FeatureMat& features, const FacesMat& faces,
-                        const VecDynFloat& flags,
+    void downsample_mesh(const registration::ConstFeatureView &features, const registration::ConstFacesView &faces,
+                        const registration::ConstVecView &flags,
                         FeatureMat& downsampledFeatures, FacesMat& downsampledFaces,
                         VecDynFloat& downsampledFlags, VecDynInt& originalIndices,
                         const float downsampleRatio/* = 0.8f*/){
 
         registration::Downsampler downsampler;
-        downsampler.set_input(&features, &faces, &flags);
+        downsampler.set_input(features, faces, flags);
         downsampler.set_output(downsampledFeatures, downsampledFaces,
                                 downsampledFlags, originalIndices);
         downsampler.set_parameters(downsampleRatio);
@@ -503,24 +648,89 @@ extern "C"
 
     //# ScaleShifter
     //## The scaleshifter is meant to transition from one scale in the pyramid to the next.
-    void scale_shift_mesh(const FeatureMat& previousFeatures, const VecDynInt& previousIndices,
-                        FeatureMat& newFeatures, const VecDynInt& newIndices){
+    void scale_shift_mesh(const registration::ConstFeatureView &previousFeatures, const registration::ConstIntVecView &previousIndices,
+                        registration::FeatureView newFeatures, const registration::ConstIntVecView &newIndices){
         registration::ScaleShifter scaleShifter;
         scaleShifter.set_input(previousFeatures, previousIndices, newIndices);
         scaleShifter.set_output(newFeatures);
         scaleShifter.update();
     }
 
+    void transfer_deformation(const registration::ConstFeatureView &proxyFeatures, const registration::ConstFacesView &proxyFaces,
+                            const registration::ConstFeatureView &registeredProxyFeatures,
+                            registration::FeatureView boundFeatures, const registration::ConstFacesView &boundFaces,
+                            const float maxDistance/* = 0.0f*/, const size_t numNeighbours/* = 3*/){
+        //# Bind the mesh to the proxy and move it along
+        registration::DeformationTransfer transfer;
+        transfer.set_input(proxyFeatures, proxyFaces, boundFeatures);
+        transfer.set_parameters(maxDistance, numNeighbours);
+        transfer.update();
+        if (!transfer.transfer(registeredProxyFeatures, boundFeatures)) { return;}
+
+        //# Update the normals (in place, in the last three columns)
+        const registration::ConstVec3View boundPositions(boundFeatures.data(), boundFeatures.rows(), 3,
+                                                         boundFeatures.rowStride(), boundFeatures.colStride());
+        registration::Vec3View boundNormals(boundFeatures.data() + 3 * boundFeatures.colStride(), boundFeatures.rows(), 3,
+                                            boundFeatures.rowStride(), boundFeatures.colStride());
+        registration::update_normals_for_altered_positions(boundPositions, boundFaces, boundNormals);
+    }
+
 
     //######################################################################################
     //###############################  MESH OPERATIONS  ####################################
     //######################################################################################
     //# Compute Normals from positions and faces
-    void compute_normals(const Vec3Mat &inPositions, const FacesMat &inFaces,
-                        Vec3Mat &outNormals){
+    void compute_normals(const registration::ConstVec3View &inPositions, const registration::ConstFacesView &inFaces,
+                        registration::Vec3View outNormals){
+        if (outNormals.rows() != inPositions.rows()) {
+            std::cerr << "compute_normals(): the normals must have a row per position." << std::endl;
+            return;
+        }
         registration::update_normals_for_altered_positions(inPositions, inFaces, outNormals);
     }
 
+
+    //######################################################################################
+    //##################################  TRACING  #########################################
+    //######################################################################################
+    void set_tracing(const bool enabled){
+        registration::Tracer::set_enabled(enabled);
+    }
+
+    void clear_trace(){
+        registration::Tracer::clear();
+    }
+
+    bool write_trace(const char filename[]){
+        return registration::Tracer::write(std::string(filename));
+    }
+
+    void set_performance_counters(const bool enabled){
+        registration::PerformanceCounters::set_enabled(enabled);
+    }
+
+    void clear_performance_counters(){
+        registration::PerformanceCounters::clear();
+    }
+
+    void print_performance_report(){
+        registration::PerformanceCounters::report(std::cout);
+    }
+
+    void set_deterministic_reductions(const bool deterministic){
+        registration::set_deterministic_reductions(deterministic);
+    }
+
+    void set_auto_tuning(const bool enabled, const char profilePath[]){
+        registration::AutoTuner::set_profile_path(std::string(profilePath));
+        registration::AutoTuner::set_enabled(enabled);
+    }
+
+    void tune_performance(const registration::ConstFeatureView &features, const char profilePath[]){
+        registration::AutoTuner::set_profile_path(std::string(profilePath));
+        registration::AutoTuner::tune(features);
+    }
+
     //######################################################################################
     //################################  INPUT/OUTPUT  ######################################
     //######################################################################################
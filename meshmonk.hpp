@@ -13,6 +13,8 @@
 #include <Eigen/Dense>
 #include "src/PyramidNonrigidRegistration.hpp"
 #include "src/RigidRegistration.hpp"
+#include "src/AffineRegistration.hpp"
+#include "src/DeformationTransfer.hpp"
 #include "src/NonrigidRegistration.hpp"
 #include "src/InlierDetector.hpp"
 #include "src/CorrespondenceFilter.hpp"
@@ -21,6 +23,10 @@
 #include "src/ViscoElasticTransformer.hpp"
 #include "src/Downsampler.hpp"
 #include "src/ScaleShifter.hpp"
+#include "src/Tracer.hpp"
+#include "src/PerformanceCounters.hpp"
+#include "src/ParallelReduction.hpp"
+#include "src/AutoTuner.hpp"
 #include "global.hpp"
 #include "src/helper_functions.hpp"
 
@@ -64,13 +70,21 @@ extern "C"
     //######################################################################################
     //################################  REGISTRATION  ######################################
     //######################################################################################
+    /*
+    The matrices are taken as views (registration::MatrixView, see src/MatrixView.hpp): a
+    FeatureMat, FacesMat, ... converts to one implicitly, and so does e.g. an Eigen::Map of a
+    caller's (row-major) data. They are read and written in place, without a copy. So the
+    outputs (corresponding features and flags, inlier weights, normals) must have their size
+    already: e.g. FeatureMat::Zero(numFloatingElements, registration::NUM_FEATURES).
+    */
+
     /*
     Full Pyramid Nonrigid Registration
     This is the function you'll normally want to call to nonrigidly register a floating mesh to a target mesh.
     */
-    void pyramid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void pyramid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 const size_t numIterations = 60, const size_t numPyramidLayers = 3,
                                 const float downsampleFloatStart = 90, const float downsampleTargetStart = 90,
                                 const float downsampleFloatEnd = 0, const float downsampleTargetEnd = 0,
@@ -79,29 +93,31 @@ extern "C"
                                 const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
                                 const float transformSigma = 3.0f,
                                 const size_t transformNumViscousIterationsStart = 50, const size_t transformNumViscousIterationsEnd = 1,
-                                const size_t transformNumElasticIterationsStart = 50, const size_t transformNumElasticIterationsEnd = 1);
+                                const size_t transformNumElasticIterationsStart = 50, const size_t transformNumElasticIterationsEnd = 1,
+                                const bool directRegularisation = false, const float radiusFactor = 3.0f);
 
     /*
     Standard Nonrigid Registration
     This is the standard nonrigid registration procedure without pyramid approach, so computationally a bit slower.
     */
-    void nonrigid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void nonrigid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 const size_t numIterations = 60,
                                 const bool correspondencesSymmetric = true, const size_t correspondencesNumNeighbours = 5,
                                 const float correspondencesFlagThreshold = 0.99f, const bool correspondencesEqualizePushPull = false,
                                 const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
                                 const float transformSigma = 3.0f,
                                 const size_t transformNumViscousIterationsStart = 50, const size_t transformNumViscousIterationsEnd = 1,
-                                const size_t transformNumElasticIterationsStart = 50, const size_t transformNumElasticIterationsEnd = 1);
+                                const size_t transformNumElasticIterationsStart = 50, const size_t transformNumElasticIterationsEnd = 1,
+                                const bool directRegularisation = false, const float radiusFactor = 3.0f);
 
     /*
     Rigid Registration
     */
-    void rigid_registration(FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const FacesMat& floatingFaces, const FacesMat& targetFaces,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
+    void rigid_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
                                 Mat4Float& transformationMatrix,
                                 const size_t numIterations = 20,
                                 const bool correspondencesSymmetric = true, const size_t correspondencesNumNeighbours = 5,
@@ -109,6 +125,21 @@ extern "C"
                                 const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
                                 const bool useScaling = false);
 
+    /*
+    Affine Registration
+    12-DOF (anisotropic scaling and shearing) registration, to run between the rigid and the
+    nonrigid registration. The regularisation pulls each step towards the identity.
+    */
+    void affine_registration(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstFacesView &floatingFaces, const registration::ConstFacesView &targetFaces,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
+                                Mat4Float& transformationMatrix,
+                                const size_t numIterations = 20,
+                                const bool correspondencesSymmetric = true, const size_t correspondencesNumNeighbours = 5,
+                                const float correspondencesFlagThreshold = 0.99f, const bool correspondencesEqualizePushPull = false,
+                                const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
+                                const float regularisation = 0.0f);
+
 
 
 
@@ -117,33 +148,33 @@ extern "C"
     //######################################################################################
 
     //# Correspondences
-    void compute_correspondences(const FeatureMat& floatingFeatures, const FeatureMat& targetFeatures,
-                                const VecDynFloat& floatingFlags, const VecDynFloat& targetFlags,
-                                FeatureMat& correspondingFeatures, VecDynFloat& correspondingFlags,
+    void compute_correspondences(const registration::ConstFeatureView &floatingFeatures, const registration::ConstFeatureView &targetFeatures,
+                                const registration::ConstVecView &floatingFlags, const registration::ConstVecView &targetFlags,
+                                registration::FeatureView correspondingFeatures, registration::VecView correspondingFlags,
                                 const bool symmetric = true, const size_t numNeighbours = 5,
                                 const float flagThreshold = 0.99f, const bool equalizePushPull = false);
 
     //# Inliers
-    void compute_inlier_weights(const FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                const VecDynFloat& correspondingFlags, VecDynFloat& inlierWeights,
+    void compute_inlier_weights(const registration::ConstFeatureView &floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                const registration::ConstVecView &correspondingFlags, registration::VecView inlierWeights,
                                 const float kappa = 4.0f, const bool useOrientation = true);
 
     //# Rigid Transformation
-    void compute_rigid_transformation(FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                    const VecDynFloat& inlierWeights, Mat4Float& transformationMatrix,
+    void compute_rigid_transformation(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                    const registration::ConstVecView &inlierWeights, Mat4Float& transformationMatrix,
                                     const bool useScaling = false);
 
     //# Nonrigid Transformation
-    void compute_nonrigid_transformation(FeatureMat& floatingFeatures, const FeatureMat& correspondingFeatures,
-                                        const FacesMat& floatingFaces, const VecDynFloat& floatingFlags,
-                                        const VecDynFloat& inlierWeights,
+    void compute_nonrigid_transformation(registration::FeatureView floatingFeatures, const registration::ConstFeatureView &correspondingFeatures,
+                                        const registration::ConstFacesView &floatingFaces, const registration::ConstVecView &floatingFlags,
+                                        const registration::ConstVecView &inlierWeights,
                                         const size_t numSmoothingNeighbours = 10, const float sigmaSmoothing = 3.0f,
                                         const size_t numViscousIterations = 50, const size_t numElasticIterations = 50);
 
 
     //# Downsampler
-    void downsample_mesh(const FeatureMat& features, const FacesMat& faces,
-                        const VecDynFloat& flags,
+    void downsample_mesh(const registration::ConstFeatureView &features, const registration::ConstFacesView &faces,
+                        const registration::ConstVecView &flags,
                         FeatureMat& downsampledFeatures, FacesMat& downsampledFaces,
                         VecDynFloat& downsampledFlags, VecDynInt& originalIndices,
                         const float downsampleRatio = 0.8f);
@@ -151,14 +182,57 @@ extern "C"
 
     //# ScaleShifter
     //## The scaleshifter is meant to transition from one scale in the pyramid to the next.
-    void scale_shift_mesh(const FeatureMat& previousFeatures, const VecDynInt& previousIndices,
-                        FeatureMat& newFeatures, const VecDynInt& newIndices);
+    void scale_shift_mesh(const registration::ConstFeatureView &previousFeatures, const registration::ConstIntVecView &previousIndices,
+                        registration::FeatureView newFeatures, const registration::ConstIntVecView &newIndices);
+
+    //# DeformationTransfer
+    //## Moves a mesh (e.g. the high resolution template) along with a registered proxy of it (e.g. a decimated
+    //## template). The bound mesh doesn't have to share vertices with the proxy. Its normals are recomputed.
+    void transfer_deformation(const registration::ConstFeatureView &proxyFeatures, const registration::ConstFacesView &proxyFaces,
+                            const registration::ConstFeatureView &registeredProxyFeatures,
+                            registration::FeatureView boundFeatures, const registration::ConstFacesView &boundFaces,
+                            const float maxDistance = 0.0f, const size_t numNeighbours = 3);
 
     //######################################################################################
     //###############################  MESH OPERATIONS  ####################################
     //######################################################################################
-    void compute_normals(const Vec3Mat &inPositions, const FacesMat &inFaces,
-                        Vec3Mat &outNormals);
+    void compute_normals(const registration::ConstVec3View &inPositions, const registration::ConstFacesView &inFaces,
+                        registration::Vec3View outNormals);
+
+
+    //######################################################################################
+    //##################################  TRACING  #########################################
+    //######################################################################################
+    /*
+    Record a timeline of the registration stages and write it as a Chrome trace-event
+    JSON file (open it in chrome://tracing or https://ui.perfetto.dev).
+    */
+    void set_tracing(const bool enabled);
+    void clear_trace();
+    bool write_trace(const char filename[]);
+
+    /*
+    Collect hardware performance counters per stage (kNN query, affinity, smoothing,
+    normals) and print a summary (cycles, IPC, LLC misses, bytes touched per vertex).
+    */
+    void set_performance_counters(const bool enabled);
+    void clear_performance_counters();
+    void print_performance_report();
+
+    /*
+    Deterministic parallel sums (fixed blocks, compensated and combined pairwise):
+    the results are bit-identical whatever the number of threads, at a small cost.
+    */
+    void set_deterministic_reductions(const bool deterministic);
+
+    /*
+    Auto-tuning of the kd-tree leaf size, thread count and parallel grain size. When
+    enabled, the first registration benchmarks the candidates on its floating mesh
+    (or loads a previously saved profile from 'profilePath'). tune_performance() runs
+    the benchmark on the given features and saves the profile right away.
+    */
+    void set_auto_tuning(const bool enabled, const char profilePath[] = "meshmonk_tuning.txt");
+    void tune_performance(const registration::ConstFeatureView &features, const char profilePath[] = "meshmonk_tuning.txt");
 
 
     //######################################################################################
@@ -218,6 +292,18 @@ extern "C"
                                 const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
                                 const bool useScaling = false);
 
+    void affine_registration_mex(float floatingFeaturesArray[], const float targetFeaturesArray[],
+                                const size_t numFloatingElements, const size_t numTargetElements,
+                                const int floatingFacesArray[], const int targetFacesArray[],
+                                const size_t numFloatingFaces, const size_t numTargetFaces,
+                                const float floatingFlagsArray[], const float targetFlagsArray[],
+                                float transformationMatrixArray[],
+                                const size_t numIterations = 20,
+                                const bool correspondencesSymmetric = true, const size_t correspondencesNumNeighbours = 5,
+                                const float correspondencesFlagThreshold = 0.99f, const bool correspondencesEqualizePushPull = false,
+                                const float inlierKappa = 4.0f, const bool inlierUseOrientation = true,
+                                const float regularisation = 0.0f);
+
     void compute_correspondences_mex(const float floatingFeaturesArray[], const float targetFeaturesArray[],
                                     const size_t numFloatingElements, const size_t numTargetElements,
                                     const float floatingFlagsArray[], const float targetFlagsArray[],
@@ -251,11 +337,40 @@ extern "C"
                             int originalIndicesArray[],
                             const float downsampleRatio/* = 0.8f*/);
 
+    /*
+    Downsampling with exact output sizes (instead of the over-allocated arrays
+    of downsample_mesh_mex()):
+    1) downsample_mesh_query() downsamples the mesh, keeps the result and returns
+       a handle to it (with the number of sampled elements and faces),
+    2) downsample_mesh_fetch() copies the result into arrays of exactly those
+       sizes (features: numSampledElements x 6, faces: numSampledFaces x 3, flags
+       and original indices: numSampledElements). NULL skips an output.
+    3) downsample_mesh_release() frees the result.
+    */
+    size_t downsample_mesh_query(const float featuresArray[], const size_t numElements,
+                                const int facesArray[], const size_t numFaces,
+                                const float flagsArray[],
+                                const float downsampleRatio,
+                                size_t &numSampledElements, size_t &numSampledFaces);
+
+    bool downsample_mesh_fetch(const size_t handle,
+                               float sampledFeaturesArray[], int sampledFacesArray[],
+                               float sampledFlagsArray[], int originalIndicesArray[]);
+
+    void downsample_mesh_release(const size_t handle);
+
     void scaleshift_mesh_mex(const float oldFeaturesArray[], const size_t numOldElements,
                             const int oldIndicesArray[],
                             float newFeaturesArray[], const size_t numNewElements,
                             const int newIndicesArray[]);
 
+    void transfer_deformation_mex(const float proxyFeaturesArray[], const size_t numProxyElements,
+                                const int proxyFacesArray[], const size_t numProxyFaces,
+                                const float registeredProxyFeaturesArray[],
+                                float boundFeaturesArray[], const size_t numBoundElements,
+                                const int boundFacesArray[], const size_t numBoundFaces,
+                                const float maxDistance/* = 0.0f*/, const size_t numNeighbours/* = 3*/);
+
     void compute_normals_mex(const float positionsArray[], const size_t numElements,
                             const int facesArray[], const size_t numFaces,
                             float normalsArray[]);
@@ -0,0 +1,1000 @@
+//# Python.h has to be included before any standard header
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "../meshmonk.hpp"
+
+/*
+# GOAL
+Python bindings of the meshmonk library (module 'meshmonk').
+
+The arrays are viewed through the buffer protocol (BufferView) and passed
+to the library as matrix views (registration::MatrixView) with the strides
+of the buffer, so NumPy float32/int32 arrays in C or Fortran order (or
+strided views of them) are read and written in place, without a copy: the
+registered floating features are written into the array that was given.
+Arrays of another type are rejected (TypeError) rather than converted, so
+a conversion is always explicit on the Python side (numpy.asarray(x,
+dtype=numpy.float32)). The registration runs without the GIL, so several
+Python threads can register scans concurrently (on different arrays).
+
+Features are (N,6) float32 arrays (positions and normals), faces (F,3) int32
+arrays and flags/weights (N,) float32 arrays. New arrays (transformation
+matrices, downsampled meshes) are returned as memoryviews, which
+numpy.asarray() wraps without a copy.
+
+# USAGE
+import numpy as np, meshmonk
+floating = np.asarray(floating, dtype=np.float32)
+transformation = np.asarray(meshmonk.rigid_registration(floating, target, floatingFaces,
+                                                        targetFaces, floatingFlags, targetFlags))
+meshmonk.pyramid_registration(floating, target, floatingFaces, targetFaces,
+                              floatingFlags, targetFlags, num_iterations=60)
+*/
+
+namespace {
+
+using registration::FeatureView;
+using registration::ConstFeatureView;
+using registration::ConstFacesView;
+using registration::Vec3View;
+using registration::ConstVec3View;
+using registration::VecView;
+using registration::ConstVecView;
+using registration::ConstIntVecView;
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorFloatMat;
+typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorIntMat;
+
+//# Number of columns of a one-dimensional array
+const Py_ssize_t VECTOR = 0;
+
+
+//######################################################################################
+//##############################  BUFFER VIEWS  ########################################
+//######################################################################################
+class BufferView
+{
+    /*
+    # GOAL
+    View a Python buffer (e.g. a NumPy array) of 32 bit floats or ints as an
+    Eigen matrix, without copying it. The buffer is released when the view
+    goes out of scope.
+
+    # PARAMETERS
+    -type: 'f' (float32) or 'i' (int32).
+    -numCols: number of columns of a two-dimensional buffer, or VECTOR for a
+    one-dimensional buffer (seen as a single column).
+    -writable: the buffer will be written.
+    */
+    public:
+        BufferView() { _view.obj = NULL;}
+        ~BufferView() { if (_view.obj != NULL) { PyBuffer_Release(&_view);}}
+
+        //# Returns false (with a Python exception set) if the object isn't a
+        //# buffer of the right type and shape
+        bool acquire(PyObject * const object, const char * const name, const char type,
+                     const Py_ssize_t numCols, const bool writable = false) {
+            const int flags = writable ? PyBUF_RECORDS : PyBUF_RECORDS_RO;
+            if (PyObject_GetBuffer(object, &_view, flags) != 0) {
+                _view.obj = NULL;
+                PyErr_Format(PyExc_TypeError, "%s must be a%s buffer (e.g. a NumPy array)",
+                             name, writable ? " writable" : "");
+                return false;
+            }
+            //## Format: a single 32 bit item, in native byte order
+            const char *format = (_view.format != NULL) ? _view.format : "B";
+            if ((format[0] == '@') || (format[0] == '=')) { format++;}
+            const bool isFloat = (format[0] == 'f') && (format[1] == '\0');
+            const bool isInt = ((format[0] == 'i') || (format[0] == 'l')) && (format[1] == '\0');
+            if ((_view.itemsize != 4) || ((type == 'f') && !isFloat) || ((type == 'i') && !isInt)) {
+                PyErr_Format(PyExc_TypeError, "%s must hold %s values", name,
+                             (type == 'f') ? "float32" : "int32");
+                return false;
+            }
+            //## Shape
+            const int expectedDimensions = (numCols == VECTOR) ? 1 : 2;
+            if ((_view.ndim != expectedDimensions)
+                || ((numCols != VECTOR) && (_view.shape[1] != numCols))) {
+                if (numCols == VECTOR) {
+                    PyErr_Format(PyExc_ValueError, "%s must be one-dimensional", name);
+                }
+                else {
+                    PyErr_Format(PyExc_ValueError, "%s must have shape (N,%zd)", name, numCols);
+                }
+                return false;
+            }
+            for (int d = 0 ; d < _view.ndim ; d++) {
+                if ((_view.strides[d] < 0) || (_view.strides[d] % _view.itemsize != 0)) {
+                    PyErr_Format(PyExc_ValueError, "%s must have positive strides aligned to its items", name);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        Py_ssize_t rows() const { return _view.shape[0];}
+        Py_ssize_t cols() const { return (_view.ndim == 1) ? 1 : _view.shape[1];}
+
+        //# View of the buffer as the library takes its matrices (e.g.
+        //# view<FeatureView>()), with the strides of the buffer: C and Fortran
+        //# order (and strided arrays) are read and written in place
+        template <typename ViewType>
+        ViewType view() const {
+            return ViewType(static_cast<typename ViewType::PointerType>(_view.buf), rows(), cols(),
+                            row_stride(), col_stride());
+        }
+
+    private:
+        Py_buffer _view;
+
+        //# Steps between the rows and between the columns, in items
+        Py_ssize_t row_stride() const { return _view.strides[0] / _view.itemsize;}
+        Py_ssize_t col_stride() const {
+            return (_view.ndim == 1) ? row_stride() * std::max(rows(), Py_ssize_t(1))
+                                     : _view.strides[1] / _view.itemsize;
+        }
+
+        BufferView(const BufferView&);
+        BufferView& operator=(const BufferView&);
+};
+
+
+//# Check that two buffers have as many rows
+bool check_rows(const BufferView &first, const char * const firstName,
+                const BufferView &second, const char * const secondName) {
+    if (first.rows() != second.rows()) {
+        PyErr_Format(PyExc_ValueError, "%s and %s must have as many rows (%zd and %zd)",
+                     firstName, secondName, first.rows(), second.rows());
+        return false;
+    }
+    return true;
+}
+
+
+//# Check that the vertex indices of faces are within the vertices (the
+//# library doesn't check them, so a bad index would read out of bounds)
+bool check_faces(const BufferView &faces, const char * const facesName,
+                 const BufferView &vertices, const char * const verticesName) {
+    const ConstFacesView indices = faces.view<ConstFacesView>();
+    const Py_ssize_t numVertices = vertices.rows();
+    for (Py_ssize_t f = 0 ; f < faces.rows() ; f++) {
+        for (Py_ssize_t c = 0 ; c < 3 ; c++) {
+            const int index = indices(f,c);
+            if ((index < 0) || (index >= numVertices)) {
+                PyErr_Format(PyExc_ValueError, "%s[%zd,%zd] = %d isn't a row of %s (which has %zd rows)",
+                             facesName, f, c, index, verticesName, numVertices);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+//# Check that a count parameter isn't negative
+bool check_count(const Py_ssize_t value, const char * const name) {
+    if (value < 0) {
+        PyErr_Format(PyExc_ValueError, "%s can't be negative", name);
+        return false;
+    }
+    return true;
+}
+
+
+//# New (rows x cols) array of float32 or int32, returned as a C-contiguous
+//# memoryview over a bytearray (numpy.asarray() doesn't copy it)
+PyObject * new_array(const char * const format, const Py_ssize_t rows, const Py_ssize_t cols,
+                     const void * const rowMajorData) {
+    PyObject * const bytes = PyByteArray_FromStringAndSize(static_cast<const char*>(rowMajorData), rows * cols * 4);
+    if (bytes == NULL) { return NULL;}
+    PyObject * const view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if (view == NULL) { return NULL;}
+    PyObject * const array = (cols == VECTOR)
+                             ? PyObject_CallMethod(view, "cast", "s", format)
+                             : PyObject_CallMethod(view, "cast", "s(nn)", format, rows, cols);
+    Py_DECREF(view);
+    return array;
+}
+
+PyObject * new_float_array(const RowMajorFloatMat &matrix) {
+    return new_array("f", matrix.rows(), matrix.cols(), matrix.data());
+}
+
+PyObject * new_float_vector(const VecDynFloat &vector) {
+    return new_array("f", vector.size(), VECTOR, vector.data());
+}
+
+PyObject * new_int_array(const RowMajorIntMat &matrix) {
+    return new_array("i", matrix.rows(), matrix.cols(), matrix.data());
+}
+
+PyObject * new_int_vector(const VecDynInt &vector) {
+    return new_array("i", vector.size(), VECTOR, vector.data());
+}
+
+
+//# Raise MemoryError if a registration didn't fit in its memory budget
+PyObject * memory_status_result(const registration::MemoryStatus status, PyObject * const result) {
+    if (status == registration::MEMORY_OVER_BUDGET) {
+        Py_XDECREF(result);
+        PyErr_SetString(PyExc_MemoryError, "the registration doesn't fit in the memory budget");
+        return NULL;
+    }
+    if (result == NULL) { Py_RETURN_NONE;}
+    return result;
+}
+
+
+//######################################################################################
+//################################  REGISTRATION  ######################################
+//######################################################################################
+PyObject * py_pyramid_registration(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "target_features", "floating_faces", "target_faces",
+                                     "floating_flags", "target_flags",
+                                     "num_iterations", "num_pyramid_layers",
+                                     "downsample_float_start", "downsample_target_start",
+                                     "downsample_float_end", "downsample_target_end",
+                                     "symmetric", "num_neighbours", "flag_threshold", "equalize_push_pull",
+                                     "kappa", "use_orientation", "sigma",
+                                     "viscous_iterations_start", "viscous_iterations_end",
+                                     "elastic_iterations_start", "elastic_iterations_end",
+                                     "surface_matching", "positional_search", "max_distance",
+                                     "selective_update", "requery_tolerance",
+                                     "incremental_normals", "normal_threshold", "compact_neighbours",
+                                     "direct_regularisation", "radius_factor",
+                                     "warm_start", "memory_budget", NULL};
+    PyObject *floatingObject, *targetObject, *floatingFacesObject, *targetFacesObject;
+    PyObject *floatingFlagsObject, *targetFlagsObject;
+    Py_ssize_t numIterations = 60, numPyramidLayers = 3;
+    float downsampleFloatStart = 90.0f, downsampleTargetStart = 90.0f;
+    float downsampleFloatEnd = 0.0f, downsampleTargetEnd = 0.0f;
+    int symmetric = 1, equalizePushPull = 0, useOrientation = 1;
+    Py_ssize_t numNeighbours = 5;
+    float flagThreshold = 0.99f, kappa = 4.0f, sigma = 3.0f;
+    Py_ssize_t viscousStart = 50, viscousEnd = 1, elasticStart = 50, elasticEnd = 1;
+    int surfaceMatching = 0, positionalSearch = 0, selectiveUpdate = 0;
+    int incrementalNormals = 0, compactNeighbours = 0, warmStart = 0;
+    int directRegularisation = 0;
+    float radiusFactor = 3.0f;
+    float maxDistance = 0.0f, requeryTolerance = 0.1f, normalThreshold = 0.01f;
+    Py_ssize_t memoryBudget = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|nnffffpnfpfpfnnnnppfpfpfppfpn",
+                                     const_cast<char **>(keywords),
+                                     &floatingObject, &targetObject, &floatingFacesObject, &targetFacesObject,
+                                     &floatingFlagsObject, &targetFlagsObject,
+                                     &numIterations, &numPyramidLayers,
+                                     &downsampleFloatStart, &downsampleTargetStart,
+                                     &downsampleFloatEnd, &downsampleTargetEnd,
+                                     &symmetric, &numNeighbours, &flagThreshold, &equalizePushPull,
+                                     &kappa, &useOrientation, &sigma,
+                                     &viscousStart, &viscousEnd, &elasticStart, &elasticEnd,
+                                     &surfaceMatching, &positionalSearch, &maxDistance,
+                                     &selectiveUpdate, &requeryTolerance,
+                                     &incrementalNormals, &normalThreshold, &compactNeighbours,
+                                     &directRegularisation, &radiusFactor,
+                                     &warmStart, &memoryBudget)) {
+        return NULL;
+    }
+    BufferView floating, target, floatingFaces, targetFaces, floatingFlags, targetFlags;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !target.acquire(targetObject, "target_features", 'f', registration::NUM_FEATURES)
+        || !floatingFaces.acquire(floatingFacesObject, "floating_faces", 'i', 3)
+        || !check_faces(floatingFaces, "floating_faces", floating, "floating_features")
+        || !targetFaces.acquire(targetFacesObject, "target_faces", 'i', 3)
+        || !check_faces(targetFaces, "target_faces", target, "target_features")
+        || !floatingFlags.acquire(floatingFlagsObject, "floating_flags", 'f', VECTOR)
+        || !targetFlags.acquire(targetFlagsObject, "target_flags", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", floatingFlags, "floating_flags")
+        || !check_rows(target, "target_features", targetFlags, "target_flags")
+        || !check_count(numIterations, "num_iterations") || !check_count(numPyramidLayers, "num_pyramid_layers")
+        || !check_count(numNeighbours, "num_neighbours") || !check_count(memoryBudget, "memory_budget")
+        || !check_count(viscousStart, "viscous_iterations_start") || !check_count(viscousEnd, "viscous_iterations_end")
+        || !check_count(elasticStart, "elastic_iterations_start") || !check_count(elasticEnd, "elastic_iterations_end")) {
+        return NULL;
+    }
+
+    registration::MemoryStatus status;
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView targetFeatures = target.view<ConstFeatureView>();
+    ConstFacesView floatingFacesMat = floatingFaces.view<ConstFacesView>();
+    ConstFacesView targetFacesMat = targetFaces.view<ConstFacesView>();
+    ConstVecView floatingFlagsVec = floatingFlags.view<ConstVecView>();
+    ConstVecView targetFlagsVec = targetFlags.view<ConstVecView>();
+
+    registration::PyramidNonrigidRegistration registrator;
+    registrator.set_input(floatingFeatures, targetFeatures, floatingFacesMat, targetFacesMat,
+                          floatingFlagsVec, targetFlagsVec);
+    registrator.set_parameters(numIterations, numPyramidLayers,
+                               downsampleFloatStart, downsampleTargetStart,
+                               downsampleFloatEnd, downsampleTargetEnd,
+                               symmetric, numNeighbours, flagThreshold, equalizePushPull,
+                               kappa, useOrientation, sigma,
+                               viscousStart, viscousEnd, elasticStart, elasticEnd);
+    registrator.set_surface_matching(surfaceMatching);
+    registrator.set_positional_search(positionalSearch);
+    registrator.set_max_distance(maxDistance);
+    registrator.set_selective_update(selectiveUpdate, requeryTolerance);
+    registrator.set_incremental_normals(incrementalNormals, normalThreshold);
+    registrator.set_compact_neighbours(compactNeighbours);
+    registrator.set_direct_regularisation(directRegularisation, radiusFactor);
+    registrator.set_warm_start(warmStart);
+    registrator.set_memory_budget(memoryBudget);
+    registrator.update();
+    status = registrator.get_memory_status();
+    Py_END_ALLOW_THREADS
+    return memory_status_result(status, NULL);
+}
+
+
+PyObject * py_nonrigid_registration(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "target_features", "floating_faces", "target_faces",
+                                     "floating_flags", "target_flags", "num_iterations",
+                                     "symmetric", "num_neighbours", "flag_threshold", "equalize_push_pull",
+                                     "kappa", "use_orientation", "sigma",
+                                     "viscous_iterations_start", "viscous_iterations_end",
+                                     "elastic_iterations_start", "elastic_iterations_end",
+                                     "surface_matching", "positional_search", "max_distance",
+                                     "selective_update", "requery_tolerance",
+                                     "incremental_normals", "normal_threshold", "compact_neighbours",
+                                     "direct_regularisation", "radius_factor",
+                                     "memory_budget", NULL};
+    PyObject *floatingObject, *targetObject, *floatingFacesObject, *targetFacesObject;
+    PyObject *floatingFlagsObject, *targetFlagsObject;
+    Py_ssize_t numIterations = 60;
+    int symmetric = 1, equalizePushPull = 0, useOrientation = 1;
+    Py_ssize_t numNeighbours = 5;
+    float flagThreshold = 0.99f, kappa = 4.0f, sigma = 3.0f;
+    Py_ssize_t viscousStart = 50, viscousEnd = 1, elasticStart = 50, elasticEnd = 1;
+    int surfaceMatching = 0, positionalSearch = 0, selectiveUpdate = 0;
+    int incrementalNormals = 0, compactNeighbours = 0;
+    int directRegularisation = 0;
+    float radiusFactor = 3.0f;
+    float maxDistance = 0.0f, requeryTolerance = 0.1f, normalThreshold = 0.01f;
+    Py_ssize_t memoryBudget = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|npnfpfpfnnnnppfpfpfppfn",
+                                     const_cast<char **>(keywords),
+                                     &floatingObject, &targetObject, &floatingFacesObject, &targetFacesObject,
+                                     &floatingFlagsObject, &targetFlagsObject, &numIterations,
+                                     &symmetric, &numNeighbours, &flagThreshold, &equalizePushPull,
+                                     &kappa, &useOrientation, &sigma,
+                                     &viscousStart, &viscousEnd, &elasticStart, &elasticEnd,
+                                     &surfaceMatching, &positionalSearch, &maxDistance,
+                                     &selectiveUpdate, &requeryTolerance,
+                                     &incrementalNormals, &normalThreshold, &compactNeighbours,
+                                     &directRegularisation, &radiusFactor,
+                                     &memoryBudget)) {
+        return NULL;
+    }
+    BufferView floating, target, floatingFaces, targetFaces, floatingFlags, targetFlags;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !target.acquire(targetObject, "target_features", 'f', registration::NUM_FEATURES)
+        || !floatingFaces.acquire(floatingFacesObject, "floating_faces", 'i', 3)
+        || !check_faces(floatingFaces, "floating_faces", floating, "floating_features")
+        || !targetFaces.acquire(targetFacesObject, "target_faces", 'i', 3)
+        || !check_faces(targetFaces, "target_faces", target, "target_features")
+        || !floatingFlags.acquire(floatingFlagsObject, "floating_flags", 'f', VECTOR)
+        || !targetFlags.acquire(targetFlagsObject, "target_flags", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", floatingFlags, "floating_flags")
+        || !check_rows(target, "target_features", targetFlags, "target_flags")
+        || !check_count(numIterations, "num_iterations") || !check_count(numNeighbours, "num_neighbours")
+        || !check_count(memoryBudget, "memory_budget")
+        || !check_count(viscousStart, "viscous_iterations_start") || !check_count(viscousEnd, "viscous_iterations_end")
+        || !check_count(elasticStart, "elastic_iterations_start") || !check_count(elasticEnd, "elastic_iterations_end")) {
+        return NULL;
+    }
+
+    registration::MemoryStatus status;
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView targetFeatures = target.view<ConstFeatureView>();
+    ConstFacesView floatingFacesMat = floatingFaces.view<ConstFacesView>();
+    ConstFacesView targetFacesMat = targetFaces.view<ConstFacesView>();
+    ConstVecView floatingFlagsVec = floatingFlags.view<ConstVecView>();
+    ConstVecView targetFlagsVec = targetFlags.view<ConstVecView>();
+
+    registration::NonrigidRegistration registrator;
+    registrator.set_input(floatingFeatures, targetFeatures, floatingFacesMat,
+                          floatingFlagsVec, targetFlagsVec);
+    registrator.set_parameters(symmetric, numNeighbours, flagThreshold, equalizePushPull,
+                               kappa, useOrientation, numIterations, sigma,
+                               viscousStart, viscousEnd, elasticStart, elasticEnd);
+    registrator.set_surface_matching(surfaceMatching, targetFacesMat);
+    registrator.set_positional_search(positionalSearch);
+    registrator.set_max_distance(maxDistance);
+    registrator.set_selective_update(selectiveUpdate, requeryTolerance);
+    registrator.set_incremental_normals(incrementalNormals, normalThreshold);
+    registrator.set_compact_neighbours(compactNeighbours);
+    registrator.set_direct_regularisation(directRegularisation, radiusFactor);
+    registrator.set_memory_budget(memoryBudget);
+    registrator.update();
+    status = registrator.get_memory_status();
+    Py_END_ALLOW_THREADS
+    return memory_status_result(status, NULL);
+}
+
+
+PyObject * py_rigid_registration(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "target_features", "floating_faces", "target_faces",
+                                     "floating_flags", "target_flags", "num_iterations",
+                                     "symmetric", "num_neighbours", "flag_threshold", "equalize_push_pull",
+                                     "kappa", "use_orientation", "use_scaling",
+                                     "surface_matching", "positional_search", "max_distance",
+                                     "memory_budget", "trim_fraction", "trim_ramp", NULL};
+    PyObject *floatingObject, *targetObject, *floatingFacesObject, *targetFacesObject;
+    PyObject *floatingFlagsObject, *targetFlagsObject;
+    Py_ssize_t numIterations = 20;
+    int symmetric = 1, equalizePushPull = 0, useOrientation = 1, useScaling = 0;
+    Py_ssize_t numNeighbours = 5;
+    float flagThreshold = 0.99f, kappa = 4.0f;
+    int surfaceMatching = 0, positionalSearch = 0;
+    float maxDistance = 0.0f;
+    Py_ssize_t memoryBudget = 0;
+    float trimFraction = 0.0f, trimRamp = 0.0f;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|npnfpfppppfnff",
+                                     const_cast<char **>(keywords),
+                                     &floatingObject, &targetObject, &floatingFacesObject, &targetFacesObject,
+                                     &floatingFlagsObject, &targetFlagsObject, &numIterations,
+                                     &symmetric, &numNeighbours, &flagThreshold, &equalizePushPull,
+                                     &kappa, &useOrientation, &useScaling,
+                                     &surfaceMatching, &positionalSearch, &maxDistance,
+                                     &memoryBudget, &trimFraction, &trimRamp)) {
+        return NULL;
+    }
+    BufferView floating, target, floatingFaces, targetFaces, floatingFlags, targetFlags;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !target.acquire(targetObject, "target_features", 'f', registration::NUM_FEATURES)
+        || !floatingFaces.acquire(floatingFacesObject, "floating_faces", 'i', 3)
+        || !check_faces(floatingFaces, "floating_faces", floating, "floating_features")
+        || !targetFaces.acquire(targetFacesObject, "target_faces", 'i', 3)
+        || !check_faces(targetFaces, "target_faces", target, "target_features")
+        || !floatingFlags.acquire(floatingFlagsObject, "floating_flags", 'f', VECTOR)
+        || !targetFlags.acquire(targetFlagsObject, "target_flags", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", floatingFlags, "floating_flags")
+        || !check_rows(target, "target_features", targetFlags, "target_flags")
+        || !check_count(numIterations, "num_iterations") || !check_count(numNeighbours, "num_neighbours")
+        || !check_count(memoryBudget, "memory_budget")) {
+        return NULL;
+    }
+
+    registration::MemoryStatus status;
+    RowMajorFloatMat transformation;
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView targetFeatures = target.view<ConstFeatureView>();
+    ConstFacesView targetFacesMat = targetFaces.view<ConstFacesView>();
+    ConstVecView floatingFlagsVec = floatingFlags.view<ConstVecView>();
+    ConstVecView targetFlagsVec = targetFlags.view<ConstVecView>();
+
+    registration::RigidRegistration registrator;
+    registrator.set_input(floatingFeatures, targetFeatures, floatingFlagsVec, targetFlagsVec);
+    registrator.set_parameters(symmetric, numNeighbours, flagThreshold, equalizePushPull,
+                               kappa, useOrientation, numIterations, useScaling);
+    registrator.set_surface_matching(surfaceMatching, targetFacesMat);
+    registrator.set_positional_search(positionalSearch);
+    registrator.set_max_distance(maxDistance);
+    registrator.set_trimming(trimFraction, trimRamp);
+    registrator.set_memory_budget(memoryBudget);
+    registrator.update();
+    status = registrator.get_memory_status();
+    transformation = registrator.get_transformation();
+    Py_END_ALLOW_THREADS
+    return memory_status_result(status, new_float_array(transformation));
+}
+
+
+PyObject * py_affine_registration(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "target_features", "floating_faces", "target_faces",
+                                     "floating_flags", "target_flags", "num_iterations",
+                                     "symmetric", "num_neighbours", "flag_threshold", "equalize_push_pull",
+                                     "kappa", "use_orientation", "regularisation",
+                                     "surface_matching", "positional_search", "max_distance",
+                                     "memory_budget", NULL};
+    PyObject *floatingObject, *targetObject, *floatingFacesObject, *targetFacesObject;
+    PyObject *floatingFlagsObject, *targetFlagsObject;
+    Py_ssize_t numIterations = 20;
+    int symmetric = 1, equalizePushPull = 0, useOrientation = 1;
+    Py_ssize_t numNeighbours = 5;
+    float flagThreshold = 0.99f, kappa = 4.0f, regularisation = 0.0f;
+    int surfaceMatching = 0, positionalSearch = 0;
+    float maxDistance = 0.0f;
+    Py_ssize_t memoryBudget = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|npnfpfpfppfn",
+                                     const_cast<char **>(keywords),
+                                     &floatingObject, &targetObject, &floatingFacesObject, &targetFacesObject,
+                                     &floatingFlagsObject, &targetFlagsObject, &numIterations,
+                                     &symmetric, &numNeighbours, &flagThreshold, &equalizePushPull,
+                                     &kappa, &useOrientation, &regularisation,
+                                     &surfaceMatching, &positionalSearch, &maxDistance,
+                                     &memoryBudget)) {
+        return NULL;
+    }
+    BufferView floating, target, floatingFaces, targetFaces, floatingFlags, targetFlags;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !target.acquire(targetObject, "target_features", 'f', registration::NUM_FEATURES)
+        || !floatingFaces.acquire(floatingFacesObject, "floating_faces", 'i', 3)
+        || !check_faces(floatingFaces, "floating_faces", floating, "floating_features")
+        || !targetFaces.acquire(targetFacesObject, "target_faces", 'i', 3)
+        || !check_faces(targetFaces, "target_faces", target, "target_features")
+        || !floatingFlags.acquire(floatingFlagsObject, "floating_flags", 'f', VECTOR)
+        || !targetFlags.acquire(targetFlagsObject, "target_flags", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", floatingFlags, "floating_flags")
+        || !check_rows(target, "target_features", targetFlags, "target_flags")
+        || !check_count(numIterations, "num_iterations") || !check_count(numNeighbours, "num_neighbours")
+        || !check_count(memoryBudget, "memory_budget")) {
+        return NULL;
+    }
+
+    registration::MemoryStatus status;
+    RowMajorFloatMat transformation;
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView targetFeatures = target.view<ConstFeatureView>();
+    ConstFacesView targetFacesMat = targetFaces.view<ConstFacesView>();
+    ConstVecView floatingFlagsVec = floatingFlags.view<ConstVecView>();
+    ConstVecView targetFlagsVec = targetFlags.view<ConstVecView>();
+
+    registration::AffineRegistration registrator;
+    registrator.set_input(floatingFeatures, targetFeatures, floatingFlagsVec, targetFlagsVec);
+    registrator.set_parameters(symmetric, numNeighbours, flagThreshold, equalizePushPull,
+                               kappa, useOrientation, numIterations, regularisation);
+    registrator.set_surface_matching(surfaceMatching, targetFacesMat);
+    registrator.set_positional_search(positionalSearch);
+    registrator.set_max_distance(maxDistance);
+    registrator.set_memory_budget(memoryBudget);
+    registrator.update();
+    status = registrator.get_memory_status();
+    transformation = registrator.get_transformation();
+    Py_END_ALLOW_THREADS
+    return memory_status_result(status, new_float_array(transformation));
+}
+
+
+//######################################################################################
+//############################  REGISTRATION MODULES  ##################################
+//######################################################################################
+PyObject * py_compute_correspondences(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "target_features", "floating_flags", "target_flags",
+                                     "corresponding_features", "corresponding_flags",
+                                     "symmetric", "num_neighbours", "flag_threshold", "equalize_push_pull", NULL};
+    PyObject *floatingObject, *targetObject, *floatingFlagsObject, *targetFlagsObject;
+    PyObject *correspondingObject, *correspondingFlagsObject;
+    int symmetric = 1, equalizePushPull = 0;
+    Py_ssize_t numNeighbours = 5;
+    float flagThreshold = 0.99f;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|pnfp", const_cast<char **>(keywords),
+                                     &floatingObject, &targetObject, &floatingFlagsObject, &targetFlagsObject,
+                                     &correspondingObject, &correspondingFlagsObject,
+                                     &symmetric, &numNeighbours, &flagThreshold, &equalizePushPull)) {
+        return NULL;
+    }
+    BufferView floating, target, floatingFlags, targetFlags, corresponding, correspondingFlags;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES)
+        || !target.acquire(targetObject, "target_features", 'f', registration::NUM_FEATURES)
+        || !floatingFlags.acquire(floatingFlagsObject, "floating_flags", 'f', VECTOR)
+        || !targetFlags.acquire(targetFlagsObject, "target_flags", 'f', VECTOR)
+        || !corresponding.acquire(correspondingObject, "corresponding_features", 'f', registration::NUM_FEATURES, true)
+        || !correspondingFlags.acquire(correspondingFlagsObject, "corresponding_flags", 'f', VECTOR, true)
+        || !check_rows(floating, "floating_features", floatingFlags, "floating_flags")
+        || !check_rows(target, "target_features", targetFlags, "target_flags")
+        || !check_rows(floating, "floating_features", corresponding, "corresponding_features")
+        || !check_rows(floating, "floating_features", correspondingFlags, "corresponding_flags")
+        || !check_count(numNeighbours, "num_neighbours")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView floatingFeatures = floating.view<ConstFeatureView>();
+    ConstFeatureView targetFeatures = target.view<ConstFeatureView>();
+    ConstVecView floatingFlagsVec = floatingFlags.view<ConstVecView>();
+    ConstVecView targetFlagsVec = targetFlags.view<ConstVecView>();
+    FeatureView correspondingFeatures = corresponding.view<FeatureView>();
+    VecView correspondingFlagsVec = correspondingFlags.view<VecView>();
+    meshmonk::compute_correspondences(floatingFeatures, targetFeatures, floatingFlagsVec, targetFlagsVec,
+                                      correspondingFeatures, correspondingFlagsVec,
+                                      symmetric, numNeighbours, flagThreshold, equalizePushPull);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+PyObject * py_compute_inlier_weights(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "corresponding_features", "corresponding_flags",
+                                     "inlier_weights", "kappa", "use_orientation", NULL};
+    PyObject *floatingObject, *correspondingObject, *correspondingFlagsObject, *weightsObject;
+    float kappa = 4.0f;
+    int useOrientation = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|fp", const_cast<char **>(keywords),
+                                     &floatingObject, &correspondingObject, &correspondingFlagsObject,
+                                     &weightsObject, &kappa, &useOrientation)) {
+        return NULL;
+    }
+    BufferView floating, corresponding, correspondingFlags, weights;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES)
+        || !corresponding.acquire(correspondingObject, "corresponding_features", 'f', registration::NUM_FEATURES)
+        || !correspondingFlags.acquire(correspondingFlagsObject, "corresponding_flags", 'f', VECTOR)
+        || !weights.acquire(weightsObject, "inlier_weights", 'f', VECTOR, true)
+        || !check_rows(floating, "floating_features", corresponding, "corresponding_features")
+        || !check_rows(floating, "floating_features", correspondingFlags, "corresponding_flags")
+        || !check_rows(floating, "floating_features", weights, "inlier_weights")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView floatingFeatures = floating.view<ConstFeatureView>();
+    ConstFeatureView correspondingFeatures = corresponding.view<ConstFeatureView>();
+    ConstVecView correspondingFlagsVec = correspondingFlags.view<ConstVecView>();
+    VecView inlierWeights = weights.view<VecView>();
+    meshmonk::compute_inlier_weights(floatingFeatures, correspondingFeatures, correspondingFlagsVec,
+                                     inlierWeights, kappa, useOrientation);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+PyObject * py_compute_rigid_transformation(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "corresponding_features", "inlier_weights",
+                                     "use_scaling", NULL};
+    PyObject *floatingObject, *correspondingObject, *weightsObject;
+    int useScaling = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|p", const_cast<char **>(keywords),
+                                     &floatingObject, &correspondingObject, &weightsObject, &useScaling)) {
+        return NULL;
+    }
+    BufferView floating, corresponding, weights;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !corresponding.acquire(correspondingObject, "corresponding_features", 'f', registration::NUM_FEATURES)
+        || !weights.acquire(weightsObject, "inlier_weights", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", corresponding, "corresponding_features")
+        || !check_rows(floating, "floating_features", weights, "inlier_weights")) {
+        return NULL;
+    }
+
+    RowMajorFloatMat transformation;
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView correspondingFeatures = corresponding.view<ConstFeatureView>();
+    ConstVecView inlierWeights = weights.view<ConstVecView>();
+    Mat4Float transformationMatrix;
+    meshmonk::compute_rigid_transformation(floatingFeatures, correspondingFeatures, inlierWeights,
+                                           transformationMatrix, useScaling);
+    transformation = transformationMatrix;
+    Py_END_ALLOW_THREADS
+    return new_float_array(transformation);
+}
+
+
+PyObject * py_compute_nonrigid_transformation(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"floating_features", "corresponding_features", "floating_faces",
+                                     "floating_flags", "inlier_weights", "num_neighbours", "sigma",
+                                     "viscous_iterations", "elastic_iterations", NULL};
+    PyObject *floatingObject, *correspondingObject, *facesObject, *flagsObject, *weightsObject;
+    Py_ssize_t numNeighbours = 10, viscousIterations = 50, elasticIterations = 50;
+    float sigma = 3.0f;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOO|nfnn", const_cast<char **>(keywords),
+                                     &floatingObject, &correspondingObject, &facesObject, &flagsObject,
+                                     &weightsObject, &numNeighbours, &sigma,
+                                     &viscousIterations, &elasticIterations)) {
+        return NULL;
+    }
+    BufferView floating, corresponding, faces, flags, weights;
+    if (!floating.acquire(floatingObject, "floating_features", 'f', registration::NUM_FEATURES, true)
+        || !corresponding.acquire(correspondingObject, "corresponding_features", 'f', registration::NUM_FEATURES)
+        || !faces.acquire(facesObject, "floating_faces", 'i', 3)
+        || !check_faces(faces, "floating_faces", floating, "floating_features")
+        || !flags.acquire(flagsObject, "floating_flags", 'f', VECTOR)
+        || !weights.acquire(weightsObject, "inlier_weights", 'f', VECTOR)
+        || !check_rows(floating, "floating_features", corresponding, "corresponding_features")
+        || !check_rows(floating, "floating_features", flags, "floating_flags")
+        || !check_rows(floating, "floating_features", weights, "inlier_weights")
+        || !check_count(numNeighbours, "num_neighbours")
+        || !check_count(viscousIterations, "viscous_iterations")
+        || !check_count(elasticIterations, "elastic_iterations")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    FeatureView floatingFeatures = floating.view<FeatureView>();
+    ConstFeatureView correspondingFeatures = corresponding.view<ConstFeatureView>();
+    ConstFacesView floatingFaces = faces.view<ConstFacesView>();
+    ConstVecView floatingFlags = flags.view<ConstVecView>();
+    ConstVecView inlierWeights = weights.view<ConstVecView>();
+    meshmonk::compute_nonrigid_transformation(floatingFeatures, correspondingFeatures, floatingFaces,
+                                              floatingFlags, inlierWeights, numNeighbours, sigma,
+                                              viscousIterations, elasticIterations);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+PyObject * py_downsample_mesh(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"features", "faces", "flags", "downsample_ratio", NULL};
+    PyObject *featuresObject, *facesObject, *flagsObject;
+    float downsampleRatio = 0.8f;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|f", const_cast<char **>(keywords),
+                                     &featuresObject, &facesObject, &flagsObject, &downsampleRatio)) {
+        return NULL;
+    }
+    BufferView featuresView, facesView, flagsView;
+    if (!featuresView.acquire(featuresObject, "features", 'f', registration::NUM_FEATURES)
+        || !facesView.acquire(facesObject, "faces", 'i', 3)
+        || !check_faces(facesView, "faces", featuresView, "features")
+        || !flagsView.acquire(flagsObject, "flags", 'f', VECTOR)
+        || !check_rows(featuresView, "features", flagsView, "flags")) {
+        return NULL;
+    }
+
+    RowMajorFloatMat downsampledFeatures;
+    RowMajorIntMat downsampledFaces;
+    VecDynFloat downsampledFlags;
+    VecDynInt originalIndices;
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView features = featuresView.view<ConstFeatureView>();
+    ConstFacesView faces = facesView.view<ConstFacesView>();
+    ConstVecView flags = flagsView.view<ConstVecView>();
+    FeatureMat sampledFeatures;
+    FacesMat sampledFaces;
+    meshmonk::downsample_mesh(features, faces, flags, sampledFeatures, sampledFaces,
+                              downsampledFlags, originalIndices, downsampleRatio);
+    downsampledFeatures = sampledFeatures;
+    downsampledFaces = sampledFaces;
+    Py_END_ALLOW_THREADS
+
+    PyObject * const featuresArray = new_float_array(downsampledFeatures);
+    PyObject * const facesArray = new_int_array(downsampledFaces);
+    PyObject * const flagsArray = new_float_vector(downsampledFlags);
+    PyObject * const indicesArray = new_int_vector(originalIndices);
+    if ((featuresArray == NULL) || (facesArray == NULL) || (flagsArray == NULL) || (indicesArray == NULL)) {
+        Py_XDECREF(featuresArray);
+        Py_XDECREF(facesArray);
+        Py_XDECREF(flagsArray);
+        Py_XDECREF(indicesArray);
+        return NULL;
+    }
+    return Py_BuildValue("(NNNN)", featuresArray, facesArray, flagsArray, indicesArray);
+}
+
+
+PyObject * py_scale_shift_mesh(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"previous_features", "previous_indices", "new_features", "new_indices", NULL};
+    PyObject *previousObject, *previousIndicesObject, *newObject, *newIndicesObject;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO", const_cast<char **>(keywords),
+                                     &previousObject, &previousIndicesObject, &newObject, &newIndicesObject)) {
+        return NULL;
+    }
+    BufferView previous, previousIndices, next, nextIndices;
+    if (!previous.acquire(previousObject, "previous_features", 'f', registration::NUM_FEATURES)
+        || !previousIndices.acquire(previousIndicesObject, "previous_indices", 'i', VECTOR)
+        || !next.acquire(newObject, "new_features", 'f', registration::NUM_FEATURES, true)
+        || !nextIndices.acquire(newIndicesObject, "new_indices", 'i', VECTOR)
+        || !check_rows(previous, "previous_features", previousIndices, "previous_indices")
+        || !check_rows(next, "new_features", nextIndices, "new_indices")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView previousFeatures = previous.view<ConstFeatureView>();
+    ConstIntVecView previousIndicesVec = previousIndices.view<ConstIntVecView>();
+    FeatureView newFeatures = next.view<FeatureView>();
+    ConstIntVecView newIndicesVec = nextIndices.view<ConstIntVecView>();
+    meshmonk::scale_shift_mesh(previousFeatures, previousIndicesVec, newFeatures, newIndicesVec);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+PyObject * py_transfer_deformation(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"proxy_features", "proxy_faces", "registered_proxy_features",
+                                     "bound_features", "bound_faces", "max_distance", "num_neighbours", NULL};
+    PyObject *proxyObject, *proxyFacesObject, *registeredObject, *boundObject, *boundFacesObject;
+    float maxDistance = 0.0f;
+    Py_ssize_t numNeighbours = 3;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOO|fn", const_cast<char **>(keywords),
+                                     &proxyObject, &proxyFacesObject, &registeredObject,
+                                     &boundObject, &boundFacesObject, &maxDistance, &numNeighbours)) {
+        return NULL;
+    }
+    BufferView proxy, proxyFaces, registered, bound, boundFaces;
+    if (!proxy.acquire(proxyObject, "proxy_features", 'f', registration::NUM_FEATURES)
+        || !proxyFaces.acquire(proxyFacesObject, "proxy_faces", 'i', 3)
+        || !check_faces(proxyFaces, "proxy_faces", proxy, "proxy_features")
+        || !registered.acquire(registeredObject, "registered_proxy_features", 'f', registration::NUM_FEATURES)
+        || !bound.acquire(boundObject, "bound_features", 'f', registration::NUM_FEATURES, true)
+        || !boundFaces.acquire(boundFacesObject, "bound_faces", 'i', 3)
+        || !check_faces(boundFaces, "bound_faces", bound, "bound_features")
+        || !check_rows(proxy, "proxy_features", registered, "registered_proxy_features")
+        || !check_count(numNeighbours, "num_neighbours")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView proxyFeatures = proxy.view<ConstFeatureView>();
+    ConstFacesView proxyFacesMat = proxyFaces.view<ConstFacesView>();
+    ConstFeatureView registeredFeatures = registered.view<ConstFeatureView>();
+    FeatureView boundFeatures = bound.view<FeatureView>();
+    ConstFacesView boundFacesMat = boundFaces.view<ConstFacesView>();
+    meshmonk::transfer_deformation(proxyFeatures, proxyFacesMat, registeredFeatures,
+                                   boundFeatures, boundFacesMat, maxDistance, numNeighbours);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+//######################################################################################
+//###############################  MESH OPERATIONS  ####################################
+//######################################################################################
+PyObject * py_compute_normals(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"positions", "faces", "normals", NULL};
+    PyObject *positionsObject, *facesObject, *normalsObject;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO", const_cast<char **>(keywords),
+                                     &positionsObject, &facesObject, &normalsObject)) {
+        return NULL;
+    }
+    BufferView positions, faces, normals;
+    if (!positions.acquire(positionsObject, "positions", 'f', 3)
+        || !faces.acquire(facesObject, "faces", 'i', 3)
+        || !check_faces(faces, "faces", positions, "positions")
+        || !normals.acquire(normalsObject, "normals", 'f', 3, true)
+        || !check_rows(positions, "positions", normals, "normals")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ConstVec3View positionsMat = positions.view<ConstVec3View>();
+    ConstFacesView facesMat = faces.view<ConstFacesView>();
+    Vec3View normalsMat = normals.view<Vec3View>();
+    meshmonk::compute_normals(positionsMat, facesMat, normalsMat);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+//######################################################################################
+//##############################  TRACING AND TUNING  ##################################
+//######################################################################################
+PyObject * py_set_tracing(PyObject *, PyObject *args) {
+    int enabled;
+    if (!PyArg_ParseTuple(args, "p", &enabled)) { return NULL;}
+    meshmonk::set_tracing(enabled);
+    Py_RETURN_NONE;
+}
+
+PyObject * py_clear_trace(PyObject *, PyObject *) {
+    meshmonk::clear_trace();
+    Py_RETURN_NONE;
+}
+
+PyObject * py_write_trace(PyObject *, PyObject *args) {
+    const char *filename;
+    if (!PyArg_ParseTuple(args, "s", &filename)) { return NULL;}
+    bool written;
+    Py_BEGIN_ALLOW_THREADS
+    written = meshmonk::write_trace(filename);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(written);
+}
+
+PyObject * py_set_performance_counters(PyObject *, PyObject *args) {
+    int enabled;
+    if (!PyArg_ParseTuple(args, "p", &enabled)) { return NULL;}
+    meshmonk::set_performance_counters(enabled);
+    Py_RETURN_NONE;
+}
+
+PyObject * py_clear_performance_counters(PyObject *, PyObject *) {
+    meshmonk::clear_performance_counters();
+    Py_RETURN_NONE;
+}
+
+PyObject * py_print_performance_report(PyObject *, PyObject *) {
+    meshmonk::print_performance_report();
+    Py_RETURN_NONE;
+}
+
+PyObject * py_set_deterministic_reductions(PyObject *, PyObject *args) {
+    int deterministic;
+    if (!PyArg_ParseTuple(args, "p", &deterministic)) { return NULL;}
+    meshmonk::set_deterministic_reductions(deterministic);
+    Py_RETURN_NONE;
+}
+
+PyObject * py_set_auto_tuning(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"enabled", "profile_path", NULL};
+    int enabled;
+    const char *profilePath = "meshmonk_tuning.txt";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "p|s", const_cast<char **>(keywords),
+                                     &enabled, &profilePath)) {
+        return NULL;
+    }
+    meshmonk::set_auto_tuning(enabled, profilePath);
+    Py_RETURN_NONE;
+}
+
+PyObject * py_tune_performance(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"features", "profile_path", NULL};
+    PyObject *featuresObject;
+    const char *profilePath = "meshmonk_tuning.txt";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|s", const_cast<char **>(keywords),
+                                     &featuresObject, &profilePath)) {
+        return NULL;
+    }
+    BufferView featuresView;
+    if (!featuresView.acquire(featuresObject, "features", 'f', registration::NUM_FEATURES)) { return NULL;}
+    //# The path is copied: the Python string can't be used without the GIL
+    const std::string path(profilePath);
+    Py_BEGIN_ALLOW_THREADS
+    ConstFeatureView features = featuresView.view<ConstFeatureView>();
+    meshmonk::tune_performance(features, path.c_str());
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+
+//######################################################################################
+//###################################  MODULE  #########################################
+//######################################################################################
+#define MESHMONK_KEYWORDS(function) reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(function)), \
+                                    METH_VARARGS | METH_KEYWORDS
+
+PyMethodDef meshmonkMethods[] = {
+    {"pyramid_registration", MESHMONK_KEYWORDS(py_pyramid_registration),
+     "Pyramid nonrigid registration of floating_features (updated in place) to target_features."},
+    {"nonrigid_registration", MESHMONK_KEYWORDS(py_nonrigid_registration),
+     "Nonrigid registration of floating_features (updated in place) to target_features."},
+    {"rigid_registration", MESHMONK_KEYWORDS(py_rigid_registration),
+     "Rigid registration of floating_features (updated in place) to target_features.\n"
+     "Returns the 4x4 transformation matrix."},
+    {"affine_registration", MESHMONK_KEYWORDS(py_affine_registration),
+     "Affine registration of floating_features (updated in place) to target_features.\n"
+     "Returns the 4x4 transformation matrix."},
+    {"compute_correspondences", MESHMONK_KEYWORDS(py_compute_correspondences),
+     "Fill corresponding_features and corresponding_flags for the floating features."},
+    {"compute_inlier_weights", MESHMONK_KEYWORDS(py_compute_inlier_weights),
+     "Fill inlier_weights from the floating and corresponding features."},
+    {"compute_rigid_transformation", MESHMONK_KEYWORDS(py_compute_rigid_transformation),
+     "Rigidly transform floating_features (in place) towards the corresponding features.\n"
+     "Returns the 4x4 transformation matrix."},
+    {"compute_nonrigid_transformation", MESHMONK_KEYWORDS(py_compute_nonrigid_transformation),
+     "Visco-elastically transform floating_features (in place) towards the corresponding features."},
+    {"downsample_mesh", MESHMONK_KEYWORDS(py_downsample_mesh),
+     "Downsample a mesh. Returns (features, faces, flags, original_indices)."},
+    {"scale_shift_mesh", MESHMONK_KEYWORDS(py_scale_shift_mesh),
+     "Interpolate previous_features onto new_features (in place) between pyramid layers."},
+    {"transfer_deformation", MESHMONK_KEYWORDS(py_transfer_deformation),
+     "Move bound_features (in place) along with the registered proxy (e.g. a high resolution template\n"
+     "along with its registered, decimated version)."},
+    {"compute_normals", MESHMONK_KEYWORDS(py_compute_normals),
+     "Fill normals with the vertex normals of the mesh (positions, faces)."},
+    {"set_tracing", py_set_tracing, METH_VARARGS, "Record a timeline of the registration stages."},
+    {"clear_trace", py_clear_trace, METH_NOARGS, "Clear the recorded timeline."},
+    {"write_trace", py_write_trace, METH_VARARGS, "Write the timeline as a Chrome trace-event JSON file."},
+    {"set_performance_counters", py_set_performance_counters, METH_VARARGS,
+     "Collect hardware performance counters per stage."},
+    {"clear_performance_counters", py_clear_performance_counters, METH_NOARGS, "Clear the counters."},
+    {"print_performance_report", py_print_performance_report, METH_NOARGS, "Print the counters per stage."},
+    {"set_deterministic_reductions", py_set_deterministic_reductions, METH_VARARGS,
+     "Make the parallel sums bit-identical whatever the number of threads."},
+    {"set_auto_tuning", MESHMONK_KEYWORDS(py_set_auto_tuning),
+     "Tune (or load) the kd-tree leaf size, threads and grain size at the first registration."},
+    {"tune_performance", MESHMONK_KEYWORDS(py_tune_performance),
+     "Tune the kd-tree leaf size, threads and grain size on the features and save the profile."},
+    {NULL, NULL, 0, NULL}
+};
+
+#undef MESHMONK_KEYWORDS
+
+PyModuleDef meshmonkModule = {
+    PyModuleDef_HEAD_INIT,
+    "meshmonk",
+    "Rigid and nonrigid registration of triangle meshes.",
+    -1,
+    meshmonkMethods,
+    NULL, NULL, NULL, NULL
+};
+
+}//namespace
+
+
+PyMODINIT_FUNC PyInit_meshmonk(void) {
+    return PyModule_Create(&meshmonkModule);
+}
@@ -0,0 +1,162 @@
+"""
+Tests of the Python bindings (python/meshmonk_python.cpp): the arrays are
+read and written in place, whatever their memory order, without a copy.
+
+Run (after 'make python'): PYTHONPATH=python python3 python/test_meshmonk_python.py
+The NumPy tests are skipped if NumPy isn't installed.
+"""
+import array
+import math
+import subprocess
+import sys
+import unittest
+
+import meshmonk
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+
+def float_matrix(rows, cols, values):
+    """(rows,cols) float32 array (a memoryview over a Python array, C order)."""
+    data = array.array('f', values)
+    return memoryview(data).cast('B').cast('f', (rows, cols))
+
+
+def int_matrix(rows, cols, values):
+    """(rows,cols) int32 array (a memoryview over a Python array, C order)."""
+    data = array.array('i', values)
+    return memoryview(data).cast('B').cast('i', (rows, cols))
+
+
+def float_vector(values):
+    """(N,) float32 array (a memoryview over a Python array)."""
+    return memoryview(array.array('f', values))
+
+
+def sphere(num_points, shift=(0.0, 0.0, 0.0)):
+    """Features (positions and normals) of points spread over a unit sphere."""
+    values = []
+    for i in range(num_points):
+        z = 1.0 - 2.0 * (i + 0.5) / num_points
+        radius = math.sqrt(1.0 - z * z)
+        angle = i * math.pi * (3.0 - math.sqrt(5.0))
+        normal = (radius * math.cos(angle), radius * math.sin(angle), z)
+        values.extend([normal[d] + shift[d] for d in range(3)])
+        values.extend(normal)
+    return values
+
+
+class InPlaceTest(unittest.TestCase):
+
+    def test_correspondences_are_written_into_the_given_array(self):
+        num_points = 50
+        floating = float_matrix(num_points, 6, sphere(num_points))
+        flags = float_vector([1.0] * num_points)
+        corresponding = float_matrix(num_points, 6, [0] * (num_points * 6))
+        corresponding_flags = float_vector([0.0] * num_points)
+        meshmonk.compute_correspondences(floating, floating, flags, flags, corresponding, corresponding_flags,
+                                         symmetric=False, num_neighbours=1)
+        for found, wanted in zip(corresponding.tolist(), floating.tolist()):
+            for d in range(6):
+                self.assertAlmostEqual(found[d], wanted[d], places=5)
+        self.assertEqual(corresponding_flags.tolist(), [1.0] * num_points)
+
+    def test_registration_moves_the_given_array(self):
+        num_points = 200
+        floating = float_matrix(num_points, 6, sphere(num_points))
+        target = float_matrix(num_points, 6, sphere(num_points, shift=(0.1, -0.05, 0.02)))
+        faces = int_matrix(1, 3, [0, 1, 2])
+        flags = float_vector([1.0] * num_points)
+        meshmonk.rigid_registration(floating, target, faces, faces, flags, flags)
+        for moved, wanted in zip(floating.tolist(), target.tolist()):
+            for d in range(3):
+                self.assertAlmostEqual(moved[d], wanted[d], places=3)
+
+    def test_direct_regularisation_moves_the_given_array(self):
+        num_points = 200
+        floating = float_matrix(num_points, 6, sphere(num_points))
+        target = float_matrix(num_points, 6, sphere(num_points, shift=(0.05, 0.0, 0.0)))
+        faces = int_matrix(1, 3, [0, 1, 2])
+        flags = float_vector([1.0] * num_points)
+        meshmonk.nonrigid_registration(floating, target, faces, faces, flags, flags, num_iterations=10,
+                                       sigma=0.3, direct_regularisation=True, radius_factor=2.0)
+        shifts = [moved[0] - x for moved, x in zip(floating.tolist(), sphere(num_points)[::6])]
+        self.assertGreater(sum(shifts) / num_points, 0.01)
+
+    def test_other_types_are_rejected_not_converted(self):
+        positions = memoryview(array.array('d', [0.0] * 9)).cast('B').cast('d', (3, 3))
+        normals = float_matrix(3, 3, [0] * 9)
+        with self.assertRaises(TypeError):
+            meshmonk.compute_normals(positions, int_matrix(1, 3, [0, 1, 2]), normals)
+        with self.assertRaises(TypeError):
+            meshmonk.compute_normals(normals, int_matrix(1, 3, [0, 1, 2]), bytes(36))
+
+
+class NoCopyTest(unittest.TestCase):
+
+    #  The peak memory of a call on large arrays, measured in a new process: a
+    #  copy of the features would add 24 bytes per vertex (the inlier detector
+    #  itself needs a few floats per vertex)
+    SCRIPT = '''
+import array, resource, sys
+import meshmonk
+num_vertices = int(sys.argv[1])
+def features(values):
+    return memoryview(array.array('f', values) * num_vertices).cast('B').cast('f', (num_vertices, 6))
+def vector(value):
+    return memoryview(array.array('f', [value]) * num_vertices)
+floating = features([0, 0, 0, 0, 0, 1])
+corresponding = features([0, 0, 0.1, 0, 0, 1])
+flags = vector(1.0)
+weights = vector(0.0)
+before = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+meshmonk.compute_inlier_weights(floating, corresponding, flags, weights)
+after = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+assert weights[0] > 0.0
+print((after - before) * 1024)
+'''
+
+    def test_inputs_are_not_copied(self):
+        num_vertices = 2000000
+        output = subprocess.check_output([sys.executable, '-c', self.SCRIPT, str(num_vertices)],
+                                         env={'PYTHONPATH': ':'.join(sys.path)})
+        extra_bytes = int(output.decode().split()[-1])
+        self.assertLess(extra_bytes, num_vertices * 24)
+
+
+@unittest.skipIf(numpy is None, 'NumPy is not installed')
+class NumpyTest(unittest.TestCase):
+
+    def register(self, floating):
+        num_points = floating.shape[0]
+        target = numpy.array(sphere(num_points, shift=(0.1, -0.05, 0.02)), dtype=numpy.float32).reshape(num_points, 6)
+        faces = numpy.array([[0, 1, 2]], dtype=numpy.int32)
+        flags = numpy.ones(num_points, dtype=numpy.float32)
+        meshmonk.rigid_registration(floating, target, faces, faces, flags, flags)
+        numpy.testing.assert_allclose(floating[:, :3], target[:, :3], atol=1e-3)
+
+    def features(self):
+        return numpy.array(sphere(200), dtype=numpy.float32).reshape(200, 6)
+
+    def test_c_order(self):
+        self.register(numpy.ascontiguousarray(self.features()))
+
+    def test_fortran_order(self):
+        self.register(numpy.asfortranarray(self.features()))
+
+    def test_strided_view(self):
+        both = numpy.zeros((200, 12), dtype=numpy.float32)
+        both[:, ::2] = self.features()
+        self.register(both[:, ::2])
+        self.assertTrue(numpy.all(both[:, 1::2] == 0.0))
+
+    def test_float64_is_rejected(self):
+        with self.assertRaises(TypeError):
+            self.register(self.features().astype(numpy.float64))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,123 @@
+#include "AffineRegistration.hpp"
+#include "Tracer.hpp"
+#include "AutoTuner.hpp"
+#include "RegistrationPipeline.hpp"
+
+namespace registration {
+
+void AffineRegistration::set_input(const FeatureView &ioFloatingFeatures,
+                             const ConstFeatureView &inTargetFeatures,
+                             const ConstVecView &inFloatingFlags,
+                             const ConstVecView &inTargetFlags){
+    _ioFloatingFeatures.reset(ioFloatingFeatures);
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inFloatingFlags.reset(inFloatingFlags);
+    _inTargetFlags.reset(inTargetFlags);
+}//end set_input()
+
+void AffineRegistration::set_parameters(bool symmetric, size_t numNeighbours,
+                                        float flagThreshold, bool equalizePushPull,
+                                        float kappaa, bool inlierUseOrientation,
+                                        size_t numIterations, float regularisation){
+    _symmetric = symmetric;
+    _numNeighbours = numNeighbours;
+    _flagThreshold = flagThreshold;
+    _equalizePushPull = equalizePushPull;
+    _kappaa = kappaa;
+    _inlierUseOrientation = inlierUseOrientation;
+    _numIterations = numIterations;
+    _regularisation = regularisation;
+}//end set_parameters()
+
+
+void AffineRegistration::set_surface_matching(const bool surfaceMatching,
+                                              const ConstFacesView &inTargetFaces){
+    _surfaceMatching = surfaceMatching;
+    _inTargetFaces.reset(inTargetFaces);
+}//end set_surface_matching()
+
+
+CorrespondenceMemoryModes AffineRegistration::_configured_modes() const{
+    CorrespondenceMemoryModes modes;
+    modes.surfaceMatching = _surfaceMatching && (_inTargetFaces.is_set());
+    modes.positionalSearch = _positionalSearch;
+    return modes;
+}//end _configured_modes()
+
+
+size_t AffineRegistration::_estimate_memory(const CorrespondenceMemoryModes &modes) const{
+    const size_t numTargetFaces = (_inTargetFaces.is_set()) ? _inTargetFaces.rows() : 0;
+    //# Same filters as the rigid registration
+    return estimate_rigid_registration_memory(_ioFloatingFeatures.rows(), _inTargetFeatures.rows(),
+                                              numTargetFaces, _numNeighbours, _symmetric, modes);
+}//end _estimate_memory()
+
+
+void AffineRegistration::update(){
+    MESHMONK_TRACE_SCOPE("AffineRegistration::update");
+
+    //# Check the memory budget before allocating anything
+    CorrespondenceMemoryModes modes = _configured_modes();
+    _memoryStatus = fit_memory_budget(_memoryBudget, modes,
+                                      [this](const CorrespondenceMemoryModes &m){ return _estimate_memory(m);},
+                                      "AffineRegistration");
+    _peakMemory = 0;
+    if (_memoryStatus == MEMORY_OVER_BUDGET) { return;}
+
+    //# Pick up (or tune) the performance profile on the floating features
+    AutoTuner::ensure_tuned(_ioFloatingFeatures);
+
+    //# Dispatch to the pipeline for the correspondence filter
+    if (_symmetric) { _run<SymmetricCorrespondences>(modes);}
+    else { _run<PushCorrespondences>(modes);}
+
+}//end update()
+
+
+template <typename CorrespondencePolicy>
+void AffineRegistration::_run(const CorrespondenceMemoryModes &modes){
+    //# Set up the pipeline (correspondences, inliers and affine transformation)
+    RegistrationPipeline<CorrespondencePolicy, GaussianInliers, AffineTransform> pipeline;
+    pipeline.set_input(_ioFloatingFeatures, _inFloatingFlags, _inTargetFeatures, _inTargetFlags);
+    //## Correspondence Filter
+    CorrespondenceSettings correspondenceSettings;
+    correspondenceSettings.numNeighbours = _numNeighbours;
+    correspondenceSettings.flagThreshold = _flagThreshold;
+    correspondenceSettings.equalizePushPull = _equalizePushPull;
+    correspondenceSettings.modes = modes;
+    correspondenceSettings.maxDistance = _maxDistance;
+    pipeline.correspondences().set_settings(correspondenceSettings);
+    pipeline.correspondences().set_target_faces(_inTargetFaces);
+    //## Inlier Filter
+    pipeline.inliers().set_parameters(_kappaa, _inlierUseOrientation);
+    //## Transformation Filter
+    pipeline.transform().set_parameters(_regularisation);
+    pipeline.transform().set_initial_transformation(_transformationMatrix);
+    pipeline.initialize();
+
+    //# Perform ICP
+    time_t timeStart, timePreIteration, timePostIteration, timeEnd;
+    timeStart = time(0);
+    std::cout << "Starting Affine Registration process..." << std::endl;
+    for (size_t iteration = 0 ; iteration < _numIterations ; iteration++) {
+        timePreIteration = time(0);
+        MESHMONK_TRACE_SCOPE_ARG("AffineRegistration::iteration", "iteration", iteration);
+        //# Correspondences, inlier detection and transformation
+        pipeline.iterate();
+
+        //# Keep track of the peak memory usage
+        const size_t memoryUsage = pipeline.get_memory_usage();
+        if (memoryUsage > _peakMemory) { _peakMemory = memoryUsage;}
+
+        //# Print info
+        timePostIteration = time(0);
+        std::cout << "Iteration " << iteration << "/" << _numIterations << " took "<< difftime(timePostIteration, timePreIteration) <<" second(s)."<< std::endl;
+    }
+    timeEnd = time(0);
+    std::cout << "Affine Registration Completed in " << difftime(timeEnd, timeStart) <<" second(s)."<< std::endl;
+
+    //# Update final transformation matrix
+    _transformationMatrix = pipeline.transform().get_transformation();
+}//end _run()
+
+}//namespace registration
@@ -0,0 +1,133 @@
+#ifndef AFFINEREGISTRATION_HPP
+#define AFFINEREGISTRATION_HPP
+
+#include <Eigen/Dense>
+#include <stdio.h>
+#include <memory.h>
+#include <time.h>
+#include "../global.hpp"
+#include "CorrespondenceFilter.hpp"
+#include "SymmetricCorrespondenceFilter.hpp"
+#include "InlierDetector.hpp"
+#include "AffineTransformer.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix4f Mat4Float;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+
+namespace registration{
+
+class AffineRegistration
+{
+    /*
+    # GOAL
+    This class performs icp-based affine registration between two oriented
+    pointclouds, with the same correspondence and inlier filters as the
+    RigidRegistration. Run it between the rigid and the nonrigid registration
+    to take out global anisotropic shape differences cheaply, so the
+    nonrigid registration starts closer to the target.
+
+    # INPUTS
+    -ioFloatingFeatures
+    -inTargetFeatures
+    -inFloatingFlags
+    -inTargetFlags
+
+    # PARAMETERS
+    -numNeighbours(=3):
+    number of nearest neighbours
+    -regularisation(=0.0):
+    pulls the affine transformation of each iteration towards the identity
+    (see AffineTransformer).
+    -surfaceMatching(=false):
+    match floating vertices to the closest point on the target surface instead
+    of to the nearest target vertices (requires the target faces).
+    -positionalSearch(=false):
+    search correspondences in a 3-D position kd-tree and re-rank them by
+    position and normal instead of searching a 6-D feature kd-tree.
+    -maxDistance(=0.0):
+    if larger than zero, floating features without target features closer
+    than this distance get no correspondence (and flag 0.0f).
+
+    # MEMORY
+    -memoryBudget(=0):
+    see RigidRegistration (the affine transformer needs no extra buffers).
+
+    # OUTPUT
+    -ioFloatingFeatures
+    -transformation (get_transformation())
+    */
+
+    public:
+
+        void set_input(const FeatureView &ioFloatingFeatures,
+                       const ConstFeatureView &inTargetFeatures,
+                       const ConstVecView &inFloatingFlags,
+                       const ConstVecView &inTargetFlags);
+        void set_parameters(bool symmetric, size_t numNeighbours,
+                            float flagThreshold, bool equalizePushPull,
+                            float kappaa, bool inlierUseOrientation,
+                            size_t numIterations, float regularisation = 0.0f);
+        void set_surface_matching(const bool surfaceMatching,
+                                  const ConstFacesView &inTargetFaces);
+        void set_positional_search(const bool positionalSearch){ _positionalSearch = positionalSearch;}
+        void set_max_distance(const float maxDistance){ _maxDistance = maxDistance;}
+        Mat4Float get_transformation() const {return _transformationMatrix;}
+        void set_memory_budget(const size_t memoryBudget){ _memoryBudget = memoryBudget;}
+        size_t estimate_memory() const { return _estimate_memory(_configured_modes());}
+        size_t get_peak_memory() const { return _peakMemory;}
+        MemoryStatus get_memory_status() const { return _memoryStatus;}
+
+        void update();
+
+    protected:
+
+    private:
+        //# Inputs/Outputs
+        FeatureView _ioFloatingFeatures;
+        ConstFeatureView _inTargetFeatures;
+        ConstVecView _inFloatingFlags;
+        ConstVecView _inTargetFlags;
+
+        //# User Parameters
+        //## Correspondences
+        bool _symmetric = true;
+        size_t _numNeighbours = 3;
+        float _flagThreshold = 0.9f;
+        bool _equalizePushPull = false;
+        bool _surfaceMatching = false;
+        ConstFacesView _inTargetFaces;
+        bool _positionalSearch = false;
+        float _maxDistance = 0.0f;
+        //## Inliers
+        float _kappaa = 3.0;
+        bool _inlierUseOrientation = true;
+        //## Transformation
+        size_t _numIterations = 10;
+        float _regularisation = 0.0f;
+        //## Memory
+        size_t _memoryBudget = 0;
+
+        //# Internal Data structures
+        Mat4Float _transformationMatrix = Mat4Float::Identity();
+
+        //# Internal Parameters
+        size_t _peakMemory = 0;
+        MemoryStatus _memoryStatus = MEMORY_OK;
+
+        //# Internal functions
+        //## The correspondence modes as set by the user
+        CorrespondenceMemoryModes _configured_modes() const;
+        //## Estimated peak memory usage with the given modes
+        size_t _estimate_memory(const CorrespondenceMemoryModes &modes) const;
+        //## Run the registration pipeline with the given correspondence policy
+        template <typename CorrespondencePolicy>
+        void _run(const CorrespondenceMemoryModes &modes);
+};
+
+}//namespace registration
+
+#endif // AFFINEREGISTRATION_HPP
@@ -0,0 +1,108 @@
+#include "AffineTransformer.hpp"
+#include "Tracer.hpp"
+#include "ParallelReduction.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+
+namespace registration{
+
+
+void AffineTransformer::set_input(const ConstFeatureView &inCorrespondingFeatures, const ConstVecView &inWeights){
+    _inCorrespondingFeatures.reset(inCorrespondingFeatures);
+    _inWeights.reset(inWeights);
+}
+void AffineTransformer::set_output(const FeatureView &ioFeatures){
+    _ioFeatures.reset(ioFeatures);
+}
+void AffineTransformer::set_parameters(const float regularisation){
+    _regularisation = regularisation;
+    if (_regularisation < 0.0f) {
+        _regularisation = 0.0f;
+        std::cerr << "The affine regularisation can't be negative!" << std::endl;
+    }
+}
+
+
+void AffineTransformer::_update_transformation() {
+    _numElements = _ioFeatures.rows();
+    _transformationMatrix = Mat4Float::Identity();
+
+    //# 1. Weighted centroids of both sets (and the sum of the weights)
+    typedef Eigen::Matrix<float, 7, 1> CentroidSum;
+    const CentroidSum centroidSum = parallel_sum(_numElements, CentroidSum(CentroidSum::Zero()),
+        [&](const size_t i) {
+            CentroidSum term;
+            term << _inWeights[i] * _ioFeatures.block<1,3>(i,0).transpose(),
+                    _inWeights[i] * _inCorrespondingFeatures.block<1,3>(i,0).transpose(),
+                    _inWeights[i];
+            return term;
+        });
+    const float sumWeights = centroidSum[6];
+    if (sumWeights <= 0.0f) {
+        std::cerr << "AffineTransformer: all weights are zero, no transformation is applied." << std::endl;
+        return;
+    }
+    const Vec3Float floatingCentroid = centroidSum.segment(0,3) / sumWeights;
+    const Vec3Float correspondingCentroid = centroidSum.segment(3,3) / sumWeights;
+
+    //# 2. Centred covariances: of the floating positions (left 3 columns) and
+    //# between the corresponding and floating positions (right 3 columns)
+    typedef Eigen::Matrix<float, 3, 6> CovarianceSum;
+    const CovarianceSum covarianceSum = parallel_sum(_numElements, CovarianceSum(CovarianceSum::Zero()),
+        [&](const size_t i) {
+            const Vec3Float floatingPosition = _ioFeatures.block<1,3>(i,0).transpose() - floatingCentroid;
+            const Vec3Float correspondingPosition = _inCorrespondingFeatures.block<1,3>(i,0).transpose() - correspondingCentroid;
+            CovarianceSum term;
+            term << floatingPosition * (_inWeights[i] * floatingPosition.transpose()),
+                    floatingPosition * (_inWeights[i] * correspondingPosition.transpose());
+            return term;
+        });
+    Eigen::Matrix3d floatingCovariance = covarianceSum.leftCols<3>().cast<double>() / sumWeights;
+    Eigen::Matrix3d crossCovariance = covarianceSum.rightCols<3>().cast<double>().transpose() / sumWeights;
+
+    //# 3. Regularise towards the identity (always a little for nearly planar sets)
+    const double meanVariance = floatingCovariance.trace() / 3.0;
+    if (meanVariance <= 0.0) {
+        std::cerr << "AffineTransformer: the floating positions coincide, no transformation is applied." << std::endl;
+        return;
+    }
+    double regularisation = _regularisation;
+    const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> decomposer(floatingCovariance, Eigen::EigenvaluesOnly);
+    if (decomposer.eigenvalues()[0] < _minConditioning * decomposer.eigenvalues()[2]) {
+        regularisation = std::max(regularisation, _minConditioning);
+    }
+    floatingCovariance += regularisation * meanVariance * Eigen::Matrix3d::Identity();
+    crossCovariance += regularisation * meanVariance * Eigen::Matrix3d::Identity();
+
+    //# 4. Linear part and translation
+    const Mat3Float linearPart = floatingCovariance.ldlt().solve(crossCovariance.transpose()).transpose().cast<float>();
+    if (!linearPart.allFinite() || (std::abs(linearPart.determinant()) < 1.0e-12f)) {
+        std::cerr << "AffineTransformer: the affine transformation is singular, no transformation is applied." << std::endl;
+        return;
+    }
+    const Vec3Float translation = correspondingCentroid - linearPart * floatingCentroid;
+    _transformationMatrix.block<3,3>(0,0) = linearPart;
+    _transformationMatrix.block<3,1>(0,3) = translation;
+    //## Normals are transformed with the cofactor matrix (det(A) * A^-T)
+    const Mat3Float normalTransformation = linearPart.determinant() * linearPart.inverse().transpose();
+
+    //# 5. Apply the transformation (independently per element, so in parallel)
+    #pragma omp parallel for
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        const Vec3Float position = _ioFeatures.block<1,3>(i,0).transpose();
+        _ioFeatures.block<1,3>(i,0) = (linearPart * position + translation).transpose();
+        Vec3Float normal = normalTransformation * _ioFeatures.block<1,3>(i,3).transpose();
+        const float normalLength = normal.norm();
+        if (normalLength > 0.0f) { normal /= normalLength;}
+        _ioFeatures.block<1,3>(i,3) = normal.transpose();
+    }
+}
+
+void AffineTransformer::update() {
+    MESHMONK_TRACE_SCOPE("AffineTransformer::update");
+    _update_transformation();
+}//end update
+
+}//namespace registration
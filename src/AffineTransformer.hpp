@@ -0,0 +1,89 @@
+#ifndef AFFINETRANSFORMER_HPP
+#define AFFINETRANSFORMER_HPP
+
+#include <Eigen/Dense>
+#include <stdio.h>
+#include <iostream>
+#include "../global.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Vector3f Vec3Float;
+typedef Eigen::Vector4f Vec4Float;
+typedef Eigen::Matrix3f Mat3Float;
+typedef Eigen::Matrix4f Mat4Float;
+
+namespace registration{
+
+class AffineTransformer
+{
+    /*
+    # GOAL
+    This class computes the affine (12 degrees of freedom) transformation
+    between a set of features and a set of corresponding features, in the
+    weighted least squares sense. Each correspondence can be weighed between
+    0.0 and 1.0. Compared to the RigidTransformer, it also captures anisotropic
+    scaling and shearing (e.g. global head-shape differences), so less is left
+    to a nonrigid registration afterwards.
+
+    The linear part is A = Cov(corresponding, floating) * Cov(floating, floating)^-1
+    (both weighted and centred), the translation maps the floating centroid
+    onto the corresponding centroid. The normals are transformed with the
+    cofactor matrix of A (and normalised), so they stay perpendicular to the
+    transformed surface.
+
+    # INPUTS
+    -ioFeatures
+    -inCorrespondingFeatures
+    -inWeights
+
+    # PARAMETERS
+    -regularisation(=0.0):
+    pulls the linear part towards the identity: regularisation times the mean
+    variance of the floating positions is added to both covariances. Nearly
+    planar floating sets (whose out-of-plane scale is undetermined) are always
+    regularised a little.
+
+    # OUTPUTS
+    -ioFeatures
+    */
+    public:
+
+        void set_input(const ConstFeatureView &inCorrespondingFeatures, const ConstVecView &inWeights);
+        void set_output(const FeatureView &ioFeatures);
+        void set_parameters(const float regularisation = 0.0f);
+        Mat4Float get_transformation() const {return _transformationMatrix;}
+        void update();
+
+    protected:
+
+    private:
+        //# Inputs
+        FeatureView _ioFeatures;
+        ConstFeatureView _inCorrespondingFeatures;
+        ConstVecView _inWeights;
+
+        //# Outputs
+        //_ioFeatures is used as both an input (to compute the transformation) and output
+
+        //# User Parameters
+        float _regularisation = 0.0f;
+
+        //# Internal Data structures
+        Mat4Float _transformationMatrix = Mat4Float::Identity();
+
+        //# Internal Parameters
+        size_t _numElements = 0;
+        //## Smallest ratio between the smallest and largest eigenvalue of the
+        //## floating covariance before it's regularised
+        const double _minConditioning = 1.0e-4;
+
+        //# Internal functions
+        //## Function to update the transformation matrix and apply it to the floating features
+        void _update_transformation();
+};
+
+}//namespace registration
+
+#endif // AFFINETRANSFORMER_HPP
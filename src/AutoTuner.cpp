@@ -0,0 +1,297 @@
+#include "AutoTuner.hpp"
+#include <nanoflann.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "Tracer.hpp"
+
+namespace registration {
+
+namespace {
+    std::mutex tunerMutex;
+    TuningProfile currentProfile;
+    bool tunerEnabled = false;
+    //# Whether ensure_tuned() already loaded or tuned a profile
+    bool profileResolved = false;
+    std::string profilePath = "meshmonk_tuning.txt";
+
+    //# Benchmark sizes: at most this many points (a regular subset of larger
+    //# meshes) and this many queries per leaf size
+    const size_t maxTuningPoints = 100000;
+    const size_t maxTuningQueries = 20000;
+    const size_t numRepeats = 3;
+    //# A candidate has to beat the default by this factor to be chosen
+    const double minimumGain = 0.95;
+
+    typedef nanoflann::KDTreeEigenMatrixAdaptor<FeatureMat> KdTree;
+
+    int num_processors(){
+#ifdef _OPENMP
+        return omp_get_num_procs();
+#else
+        return 1;
+#endif
+    }
+
+    int max_threads(){
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    double seconds_now(){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //# Query the 'numNeighbours' nearest neighbours of every 'stride'-th point
+    void knn_queries(const KdTree &kdTree, const FeatureMat &points, const size_t numNeighbours,
+                     const size_t stride, Eigen::MatrixXi *outIndices){
+        std::vector<float> queriedFeature(NUM_FEATURES);
+        std::vector<size_t> neighbourIndices(numNeighbours);
+        std::vector<float> neighbourSquaredDistances(numNeighbours);
+        nanoflann::KNNResultSet<float> knnResultSet(numNeighbours);
+        for (size_t i = 0 ; i < size_t(points.rows()) ; i += stride) {
+            knnResultSet.init(&neighbourIndices[0], &neighbourSquaredDistances[0]);
+            for (size_t j = 0 ; j < NUM_FEATURES ; j++) { queriedFeature[j] = points(i,j);}
+            kdTree.index->findNeighbors(knnResultSet, &queriedFeature[0], nanoflann::SearchParams(32, 0.0001, true));
+            if (outIndices != NULL) {
+                for (size_t j = 0 ; j < numNeighbours ; j++) {
+                    (*outIndices)(i,j) = (j < knnResultSet.size()) ? int(neighbourIndices[j]) : int(i);
+                }
+            }
+        }
+    }
+
+    //# One smoothing pass as in ViscoElasticTransformer (weighted average of
+    //# the neighbouring vectors)
+    void smoothing_pass(const Eigen::MatrixXf &inField, const Eigen::MatrixXi &neighbourIndices,
+                        const Eigen::MatrixXf &weights, Eigen::MatrixXf &outField,
+                        const int numThreads, const int chunkSize){
+        const long numElements = long(inField.rows());
+        #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+        for (long i = 0 ; i < numElements ; i++) {
+            Eigen::Vector3f vectorAverage = Eigen::Vector3f::Zero();
+            float sumWeights = 0.0f;
+            for (long j = 0 ; j < neighbourIndices.cols() ; j++) {
+                const float weight = weights(i,j);
+                vectorAverage += weight * inField.row(neighbourIndices(i,j)).transpose();
+                sumWeights += weight;
+            }
+            outField.row(i) = vectorAverage.transpose() / sumWeights;
+        }
+    }
+}//namespace
+
+
+void AutoTuner::set_enabled(const bool enabled){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    tunerEnabled = enabled;
+}//end set_enabled()
+
+
+bool AutoTuner::is_enabled(){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    return tunerEnabled;
+}//end is_enabled()
+
+
+void AutoTuner::set_profile_path(const std::string &path){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    if (path != profilePath) { profileResolved = false;}
+    profilePath = path;
+}//end set_profile_path()
+
+
+std::string AutoTuner::get_profile_path(){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    return profilePath;
+}//end get_profile_path()
+
+
+TuningProfile AutoTuner::get_profile(){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    return currentProfile;
+}//end get_profile()
+
+
+void AutoTuner::set_profile(const TuningProfile &profile){
+    std::lock_guard<std::mutex> lock(tunerMutex);
+    currentProfile = profile;
+    profileResolved = true;
+}//end set_profile()
+
+
+void AutoTuner::ensure_tuned(const ConstFeatureView &inFeatures){
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(tunerMutex);
+        if (!tunerEnabled || profileResolved) { return;}
+        path = profilePath;
+    }
+    TuningProfile profile;
+    if (load(path, profile)) {
+        set_profile(profile);
+        return;
+    }
+    tune(inFeatures);
+}//end ensure_tuned()
+
+
+TuningProfile AutoTuner::tune(const ConstFeatureView &inFeatures){
+    MESHMONK_TRACE_SCOPE("AutoTuner::tune");
+    const TuningProfile defaults;
+    TuningProfile best;
+    if (inFeatures.rows() < 100) {
+        std::cerr << "AutoTuner::tune(): too few points to tune on, keeping the defaults." << std::endl;
+        set_profile(best);
+        return best;
+    }
+
+    //# Take a regular subset of large meshes
+    const size_t pointStride = (size_t(inFeatures.rows()) + maxTuningPoints - 1) / maxTuningPoints;
+    const size_t numPoints = (size_t(inFeatures.rows()) + pointStride - 1) / pointStride;
+    FeatureMat points(numPoints, NUM_FEATURES);
+    for (size_t i = 0 ; i < numPoints ; i++) { points.row(i) = inFeatures.row(i * pointStride);}
+    const size_t queryStride = (numPoints + maxTuningQueries - 1) / maxTuningQueries;
+    const double queryScale = double(queryStride);
+
+    //# 1) Leaf size: build the tree and query all points (extrapolated from
+    //# the sampled queries)
+    const size_t leafSizes[] = {5, 10, 15, 20, 30, 50};
+    double defaultTime = 0.0;
+    double bestTime = 0.0;
+    for (size_t l = 0 ; l < sizeof(leafSizes) / sizeof(leafSizes[0]) ; l++) {
+        double time = 0.0;
+        for (size_t r = 0 ; r < numRepeats ; r++) {
+            const double start = seconds_now();
+            KdTree kdTree(points, int(leafSizes[l]));
+            const double built = seconds_now();
+            knn_queries(kdTree, points, 3, queryStride, NULL);
+            const double repeatTime = (built - start) + queryScale * (seconds_now() - built);
+            if ((r == 0) || (repeatTime < time)) { time = repeatTime;}
+        }
+        if (leafSizes[l] == defaults.leafSize) { defaultTime = time;}
+        if ((l == 0) || (time < bestTime)) { bestTime = time; best.leafSize = leafSizes[l];}
+    }
+    if (bestTime > minimumGain * defaultTime) { best.leafSize = defaults.leafSize;}
+
+    //# 2) Threads and grain size of a smoothing pass over 10 neighbours
+    const size_t numNeighbours = 10;
+    Eigen::MatrixXi neighbourIndices(numPoints, numNeighbours);
+    {
+        KdTree kdTree(points, int(best.leafSize));
+        knn_queries(kdTree, points, numNeighbours, 1, &neighbourIndices);
+    }
+    const Eigen::MatrixXf weights = Eigen::MatrixXf::Constant(numPoints, numNeighbours, 1.0f / float(numNeighbours));
+    const Eigen::MatrixXf field = points.leftCols(3);
+    Eigen::MatrixXf smoothedField(numPoints, 3);
+
+    std::vector<int> threadCounts;
+    for (int t = 1 ; t < max_threads() ; t *= 2) { threadCounts.push_back(t);}
+    threadCounts.push_back(max_threads());
+    const size_t grainSizes[] = {0, 64, 256, 1024, 4096};
+    defaultTime = 0.0;
+    bestTime = 0.0;
+    bool first = true;
+    for (size_t t = 0 ; t < threadCounts.size() ; t++) {
+        for (size_t g = 0 ; g < sizeof(grainSizes) / sizeof(grainSizes[0]) ; g++) {
+            TuningProfile candidate;
+            candidate.numThreads = threadCounts[t];
+            candidate.grainSize = grainSizes[g];
+            double time = 0.0;
+            for (size_t r = 0 ; r < numRepeats ; r++) {
+                const double start = seconds_now();
+                smoothing_pass(field, neighbourIndices, weights, smoothedField,
+                               num_threads(candidate), chunk_size(candidate, numPoints));
+                const double repeatTime = seconds_now() - start;
+                if ((r == 0) || (repeatTime < time)) { time = repeatTime;}
+            }
+            //## The default: all threads, one chunk each
+            if ((threadCounts[t] == max_threads()) && (grainSizes[g] == 0)) { defaultTime = time;}
+            if (first || (time < bestTime)) {
+                bestTime = time;
+                best.numThreads = candidate.numThreads;
+                best.grainSize = candidate.grainSize;
+                first = false;
+            }
+        }
+    }
+    if (bestTime > minimumGain * defaultTime) {
+        best.numThreads = defaults.numThreads;
+        best.grainSize = defaults.grainSize;
+    }
+
+    //# Use and save the profile
+    set_profile(best);
+    const std::string path = get_profile_path();
+    if (!save(path, best)) {
+        std::cerr << "AutoTuner::tune(): couldn't write the profile to " << path << "." << std::endl;
+    }
+    return best;
+}//end tune()
+
+
+bool AutoTuner::load(const std::string &path, TuningProfile &outProfile){
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) { return false;}
+
+    TuningProfile profile;
+    int processors = -1;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || (line[0] == '#')) { continue;}
+        const size_t separator = line.find('=');
+        if (separator == std::string::npos) { continue;}
+        const std::string key = line.substr(0, separator);
+        std::istringstream value(line.substr(separator + 1));
+        bool parsed = true;
+        if (key == "processors") { parsed = bool(value >> processors);}
+        else if (key == "leaf_size") { parsed = bool(value >> profile.leafSize);}
+        else if (key == "num_threads") { parsed = bool(value >> profile.numThreads);}
+        else if (key == "grain_size") { parsed = bool(value >> profile.grainSize);}
+        if (!parsed) {
+            std::cerr << "AutoTuner::load(): couldn't parse '" << line << "' in " << path << "." << std::endl;
+            return false;
+        }
+    }
+    //# The profile only holds for the machine it was tuned on
+    if (processors != num_processors()) { return false;}
+    if ((profile.leafSize == 0) || (profile.numThreads < 0)) { return false;}
+    outProfile = profile;
+    return true;
+}//end load()
+
+
+bool AutoTuner::save(const std::string &path, const TuningProfile &profile){
+    std::ofstream file(path.c_str());
+    if (!file.is_open()) { return false;}
+    file << "# meshmonk tuning profile" << std::endl;
+    file << "processors=" << num_processors() << std::endl;
+    file << "leaf_size=" << profile.leafSize << std::endl;
+    file << "num_threads=" << profile.numThreads << std::endl;
+    file << "grain_size=" << profile.grainSize << std::endl;
+    return bool(file);
+}//end save()
+
+
+int AutoTuner::num_threads(const TuningProfile &profile){
+    return (profile.numThreads > 0) ? profile.numThreads : max_threads();
+}//end num_threads()
+
+
+int AutoTuner::chunk_size(const TuningProfile &profile, const size_t numElements){
+    if (profile.grainSize > 0) { return int(profile.grainSize);}
+    const size_t numThreads = size_t(num_threads(profile));
+    return int(std::max(size_t(1), (numElements + numThreads - 1) / numThreads));
+}//end chunk_size()
+
+}//namespace registration
@@ -0,0 +1,87 @@
+#ifndef AUTOTUNER_HPP
+#define AUTOTUNER_HPP
+
+#include <Eigen/Dense>
+#include <string>
+#include "../global.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat;
+
+namespace registration {
+
+//# The tunable performance parameters
+struct TuningProfile {
+    //## Maximum number of points in a leaf of the kd-trees (NeighbourFinder)
+    size_t leafSize = 15;
+    //## Threads for the parallel kNN queries and smoothing passes (0: the
+    //## OpenMP default)
+    int numThreads = 0;
+    //## Number of consecutive vertices a thread takes at a time in those loops
+    //## (0: one contiguous chunk per thread)
+    size_t grainSize = 0;
+};
+
+
+class AutoTuner
+{
+    /*
+    # GOAL
+    This class picks the kd-tree leaf size, the number of threads and the
+    parallel grain size for this machine and a representative mesh (e.g. the
+    template that is registered) by benchmarking the candidates:
+    -leaf sizes: building a kd-tree over the features and querying the 3
+    nearest neighbours of (a sample of) all the points,
+    -threads and grain sizes: a smoothing pass (weighted average over 10
+    neighbours, as in ViscoElasticTransformer) over all the points.
+    A candidate is only chosen over the default if it's at least 5% faster, so
+    benchmark noise doesn't flip the profile.
+
+    The chosen profile is written to a local text file (key=value lines) and
+    read back on the next run, so the benchmark only runs once per machine.
+    A profile that was tuned with a different number of processors is
+    ignored.
+
+    NeighbourFinder (leaf size, threads and grain of the kNN queries) and the
+    ViscoElasticTransformer smoothing passes pick up the current profile
+    automatically. Without tuning they use the defaults of TuningProfile.
+
+    # USAGE
+    Auto-tuning is off by default. With AutoTuner::set_enabled(true), the
+    registrations call ensure_tuned() with their floating features: the
+    profile is loaded from the profile file, or tuned and saved if there is
+    none. tune() always runs the benchmark.
+    */
+
+    public:
+        //# Enable automatic tuning at first use and set the profile file
+        static void set_enabled(const bool enabled);
+        static bool is_enabled();
+        static void set_profile_path(const std::string &profilePath);
+        static std::string get_profile_path();
+
+        //# Current profile (defaults if not tuned or loaded)
+        static TuningProfile get_profile();
+        static void set_profile(const TuningProfile &profile);
+
+        //# If enabled and not done yet: load the profile file, or tune on
+        //# 'inFeatures' and save the profile.
+        static void ensure_tuned(const ConstFeatureView &inFeatures);
+        //# Benchmark the candidates on 'inFeatures', make the best one the
+        //# current profile and save it.
+        static TuningProfile tune(const ConstFeatureView &inFeatures);
+
+        //# Read and write a profile file. load() returns false if the file
+        //# doesn't exist, can't be parsed or was tuned on another machine.
+        static bool load(const std::string &profilePath, TuningProfile &outProfile);
+        static bool save(const std::string &profilePath, const TuningProfile &profile);
+
+        //# Helpers for the parallel loops: the number of threads and the
+        //# chunk size for 'numElements' iterations.
+        static int num_threads(const TuningProfile &profile);
+        static int chunk_size(const TuningProfile &profile, const size_t numElements);
+};
+
+}//namespace registration
+
+#endif // AUTOTUNER_HPP
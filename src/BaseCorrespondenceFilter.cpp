@@ -13,11 +13,11 @@ BaseCorrespondenceFilter::~BaseCorrespondenceFilter()
 }
 
 
-void BaseCorrespondenceFilter::set_output(FeatureMat * const ioCorrespondingFeatures,
-                                    VecDynFloat * const ioCorrespondingFlags)
+void BaseCorrespondenceFilter::set_output(const FeatureView &ioCorrespondingFeatures,
+                                    const VecView &ioCorrespondingFlags)
 {
-    _ioCorrespondingFeatures = ioCorrespondingFeatures;
-    _ioCorrespondingFlags = ioCorrespondingFlags;
+    _ioCorrespondingFeatures.reset(ioCorrespondingFeatures);
+    _ioCorrespondingFlags.reset(ioCorrespondingFlags);
 
 }//end set_output
 
@@ -40,24 +40,24 @@ void BaseCorrespondenceFilter::_affinity_to_correspondences(){
     */
 
     //# Simple computation of corresponding features and flags
-    *_ioCorrespondingFeatures = _affinity * (*_inTargetFeatures);
-    *_ioCorrespondingFlags = _affinity * (*_inTargetFlags);
+    _ioCorrespondingFeatures = _affinity * _inTargetFeatures;
+    _ioCorrespondingFlags = _affinity * _inTargetFlags;
 
     //# Flag correction.
     //## Flags are binary. We will round them down if lower than the flag
     //## rounding limit (see explanation in parameter description).
     if (_flagThreshold >= 1.0f) {std::cerr << "corresponding flag threshold equals " << _flagThreshold << " but has to be between 0.0 and 1.0!" <<std::endl;}
     for (size_t i = 0 ; i < _numFloatingElements ; i++) {
-        if ((*_ioCorrespondingFlags)[i] > _flagThreshold){
-            (*_ioCorrespondingFlags)[i] = 1.0;
+        if (_ioCorrespondingFlags[i] > _flagThreshold){
+            _ioCorrespondingFlags[i] = 1.0;
         }
         else {
-            (*_ioCorrespondingFlags)[i] = 0.0;
+            _ioCorrespondingFlags[i] = 0.0;
         }
     }
 
     //# Merge corresponding and floating flags
-    (*_ioCorrespondingFlags) = (*_ioCorrespondingFlags).cwiseProduct(*_inFloatingFlags);
+    _ioCorrespondingFlags = _ioCorrespondingFlags.cwiseProduct(_inFloatingFlags);
 }
 
 }//namespace registration
@@ -5,6 +5,8 @@
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
 #include "../global.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
 #include <iostream>
 
 typedef Eigen::VectorXf VecDynFloat;
@@ -15,6 +17,7 @@ typedef Eigen::SparseMatrix<float, 0, int> SparseMat;
 typedef Eigen::Triplet<float> Triplet;
 typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
 
 namespace registration {
 
@@ -30,31 +33,40 @@ class BaseCorrespondenceFilter
         BaseCorrespondenceFilter();
         virtual ~BaseCorrespondenceFilter();
 
-        virtual void set_floating_input(const FeatureMat * const inFloatingFeatures,
-                                const VecDynFloat * const inFloatingFlags){}
-        virtual void set_target_input(const FeatureMat * const inTargetFeatures,
-                            const VecDynFloat * const inTargetFlags){}
-        void set_output(FeatureMat * const ioCorrespondingFeatures,
-                        VecDynFloat * const ioCorrespondingFlags);
+        virtual void set_floating_input(const ConstFeatureView &inFloatingFeatures,
+                                const ConstVecView &inFloatingFlags){}
+        virtual void set_target_input(const ConstFeatureView &inTargetFeatures,
+                            const ConstVecView &inTargetFlags){}
+        void set_output(const FeatureView &ioCorrespondingFeatures,
+                        const VecView &ioCorrespondingFlags);
         SparseMat get_affinity() const {return _affinity;}
+        //## Bytes held by the filter (kd-trees, neighbours, affinity matrix)
+        virtual size_t get_memory_usage() const { return memory_usage(_affinity);}
         virtual void set_parameters(const size_t numNeighbours,
                                     const float flagThreshold){}
         virtual void set_parameters(const size_t numNeighbours,
                                     const float flagThreshold,
                                     const bool equalizePushPull){}
+        virtual void set_target_faces(const ConstFacesView &inTargetFaces){}
+        virtual void set_surface_matching(const bool surfaceMatching = true){}
+        virtual void set_positional_search(const bool positionalSearch = true,
+                                           const size_t numCandidates = 0){}
+        virtual void set_max_distance(const float maxDistance){}
+        virtual void set_selective_update(const bool selectiveUpdate = true,
+                                          const float requeryTolerance = 0.1f){}
         virtual void update(){}
 
     protected:
 
         //# Inputs
-        const FeatureMat * _inFloatingFeatures = NULL;
-        const VecDynFloat * _inFloatingFlags = NULL; //currently never used (only in the symmetric version)
-        const FeatureMat * _inTargetFeatures = NULL;
-        const VecDynFloat * _inTargetFlags = NULL;
+        ConstFeatureView _inFloatingFeatures;
+        ConstVecView _inFloatingFlags; //currently never used (only in the symmetric version)
+        ConstFeatureView _inTargetFeatures;
+        ConstVecView _inTargetFlags;
 
         //# Outputs
-        FeatureMat * _ioCorrespondingFeatures = NULL;
-        VecDynFloat * _ioCorrespondingFlags = NULL;
+        FeatureView _ioCorrespondingFeatures;
+        VecView _ioCorrespondingFlags;
 
         //# User Parameters
         size_t _numNeighbours = 3;
@@ -0,0 +1,84 @@
+#ifndef BINARYSTREAM_HPP
+#define BINARYSTREAM_HPP
+
+#include <fstream>
+#include <limits>
+#include <stdint.h>
+#include <Eigen/Dense>
+
+namespace registration {
+
+//# Helpers for the binary files of meshmonk (checkpoints, prepared templates).
+//# Sizes are written as 64 bit words, matrices as their dimensions followed by
+//# their (column major) coefficients, in the byte order of the machine.
+//# Readers return false on a short or damaged file instead of throwing.
+
+inline void write_size(std::ofstream &file, const size_t value){
+    const uint64_t word = value;
+    file.write(reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+inline bool read_size(std::ifstream &file, size_t &outValue){
+    uint64_t word = 0;
+    if (!file.read(reinterpret_cast<char *>(&word), sizeof(word))) { return false;}
+    outValue = size_t(word);
+    return true;
+}
+
+template <typename Matrix>
+void write_matrix(std::ofstream &file, const Matrix &matrix){
+    write_size(file, matrix.rows());
+    write_size(file, matrix.cols());
+    file.write(reinterpret_cast<const char *>(matrix.data()), sizeof(typename Matrix::Scalar) * matrix.size());
+}
+
+//# Number of bytes left to read in the file (0 if it can't be told)
+inline size_t remaining_bytes(std::ifstream &file){
+    const std::streampos position = file.tellg();
+    if (position < 0) { return 0;}
+    file.seekg(0, std::ios::end);
+    const std::streampos end = file.tellg();
+    file.seekg(position);
+    if ((end < 0) || (end < position)) { return 0;}
+    return size_t(end - position);
+}
+
+//# Returns false (without allocating) if the dimensions don't fit the matrix
+//# type or the rest of the file, e.g. for a truncated or damaged file.
+template <typename Matrix>
+bool read_matrix(std::ifstream &file, Matrix &outMatrix){
+    typedef typename Matrix::Scalar Scalar;
+    size_t rows = 0;
+    size_t cols = 0;
+    if (!read_size(file, rows) || !read_size(file, cols)) { return false;}
+    if ((Matrix::ColsAtCompileTime != Eigen::Dynamic) && (cols != size_t(Matrix::ColsAtCompileTime))) { return false;}
+    if ((Matrix::RowsAtCompileTime != Eigen::Dynamic) && (rows != size_t(Matrix::RowsAtCompileTime))) { return false;}
+    if ((rows > size_t(std::numeric_limits<Eigen::Index>::max())) || (cols > size_t(std::numeric_limits<Eigen::Index>::max()))) { return false;}
+    if ((rows > 0) && (cols > 0) && (rows > remaining_bytes(file) / sizeof(Scalar) / cols)) { return false;}
+    outMatrix.resize(rows, cols);
+    return bool(file.read(reinterpret_cast<char *>(outMatrix.data()), sizeof(Scalar) * outMatrix.size()));
+}
+
+//# FNV-1a hash of the coefficients of a matrix (and its dimensions), added to
+//# 'hash'. Used to recognise the inputs a file was written for.
+const uint64_t FINGERPRINT_SEED = 14695981039346656037ULL;
+
+inline uint64_t fingerprint_bytes(const void * const data, const size_t numBytes, uint64_t hash = FINGERPRINT_SEED){
+    const unsigned char * const bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0 ; i < numBytes ; i++) {
+        hash ^= uint64_t(bytes[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename Matrix>
+uint64_t fingerprint_matrix(const Matrix &matrix, uint64_t hash = FINGERPRINT_SEED){
+    const uint64_t dimensions[2] = {uint64_t(matrix.rows()), uint64_t(matrix.cols())};
+    hash = fingerprint_bytes(dimensions, sizeof(dimensions), hash);
+    return fingerprint_bytes(matrix.data(), sizeof(typename Matrix::Scalar) * matrix.size(), hash);
+}
+
+}//namespace registration
+
+#endif // BINARYSTREAM_HPP
@@ -0,0 +1,347 @@
+#include "BoundingVolumeHierarchy.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+
+namespace registration {
+
+
+void BoundingVolumeHierarchy::set_source_surface(const ConstFeatureView &inSourceFeatures,
+                                                 const ConstFacesView &inSourceFaces){
+    //# Set input
+    _inSourceFeatures.reset(inSourceFeatures);
+    _inSourceFaces.reset(inSourceFaces);
+
+    //# Update internal parameters
+    _numSourceFaces = _inSourceFaces.rows();
+
+    //# Update internal data structures
+    //## The tree has to be rebuilt.
+    _build_tree();
+}
+
+
+void BoundingVolumeHierarchy::set_queried_points(const ConstFeatureView &inQueriedFeatures){
+    //# Set input
+    _inQueriedFeatures.reset(inQueriedFeatures);
+
+    //# Update internal parameters
+    _numQueriedElements = _inQueriedFeatures.rows();
+
+    //# Adjust internal data structures
+    //## The outputs have to be resized.
+    _outFaceIndices.setZero(_numQueriedElements);
+    _outBarycentricCoordinates.setZero(_numQueriedElements, 3);
+    _outSquaredDistances.setZero(_numQueriedElements);
+}
+
+
+void BoundingVolumeHierarchy::set_parameters(const size_t leafSize){
+    //# Check if what user requests, changes the parameter value
+    bool parameterChanged = false;
+    if (_leafSize != leafSize){ parameterChanged = true;}
+
+    //# Set parameter
+    _leafSize = leafSize;
+    if (_leafSize < 1) { _leafSize = 1;}
+
+    //# Rebuild the tree if the parameter is changed
+    if ((parameterChanged == true) && (_inSourceFaces.is_set())) {
+        _build_tree();
+    }
+}
+
+
+void BoundingVolumeHierarchy::_build_tree(){
+    //# Info & Initialization
+    _nodes.clear();
+    _trianglePositions.clear();
+    _triangleFaceIndices.clear();
+    if (_numSourceFaces == 0) {
+        std::cerr << "BoundingVolumeHierarchy needs at least one face to build its tree!" << std::endl;
+        return;
+    }
+
+    //# Compute the centroid of each face (used to decide how to split)
+    std::vector<float> centroids(3 * _numSourceFaces, 0.0f);
+    std::vector<int> faceOrder(_numSourceFaces);
+    for (size_t f = 0 ; f < _numSourceFaces ; f++) {
+        faceOrder[f] = f;
+        for (size_t c = 0 ; c < 3 ; c++) {
+            const int vertexIndex = _inSourceFaces(f,c);
+            for (size_t d = 0 ; d < 3 ; d++) {
+                centroids[3*f + d] += _inSourceFeatures(vertexIndex,d) / 3.0f;
+            }
+        }
+    }
+
+    //# Recursively build the tree, starting from the root node
+    //## A binary tree with leaves of at least one triangle never has more than
+    //## 2*numFaces - 1 nodes.
+    _nodes.reserve(2 * _numSourceFaces);
+    _nodes.push_back(Node());
+    _build_node(0, 0, _numSourceFaces, faceOrder, centroids);
+
+    //# Store the triangles in the order of the leaves
+    _trianglePositions.resize(9 * _numSourceFaces);
+    _triangleFaceIndices.resize(_numSourceFaces);
+    for (size_t t = 0 ; t < _numSourceFaces ; t++) {
+        const int faceIndex = faceOrder[t];
+        _triangleFaceIndices[t] = faceIndex;
+        for (size_t c = 0 ; c < 3 ; c++) {
+            const int vertexIndex = _inSourceFaces(faceIndex,c);
+            for (size_t d = 0 ; d < 3 ; d++) {
+                _trianglePositions[9*t + 3*c + d] = _inSourceFeatures(vertexIndex,d);
+            }
+        }
+    }
+}//end _build_tree()
+
+
+void BoundingVolumeHierarchy::_build_node(const size_t nodeIndex, const size_t first,
+                                          const size_t numTriangles,
+                                          std::vector<int> &faceOrder,
+                                          const std::vector<float> &centroids){
+    //# Compute the bounding box of all corners of the triangles in this node
+    //# (and the bounding box of their centroids to decide where to split)
+    float boxMin[3], boxMax[3], centroidMin[3], centroidMax[3];
+    for (size_t d = 0 ; d < 3 ; d++) {
+        boxMin[d] = centroidMin[d] = std::numeric_limits<float>::max();
+        boxMax[d] = centroidMax[d] = -std::numeric_limits<float>::max();
+    }
+    for (size_t t = first ; t < first + numTriangles ; t++) {
+        const int faceIndex = faceOrder[t];
+        for (size_t d = 0 ; d < 3 ; d++) {
+            centroidMin[d] = std::min(centroidMin[d], centroids[3*faceIndex + d]);
+            centroidMax[d] = std::max(centroidMax[d], centroids[3*faceIndex + d]);
+        }
+        for (size_t c = 0 ; c < 3 ; c++) {
+            const int vertexIndex = _inSourceFaces(faceIndex,c);
+            for (size_t d = 0 ; d < 3 ; d++) {
+                const float coordinate = _inSourceFeatures(vertexIndex,d);
+                boxMin[d] = std::min(boxMin[d], coordinate);
+                boxMax[d] = std::max(boxMax[d], coordinate);
+            }
+        }
+    }
+    for (size_t d = 0 ; d < 3 ; d++) {
+        _nodes[nodeIndex].boxMin[d] = boxMin[d];
+        _nodes[nodeIndex].boxMax[d] = boxMax[d];
+    }
+
+    //# Small enough? Then this node becomes a leaf.
+    if (numTriangles <= _leafSize) {
+        _nodes[nodeIndex].first = first;
+        _nodes[nodeIndex].numTriangles = numTriangles;
+        return;
+    }
+
+    //# Split the triangles in two halves along the longest axis of the
+    //# centroid bounding box (median split)
+    size_t axis = 0;
+    for (size_t d = 1 ; d < 3 ; d++) {
+        if ((centroidMax[d] - centroidMin[d]) > (centroidMax[axis] - centroidMin[axis])) { axis = d;}
+    }
+    const size_t numLeft = numTriangles / 2;
+    std::nth_element(faceOrder.begin() + first,
+                     faceOrder.begin() + first + numLeft,
+                     faceOrder.begin() + first + numTriangles,
+                     [&centroids, axis](const int left, const int right) {
+                        return centroids[3*left + axis] < centroids[3*right + axis];
+                     });
+
+    //# Create the two children next to each other and recurse
+    const size_t leftChild = _nodes.size();
+    _nodes.push_back(Node());
+    _nodes.push_back(Node());
+    _nodes[nodeIndex].first = leftChild;
+    _nodes[nodeIndex].numTriangles = 0;
+    _build_node(leftChild, first, numLeft, faceOrder, centroids);
+    _build_node(leftChild + 1, first + numLeft, numTriangles - numLeft, faceOrder, centroids);
+}//end _build_node()
+
+
+float BoundingVolumeHierarchy::_box_squared_distance(const Node &node, const float * const point) const {
+    float distanceSquared = 0.0f;
+    for (size_t d = 0 ; d < 3 ; d++) {
+        if (point[d] < node.boxMin[d]) {
+            const float difference = node.boxMin[d] - point[d];
+            distanceSquared += difference * difference;
+        }
+        else if (point[d] > node.boxMax[d]) {
+            const float difference = point[d] - node.boxMax[d];
+            distanceSquared += difference * difference;
+        }
+    }
+    return distanceSquared;
+}
+
+
+float BoundingVolumeHierarchy::_closest_point_on_triangle(const float * const point,
+                                                          const float * const corners,
+                                                          Vec3Float &barycentric) const {
+    /*
+    Computes the point on the triangle (a,b,c) closest to 'point' by checking
+    in which Voronoi region of the triangle the point lies (see Ericson,
+    Real-Time Collision Detection, section 5.1.5). The result is returned as
+    barycentric coordinates and the squared distance to that point.
+    */
+    const Eigen::Map<const Vec3Float> a(corners);
+    const Eigen::Map<const Vec3Float> b(corners + 3);
+    const Eigen::Map<const Vec3Float> c(corners + 6);
+    const Eigen::Map<const Vec3Float> p(point);
+    const Vec3Float ab = b - a;
+    const Vec3Float ac = c - a;
+
+    //# Vertex region of a
+    const Vec3Float ap = p - a;
+    const float d1 = ab.dot(ap);
+    const float d2 = ac.dot(ap);
+    if ((d1 <= 0.0f) && (d2 <= 0.0f)) {
+        barycentric << 1.0f, 0.0f, 0.0f;
+        return ap.squaredNorm();
+    }
+
+    //# Vertex region of b
+    const Vec3Float bp = p - b;
+    const float d3 = ab.dot(bp);
+    const float d4 = ac.dot(bp);
+    if ((d3 >= 0.0f) && (d4 <= d3)) {
+        barycentric << 0.0f, 1.0f, 0.0f;
+        return bp.squaredNorm();
+    }
+
+    //# Edge region of ab
+    const float vc = d1 * d4 - d3 * d2;
+    if ((vc <= 0.0f) && (d1 >= 0.0f) && (d3 <= 0.0f)) {
+        const float v = d1 / (d1 - d3);
+        barycentric << 1.0f - v, v, 0.0f;
+        return (p - (a + v * ab)).squaredNorm();
+    }
+
+    //# Vertex region of c
+    const Vec3Float cp = p - c;
+    const float d5 = ab.dot(cp);
+    const float d6 = ac.dot(cp);
+    if ((d6 >= 0.0f) && (d5 <= d6)) {
+        barycentric << 0.0f, 0.0f, 1.0f;
+        return cp.squaredNorm();
+    }
+
+    //# Edge region of ac
+    const float vb = d5 * d2 - d1 * d6;
+    if ((vb <= 0.0f) && (d2 >= 0.0f) && (d6 <= 0.0f)) {
+        const float w = d2 / (d2 - d6);
+        barycentric << 1.0f - w, 0.0f, w;
+        return (p - (a + w * ac)).squaredNorm();
+    }
+
+    //# Edge region of bc
+    const float va = d3 * d6 - d5 * d4;
+    if ((va <= 0.0f) && ((d4 - d3) >= 0.0f) && ((d5 - d6) >= 0.0f)) {
+        const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        barycentric << 0.0f, 1.0f - w, w;
+        return (p - (b + w * (c - b))).squaredNorm();
+    }
+
+    //# Inside the face region
+    const float sum = va + vb + vc;
+    if (sum <= 0.0f) {
+        //## Degenerate (zero area) triangle: fall back to its first corner.
+        barycentric << 1.0f, 0.0f, 0.0f;
+        return ap.squaredNorm();
+    }
+    const float v = vb / sum;
+    const float w = vc / sum;
+    barycentric << 1.0f - v - w, v, w;
+    return (p - (a + v * ab + w * ac)).squaredNorm();
+}//end _closest_point_on_triangle()
+
+
+void BoundingVolumeHierarchy::set_max_distance(const float maxDistance){
+    _maxDistance = maxDistance;
+    if (_maxDistance < 0.0f) { _maxDistance = 0.0f;}
+}
+
+
+void BoundingVolumeHierarchy::update(){
+    MESHMONK_TRACE_SCOPE("BoundingVolumeHierarchy::query");
+    if (_nodes.empty()) {
+        std::cerr << "BoundingVolumeHierarchy::update() called without a valid source surface!" << std::endl;
+        return;
+    }
+
+    //# Query the tree
+    //## Loop over the queried features
+    //### Initialize variables we'll need during the loop
+    std::vector<int> nodeStack;
+    nodeStack.reserve(64);
+    float queriedPoint[3];
+    Vec3Float barycentric = Vec3Float::Zero();
+    const float maxSquaredDistance = (_maxDistance > 0.0f) ? _maxDistance * _maxDistance
+                                                           : std::numeric_limits<float>::max();
+
+    //### Execute loop
+    for (size_t i = 0 ; i < _numQueriedElements ; i++) {
+        for (size_t d = 0 ; d < 3 ; d++) {
+            queriedPoint[d] = _inQueriedFeatures(i,d);
+        }
+
+        //### Depth-first traversal, visiting the nearest child first and
+        //### skipping every node whose box is further away than the best
+        //### triangle found so far.
+        float bestDistanceSquared = maxSquaredDistance;
+        int bestTriangle = -1;
+        Vec3Float bestBarycentric(1.0f, 0.0f, 0.0f);
+        nodeStack.clear();
+        nodeStack.push_back(0);
+        while (!nodeStack.empty()) {
+            const Node &node = _nodes[nodeStack.back()];
+            nodeStack.pop_back();
+            if (_box_squared_distance(node, queriedPoint) >= bestDistanceSquared) { continue;}
+
+            if (node.numTriangles > 0) {
+                //#### Leaf: check each of its triangles
+                for (int t = node.first ; t < node.first + node.numTriangles ; t++) {
+                    const float distanceSquared = _closest_point_on_triangle(queriedPoint,
+                                                                             &_trianglePositions[9*t],
+                                                                             barycentric);
+                    if (distanceSquared < bestDistanceSquared) {
+                        bestDistanceSquared = distanceSquared;
+                        bestTriangle = t;
+                        bestBarycentric = barycentric;
+                    }
+                }
+            }
+            else {
+                //#### Inner node: push the furthest child first so that the
+                //#### nearest one is popped (and tightens the bound) first.
+                const int leftChild = node.first;
+                const int rightChild = node.first + 1;
+                const float leftDistance = _box_squared_distance(_nodes[leftChild], queriedPoint);
+                const float rightDistance = _box_squared_distance(_nodes[rightChild], queriedPoint);
+                if (leftDistance < rightDistance) {
+                    nodeStack.push_back(rightChild);
+                    nodeStack.push_back(leftChild);
+                }
+                else {
+                    nodeStack.push_back(leftChild);
+                    nodeStack.push_back(rightChild);
+                }
+            }
+        }
+
+        //### Copy the result into the outputs
+        if (bestTriangle < 0) {
+            //#### No surface point within the maximum distance
+            _outFaceIndices[i] = -1;
+            _outBarycentricCoordinates.row(i) = bestBarycentric;
+            _outSquaredDistances[i] = maxSquaredDistance;
+            continue;
+        }
+        _outFaceIndices[i] = _triangleFaceIndices[bestTriangle];
+        _outBarycentricCoordinates.row(i) = bestBarycentric;
+        _outSquaredDistances[i] = bestDistanceSquared;
+    }
+}//end update()
+
+}//namespace registration
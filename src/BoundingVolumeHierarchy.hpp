@@ -0,0 +1,125 @@
+#ifndef BOUNDINGVOLUMEHIERARCHY_HPP
+#define BOUNDINGVOLUMEHIERARCHY_HPP
+
+#include <Eigen/Dense>
+#include <vector>
+#include <limits>
+#include <iostream>
+#include "../global.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Vector3f Vec3Float;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+
+namespace registration {
+
+class BoundingVolumeHierarchy
+{
+    /*
+    # GOAL
+    This class searches for the closest point on the surface given by
+    'inSourceFeatures' and 'inSourceFaces' for each element in the
+    'inQueriedFeatures' set. Instead of only looking at the vertices of the
+    source surface, the closest point can lie anywhere on its triangles.
+
+    The triangles are organized in a bounding volume hierarchy (a binary tree of
+    axis aligned bounding boxes) so that each query only visits the few
+    triangles that are near the queried point.
+
+    # INPUTS
+    -inSourceFeatures: only the positions (first three columns) are used
+    -inSourceFaces
+    -inQueriedFeatures: only the positions (first three columns) are used
+
+    # PARAMETERS
+    -leafSize(= 4): maximum number of triangles in a leaf of the tree
+    -maxDistance(= 0.0): if larger than zero, only points on the surface closer
+    than this distance are searched. Queried points without such a point get
+    face index -1.
+
+    # OUTPUTS
+    -outFaceIndices: index of the face on which the closest point lies
+    -outBarycentricCoordinates: barycentric coordinates of the closest point
+    with respect to the three vertices of that face (in the order of the
+    columns of inSourceFaces).
+    -outSquaredDistances: squared (!) distance to the closest point.
+    */
+
+    public:
+        void set_source_surface(const ConstFeatureView &inSourceFeatures,
+                                const ConstFacesView &inSourceFaces);
+        void set_queried_points(const ConstFeatureView &inQueriedFeatures);
+        void set_parameters(const size_t leafSize);
+        void set_max_distance(const float maxDistance);
+        VecDynInt get_face_indices() const { return _outFaceIndices;}
+        Vec3Mat get_barycentric_coordinates() const { return _outBarycentricCoordinates;}
+        VecDynFloat get_distances() const { return _outSquaredDistances;}
+        size_t get_memory_usage() const {
+            return memory_usage(_nodes) + memory_usage(_trianglePositions) + memory_usage(_triangleFaceIndices)
+                   + memory_usage(_outFaceIndices) + memory_usage(_outBarycentricCoordinates)
+                   + memory_usage(_outSquaredDistances);
+        }
+        void update();
+
+    protected:
+
+    private:
+        //# Inputs
+        ConstFeatureView _inSourceFeatures;
+        ConstFacesView _inSourceFaces;
+        ConstFeatureView _inQueriedFeatures;
+
+        //# Outputs
+        VecDynInt _outFaceIndices;
+        Vec3Mat _outBarycentricCoordinates;
+        VecDynFloat _outSquaredDistances;
+
+        //# User parameters
+        size_t _leafSize = 4;
+        float _maxDistance = 0.0f;
+
+        //# Internal Data structures
+        //## A node of the tree. Leaves (numTriangles > 0) point to a range of
+        //## triangles, inner nodes (numTriangles == 0) to their two children
+        //## which are stored next to each other.
+        struct Node {
+            float boxMin[3];
+            float boxMax[3];
+            int first; //first triangle (leaf) or left child (inner node)
+            int numTriangles;
+        };
+        std::vector<Node> _nodes;
+        //## Triangles in the order of the tree leaves. For each triangle we
+        //## store its corner positions (9 floats) next to each other so that
+        //## a leaf can be scanned without jumping around in memory.
+        std::vector<float> _trianglePositions;
+        std::vector<int> _triangleFaceIndices;
+
+        //# Internal parameters
+        size_t _numSourceFaces = 0;
+        size_t _numQueriedElements = 0;
+
+        //# Internal functions
+        //## Build the tree over the faces of the source surface
+        void _build_tree();
+        //## Recursively split a range of triangles into a subtree
+        void _build_node(const size_t nodeIndex, const size_t first,
+                         const size_t numTriangles,
+                         std::vector<int> &faceOrder,
+                         const std::vector<float> &centroids);
+        //## Squared distance between a point and the bounding box of a node
+        float _box_squared_distance(const Node &node, const float * const point) const;
+        //## Closest point on a single triangle
+        float _closest_point_on_triangle(const float * const point,
+                                         const float * const corners,
+                                         Vec3Float &barycentric) const;
+};
+
+}//namespace registration
+
+#endif // BOUNDINGVOLUMEHIERARCHY_HPP
@@ -0,0 +1,88 @@
+#include "Checkpoint.hpp"
+#include "BinaryStream.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace registration {
+
+namespace {
+    const char checkpointMagic[8] = {'M', 'M', 'C', 'K', 'P', 'T', '0', '2'};
+}//namespace
+
+
+bool save_checkpoint(const std::string &path, const RegistrationCheckpoint &checkpoint){
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "save_checkpoint(): couldn't write " << temporaryPath << "." << std::endl;
+            return false;
+        }
+        file.write(checkpointMagic, sizeof(checkpointMagic));
+        write_size(file, checkpoint.layer);
+        write_size(file, checkpoint.iteration);
+        write_size(file, checkpoint.numViscousIterations);
+        write_size(file, checkpoint.numElasticIterations);
+        write_size(file, checkpoint.numInputElements);
+        write_size(file, checkpoint.numIterations);
+        write_size(file, checkpoint.numPyramidLayers);
+        write_size(file, checkpoint.fingerprint);
+        write_matrix(file, checkpoint.floatingFeatures);
+        write_matrix(file, checkpoint.originalIndices);
+        write_matrix(file, checkpoint.inlierWeights);
+        write_matrix(file, checkpoint.displacementField);
+        write_matrix(file, checkpoint.startPositions);
+        file.flush();
+        if (!file) {
+            std::cerr << "save_checkpoint(): couldn't write " << temporaryPath << "." << std::endl;
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "save_checkpoint(): couldn't rename " << temporaryPath << " to " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}//end save_checkpoint()
+
+
+bool load_checkpoint(const std::string &path, RegistrationCheckpoint &outCheckpoint){
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open()) { return false;}
+    char magic[sizeof(checkpointMagic)];
+    if (!file.read(magic, sizeof(magic)) || (std::memcmp(magic, checkpointMagic, sizeof(magic)) != 0)) {
+        std::cerr << "load_checkpoint(): " << path << " isn't a meshmonk checkpoint." << std::endl;
+        return false;
+    }
+    RegistrationCheckpoint checkpoint;
+    const bool complete = read_size(file, checkpoint.layer)
+                          && read_size(file, checkpoint.iteration)
+                          && read_size(file, checkpoint.numViscousIterations)
+                          && read_size(file, checkpoint.numElasticIterations)
+                          && read_size(file, checkpoint.numInputElements)
+                          && read_size(file, checkpoint.numIterations)
+                          && read_size(file, checkpoint.numPyramidLayers)
+                          && read_size(file, checkpoint.fingerprint)
+                          && read_matrix(file, checkpoint.floatingFeatures)
+                          && read_matrix(file, checkpoint.originalIndices)
+                          && read_matrix(file, checkpoint.inlierWeights)
+                          && read_matrix(file, checkpoint.displacementField)
+                          && read_matrix(file, checkpoint.startPositions);
+    const size_t numElements = checkpoint.floatingFeatures.rows();
+    if (!complete || (size_t(checkpoint.originalIndices.rows()) != numElements)
+        || (size_t(checkpoint.inlierWeights.rows()) != numElements)
+        || (size_t(checkpoint.displacementField.rows()) != numElements)
+        || ((checkpoint.startPositions.rows() != 0) && (size_t(checkpoint.startPositions.rows()) != numElements))) {
+        std::cerr << "load_checkpoint(): " << path << " is damaged." << std::endl;
+        return false;
+    }
+    outCheckpoint = checkpoint;
+    return true;
+}//end load_checkpoint()
+
+}//namespace registration
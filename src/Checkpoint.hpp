@@ -0,0 +1,63 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <string>
+#include <Eigen/Dense>
+#include "../global.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
+
+namespace registration {
+
+struct RegistrationCheckpoint
+{
+    /*
+    # GOAL
+    State of a pyramid registration at a layer or iteration boundary, so an
+    interrupted registration can be resumed instead of restarted.
+
+    The state is taken *before* 'iteration' of pyramid layer 'layer': with
+    iteration == 0 the layers before 'layer' are done (and layer ==
+    numPyramidLayers means the whole registration is done), otherwise the
+    first 'iteration' iterations of 'layer' are done as well. The floating
+    features, original indices, inlier weights and displacement field are
+    those of the last layer that ran. Within a layer, startPositions holds
+    the floating positions at the start of the layer (the smoothing
+    neighbours are found in those); it's empty at layer boundaries. The
+    annealing position follows from (layer, iteration); the numbers of
+    visco-elastic smoothing iterations at that position are kept for
+    information.
+
+    numInputElements, numIterations, numPyramidLayers and fingerprint
+    identify the registration the checkpoint belongs to: the fingerprint is a
+    hash of the input meshes (features, faces and flags of both) and of the
+    parameters that change the result (see fingerprint_matrix()). A checkpoint
+    of a different registration is not resumed.
+    */
+    size_t layer = 0;
+    size_t iteration = 0;
+    size_t numViscousIterations = 0;
+    size_t numElasticIterations = 0;
+    size_t numInputElements = 0;
+    size_t numIterations = 0;
+    size_t numPyramidLayers = 0;
+    size_t fingerprint = 0;
+    FeatureMat floatingFeatures;
+    VecDynInt originalIndices;
+    VecDynFloat inlierWeights;
+    Vec3Mat displacementField;
+    Vec3Mat startPositions;
+};
+
+//# Write a checkpoint (binary). It's written to a temporary file first and
+//# renamed, so an interrupted write leaves the previous checkpoint intact.
+bool save_checkpoint(const std::string &path, const RegistrationCheckpoint &checkpoint);
+//# Read a checkpoint. Returns false if there is none or it is damaged.
+bool load_checkpoint(const std::string &path, RegistrationCheckpoint &outCheckpoint);
+
+}//namespace registration
+
+#endif // CHECKPOINT_HPP
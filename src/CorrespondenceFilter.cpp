@@ -1,37 +1,104 @@
 #include "CorrespondenceFilter.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+#include <limits>
 
 
 namespace registration {
 
 
-void CorrespondenceFilter::set_floating_input(const FeatureMat * const inFloatingFeatures,
-                                              const VecDynFloat * const inFloatingFlags)
+void CorrespondenceFilter::set_floating_input(const ConstFeatureView &inFloatingFeatures,
+                                              const ConstVecView &inFloatingFlags)
 {
     //# Set input
-    _inFloatingFeatures = inFloatingFeatures;
-    _inFloatingFlags = inFloatingFlags;
+    _inFloatingFeatures.reset(inFloatingFeatures);
+    _inFloatingFlags.reset(inFloatingFlags);
 
     //# Update internal parameters
-    _numFloatingElements = _inFloatingFeatures->rows();
+    _numFloatingElements = _inFloatingFeatures.rows();
     _numAffinityElements = _numFloatingElements * _numNeighbours;
 
     //# Update the neighbour finder
     _neighbourFinder.set_queried_points(_inFloatingFeatures);
 }
 
-void CorrespondenceFilter::set_target_input(const FeatureMat * const inTargetFeatures,
-                                            const VecDynFloat * const inTargetFlags)
+void CorrespondenceFilter::set_target_input(const ConstFeatureView &inTargetFeatures,
+                                            const ConstVecView &inTargetFlags)
 {
     //# Set input
-    _inTargetFeatures = inTargetFeatures;
-    _inTargetFlags = inTargetFlags;
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inTargetFlags.reset(inTargetFlags);
 
     //# Update internal parameters
-    _numTargetElements = _inTargetFeatures->rows();
+    _numTargetElements = _inTargetFeatures.rows();
     _numAffinityElements = _numFloatingElements * _numNeighbours;
 
-    //# Update the neighbour finder
-    _neighbourFinder.set_source_points(_inTargetFeatures);
+    //# Update the neighbour finder (or mark the surface tree as outdated)
+    //## The target changed, so cached neighbours can no longer be trusted.
+    _neighboursCached = false;
+    if (_surfaceMatching) {
+        _surfaceOutdated = true;
+    }
+    else if (_positionalSearch) {
+        _targetPositions = _inTargetFeatures.leftCols(3);
+        _positionFinder.set_source_points(&_targetPositions);
+    }
+    else {
+        _neighbourFinder.set_source_points(_inTargetFeatures);
+    }
+}
+
+
+void CorrespondenceFilter::set_target_faces(const ConstFacesView &inTargetFaces)
+{
+    _inTargetFaces.reset(inTargetFaces);
+    _surfaceOutdated = true;
+}
+
+
+void CorrespondenceFilter::set_surface_matching(const bool surfaceMatching)
+{
+    //# When switching back to vertex matching, the neighbour finder still
+    //# needs a kd-tree of the current target.
+    _surfaceMatching = surfaceMatching;
+    _surfaceOutdated = true;
+    if (!_surfaceMatching && (_inTargetFeatures.is_set())) {
+        set_target_input(_inTargetFeatures, _inTargetFlags);
+    }
+}
+
+
+void CorrespondenceFilter::set_positional_search(const bool positionalSearch,
+                                                 const size_t numCandidates)
+{
+    _positionalSearch = positionalSearch;
+    _numCandidatesRequested = numCandidates;
+    _update_num_candidates();
+    _neighboursCached = false;
+
+    //# The kd-tree of the (new) search mode has to be built.
+    if (_inTargetFeatures.is_set()) {
+        set_target_input(_inTargetFeatures, _inTargetFlags);
+    }
+}
+
+
+void CorrespondenceFilter::set_selective_update(const bool selectiveUpdate,
+                                                const float requeryTolerance)
+{
+    _selectiveUpdate = selectiveUpdate;
+    _requeryTolerance = requeryTolerance;
+    _neighboursCached = false;
+}
+
+
+void CorrespondenceFilter::set_max_distance(const float maxDistance)
+{
+    _neighboursCached = false;
+    _maxDistance = maxDistance;
+    _neighbourFinder.set_max_distance(maxDistance);
+    _positionFinder.set_max_distance(maxDistance);
+    _surfaceFinder.set_max_distance(maxDistance);
 }
 
 
@@ -42,6 +109,17 @@ void CorrespondenceFilter::set_parameters(const size_t numNeighbours,
     _flagThreshold = flagThreshold;
     _numAffinityElements = _numFloatingElements * _numNeighbours;
     _neighbourFinder.set_parameters(_numNeighbours);
+    _update_num_candidates();
+    _neighboursCached = false;
+}
+
+
+void CorrespondenceFilter::_update_num_candidates(){
+    //# By default (or when too few candidates are requested), twice the number
+    //# of neighbours are searched in the positional kd-tree.
+    _numCandidates = _numCandidatesRequested;
+    if (_numCandidates < _numNeighbours) { _numCandidates = 2 * _numNeighbours;}
+    _positionFinder.set_parameters(_numCandidates);
 }
 
 
@@ -50,6 +128,8 @@ void CorrespondenceFilter::set_affinity_normalization(const bool normalizeAffini
 }
 
 void CorrespondenceFilter::_update_affinity() {
+    MESHMONK_TRACE_SCOPE("CorrespondenceFilter::affinity");
+    MESHMONK_COUNT_STAGE("affinity", _numFloatingElements);
     /*
     # GOALthe
     For each element in _inFloatingFeatures, we're going to determine affinity weights
@@ -65,9 +145,9 @@ void CorrespondenceFilter::_update_affinity() {
     //## the affinity matrix later.
     std::vector<Triplet> affinityElements(_numAffinityElements, Triplet(0,0,0.0f));
 
-    //## Obtain pointers to neighbouring indices and (squared) distances:
-    const MatDynInt neighbourIndices = _neighbourFinder.get_indices();
-    const MatDynFloat neighbourSquaredDistances = _neighbourFinder.get_distances();
+    //## Obtain references to neighbouring indices and (squared) distances:
+    const MatDynInt &neighbourIndices = _neighbourIndices;
+    const MatDynFloat &neighbourSquaredDistances = _neighbourSquaredDistances;
 
     //# Compute the affinity matrix
     //## Loop over the first feature set to determine their affinity with the
@@ -78,11 +158,12 @@ void CorrespondenceFilter::_update_affinity() {
     Vec3Float targetNormal = Vec3Float::Zero();
     unsigned int counter = 0;
     for ( ; i < _numFloatingElements ; i++) {
-        floatingNormal = _inFloatingFeatures->row(i).tail(3);
+        floatingNormal = _inFloatingFeatures.row(i).tail(3);
         //### Loop over each found neighbour
         for ( j = 0 ; j < _numNeighbours ; j++) {
             //### Get index of neighbour and squared distance to it
             const int neighbourIndex = neighbourIndices(i,j);
+            if (neighbourIndex < 0) { break;} //no more neighbours within the maximum distance
             float distanceSquared = neighbourSquaredDistances(i,j);
 
             //### For numerical stability, check if the distance is very small
@@ -93,7 +174,7 @@ void CorrespondenceFilter::_update_affinity() {
             float affinityElement = 1.0f / distanceSquared;
 
             //### Incorporate the orientation
-            targetNormal = _inTargetFeatures->row(neighbourIndex).tail(3);
+            targetNormal = _inTargetFeatures.row(neighbourIndex).tail(3);
             float dotProduct = floatingNormal.dot(targetNormal);
             float orientationWeight = dotProduct / 2.0f + 0.5f;
             affinityElement *= orientationWeight;
@@ -110,6 +191,7 @@ void CorrespondenceFilter::_update_affinity() {
         }
     }
     //## Construct the sparse matrix with the computed element list
+    affinityElements.resize(counter);
     _affinity.setFromTriplets(affinityElements.begin(),
                                 affinityElements.end());
 
@@ -121,16 +203,268 @@ void CorrespondenceFilter::_update_affinity() {
 }//end wknn_affinity()
 
 
+void CorrespondenceFilter::_update_positional_neighbours(const std::vector<size_t> * const queriedIndices) {
+    /*
+    # GOAL
+    Find the k nearest target features of each floating feature by searching
+    _numCandidates candidates in the 3-D position kd-tree and re-ranking them
+    with the squared 6-D distance (position and normal).
+    If 'queriedIndices' is given, only those floating features are updated.
+    */
+
+    //# Query the positional kd-tree
+    _floatingPositions = _inFloatingFeatures.leftCols(3);
+    _positionFinder.set_queried_points(&_floatingPositions);
+    if (queriedIndices != NULL) { _positionFinder.update_subset(*queriedIndices);}
+    else { _positionFinder.update();}
+    const MatDynInt candidateIndices = _positionFinder.get_indices();
+    const MatDynFloat candidateSquaredDistances = _positionFinder.get_distances();
+
+    //# Re-rank the candidates
+    if (queriedIndices == NULL) {
+        _neighbourIndices.resize(_numFloatingElements, _numNeighbours);
+        _neighbourSquaredDistances.resize(_numFloatingElements, _numNeighbours);
+    }
+    const size_t numQueries = (queriedIndices != NULL) ? queriedIndices->size() : _numFloatingElements;
+    std::vector<std::pair<float, int> > candidates(_numCandidates);
+    Vec3Float floatingNormal = Vec3Float::Zero();
+    Vec3Float targetNormal = Vec3Float::Zero();
+    for (size_t q = 0 ; q < numQueries ; q++) {
+        const size_t i = (queriedIndices != NULL) ? (*queriedIndices)[q] : q;
+        floatingNormal = _inFloatingFeatures.row(i).tail(3);
+        //## Combined score: squared positional distance + squared normal distance
+        for (size_t j = 0 ; j < _numCandidates ; j++) {
+            const int candidateIndex = candidateIndices(i,j);
+            if (candidateIndex < 0) {
+                //### Not found within the maximum distance
+                candidates[j] = std::make_pair(std::numeric_limits<float>::max(), -1);
+                continue;
+            }
+            targetNormal = _inTargetFeatures.row(candidateIndex).tail(3);
+            const float score = candidateSquaredDistances(i,j)
+                                + (targetNormal - floatingNormal).squaredNorm();
+            candidates[j] = std::make_pair(score, candidateIndex);
+        }
+        //## Keep the k best candidates
+        std::partial_sort(candidates.begin(), candidates.begin() + _numNeighbours,
+                          candidates.end());
+        for (size_t j = 0 ; j < _numNeighbours ; j++) {
+            _neighbourIndices(i,j) = candidates[j].second;
+            _neighbourSquaredDistances(i,j) = candidates[j].first;
+        }
+    }
+}//end _update_positional_neighbours()
+
+
+void CorrespondenceFilter::_update_neighbours() {
+    /*
+    # GOAL
+    Update the k nearest target features of each floating feature (with the
+    6-D or the positional search).
+
+    In selective mode, only the floating features that moved more than
+    _requeryTolerance times the distance to their nearest neighbour (at the
+    time they were last queried) are queried again. The others keep their
+    neighbours, of which only the distances are recomputed. Floating features
+    that had no neighbour within the maximum distance are stored with a zero
+    distance, so they are queried again as soon as they move, and those of
+    which a kept neighbour is now beyond the maximum distance are queried
+    again as well.
+    */
+
+    //# Determine which floating features have to be queried again
+    const bool reuseNeighbours = _selectiveUpdate && _neighboursCached
+                                 && (size_t(_lastQueriedFeatures.rows()) == _numFloatingElements)
+                                 && (size_t(_neighbourIndices.rows()) == _numFloatingElements)
+                                 && (size_t(_neighbourIndices.cols()) == _numNeighbours);
+    _requeriedIndices.clear();
+    const bool bounded = (_maxDistance > 0.0f);
+    const float maxSquaredDistance = _maxDistance * _maxDistance;
+    if (reuseNeighbours) {
+        const float toleranceSquared = _requeryTolerance * _requeryTolerance;
+        for (size_t i = 0 ; i < _numFloatingElements ; i++) {
+            const float movementSquared = (_inFloatingFeatures.row(i) - _lastQueriedFeatures.row(i)).squaredNorm();
+            bool requery = (movementSquared > toleranceSquared * _queriedNearestSquaredDistances[i]);
+            //## The features that keep their neighbours get the distances to
+            //## them updated (they have moved); a neighbour beyond the maximum
+            //## distance (in the searched space) means a query again.
+            for (size_t j = 0 ; !requery && (j < _numNeighbours) ; j++) {
+                const int neighbourIndex = _neighbourIndices(i,j);
+                if (neighbourIndex < 0) { break;}
+                const FeatureVec difference = _inTargetFeatures.row(neighbourIndex) - _inFloatingFeatures.row(i);
+                _neighbourSquaredDistances(i,j) = difference.squaredNorm();
+                const float searchedSquaredDistance = _positionalSearch ? difference.head(3).squaredNorm()
+                                                                        : _neighbourSquaredDistances(i,j);
+                if (bounded && (searchedSquaredDistance > maxSquaredDistance)) { requery = true;}
+            }
+            if (requery) { _requeriedIndices.push_back(i);}
+        }
+    }
+
+    //# Query the kd-tree
+    if (!reuseNeighbours) {
+        //## All floating features
+        if (_positionalSearch) {
+            _update_positional_neighbours(NULL);
+        }
+        else {
+            _neighbourFinder.set_queried_points(_inFloatingFeatures);
+            _neighbourFinder.update();
+            _neighbourIndices = _neighbourFinder.get_indices();
+            _neighbourSquaredDistances = _neighbourFinder.get_distances();
+        }
+        _numRequeried = _numFloatingElements;
+        if (_selectiveUpdate) {
+            _lastQueriedFeatures = _inFloatingFeatures;
+            _queriedNearestSquaredDistances.resize(_numFloatingElements);
+            for (size_t i = 0 ; i < _numFloatingElements ; i++) {
+                _queriedNearestSquaredDistances[i] = (_neighbourIndices(i,0) < 0) ? 0.0f : _neighbourSquaredDistances(i,0);
+            }
+        }
+    }
+    else {
+        //## Only the floating features that moved too much
+        if (!_requeriedIndices.empty()) {
+            if (_positionalSearch) {
+                _update_positional_neighbours(&_requeriedIndices);
+            }
+            else {
+                _neighbourFinder.update_subset(_requeriedIndices);
+                const MatDynInt neighbourIndices = _neighbourFinder.get_indices();
+                const MatDynFloat neighbourSquaredDistances = _neighbourFinder.get_distances();
+                for (size_t q = 0 ; q < _requeriedIndices.size() ; q++) {
+                    const size_t i = _requeriedIndices[q];
+                    _neighbourIndices.row(i) = neighbourIndices.row(i);
+                    _neighbourSquaredDistances.row(i) = neighbourSquaredDistances.row(i);
+                }
+            }
+            for (size_t q = 0 ; q < _requeriedIndices.size() ; q++) {
+                const size_t i = _requeriedIndices[q];
+                _lastQueriedFeatures.row(i) = _inFloatingFeatures.row(i);
+                _queriedNearestSquaredDistances[i] = (_neighbourIndices(i,0) < 0) ? 0.0f : _neighbourSquaredDistances(i,0);
+            }
+        }
+        _numRequeried = _requeriedIndices.size();
+    }
+    _neighboursCached = true;
+}//end _update_neighbours()
+
+
+void CorrespondenceFilter::_update_surface_affinity() {
+    MESHMONK_TRACE_SCOPE("CorrespondenceFilter::surface_affinity");
+    MESHMONK_COUNT_STAGE("affinity", _numFloatingElements);
+    /*
+    # GOAL
+    For each element in _inFloatingFeatures, the closest point on the target
+    surface is known (a face and barycentric coordinates within that face).
+    The affinity links the floating element to the three vertices of that face.
+    Each affinity element is the barycentric coordinate of the vertex, weighted
+    in the same way as in _update_affinity() (one over the distance squared
+    and the orientation of the vertex), so that both modes produce affinities
+    of the same magnitude (important when fusing push and pull affinities).
+    */
+
+    //# Initialization
+    //## Initialize the sparse affinity matrix
+    _affinity = SparseMat(_numFloatingElements, _numTargetElements);
+    _affinity.reserve(3 * _numFloatingElements);
+    //## Initialize a vector of triplets which is used to insert elements into
+    //## the affinity matrix later.
+    std::vector<Triplet> affinityElements;
+    affinityElements.reserve(3 * _numFloatingElements);
+
+    //## Obtain the closest faces, barycentric coordinates and (squared) distances
+    const VecDynInt faceIndices = _surfaceFinder.get_face_indices();
+    const Vec3Mat barycentricCoordinates = _surfaceFinder.get_barycentric_coordinates();
+    const VecDynFloat squaredDistances = _surfaceFinder.get_distances();
+
+    //# Compute the affinity matrix
+    Vec3Float floatingNormal = Vec3Float::Zero();
+    Vec3Float targetNormal = Vec3Float::Zero();
+    for (size_t i = 0 ; i < _numFloatingElements ; i++) {
+        floatingNormal = _inFloatingFeatures.row(i).tail(3);
+
+        //## For numerical stability, check if the distance is very small
+        float distanceSquared = squaredDistances[i];
+        const float eps1 = 0.000001f;
+        if (distanceSquared < eps1) {distanceSquared = eps1;}
+
+        //## Loop over the corners of the closest face
+        const int faceIndex = faceIndices[i];
+        if (faceIndex < 0) { continue;} //no surface within the maximum distance
+        for (size_t c = 0 ; c < 3 ; c++) {
+            const float barycentricCoordinate = barycentricCoordinates(i,c);
+            if (barycentricCoordinate <= 0.0f) { continue;} //closest point lies on the opposite edge
+            const int vertexIndex = _inTargetFaces(faceIndex,c);
+
+            //### Compute the affinity element as barycentric/distance*distance
+            float affinityElement = barycentricCoordinate / distanceSquared;
+
+            //### Incorporate the orientation
+            targetNormal = _inTargetFeatures.row(vertexIndex).tail(3);
+            float dotProduct = floatingNormal.dot(targetNormal);
+            float orientationWeight = dotProduct / 2.0f + 0.5f;
+            affinityElement *= orientationWeight;
+
+            //### Check for numerical stability
+            const float eps2 = 0.0001f;
+            if (affinityElement < eps2) {affinityElement = eps2;}
+
+            //### Write result to the affinity triplet list
+            affinityElements.push_back(Triplet(i,vertexIndex,affinityElement));
+        }
+    }
+    //## Construct the sparse matrix with the computed element list
+    _affinity.setFromTriplets(affinityElements.begin(),
+                                affinityElements.end());
+
+    //# Normalize the rows of the affinity matrix
+    if (_normalizeAffinity) {
+        normalize_sparse_matrix(_affinity);
+    }
+}//end _update_surface_affinity()
+
+
+size_t CorrespondenceFilter::get_memory_usage() const {
+    size_t bytes = memory_usage(_affinity);
+    bytes += _neighbourFinder.get_memory_usage() + _positionFinder.get_memory_usage();
+    bytes += _surfaceFinder.get_memory_usage();
+    bytes += memory_usage(_floatingPositions) + memory_usage(_targetPositions);
+    bytes += memory_usage(_neighbourIndices) + memory_usage(_neighbourSquaredDistances);
+    bytes += memory_usage(_lastQueriedFeatures) + memory_usage(_queriedNearestSquaredDistances);
+    bytes += memory_usage(_requeriedIndices);
+    return bytes;
+}//end get_memory_usage()
+
+
 void CorrespondenceFilter::update() {
+    MESHMONK_TRACE_SCOPE("CorrespondenceFilter::update");
 
-    //# Update the neighbour indices and distances
-    _neighbourFinder.set_queried_points(_inFloatingFeatures);
-    _neighbourFinder.update();
+    if (_surfaceMatching && (_inTargetFaces.is_set())) {
+        //# Update the closest points on the target surface
+        if (_surfaceOutdated) {
+            _surfaceFinder.set_source_surface(_inTargetFeatures, _inTargetFaces);
+            _surfaceOutdated = false;
+        }
+        _surfaceFinder.set_queried_points(_inFloatingFeatures);
+        _surfaceFinder.update();
+
+        //# Update the (sparse) affinity matrix
+        _update_surface_affinity();
+    }
+    else {
+        if (_surfaceMatching) {
+            std::cerr << "Surface matching requested in CorrespondenceFilter, but no target faces were set!" << std::endl;
+            set_surface_matching(false);
+        }
+        //# Update the neighbour indices and distances
+        _update_neighbours();
 
-    //# Update the (sparse) affinity matrix
-    _update_affinity();
+        //# Update the (sparse) affinity matrix
+        _update_affinity();
+    }
 
-    if (_ioCorrespondingFeatures != NULL) {
+    if (_ioCorrespondingFeatures.is_set()) {
         //# Use the affinity weights to determine corresponding features and flags.
         if (_normalizeAffinity) {
             BaseCorrespondenceFilter::_affinity_to_correspondences();
@@ -8,6 +8,7 @@
 #include "NeighbourFinder.hpp"
 #include "helper_functions.hpp"
 #include "BaseCorrespondenceFilter.hpp"
+#include "BoundingVolumeHierarchy.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
@@ -17,6 +18,8 @@ typedef Eigen::SparseMatrix<float, 0, int> SparseMat;
 typedef Eigen::Triplet<float> Triplet;
 typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat;
 
 namespace registration {
 
@@ -40,6 +43,34 @@ class CorrespondenceFilter : public BaseCorrespondenceFilter
     -flagThreshold:
     threshold that the weighted corresponding flag needs to make in order to be flagged as 1.0.
     Otherwise, it receives flag 0.0f.
+    -surfaceMatching(=false):
+    instead of the k nearest target vertices, use the closest point on the
+    target surface (requires the target faces, see set_target_faces()). The
+    affinity then links each floating element to the three vertices of the
+    closest target face through the barycentric coordinates of that point, so
+    the corresponding features and flags are interpolated over the face.
+    -positionalSearch(=false):
+    instead of searching the k nearest neighbours in a 6-D kd-tree (positions
+    and normals), search numCandidates (=2*numNeighbours by default) nearest
+    neighbours in a 3-D kd-tree of the target positions and keep the k
+    candidates with the smallest combined score |dPosition|^2 + |dNormal|^2.
+    That score is the squared 6-D distance, so the result only differs from
+    the 6-D search when a 6-D neighbour is not among the positional candidates.
+    The normal components are poorly separated and hurt the pruning of the
+    6-D tree, so this is usually faster on densely sampled surfaces.
+    -maxDistance(=0.0):
+    if larger than zero, only target features closer than this distance (in
+    the searched space) are used. Floating features without any target
+    feature that close get no affinity elements and receive flag 0.0f.
+    -selectiveUpdate(=false), requeryTolerance(=0.1):
+    only query the floating features again that moved more than
+    requeryTolerance times the distance to their nearest target feature since
+    they were last queried. The others keep their (cached) neighbours, only
+    the distances to them and the affinity elements are recomputed. Floating
+    features without a neighbour (see maxDistance), and those of which a
+    cached neighbour moved beyond maxDistance, are always queried again. The
+    cache is cleared whenever the target input is set again. Not used in
+    surface matching mode.
 
     # OUTPUT
     -outCorrespondingFeatures
@@ -50,14 +81,23 @@ class CorrespondenceFilter : public BaseCorrespondenceFilter
         //CorrespondenceFilter(); //default constructor
         //~CorrespondenceFilter(); //destructor
 
-        void set_floating_input(const FeatureMat * const inFloatingFeatures,
-                                const VecDynFloat * const inFloatingFlags);
-        void set_target_input(const FeatureMat * const inTargetFeatures,
-                            const VecDynFloat * const inTargetFlags);
+        void set_floating_input(const ConstFeatureView &inFloatingFeatures,
+                                const ConstVecView &inFloatingFlags);
+        void set_target_input(const ConstFeatureView &inTargetFeatures,
+                            const ConstVecView &inTargetFlags);
         SparseMat get_affinity() const {return _affinity;}
         void set_parameters(const size_t numNeighbours,
                             const float flagThreshold);
         void set_affinity_normalization(const bool normalizeAffinity = true);
+        void set_target_faces(const ConstFacesView &inTargetFaces);
+        void set_surface_matching(const bool surfaceMatching = true);
+        void set_positional_search(const bool positionalSearch = true,
+                                   const size_t numCandidates = 0);
+        void set_max_distance(const float maxDistance);
+        void set_selective_update(const bool selectiveUpdate = true,
+                                  const float requeryTolerance = 0.1f);
+        size_t get_num_requeried() const { return _numRequeried;}
+        size_t get_memory_usage() const;
         void update();
 
     protected:
@@ -66,15 +106,50 @@ class CorrespondenceFilter : public BaseCorrespondenceFilter
 
         //# Internal Data structures
         NeighbourFinder<FeatureMat> _neighbourFinder;
+        NeighbourFinder<Vec3Mat> _positionFinder;
+        BoundingVolumeHierarchy _surfaceFinder;
+        //## Positions of the floating and target features (positional search)
+        Vec3Mat _floatingPositions;
+        Vec3Mat _targetPositions;
+        //## Neighbour indices and (squared) distances used for the affinity
+        MatDynInt _neighbourIndices;
+        MatDynFloat _neighbourSquaredDistances;
+
+        //# Inputs
+        ConstFacesView _inTargetFaces;
 
         //# Internal Parameters
         size_t _numAffinityElements = 0;
         //# Normalize affinity matrix
         bool _normalizeAffinity = true;
+        //# Match to the closest point on the target surface
+        bool _surfaceMatching = false;
+        bool _surfaceOutdated = true;
+        //# Search positions only and re-rank the candidates
+        bool _positionalSearch = false;
+        size_t _numCandidatesRequested = 0;
+        size_t _numCandidates = 6;
+        //# Only query the floating features again that moved
+        bool _selectiveUpdate = false;
+        float _requeryTolerance = 0.1f;
+        float _maxDistance = 0.0f;
+        bool _neighboursCached = false;
+        FeatureMat _lastQueriedFeatures;
+        VecDynFloat _queriedNearestSquaredDistances;
+        std::vector<size_t> _requeriedIndices;
+        size_t _numRequeried = 0;
 
         //# Internal Functions
         //## Function to update the sparse affinity matrix
         void _update_affinity();
+        //## Function to determine the number of positional candidates
+        void _update_num_candidates();
+        //## Function to find the neighbours (of all or only the moved elements)
+        void _update_neighbours();
+        //## Function to find the neighbours with the positional search
+        void _update_positional_neighbours(const std::vector<size_t> * const queriedIndices);
+        //## Function to update the sparse affinity matrix in surface matching mode
+        void _update_surface_affinity();
         //## Function to convert the sparse affinity weights into corresponding
         //## features and flags
         void _affinity_to_correspondences();
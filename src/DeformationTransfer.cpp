@@ -0,0 +1,148 @@
+#include "DeformationTransfer.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "NeighbourFinder.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace registration {
+
+
+void DeformationTransfer::set_input(const ConstFeatureView &inProxyFeatures,
+                                    const ConstFacesView &inProxyFaces,
+                                    const ConstFeatureView &inBoundFeatures){
+    _inProxyFeatures.reset(inProxyFeatures);
+    _inProxyFaces.reset(inProxyFaces);
+    _inBoundFeatures.reset(inBoundFeatures);
+    _numProxyElements = _inProxyFeatures.rows();
+    _numBoundElements = _inBoundFeatures.rows();
+}//end set_input()
+
+
+void DeformationTransfer::set_parameters(const float maxDistance, const size_t numNeighbours){
+    _maxDistance = (maxDistance > 0.0f) ? maxDistance : 0.0f;
+    _numNeighbours = numNeighbours;
+    if (_numNeighbours < 1) { _numNeighbours = 1;}
+}//end set_parameters()
+
+
+void DeformationTransfer::update(){
+    MESHMONK_TRACE_SCOPE("DeformationTransfer::update");
+    //# Safety check
+    if ((!_inProxyFeatures.is_set()) || (!_inBoundFeatures.is_set()) || (_numProxyElements == 0)) {
+        std::cerr << "DeformationTransfer needs a proxy with at least one vertex and a mesh to bind!" << std::endl;
+        _binding = RowSparseMat(_numBoundElements, _numProxyElements);
+        return;
+    }
+    std::vector<Eigen::Triplet<float, int> > bindingElements;
+    bindingElements.reserve(_numBoundElements * 3);
+
+    //# Closest points on the proxy surface (barycentric weights)
+    std::vector<size_t> fallbackIndices;
+    if ((_inProxyFaces.is_set()) && (_inProxyFaces.rows() > 0)) {
+        BoundingVolumeHierarchy surfaceFinder;
+        surfaceFinder.set_source_surface(_inProxyFeatures, _inProxyFaces);
+        surfaceFinder.set_queried_points(_inBoundFeatures);
+        surfaceFinder.set_max_distance(_maxDistance);
+        surfaceFinder.update();
+        const VecDynInt faceIndices = surfaceFinder.get_face_indices();
+        const Vec3Mat barycentricCoordinates = surfaceFinder.get_barycentric_coordinates();
+        for (size_t i = 0 ; i < _numBoundElements ; i++) {
+            const int faceIndex = faceIndices[i];
+            if (faceIndex < 0) {
+                fallbackIndices.push_back(i);
+                continue;
+            }
+            for (size_t c = 0 ; c < 3 ; c++) {
+                //## Skip the corners without weight (closest point on an edge or corner)
+                if (barycentricCoordinates(i,c) <= 0.0f) { continue;}
+                bindingElements.push_back(Eigen::Triplet<float, int>(int(i), _inProxyFaces(faceIndex,c),
+                                                                     barycentricCoordinates(i,c)));
+            }
+        }
+    }
+    else {
+        for (size_t i = 0 ; i < _numBoundElements ; i++) { fallbackIndices.push_back(i);}
+    }
+
+    //# Vertices far from the proxy surface: 1/d^2 weights of the nearest
+    //# proxy vertices, lowered for opposite normals (as in the ScaleShifter)
+    _numFallbackVertices = fallbackIndices.size();
+    if (_numFallbackVertices > 0) {
+        FeatureMat fallbackFeatures(_numFallbackVertices, NUM_FEATURES);
+        for (size_t i = 0 ; i < _numFallbackVertices ; i++) {
+            fallbackFeatures.row(i) = _inBoundFeatures.row(fallbackIndices[i]);
+        }
+        const size_t numNeighbours = std::min(_numNeighbours, _numProxyElements);
+        NeighbourFinder<FeatureMat> neighbourFinder;
+        neighbourFinder.set_source_points(_inProxyFeatures);
+        neighbourFinder.set_queried_points(&fallbackFeatures);
+        neighbourFinder.set_parameters(numNeighbours);
+        neighbourFinder.update();
+        const MatDynInt neighbourIndices = neighbourFinder.get_indices();
+        const MatDynFloat neighbourSquaredDistances = neighbourFinder.get_distances();
+
+        std::vector<float> weights(numNeighbours);
+        for (size_t i = 0 ; i < _numFallbackVertices ; i++) {
+            float sumWeights = 0.0f;
+            for (size_t j = 0 ; j < numNeighbours ; j++) {
+                //## For numerical stability, check if the distance is very small
+                const float distanceSquared = std::max(neighbourSquaredDistances(i,j), 0.000001f);
+                const float orientationWeight = 0.5f * fallbackFeatures.block<1,3>(i,3).dot(
+                                                    _inProxyFeatures.block<1,3>(neighbourIndices(i,j),3)) + 0.5f;
+                weights[j] = std::max(orientationWeight / distanceSquared, 0.0001f);
+                sumWeights += weights[j];
+            }
+            for (size_t j = 0 ; j < numNeighbours ; j++) {
+                bindingElements.push_back(Eigen::Triplet<float, int>(int(fallbackIndices[i]), neighbourIndices(i,j),
+                                                                     weights[j] / sumWeights));
+            }
+        }
+    }
+
+    //# Assemble the binding (duplicate entries are summed)
+    _binding = RowSparseMat(_numBoundElements, _numProxyElements);
+    _binding.setFromTriplets(bindingElements.begin(), bindingElements.end());
+    _binding.makeCompressed();
+}//end update()
+
+
+bool DeformationTransfer::apply(const Vec3Mat &inProxyDisplacements, Vec3Mat &outBoundDisplacements) const{
+    MESHMONK_TRACE_SCOPE("DeformationTransfer::apply");
+    if (inProxyDisplacements.rows() != _binding.cols()) {
+        std::cerr << "DeformationTransfer::apply(): the displacement field has " << inProxyDisplacements.rows()
+                  << " rows, but the proxy has " << _binding.cols() << " vertices." << std::endl;
+        return false;
+    }
+    //# One sparse product, parallel over the rows (each row of the result only
+    //# depends on one row of the binding)
+    outBoundDisplacements.resize(_binding.rows(), 3);
+    const int * const offsets = _binding.outerIndexPtr();
+    const int * const indices = _binding.innerIndexPtr();
+    const float * const weights = _binding.valuePtr();
+    #pragma omp parallel for schedule(static, 256)
+    for (long i = 0 ; i < long(_binding.rows()) ; i++) {
+        Vec3Float displacement = Vec3Float::Zero();
+        for (int e = offsets[i] ; e < offsets[i+1] ; e++) {
+            displacement += weights[e] * inProxyDisplacements.row(indices[e]).transpose();
+        }
+        outBoundDisplacements.row(i) = displacement.transpose();
+    }
+    return true;
+}//end apply()
+
+
+bool DeformationTransfer::transfer(const ConstFeatureView &inRegisteredProxyFeatures, FeatureView ioBoundFeatures) const{
+    if ((!_inProxyFeatures.is_set()) || (inRegisteredProxyFeatures.rows() != _inProxyFeatures.rows())
+        || (ioBoundFeatures.rows() != _binding.rows())) {
+        std::cerr << "DeformationTransfer::transfer(): the registered proxy or the bound mesh doesn't match the binding." << std::endl;
+        return false;
+    }
+    const Vec3Mat proxyDisplacements = inRegisteredProxyFeatures.leftCols(3) - _inProxyFeatures.leftCols(3);
+    Vec3Mat boundDisplacements;
+    if (!apply(proxyDisplacements, boundDisplacements)) { return false;}
+    ioBoundFeatures.leftCols(3) += boundDisplacements;
+    return true;
+}//end transfer()
+
+}//namespace registration
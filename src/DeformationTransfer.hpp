@@ -0,0 +1,107 @@
+#ifndef DEFORMATIONTRANSFER_HPP
+#define DEFORMATIONTRANSFER_HPP
+
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+#include <iostream>
+#include "../global.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::SparseMatrix<float, Eigen::RowMajor, int> RowSparseMat;
+
+namespace registration {
+
+class DeformationTransfer
+{
+    /*
+    # GOAL
+    Transfer the deformation of a registered (low resolution) proxy mesh to
+    another mesh of the same shape, e.g. the high resolution or differently
+    tessellated version of the template the proxy was decimated from, or a
+    texture-mapped variant of it. Unlike the ScaleShifter, the two meshes don't
+    have to come from the same decimation.
+
+    update() binds each vertex of the bound mesh to the proxy once: a vertex
+    gets the barycentric coordinates of its closest point on the proxy surface
+    (found with a BoundingVolumeHierarchy). Vertices farther than maxDistance
+    from the proxy surface (or all of them, if the proxy has no faces) get
+    1/d^2 weights of their k nearest proxy vertices instead, like the new
+    nodes of the ScaleShifter. The binding is a sparse matrix (one row per
+    bound vertex, one column per proxy vertex, rows sum to one), so any
+    displacement field of the proxy is transferred with one sparse product,
+    which apply() computes in parallel over the rows.
+
+    # INPUTS
+    -inProxyFeatures: the proxy before registration (in the same space as
+    the bound mesh)
+    -inProxyFaces: may be empty (then only the k-nn weights are used)
+    -inBoundFeatures: the mesh to bind to the proxy
+
+    # PARAMETERS
+    -maxDistance(=0.0): vertices farther from the proxy surface than this use
+    the k-nn weights. Zero binds every vertex to the surface.
+    -numNeighbours(=3): number of proxy vertices of the k-nn weights.
+
+    # OUTPUT
+    -binding (get_binding()), which can be kept and set again with
+    set_binding() to transfer the registrations of many scans.
+
+    # USAGE
+    DeformationTransfer transfer;
+    transfer.set_input(&proxyFeatures, &proxyFaces, &highFeatures);
+    transfer.update();
+    (register proxyFeatures, giving registeredProxyFeatures)
+    transfer.transfer(registeredProxyFeatures, highFeatures);
+    (or transfer.apply(proxyDisplacements, highDisplacements) for any field)
+    */
+
+    public:
+        void set_input(const ConstFeatureView &inProxyFeatures,
+                       const ConstFacesView &inProxyFaces,
+                       const ConstFeatureView &inBoundFeatures);
+        void set_parameters(const float maxDistance = 0.0f, const size_t numNeighbours = 3);
+        void update();
+
+        //## The binding (number of bound vertices x number of proxy vertices)
+        RowSparseMat get_binding() const { return _binding;}
+        void set_binding(const RowSparseMat &binding) { _binding = binding; _binding.makeCompressed();}
+        //## Number of vertices that were bound with the k-nn weights
+        size_t get_num_fallback_vertices() const { return _numFallbackVertices;}
+        size_t get_memory_usage() const { return memory_usage(_binding);}
+
+        //## Transfer a displacement field of the proxy to the bound mesh
+        bool apply(const Vec3Mat &inProxyDisplacements, Vec3Mat &outBoundDisplacements) const;
+        //## Move the bound mesh along with the registered proxy (the
+        //## proxy of set_input() is the unregistered one; the normals of
+        //## ioBoundFeatures are left as they are)
+        bool transfer(const ConstFeatureView &inRegisteredProxyFeatures, FeatureView ioBoundFeatures) const;
+
+    protected:
+
+    private:
+        //# Inputs
+        ConstFeatureView _inProxyFeatures;
+        ConstFacesView _inProxyFaces;
+        ConstFeatureView _inBoundFeatures;
+
+        //# User parameters
+        float _maxDistance = 0.0f;
+        size_t _numNeighbours = 3;
+
+        //# Internal data structures
+        RowSparseMat _binding;
+
+        //# Internal parameters
+        size_t _numProxyElements = 0;
+        size_t _numBoundElements = 0;
+        size_t _numFallbackVertices = 0;
+};
+
+}//namespace registration
+
+#endif // DEFORMATIONTRANSFER_HPP
@@ -1,16 +1,18 @@
 #include "Downsampler.hpp"
+#include "Tracer.hpp"
+#include <cmath>
 
 
 namespace registration {
 
 
 
-void Downsampler::set_input(const FeatureMat * const inFeatures,
-                            const FacesMat * const inFaces,
-                            const VecDynFloat * const inFlags){
-    _inFeatures = inFeatures;
-    _inFaces = inFaces;
-    _inFlags = inFlags;
+void Downsampler::set_input(const ConstFeatureView &inFeatures,
+                            const ConstFacesView &inFaces,
+                            const ConstVecView &inFlags){
+    _inFeatures.reset(inFeatures);
+    _inFaces.reset(inFaces);
+    _inFlags.reset(inFlags);
 
 }//end set_input()
 
@@ -41,11 +43,12 @@ void Downsampler::set_output(FeatureMat &outFeatures,
 
 
 void Downsampler::update(){
+    MESHMONK_TRACE_SCOPE("Downsampler::update");
     //# Convert the input data to OpenMesh's mesh structure
     TriMesh mesh;
-    convert_matrices_to_mesh(*_inFeatures,
-                            *_inFaces,
-                            *_inFlags,
+    convert_matrices_to_mesh(_inFeatures,
+                            _inFaces,
+                            _inFlags,
                             mesh);
 
     //# Add the original indices as a custom property to each vertex
@@ -144,4 +147,14 @@ void Downsampler::update(){
 }
 
 
+float pyramid_downsample_ratio(const float start, const float end,
+                               const size_t layer, const size_t numLayers){
+    float downsampleRatio = start;
+    if (numLayers > 1) {
+        downsampleRatio = float(std::round(start - layer * std::round((start-end)/(numLayers-1.0))));
+    }
+    return downsampleRatio / 100.0f;
+}//end pyramid_downsample_ratio()
+
+
 }//namespace registration
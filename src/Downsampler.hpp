@@ -10,6 +10,7 @@
 #include <OpenMesh/Tools/Decimater/ModQuadricT.hh>
 #include "../global.hpp"
 #include "helper_functions.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::Vector3f Vec3Float;
 typedef Eigen::VectorXf VecDynFloat;
@@ -27,9 +28,9 @@ class Downsampler
 {
     public:
 
-        void set_input(const FeatureMat * const inFeatures,
-                       const FacesMat * const inFaces,
-                       const VecDynFloat * const inFlags);
+        void set_input(const ConstFeatureView &inFeatures,
+                       const ConstFacesView &inFaces,
+                       const ConstVecView &inFlags);
         void set_output(FeatureMat &outFeatures,
                         FacesMat &outFaces,
                         VecDynFloat &outFlags,
@@ -44,9 +45,9 @@ class Downsampler
 
     private:
         //# Inputs
-        const FeatureMat * _inFeatures = NULL;
-        const FacesMat * _inFaces = NULL;
-        const VecDynFloat * _inFlags = NULL;
+        ConstFeatureView _inFeatures;
+        ConstFacesView _inFaces;
+        ConstVecView _inFlags;
 
         //# Outputs
         FeatureMat * _outFeatures = NULL;
@@ -65,6 +66,11 @@ class Downsampler
         //# Internal functions
 };
 
+//# Downsample ratio (between 0.0 and 1.0) of pyramid layer 'layer' out of
+//# numLayers, going linearly from start to end (percentages)
+float pyramid_downsample_ratio(const float start, const float end,
+                               const size_t layer, const size_t numLayers);
+
 }//namespace registration
 
 #endif // DOWNSAMPLER_HPP
@@ -0,0 +1,188 @@
+#include "IncrementalNormalUpdater.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace registration {
+
+void IncrementalNormalUpdater::set_input(const ConstFacesView &inFaces){
+    _inFaces.reset(inFaces);
+    _numFaces = (_inFaces.is_set()) ? _inFaces.rows() : 0;
+    _adjacencyOutdated = true;
+    _initialised = false;
+}//end set_input()
+
+
+void IncrementalNormalUpdater::set_output(const FeatureView &ioFeatures){
+    _ioFeatures.reset(ioFeatures);
+    if (size_t(_ioFeatures.rows()) != _numVertices) { _adjacencyOutdated = true;}
+    _numVertices = _ioFeatures.rows();
+    _initialised = false;
+}//end set_output()
+
+
+void IncrementalNormalUpdater::set_parameters(const float threshold, const float maxDirtyFraction){
+    _threshold = (threshold > 0.0f) ? threshold : 0.0f;
+    _maxDirtyFraction = maxDirtyFraction;
+}//end set_parameters()
+
+
+void IncrementalNormalUpdater::_build_adjacency(){
+    //# Count the faces of each vertex, then fill them in (compressed rows)
+    _adjacencyOffsets = VecDynInt::Zero(_numVertices + 1);
+    for (size_t f = 0 ; f < _numFaces ; f++) {
+        for (size_t c = 0 ; c < 3 ; c++) { _adjacencyOffsets[_inFaces(f,c) + 1]++;}
+    }
+    for (size_t i = 0 ; i < _numVertices ; i++) { _adjacencyOffsets[i+1] += _adjacencyOffsets[i];}
+    _adjacentFaces.resize(_adjacencyOffsets[_numVertices]);
+    VecDynInt positions = _adjacencyOffsets.head(_numVertices);
+    for (size_t f = 0 ; f < _numFaces ; f++) {
+        for (size_t c = 0 ; c < 3 ; c++) { _adjacentFaces[positions[_inFaces(f,c)]++] = int(f);}
+    }
+
+    _faceNormals = Vec3Mat::Zero(_numFaces, 3);
+    _faceStamps.assign(_numFaces, 0);
+    _vertexStamps.assign(_numVertices, 0);
+    _stamp = 0;
+    _adjacencyOutdated = false;
+}//end _build_adjacency()
+
+
+void IncrementalNormalUpdater::_next_stamp(){
+    //# Reset the stamps before they overflow
+    if (_stamp == std::numeric_limits<int>::max()) {
+        std::fill(_faceStamps.begin(), _faceStamps.end(), 0);
+        std::fill(_vertexStamps.begin(), _vertexStamps.end(), 0);
+        _stamp = 0;
+    }
+    _stamp++;
+}//end _next_stamp()
+
+
+void IncrementalNormalUpdater::_compute_face_normal(const int face){
+    const Eigen::Vector3f p0 = _ioFeatures.row(_inFaces(face,0)).head(3);
+    const Eigen::Vector3f p1 = _ioFeatures.row(_inFaces(face,1)).head(3);
+    const Eigen::Vector3f p2 = _ioFeatures.row(_inFaces(face,2)).head(3);
+    Eigen::Vector3f normal = (p1 - p0).cross(p2 - p0);
+    const float norm = normal.norm();
+    if (norm > 0.0f) { normal /= norm;}
+    _faceNormals.row(face) = normal;
+}//end _compute_face_normal()
+
+
+Eigen::Vector3f IncrementalNormalUpdater::_compute_vertex_normal(const int vertex){
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    for (int a = _adjacencyOffsets[vertex] ; a < _adjacencyOffsets[vertex+1] ; a++) {
+        normal += _faceNormals.row(_adjacentFaces[a]);
+    }
+    const float norm = normal.norm();
+    if (norm > 0.0f) { normal *= _orientation / norm;}
+    const Eigen::Vector3f change = normal - _ioFeatures.row(vertex).tail(3).transpose();
+    _ioFeatures.row(vertex).tail(3) = normal;
+    return change;
+}//end _compute_vertex_normal()
+
+
+void IncrementalNormalUpdater::_keep_orientation(const Eigen::Vector3d &normalSumBefore){
+    if (normalSumBefore.dot(_normalSum) >= 0.0) { return;}
+    //# The average normal reversed: flip all normals back, and keep flipping
+    //# the normals computed from the (unflipped) face normals
+    _orientation = -_orientation;
+    _ioFeatures.rightCols(3) *= -1.0f;
+    _normalSum = -_normalSum;
+}//end _keep_orientation()
+
+
+void IncrementalNormalUpdater::_update_all(){
+    //# Average normal before the update (as update_normals_safely())
+    const Eigen::Vector3d normalSumBefore = _ioFeatures.rightCols(3).colwise().sum().transpose().cast<double>();
+    _orientation = 1.0f;
+
+    #pragma omp parallel for
+    for (long f = 0 ; f < long(_numFaces) ; f++) { _compute_face_normal(int(f));}
+    #pragma omp parallel for
+    for (long i = 0 ; i < long(_numVertices) ; i++) { _compute_vertex_normal(int(i));}
+
+    _normalSum = _ioFeatures.rightCols(3).colwise().sum().transpose().cast<double>();
+    _keep_orientation(normalSumBefore);
+    _lastPositions = _ioFeatures.leftCols(3);
+    _numUpdatedFaces = _numFaces;
+    _numUpdatedVertices = _numVertices;
+}//end _update_all()
+
+
+void IncrementalNormalUpdater::_update_dirty(){
+    //# Dirty vertices: moved more than the threshold since their normals were
+    //# last recomputed
+    const float squaredThreshold = _threshold * _threshold;
+    _dirtyVertices.clear();
+    for (size_t i = 0 ; i < _numVertices ; i++) {
+        const float squaredDisplacement = (_ioFeatures.row(i).head(3) - _lastPositions.row(i)).squaredNorm();
+        if ((squaredDisplacement > squaredThreshold)
+            || ((_threshold == 0.0f) && (squaredDisplacement > 0.0f))) {
+            _dirtyVertices.push_back(int(i));
+        }
+    }
+    if (_dirtyVertices.empty()) {
+        _numUpdatedFaces = 0;
+        _numUpdatedVertices = 0;
+        return;
+    }
+    if (float(_dirtyVertices.size()) > _maxDirtyFraction * float(_numVertices)) {
+        _update_all();
+        return;
+    }
+
+    //# Faces touching a dirty vertex get a new face normal
+    _next_stamp();
+    _dirtyFaces.clear();
+    for (size_t d = 0 ; d < _dirtyVertices.size() ; d++) {
+        const int vertex = _dirtyVertices[d];
+        for (int a = _adjacencyOffsets[vertex] ; a < _adjacencyOffsets[vertex+1] ; a++) {
+            const int face = _adjacentFaces[a];
+            if (_faceStamps[face] != _stamp) {
+                _faceStamps[face] = _stamp;
+                _dirtyFaces.push_back(face);
+            }
+        }
+        _lastPositions.row(vertex) = _ioFeatures.row(vertex).head(3);
+    }
+    #pragma omp parallel for
+    for (long f = 0 ; f < long(_dirtyFaces.size()) ; f++) { _compute_face_normal(_dirtyFaces[f]);}
+
+    //# The vertices of those faces (one-rings of the dirty vertices) get a
+    //# new vertex normal. The change of the normal sum is accumulated to
+    //# check the orientation.
+    const Eigen::Vector3d normalSumBefore = _normalSum;
+    _numUpdatedVertices = 0;
+    for (size_t f = 0 ; f < _dirtyFaces.size() ; f++) {
+        for (size_t c = 0 ; c < 3 ; c++) {
+            const int vertex = _inFaces(_dirtyFaces[f], c);
+            if (_vertexStamps[vertex] == _stamp) { continue;}
+            _vertexStamps[vertex] = _stamp;
+            _normalSum += _compute_vertex_normal(vertex).cast<double>();
+            _numUpdatedVertices++;
+        }
+    }
+    _numUpdatedFaces = _dirtyFaces.size();
+    _keep_orientation(normalSumBefore);
+}//end _update_dirty()
+
+
+void IncrementalNormalUpdater::update(){
+    MESHMONK_TRACE_SCOPE("IncrementalNormalUpdater::update");
+    if ((!_inFaces.is_set()) || (!_ioFeatures.is_set())) {
+        std::cerr << "IncrementalNormalUpdater::update() called without faces or features!" << std::endl;
+        return;
+    }
+    if (_adjacencyOutdated) { _build_adjacency();}
+    if (!_initialised) {
+        _update_all();
+        _initialised = true;
+        return;
+    }
+    _update_dirty();
+}//end update()
+
+}//namespace registration
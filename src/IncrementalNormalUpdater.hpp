@@ -0,0 +1,124 @@
+#ifndef INCREMENTALNORMALUPDATER_HPP
+#define INCREMENTALNORMALUPDATER_HPP
+
+#include <Eigen/Dense>
+#include <vector>
+#include "../global.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+
+namespace registration {
+
+class IncrementalNormalUpdater
+{
+    /*
+    # GOAL
+    Update the vertex normals (last three columns of the features) after the
+    positions (first three columns) changed, but only where they changed. A
+    vertex is dirty if it moved more than 'threshold' since its normals were
+    last recomputed. Only the faces touching a dirty vertex get a new face
+    normal, and only the vertices of those faces (the one-rings of the dirty
+    vertices) get a new vertex normal. The vertex-face adjacency and the face
+    normals are cached between updates.
+
+    The normals are computed as OpenMesh does (update_normals()): normalised
+    face normals, summed over the faces of a vertex and normalised.
+
+    Like update_normals_safely(), the average normal is compared before and
+    after the update: if it flipped, all normals are flipped back.
+
+    # INPUTS
+    -inFaces
+
+    # PARAMETERS
+    -threshold(=0.01): displacement (in the units of the positions) above
+    which a vertex is dirty. Zero recomputes every face touching a vertex
+    that moved at all.
+    -maxDirtyFraction(=0.5): if more than this fraction of the vertices is
+    dirty, all normals are recomputed (a full update is cheaper then).
+
+    # OUTPUT
+    -ioFeatures: positions are read, normals are written.
+    */
+
+    public:
+        void set_input(const ConstFacesView &inFaces);
+        void set_output(const FeatureView &ioFeatures);
+        void set_parameters(const float threshold = 0.01f, const float maxDirtyFraction = 0.5f);
+        //## Recompute all normals at the next update (e.g. after the positions
+        //## were changed elsewhere)
+        void invalidate() { _initialised = false;}
+        void update();
+
+        //## Statistics of the last update
+        size_t get_num_updated_faces() const { return _numUpdatedFaces;}
+        size_t get_num_updated_vertices() const { return _numUpdatedVertices;}
+        //## Bytes held by the adjacency, the face normals and the positions
+        size_t get_memory_usage() const {
+            return memory_usage(_adjacencyOffsets) + memory_usage(_adjacentFaces)
+                   + memory_usage(_faceNormals) + memory_usage(_lastPositions)
+                   + memory_usage(_dirtyVertices) + memory_usage(_dirtyFaces)
+                   + memory_usage(_faceStamps) + memory_usage(_vertexStamps);
+        }
+
+    protected:
+
+    private:
+        //# Inputs
+        ConstFacesView _inFaces;
+
+        //# Outputs
+        FeatureView _ioFeatures;
+
+        //# User parameters
+        float _threshold = 0.01f;
+        float _maxDirtyFraction = 0.5f;
+
+        //# Internal data structures
+        //## Vertex-face adjacency (compressed rows): the faces of vertex i are
+        //## _adjacentFaces[_adjacencyOffsets[i] .. _adjacencyOffsets[i+1]-1]
+        VecDynInt _adjacencyOffsets;
+        VecDynInt _adjacentFaces;
+        //## Face normals and the positions at which the vertex normals were
+        //## last recomputed
+        Vec3Mat _faceNormals;
+        Vec3Mat _lastPositions;
+        //## Work lists, and stamps to mark each face/vertex once per update
+        std::vector<int> _dirtyVertices;
+        std::vector<int> _dirtyFaces;
+        std::vector<int> _faceStamps;
+        std::vector<int> _vertexStamps;
+        int _stamp = 0;
+
+        //# Internal parameters
+        size_t _numVertices = 0;
+        size_t _numFaces = 0;
+        bool _initialised = false;
+        bool _adjacencyOutdated = true;
+        //## -1.0f once the normals were flipped to keep their orientation
+        float _orientation = 1.0f;
+        //## Sum of the vertex normals (to detect flips)
+        Eigen::Vector3d _normalSum = Eigen::Vector3d::Zero();
+        size_t _numUpdatedFaces = 0;
+        size_t _numUpdatedVertices = 0;
+
+        //# Internal functions
+        void _build_adjacency();
+        void _compute_face_normal(const int face);
+        //## Sets the vertex normal and returns the change of the normal
+        Eigen::Vector3f _compute_vertex_normal(const int vertex);
+        void _update_all();
+        void _update_dirty();
+        void _next_stamp();
+        //## Flip all normals if the average normal reversed
+        void _keep_orientation(const Eigen::Vector3d &normalSumBefore);
+};
+
+}//namespace registration
+
+#endif // INCREMENTALNORMALUPDATER_HPP
@@ -1,23 +1,27 @@
 #include "InlierDetector.hpp"
+#include "Tracer.hpp"
+#include "ParallelReduction.hpp"
+#include <cmath>
+#include <limits>
 
 namespace registration {
 
-void InlierDetector::set_input(const FeatureMat * const inFeatures,
-                        const FeatureMat * const inCorrespondingFeatures,
-                        const VecDynFloat * const inCorrespondingFlags)
+void InlierDetector::set_input(const ConstFeatureView &inFeatures,
+                        const ConstFeatureView &inCorrespondingFeatures,
+                        const ConstVecView &inCorrespondingFlags)
 {
     //# Set input
-    _inFeatures = inFeatures;
-    _inCorrespondingFeatures = inCorrespondingFeatures;
-    _inCorrespondingFlags = inCorrespondingFlags;
+    _inFeatures.reset(inFeatures);
+    _inCorrespondingFeatures.reset(inCorrespondingFeatures);
+    _inCorrespondingFlags.reset(inCorrespondingFlags);
 
     //# Update internal variables
-    _numElements = _inFeatures->rows();
+    _numElements = _inFeatures.rows();
 }
 
-void InlierDetector::set_output(VecDynFloat * const ioProbability)
+void InlierDetector::set_output(const VecView &ioProbability)
 {
-    _ioProbability = ioProbability;
+    _ioProbability.reset(ioProbability);
 }
 
 void InlierDetector::set_parameters(const float kappa, const bool useOrientation)
@@ -26,9 +30,23 @@ void InlierDetector::set_parameters(const float kappa, const bool useOrientation
     _useOrientation = useOrientation;
 }
 
+void InlierDetector::set_initial_weights(const ConstVecView &inInitialWeights)
+{
+    _inInitialWeights.reset(inInitialWeights);
+}
+
+void InlierDetector::set_trimming(const float trimFraction, const float trimRamp)
+{
+    _trimFraction = std::min(std::max(trimFraction, 0.0f), 1.0f);
+    _trimRamp = std::max(trimRamp, 0.0f);
+    if ((trimFraction < 0.0f) || (trimFraction > 1.0f) || (trimRamp < 0.0f)) {
+        std::cerr << "The trimming fraction should be in [0,1] and its ramp can't be negative!" << std::endl;
+    }
+}
+
 
 void InlierDetector::_determine_neighbours(){
-    Vec3Mat floatingPositions = _inFeatures->leftCols(3);
+    Vec3Mat floatingPositions = _inFeatures.leftCols(3);
     _neighbourFinder.set_source_points(&floatingPositions);
     _neighbourFinder.set_queried_points(&floatingPositions);
     _neighbourFinder.set_parameters(_numNeighbours);
@@ -87,7 +105,7 @@ void InlierDetector::_smooth_inlier_weights(){
     //## Start iterative loop
     for (size_t it = 0 ; it < _numSmoothingPasses ; it++){
         //## Copy the inlier weights into a temporary variable.
-        tempInlierWeights = (*_ioProbability);
+        tempInlierWeights = _ioProbability;
 
         //## Loop over the nodes
         for (size_t i = 0 ; i < _numElements ; i++) {
@@ -109,15 +127,91 @@ void InlierDetector::_smooth_inlier_weights(){
 
             //## Determine the weighted average inlier weight by dividing by the sum of smoothing weights.
             inlierWeightAvg /= sumSmoothingWeights; //smoothing weights are already normalized, so this should be redundant.
-            (*_ioProbability)[i] = inlierWeightAvg;
+            _ioProbability[i] = inlierWeightAvg;
         }
 
         //# Multiply the resulting inlier weights with the deterministic corresponding flags again!
-        (*_ioProbability) *= (*_inCorrespondingFlags);
+        _ioProbability *= _inCorrespondingFlags;
     }
 }//end _smooth_inlier_weights()
 
+void InlierDetector::_update_gaussian_weights(const ConstVecView &inSeedWeights){
+    //## Sum of the numerator (first) and denominator (second element) of sigma
+    //## (of the first estimate, the residuals are weighted by the seed
+    //## weights, if given)
+    Eigen::Vector2f sigmaSums = parallel_sum(_numElements, Eigen::Vector2f(Eigen::Vector2f::Zero()),
+        [&](const size_t i) {
+            const float weight = (inSeedWeights.is_set()) ? _ioProbability[i] * inSeedWeights[i]
+                                                         : _ioProbability[i];
+            return Eigen::Vector2f(weight * _squaredDistances[i], weight);
+        });
+    if ((inSeedWeights.is_set()) && !(sigmaSums[1] > 0.0f)) {
+        //## No previous inliers left: start from the flags alone
+        sigmaSums = parallel_sum(_numElements, Eigen::Vector2f(Eigen::Vector2f::Zero()),
+            [&](const size_t i) {
+                return Eigen::Vector2f(_ioProbability[i] * _squaredDistances[i], _ioProbability[i]);
+            });
+    }
+    const float numDistanceBasedIterations = 10;
+    for (size_t it = 0 ; it < numDistanceBasedIterations ; it++) {
+        //## Re-calculate the parameters sigma and lambda
+        float sigmaa = 0.0;
+        float lambdaa = 0.0;
+        const float sigmaNumerator = sigmaSums[0];
+        const float sigmaDenominator = sigmaSums[1];
+        //### sigma and lambda
+        sigmaa = std::sqrt(sigmaNumerator/sigmaDenominator);
+        if (sigmaa < _minimalSigma) {sigmaa = _minimalSigma;}
+        else if (sigmaa > _maximalSigma) {sigmaa = _maximalSigma;}
+
+        lambdaa = 1.0/(std::sqrt(2.0 * 3.14159) * sigmaa) * std::exp(-0.5 * _kappa * _kappa);
+
+        //## Recalculate the distance-based probabilities. The sums for the
+        //## next sigma are accumulated in the same pass.
+        sigmaSums = parallel_sum(_numElements, Eigen::Vector2f(Eigen::Vector2f::Zero()),
+            [&](const size_t i) {
+                //### Compute probability
+                float probability = 1.0/(std::sqrt(2.0 * 3.14159) * sigmaa) * std::exp(-0.5 * _squaredDistances[i] / std::pow(sigmaa, 2.0));
+                probability /= (probability + lambdaa);
+                _ioProbability[i] *= probability;
+
+                return Eigen::Vector2f(_ioProbability[i] * _squaredDistances[i], _ioProbability[i]);
+            });
+    }
+}//end _update_gaussian_weights()
+
+
+void InlierDetector::_update_trimmed_weights(){
+    //# Trimming threshold: the largest squared distance of the kept fraction
+    //## of the candidates (elements that aren't flagged out)
+    const float infinity = std::numeric_limits<float>::infinity();
+    const size_t numCandidates = parallel_sum(_numElements, size_t(0), [&](const size_t i) {
+        return size_t(_ioProbability[i] > 0.0f);
+    });
+    if (numCandidates == 0) { return;}
+    const size_t numKept = std::max(size_t(1), size_t(std::ceil(_trimFraction * numCandidates)));
+    if (numKept >= numCandidates) { return;}
+    const float thresholdSquared = parallel_nth_value(_numElements, numKept - 1, [&](const size_t i) {
+        return (_ioProbability[i] > 0.0f) ? _squaredDistances[i] : infinity;
+    });
+
+    //# Weights: 1 up to the threshold, then a linear ramp to 0 (in distance units)
+    const float threshold = std::sqrt(thresholdSquared);
+    const float rampEnd = (1.0f + _trimRamp) * threshold;
+    #pragma omp parallel for
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        if (_squaredDistances[i] <= thresholdSquared) { continue;}
+        float weight = 0.0f;
+        if (rampEnd > threshold) {
+            weight = std::max(0.0f, (rampEnd - std::sqrt(_squaredDistances[i])) / (rampEnd - threshold));
+        }
+        _ioProbability[i] *= weight;
+    }
+}//end _update_trimmed_weights()
+
+
 void InlierDetector::update() {
+    MESHMONK_TRACE_SCOPE("InlierDetector::update");
 
 //    _parameterList["jos"] = 2.0f;
 //    _parameterList.insert(std::make_pair("ljkewqr", 3));
@@ -138,59 +232,52 @@ void InlierDetector::update() {
     //## corresponding flags as a first way to determine inlier weights for the
     //## floating nodes.
     //## -> Initialize the probabilities as a copy of the flags
-    *_ioProbability = *_inCorrespondingFlags;
-
-    //# Distance based inlier/outlier classification
-    const float numDistanceBasedIterations = 10;
-    for (size_t it = 0 ; it < numDistanceBasedIterations ; it++) {
-        //## Re-calculate the parameters sigma and lambda
-        float sigmaa = 0.0;
-        float lambdaa = 0.0;
-        float sigmaNumerator = 0.0;
-        float sigmaDenominator = 0.0;
-        for (size_t i = 0 ; i < _numElements ; i++) {
-            //### Compute distance (squared)
-            FeatureVec difVector = _inCorrespondingFeatures->row(i) - _inFeatures->row(i);
-            const float distanceSquared = difVector.squaredNorm();
-
-            sigmaNumerator += (*_ioProbability)[i] * distanceSquared;
-            sigmaDenominator += (*_ioProbability)[i];
+    _ioProbability = _inCorrespondingFlags;
+    //## -> Warm start: the first estimate of sigma weights the elements
+    //## by how much they were inliers before (they're used once).
+    ConstVecView seedWeights;
+    if (_inInitialWeights.is_set()) {
+        if (size_t(_inInitialWeights.size()) == _numElements) {
+            seedWeights.reset(_inInitialWeights);
         }
-        //### sigma and lambda
-        sigmaa = std::sqrt(sigmaNumerator/sigmaDenominator);
-        if (sigmaa < _minimalSigma) {sigmaa = _minimalSigma;}
-        else if (sigmaa > _maximalSigma) {sigmaa = _maximalSigma;}
-
-        lambdaa = 1.0/(std::sqrt(2.0 * 3.14159) * sigmaa) * std::exp(-0.5 * _kappa * _kappa);
-
-        //## Recalculate the distance-based probabilities
-        for (size_t i = 0 ; i < _numElements ; i++) {
-            //### Get squared distance
-            FeatureVec difVector = _inCorrespondingFeatures->row(i) - _inFeatures->row(i);
-            const float distanceSquared = difVector.squaredNorm();
-            //### Compute probability
-            float probability = 1.0/(std::sqrt(2.0 * 3.14159) * sigmaa) * std::exp(-0.5 * distanceSquared / std::pow(sigmaa, 2.0));
-            probability /= (probability + lambdaa);
-            (*_ioProbability)[i] *= probability;
-
+        else {
+            std::cerr << "The initial inlier weights should have one element per floating feature!" << std::endl;
         }
+        _inInitialWeights.reset(NULL);
     }
 
-
-    //#Gradient Based inlier/outlier classification
-    if (_useOrientation){
-        float averageOrientationInlierWeight = 0.0f; //simply to warn the user when this is too low, they probably have the normals flipped.
-        for (size_t i = 0 ; i < _numElements ; i++) {
-            const Vec3Float normal = _inFeatures->row(i).tail(3);
-            const Vec3Float correspondingNormal = _inCorrespondingFeatures->row(i).tail(3);
+    //# Residuals
+    //## The squared distances to the corresponding features (and the
+    //## orientation probabilities) don't change during the update, so they
+    //## are computed once, in a single pass over both feature matrices.
+    _squaredDistances.resize(_numElements);
+    if (_useOrientation) { _orientationProbabilities.resize(_numElements);}
+    #pragma omp parallel for
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        FeatureVec difVector = _inCorrespondingFeatures.row(i) - _inFeatures.row(i);
+        _squaredDistances[i] = difVector.squaredNorm();
+        if (_useOrientation) {
+            const Vec3Float normal = _inFeatures.row(i).tail(3);
+            const Vec3Float correspondingNormal = _inCorrespondingFeatures.row(i).tail(3);
             //## Dot product gives an idea of how well they point in the same
             //## direction. This gives a weight between -1.0 and +1.0
             const float dotProduct = normal.dot(correspondingNormal);
             //## Rescale this result so that it's continuous between 0.0 and +1.0
-            float probability = dotProduct / 2.0 + 0.5;
-            (*_ioProbability)[i] *= probability;
-            averageOrientationInlierWeight += probability;
+            _orientationProbabilities[i] = dotProduct / 2.0 + 0.5;
         }
+    }
+
+    //# Distance based inlier/outlier classification
+    if (_trimFraction > 0.0f) { _update_trimmed_weights();}
+    else { _update_gaussian_weights(seedWeights);}
+
+    //#Gradient Based inlier/outlier classification
+    if (_useOrientation){
+        //## The average is simply to warn the user when this is too low, they probably have the normals flipped.
+        float averageOrientationInlierWeight = parallel_sum(_numElements, 0.0f, [&](const size_t i) {
+            _ioProbability[i] *= _orientationProbabilities[i];
+            return _orientationProbabilities[i];
+        });
 
         averageOrientationInlierWeight /= _numElements;
         if (averageOrientationInlierWeight < 0.5f) {
@@ -7,6 +7,7 @@
 #include <map>
 #include "../global.hpp"
 #include "NeighbourFinder.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
@@ -33,25 +34,45 @@ class InlierDetector
 
     # PARAMETERS
     -_kappa(=3): Mahalanobis distance that determines cut-off in- vs outliers
+    -_trimFraction(=0): if larger than zero, the trimmed model is used instead
+    of the expectation maximisation: only the fraction trimFraction of the
+    candidates (elements with a non-zero flag) with the smallest residuals are
+    inliers (weight 1), the others get weight 0. It needs a single selection
+    over the residuals (parallel_nth_value()) instead of 10 passes with
+    exponentials, which is enough for rigid pre-alignment.
+    -_trimRamp(=0): soft trimming. Residual distances between the trimming
+    threshold t and (1 + trimRamp) * t get a weight that falls linearly from
+    1 to 0, so the weights don't jump when the threshold moves.
 
     # OUTPUTS
     -_ioProbability
 
+    Initial inlier weights (e.g. from a coarser pyramid layer) can be given
+    with set_initial_weights(). In the next update() only, they weight the
+    residuals of the first estimate of sigma (and so of the mixture), so the
+    expectation maximisation starts from the previous inliers. They aren't
+    part of the resulting weights: those still follow from the flags, the
+    residuals and the orientations alone (the initial weights already hold
+    an orientation term). The trimmed model doesn't use them.
+
     # RETURNS
     */
 
     private:
         //# Inputs
-        const FeatureMat * _inFeatures = NULL;
-        const FeatureMat * _inCorrespondingFeatures = NULL;
-        const VecDynFloat * _inCorrespondingFlags = NULL;
+        ConstFeatureView _inFeatures;
+        ConstFeatureView _inCorrespondingFeatures;
+        ConstVecView _inCorrespondingFlags;
+        ConstVecView _inInitialWeights;
 
         //# Outputs
-        VecDynFloat *_ioProbability = NULL;
+        VecView _ioProbability;
 
         //# User Parameters
         float _kappa = 3.0;
         bool _useOrientation = true;
+        float _trimFraction = 0.0f;
+        float _trimRamp = 0.0f;
 
         //# Internal variables
         size_t _numElements;
@@ -64,6 +85,10 @@ class InlierDetector
         //# Internal Data structures
         NeighbourFinder<Vec3Mat> _neighbourFinder;
         MatDynFloat _smoothingWeights;
+        //## Squared distances to the corresponding features and orientation
+        //## probabilities, computed once per update
+        VecDynFloat _squaredDistances;
+        VecDynFloat _orientationProbabilities;
 
         //# Internal functions
         //## Find nearest neighbours (required for smoothing inlier weights)
@@ -72,15 +97,25 @@ class InlierDetector
         void _update_smoothing_weights();
         //## Smooth the inlier weights
         void _smooth_inlier_weights();
+        //## Distance based weights: expectation maximisation of the gaussian
+        //## model or trimming of the largest residuals
+        void _update_gaussian_weights(const ConstVecView &inSeedWeights);
+        void _update_trimmed_weights();
 
     protected:
 
     public:
-        void set_input(const FeatureMat * const inFeatures,
-                        const FeatureMat * const inCorrespondingFeatures,
-                        const VecDynFloat * const inCorrespondingFlags);
-        void set_output(VecDynFloat * const _ioProbability);
+        void set_input(const ConstFeatureView &inFeatures,
+                        const ConstFeatureView &inCorrespondingFeatures,
+                        const ConstVecView &inCorrespondingFlags);
+        void set_output(const VecView &_ioProbability);
         void set_parameters(const float kappa, const bool useOrientation);
+        void set_initial_weights(const ConstVecView &inInitialWeights);
+        void set_trimming(const float trimFraction = 0.0f, const float trimRamp = 0.0f);
+        size_t get_memory_usage() const {
+            return _neighbourFinder.get_memory_usage() + memory_usage(_smoothingWeights)
+                   + memory_usage(_squaredDistances) + memory_usage(_orientationProbabilities);
+        }
         void update();
 };
 
@@ -0,0 +1,454 @@
+#include "JobQueue.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace registration {
+
+namespace {
+    const char jobSuffix[] = ".job";
+    const char leaseSuffix[] = ".lease";
+    const char resultSuffix[] = ".result";
+    const char checkpointSuffix[] = ".checkpoint";
+    const char lockSuffix[] = ".lock";
+
+    double seconds_since_epoch(){
+        return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    int process_id(){
+#ifdef _WIN32
+        return _getpid();
+#else
+        return int(getpid());
+#endif
+    }
+
+    bool make_directory(const std::string &path){
+#ifdef _WIN32
+        return (_mkdir(path.c_str()) == 0) || (errno == EEXIST);
+#else
+        return (mkdir(path.c_str(), 0777) == 0) || (errno == EEXIST);
+#endif
+    }
+
+    //# Names of the files in a directory that end with 'suffix' (without it)
+    std::vector<std::string> list_directory(const std::string &directory, const std::string &suffix){
+        std::vector<std::string> names;
+#ifdef _WIN32
+        _finddata_t entry;
+        const intptr_t search = _findfirst((directory + "/*" + suffix).c_str(), &entry);
+        if (search == -1) { return names;}
+        do { names.push_back(entry.name);} while (_findnext(search, &entry) == 0);
+        _findclose(search);
+#else
+        DIR * const dir = opendir(directory.c_str());
+        if (dir == NULL) { return names;}
+        for (struct dirent *entry = readdir(dir) ; entry != NULL ; entry = readdir(dir)) {
+            names.push_back(entry->d_name);
+        }
+        closedir(dir);
+#endif
+        std::vector<std::string> ids;
+        for (size_t i = 0 ; i < names.size() ; i++) {
+            const std::string &name = names[i];
+            if ((name.size() > suffix.size()) && (name[0] != '.')
+                && (name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)) {
+                ids.push_back(name.substr(0, name.size() - suffix.size()));
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    bool read_file(const std::string &path, std::string &outContent){
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file.is_open()) { return false;}
+        std::ostringstream content;
+        content << file.rdbuf();
+        outContent = content.str();
+        return true;
+    }
+
+    bool write_file(const std::string &path, const std::string &content){
+        std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) { return false;}
+        file << content;
+        file.close();
+        return bool(file);
+    }
+
+    //# Parse key=value lines
+    std::map<std::string, std::string> parse_settings(const std::string &content){
+        std::map<std::string, std::string> settings;
+        std::istringstream lines(content);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (!line.empty() && (line[line.size()-1] == '\r')) { line.erase(line.size()-1);}
+            if (line.empty() || (line[0] == '#')) { continue;}
+            const size_t separator = line.find('=');
+            if (separator == std::string::npos) { continue;}
+            settings[line.substr(0, separator)] = line.substr(separator + 1);
+        }
+        return settings;
+    }
+
+    //# Whether the expiry time of a lease (or lock) passed
+    bool is_expired(const std::string &content){
+        double expires = 0.0;
+        const std::map<std::string, std::string> lease = parse_settings(content);
+        std::map<std::string, std::string>::const_iterator found = lease.find("expires");
+        if (found != lease.end()) { std::istringstream(found->second) >> expires;}
+        return seconds_since_epoch() >= expires;
+    }
+
+    std::string token_of(const std::string &content){
+        return parse_settings(content)["token"];
+    }
+
+    //# Give 'source' the name 'target' unless 'target' exists (atomically).
+    //# 'source' is left behind on POSIX systems.
+    bool link_exclusively(const std::string &source, const std::string &target){
+#ifdef _WIN32
+        //## rename() fails on Windows if the target exists
+        return std::rename(source.c_str(), target.c_str()) == 0;
+#else
+        return link(source.c_str(), target.c_str()) == 0;
+#endif
+    }
+
+    //# Replace 'target' by 'source' (atomically)
+    bool replace_file(const std::string &source, const std::string &target){
+#ifdef _WIN32
+        std::remove(target.c_str());
+#endif
+        return std::rename(source.c_str(), target.c_str()) == 0;
+    }
+}//namespace
+
+
+void JobQueue::set_input(const std::string &manifestDirectory){
+    _manifestDirectory = manifestDirectory;
+}//end set_input()
+
+
+void JobQueue::set_parameters(const std::string &workerId, const double leaseSeconds){
+    _workerId = workerId.empty() ? default_worker_id() : workerId;
+    _leaseSeconds = leaseSeconds;
+}//end set_parameters()
+
+
+std::string JobQueue::default_worker_id(){
+    char hostName[256] = "host";
+#ifdef _WIN32
+    const char * const computerName = std::getenv("COMPUTERNAME");
+    if (computerName != NULL) { std::snprintf(hostName, sizeof(hostName), "%s", computerName);}
+#else
+    if (gethostname(hostName, sizeof(hostName)) != 0) { std::snprintf(hostName, sizeof(hostName), "host");}
+    hostName[sizeof(hostName)-1] = '\0';
+#endif
+    std::ostringstream id;
+    id << hostName << "-" << process_id();
+    return id.str();
+}//end default_worker_id()
+
+
+std::string JobQueue::_job_path(const std::string &jobId) const{
+    return _manifestDirectory + "/jobs/" + jobId + jobSuffix;
+}
+
+std::string JobQueue::_lease_path(const std::string &jobId) const{
+    return _manifestDirectory + "/leases/" + jobId + leaseSuffix;
+}
+
+std::string JobQueue::_result_path(const std::string &jobId) const{
+    return _manifestDirectory + "/results/" + jobId + resultSuffix;
+}
+
+std::string JobQueue::_lock_path(const std::string &jobId) const{
+    return _manifestDirectory + "/leases/" + jobId + lockSuffix;
+}
+
+
+std::string JobQueue::get_checkpoint_path(const std::string &jobId) const{
+    make_directory(_manifestDirectory + "/checkpoints");
+    return _manifestDirectory + "/checkpoints/" + jobId + checkpointSuffix;
+}//end get_checkpoint_path()
+
+
+std::string JobQueue::_new_token(){
+    //# Unique per worker and claim (the worker id holds the host and process)
+    std::ostringstream token;
+    token << _workerId << "-" << (_numTokens++) << "-"
+          << std::chrono::steady_clock::now().time_since_epoch().count();
+    return token.str();
+}//end _new_token()
+
+
+std::string JobQueue::_lease_content(const std::string &token) const{
+    std::ostringstream content;
+    content.precision(15);
+    content << "worker=" << _workerId << std::endl;
+    content << "token=" << token << std::endl;
+    content << "expires=" << (seconds_since_epoch() + _leaseSeconds) << std::endl;
+    return content.str();
+}//end _lease_content()
+
+
+bool JobQueue::add_job(const std::string &jobId, const std::map<std::string, std::string> &settings) const{
+    if (!make_directory(_manifestDirectory) || !make_directory(_manifestDirectory + "/jobs")) {
+        std::cerr << "JobQueue::add_job(): couldn't create " << _manifestDirectory << "/jobs." << std::endl;
+        return false;
+    }
+    std::ostringstream content;
+    for (std::map<std::string, std::string>::const_iterator it = settings.begin() ; it != settings.end() ; ++it) {
+        content << it->first << "=" << it->second << std::endl;
+    }
+    const std::string path = _job_path(jobId);
+    const std::string temporaryPath = path + ".tmp";
+    return write_file(temporaryPath, content.str()) && replace_file(temporaryPath, path);
+}//end add_job()
+
+
+std::vector<std::string> JobQueue::list_jobs() const{
+    return list_directory(_manifestDirectory + "/jobs", jobSuffix);
+}//end list_jobs()
+
+
+bool JobQueue::has_result(const std::string &jobId) const{
+    std::ifstream file(_result_path(jobId).c_str());
+    return file.is_open();
+}//end has_result()
+
+
+bool JobQueue::get_result(const std::string &jobId, JobResult &outResult) const{
+    std::string content;
+    if (!read_file(_result_path(jobId), content)) { return false;}
+    const std::map<std::string, std::string> settings = parse_settings(content);
+    JobResult result;
+    std::map<std::string, std::string>::const_iterator found;
+    if ((found = settings.find("status")) != settings.end()) { result.succeeded = (found->second == "ok");}
+    if ((found = settings.find("worker")) != settings.end()) { result.worker = found->second;}
+    if ((found = settings.find("start")) != settings.end()) { std::istringstream(found->second) >> result.startTime;}
+    if ((found = settings.find("seconds")) != settings.end()) { std::istringstream(found->second) >> result.seconds;}
+    if ((found = settings.find("message")) != settings.end()) { result.message = found->second;}
+    outResult = result;
+    return true;
+}//end get_result()
+
+
+size_t JobQueue::retry_failed() const{
+    const std::vector<std::string> jobIds = list_jobs();
+    size_t numRetried = 0;
+    for (size_t j = 0 ; j < jobIds.size() ; j++) {
+        JobResult result;
+        if (!get_result(jobIds[j], result) || result.succeeded) { continue;}
+        if (std::remove(_result_path(jobIds[j]).c_str()) == 0) { numRetried++;}
+    }
+    return numRetried;
+}//end retry_failed()
+
+
+bool JobQueue::_read_job(const std::string &jobId, Job &outJob) const{
+    std::string content;
+    if (!read_file(_job_path(jobId), content)) { return false;}
+    outJob.id = jobId;
+    outJob.settings = parse_settings(content);
+    return true;
+}//end _read_job()
+
+
+std::string JobQueue::_lock_lease(const std::string &jobId){
+    const std::string lockPath = _lock_path(jobId);
+    const std::string token = _new_token();
+    const std::string temporaryPath = _manifestDirectory + "/leases/." + token + ".tmp";
+    if (!write_file(temporaryPath, _lease_content(token))) {
+        std::cerr << "JobQueue::_lock_lease(): couldn't write " << temporaryPath << "." << std::endl;
+        return "";
+    }
+    //# Another worker holds the lock for a few file operations at most, so
+    //# wait for it (or break it once it's stale)
+    size_t numMissing = 0;
+    while (!link_exclusively(temporaryPath, lockPath)) {
+        std::string content;
+        if (!read_file(lockPath, content)) {
+            //## Released in the meantime, unless it can't be created at all
+            if (++numMissing < 100) { continue;}
+            std::remove(temporaryPath.c_str());
+            std::cerr << "JobQueue::_lock_lease(): couldn't create " << lockPath << "." << std::endl;
+            return "";
+        }
+        numMissing = 0;
+        if (is_expired(content)) { _break_stale_lock(jobId, content);}
+        else { std::this_thread::sleep_for(std::chrono::milliseconds(5));}
+    }
+    std::remove(temporaryPath.c_str());
+    return token;
+}//end _lock_lease()
+
+
+void JobQueue::_unlock_lease(const std::string &jobId, const std::string &lockToken) const{
+    const std::string lockPath = _lock_path(jobId);
+    std::string content;
+    if (read_file(lockPath, content) && (token_of(content) == lockToken)) {
+        std::remove(lockPath.c_str());
+    }
+}//end _unlock_lease()
+
+
+void JobQueue::_break_stale_lock(const std::string &jobId, const std::string &staleContent){
+    //# Move the stale lock to a name of our own: if several workers try,
+    //# only one of them finds it
+    const std::string lockPath = _lock_path(jobId);
+    const std::string stalePath = lockPath + ".stale." + _new_token();
+    if (std::rename(lockPath.c_str(), stalePath.c_str()) != 0) { return;}
+    std::string movedContent;
+    read_file(stalePath, movedContent);
+    if (movedContent != staleContent) {
+        //## Another worker broke it and took the lock between our read and
+        //## rename: put its lock back
+        link_exclusively(stalePath, lockPath);
+    }
+    std::remove(stalePath.c_str());
+}//end _break_stale_lock()
+
+
+bool JobQueue::_take_over_expired(const std::string &jobId, const std::string &newLeasePath){
+    const std::string lockToken = _lock_lease(jobId);
+    if (lockToken.empty()) { return false;}
+    //# Nobody else changes the lease while we hold the lock (and nobody can
+    //# claim it while it exists), so the lease we check is the one we replace
+    const std::string leasePath = _lease_path(jobId);
+    std::string content;
+    bool takenOver = false;
+    if (!read_file(leasePath, content)) { takenOver = link_exclusively(newLeasePath, leasePath);} //released in the meantime
+    else if (is_expired(content)) { takenOver = replace_file(newLeasePath, leasePath);}
+    _unlock_lease(jobId, lockToken);
+    return takenOver;
+}//end _take_over_expired()
+
+
+bool JobQueue::claim(Job &outJob){
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_workerId.empty()) { _workerId = default_worker_id();}
+    if (!make_directory(_manifestDirectory + "/leases") || !make_directory(_manifestDirectory + "/results")) {
+        std::cerr << "JobQueue::claim(): couldn't create the lease and result directories in "
+                  << _manifestDirectory << "." << std::endl;
+        return false;
+    }
+
+    const std::vector<std::string> jobIds = list_jobs();
+    for (size_t j = 0 ; j < jobIds.size() ; j++) {
+        const std::string &jobId = jobIds[j];
+        if (has_result(jobId) || (_heldLeases.find(jobId) != _heldLeases.end())) { continue;}
+
+        //# Try to create the lease, or else take over an expired one (a job
+        //# with a valid lease is taken)
+        const std::string leasePath = _lease_path(jobId);
+        const std::string token = _new_token();
+        const std::string temporaryPath = _manifestDirectory + "/leases/." + token + ".tmp";
+        if (!write_file(temporaryPath, _lease_content(token))) {
+            std::cerr << "JobQueue::claim(): couldn't write " << temporaryPath << "." << std::endl;
+            return false;
+        }
+        const bool claimed = link_exclusively(temporaryPath, leasePath) || _take_over_expired(jobId, temporaryPath);
+        std::remove(temporaryPath.c_str());
+        if (!claimed) { continue;}
+        _heldLeases[jobId] = token;
+
+        //# The job may have been completed between the checks
+        if (has_result(jobId) || !_read_job(jobId, outJob)) {
+            _release_held(jobId);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}//end claim()
+
+
+bool JobQueue::renew(const std::string &jobId){
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<std::string, std::string>::const_iterator held = _heldLeases.find(jobId);
+    if (held == _heldLeases.end()) { return false;}
+    const std::string lockToken = _lock_lease(jobId);
+    if (lockToken.empty()) { return false;}
+    //# Only replace the lease if it's still ours (it can't change while we
+    //# hold the lock)
+    const std::string leasePath = _lease_path(jobId);
+    std::string content;
+    if (!read_file(leasePath, content) || (token_of(content) != held->second)) {
+        _unlock_lease(jobId, lockToken);
+        _heldLeases.erase(jobId);
+        return false;
+    }
+    const std::string temporaryPath = _manifestDirectory + "/leases/." + held->second + ".renew.tmp";
+    const bool renewed = write_file(temporaryPath, _lease_content(held->second)) && replace_file(temporaryPath, leasePath);
+    if (!renewed) { std::remove(temporaryPath.c_str());}
+    _unlock_lease(jobId, lockToken);
+    return renewed;
+}//end renew()
+
+
+bool JobQueue::complete(const std::string &jobId, const JobResult &result){
+    std::ostringstream content;
+    content.precision(15);
+    content << "status=" << (result.succeeded ? "ok" : "failed") << std::endl;
+    content << "job=" << jobId << std::endl;
+    content << "worker=" << (result.worker.empty() ? _workerId : result.worker) << std::endl;
+    content << "start=" << result.startTime << std::endl;
+    content << "seconds=" << result.seconds << std::endl;
+    std::string message = result.message;
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    content << "message=" << message << std::endl;
+
+    //# Written completely before it replaces an earlier result
+    const std::string resultPath = _result_path(jobId);
+    const std::string temporaryPath = _manifestDirectory + "/results/." + jobId + "." + _workerId + ".tmp";
+    const bool written = write_file(temporaryPath, content.str()) && replace_file(temporaryPath, resultPath);
+    if (!written) {
+        std::remove(temporaryPath.c_str());
+        std::cerr << "JobQueue::complete(): couldn't write " << resultPath << "." << std::endl;
+    }
+    //# A finished job doesn't need its checkpoint anymore
+    if (written && result.succeeded) { std::remove(get_checkpoint_path(jobId).c_str());}
+    release(jobId);
+    return written;
+}//end complete()
+
+
+void JobQueue::release(const std::string &jobId){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _release_held(jobId);
+}//end release()
+
+
+void JobQueue::_release_held(const std::string &jobId){
+    std::map<std::string, std::string>::iterator held = _heldLeases.find(jobId);
+    if (held == _heldLeases.end()) { return;}
+    //# Only remove the lease if it's still ours
+    const std::string lockToken = _lock_lease(jobId);
+    std::string content;
+    if (!lockToken.empty() && read_file(_lease_path(jobId), content) && (token_of(content) == held->second)) {
+        std::remove(_lease_path(jobId).c_str());
+    }
+    if (!lockToken.empty()) { _unlock_lease(jobId, lockToken);}
+    _heldLeases.erase(held);
+}//end _release_held()
+
+}//namespace registration
@@ -0,0 +1,166 @@
+#ifndef JOBQUEUE_HPP
+#define JOBQUEUE_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace registration {
+
+//# A job of the batch: the key=value lines of its job file
+struct Job {
+    std::string id;
+    std::map<std::string, std::string> settings;
+
+    //## Setting with a default if the job file doesn't have it
+    std::string get(const std::string &key, const std::string &defaultValue = "") const {
+        std::map<std::string, std::string>::const_iterator found = settings.find(key);
+        return (found != settings.end()) ? found->second : defaultValue;
+    }
+};
+
+//# Result and timing of a job
+struct JobResult {
+    bool succeeded = false;
+    std::string worker;
+    double startTime = 0.0; //seconds since the epoch
+    double seconds = 0.0;
+    std::string message;
+};
+
+
+class JobQueue
+{
+    /*
+    # GOAL
+    A queue of registration jobs in a shared manifest directory, from which
+    workers on any number of nodes claim jobs without a coordination service
+    (only a shared or local file system):
+
+    manifestDirectory/jobs/<id>.job         job settings (key=value lines)
+    manifestDirectory/leases/<id>.lease     worker, token and expiry of a claim
+    manifestDirectory/results/<id>.result   status, worker and timing
+    manifestDirectory/checkpoints/<id>.checkpoint
+                                            registration state of a running job
+
+    A job is claimed by writing a lease to a temporary file and linking it to
+    <id>.lease, which fails if the lease already exists, so only one worker
+    wins. A lease expires after leaseSeconds unless the worker renews it, so
+    the jobs of a worker that died are claimed again.
+
+    An existing lease is only changed (taken over once it expired, renewed
+    or released) while holding the lock leases/<id>.lock, which is taken
+    the same way as a lease. The lease is checked and replaced (atomically)
+    within the lock, so a worker never replaces a lease that was renewed or
+    taken over after it read it, and the lease file exists throughout (a
+    new claim can't slip in between). The lock is only held for a few file
+    operations; a lock older than leaseSeconds was left by a worker that
+    died holding it and is broken. (Only when two workers break the same
+    lock at the same moment can a third one take the lock alongside.)
+
+    Results are written to a temporary file and renamed over <id>.result,
+    so a result file is always complete, and writing the result of a job
+    twice (e.g. after its lease expired while it was still running) just
+    replaces it. Jobs with a result are never claimed again. A job that
+    was interrupted (its worker died or was preempted) can resume from its
+    checkpoint, which is removed once the job succeeded.
+
+    A failed job has a result too (status failed), so it isn't retried
+    automatically (a job that always fails would otherwise keep the
+    workers busy). Its checkpoint is kept, and retry_failed() removes the
+    results of the failed jobs, so they are claimed (and resumed) again.
+
+    The expiry times are compared across nodes, so their clocks should be
+    synchronised (to well within leaseSeconds).
+
+    # PARAMETERS
+    -workerId: name of this worker in the leases and results (default:
+    host name and process id).
+    -leaseSeconds(=3600): time after which a lease that wasn't renewed
+    expires.
+
+    # USAGE
+    JobQueue queue;
+    queue.set_input("manifest");
+    queue.set_parameters("", 600.0);
+    Job job;
+    while (queue.claim(job)) {
+        ... run the job, calling queue.renew(job.id) well within 600 s ...
+        queue.complete(job.id, result);
+    }
+    */
+
+    public:
+        void set_input(const std::string &manifestDirectory);
+        void set_parameters(const std::string &workerId = "", const double leaseSeconds = 3600.0);
+
+        //# Add a job to the manifest (creates the directories)
+        bool add_job(const std::string &jobId, const std::map<std::string, std::string> &settings) const;
+
+        //# Claim the next job that has no result and no valid lease. Returns
+        //# false when there is none left.
+        bool claim(Job &outJob);
+        //# Extend the lease of a claimed job. Returns false if the lease was
+        //# lost (it expired and another worker claimed the job).
+        bool renew(const std::string &jobId);
+        //# Write the result of a claimed job and release its lease
+        bool complete(const std::string &jobId, const JobResult &result);
+        //# Release the lease of a claimed job without a result
+        void release(const std::string &jobId);
+
+        //# Job ids of the manifest (sorted)
+        std::vector<std::string> list_jobs() const;
+        bool has_result(const std::string &jobId) const;
+        bool get_result(const std::string &jobId, JobResult &outResult) const;
+        //# Remove the results of the failed jobs, so they are claimed again.
+        //# Returns the number of jobs that will be retried.
+        size_t retry_failed() const;
+        std::string get_worker_id() const { return _workerId;}
+        //# Where a job keeps its checkpoint (creates the directory)
+        std::string get_checkpoint_path(const std::string &jobId) const;
+
+        //# Host name and process id
+        static std::string default_worker_id();
+
+    protected:
+
+    private:
+        //# Inputs
+        std::string _manifestDirectory;
+
+        //# User parameters
+        std::string _workerId;
+        double _leaseSeconds = 3600.0;
+
+        //# Internal data structures
+        //## Token of each lease this worker holds (by job id)
+        std::map<std::string, std::string> _heldLeases;
+        std::mutex _mutex;
+        size_t _numTokens = 0;
+
+        //# Internal functions
+        std::string _job_path(const std::string &jobId) const;
+        std::string _lease_path(const std::string &jobId) const;
+        std::string _result_path(const std::string &jobId) const;
+        std::string _lock_path(const std::string &jobId) const;
+        std::string _new_token();
+        std::string _lease_content(const std::string &token) const;
+        bool _read_job(const std::string &jobId, Job &outJob) const;
+        //## Take the lock on the changes of a job's lease. Returns its token
+        //## (empty if the lock couldn't be created).
+        std::string _lock_lease(const std::string &jobId);
+        void _unlock_lease(const std::string &jobId, const std::string &lockToken) const;
+        //## Move away a lock that a dead worker left, if it's still the one
+        //## that was read
+        void _break_stale_lock(const std::string &jobId, const std::string &staleContent);
+        //## Replace the lease of a job by the one at 'newLeasePath' if it expired
+        //## (or was released). Returns false if it's still valid.
+        bool _take_over_expired(const std::string &jobId, const std::string &newLeasePath);
+        //## release() for a caller that holds _mutex
+        void _release_held(const std::string &jobId);
+};
+
+}//namespace registration
+
+#endif // JOBQUEUE_HPP
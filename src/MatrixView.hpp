@@ -0,0 +1,120 @@
+#ifndef MATRIXVIEW_HPP
+#define MATRIXVIEW_HPP
+
+#include <new>
+#include <type_traits>
+#include <Eigen/Dense>
+#include "../global.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
+
+namespace registration {
+
+typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> DynamicStride;
+
+template <typename MatrixType>
+class MatrixView : public Eigen::Map<MatrixType, Eigen::Unaligned, DynamicStride>
+{
+    /*
+    # GOAL
+    A view of the data of a matrix, with any step between its rows and
+    columns, that doesn't have to be held by an Eigen matrix. The registration
+    classes keep their inputs and outputs as views, so they read and write the
+    caller's data in place: an Eigen matrix, but also e.g. a NumPy array in C
+    or in Fortran order (see python/meshmonk_python.cpp).
+
+    Unlike Eigen::Ref, a view can be empty and can be pointed at other data
+    with reset(), so a class can keep one from set_input() to update().
+    Assigning to a view writes its coefficients (as with Eigen::Map). A view
+    of an Eigen matrix is invalid once the matrix is resized (as a pointer to
+    its data would be).
+
+    MatrixView<FeatureMat> reads and writes, MatrixView<const FeatureMat>
+    only reads. Both convert implicitly from a matrix, from a pointer to one
+    (NULL gives an empty view) and from an Eigen::Map or Eigen::Ref, so the
+    functions that took a matrix or a pointer to one take a view without
+    changes to their callers. A const view can't be written, so a function
+    that writes through a view takes it by value (it only copies the pointer,
+    sizes and strides).
+
+    # USAGE
+    FeatureMat features = ...;
+    FeatureView view(&features);
+    ConstFeatureView rowMajorView(data, numRows, NUM_FEATURES, NUM_FEATURES, 1);
+    */
+
+    public:
+        typedef Eigen::Map<MatrixType, Eigen::Unaligned, DynamicStride> Base;
+        typedef typename std::remove_const<MatrixType>::type PlainMatrix;
+        typedef typename Base::PointerType PointerType;
+        typedef Eigen::Index Index;
+
+        //# Empty view
+        MatrixView() : Base(NULL, 0, _empty_cols(), DynamicStride(0, 0)) {}
+        //# View of a whole matrix (an empty view if NULL)
+        MatrixView(MatrixType * const matrix)
+            : Base((matrix != NULL) ? matrix->data() : NULL,
+                   (matrix != NULL) ? matrix->rows() : 0,
+                   (matrix != NULL) ? matrix->cols() : _empty_cols(),
+                   DynamicStride((matrix != NULL) ? matrix->outerStride() : 0,
+                                 (matrix != NULL) ? matrix->innerStride() : 0)) {}
+        //# View of raw data: element (i,j) is at data[i*rowStride + j*colStride]
+        MatrixView(PointerType data, const Index numRows, const Index numCols,
+                   const Index rowStride, const Index colStride)
+            : Base(data, numRows, numCols, DynamicStride(colStride, rowStride)) {}
+        //# View of a whole matrix (not of a temporary one)
+        MatrixView(MatrixType &matrix)
+            : Base(matrix.data(), matrix.rows(), matrix.cols(),
+                   DynamicStride(matrix.outerStride(), matrix.innerStride())) {}
+        MatrixView(PlainMatrix &&matrix) = delete;
+        //# View of the data of an Eigen::Map, an Eigen::Ref or another view (of
+        //# the same type of matrix)
+        template <typename Derived>
+        MatrixView(Eigen::MapBase<Derived, Eigen::WriteAccessors> &other,
+                   typename std::enable_if<std::is_same<typename Derived::PlainObject,
+                                                        PlainMatrix>::value>::type * = 0)
+            : Base(other.data(), other.rows(), other.cols(),
+                   DynamicStride(other.outerStride(), other.innerStride())) {}
+        template <typename Derived>
+        MatrixView(const Eigen::MapBase<Derived, Eigen::ReadOnlyAccessors> &other,
+                   typename std::enable_if<std::is_same<typename Derived::PlainObject,
+                                                        PlainMatrix>::value>::type * = 0)
+            : Base(other.data(), other.rows(), other.cols(),
+                   DynamicStride(other.outerStride(), other.innerStride())) {}
+
+        //# Assigning writes the coefficients (of writable views only)
+        template <typename OtherDerived>
+        MatrixView &operator=(const Eigen::EigenBase<OtherDerived> &other) {
+            Base::operator=(other.derived());
+            return *this;
+        }
+        //## (use reset() to point the view at other data)
+        MatrixView &operator=(MatrixType * const matrix) = delete;
+
+        //# Point the view at other data
+        void reset(const MatrixView &other) { new (this) MatrixView(other);}
+        //# Whether the view was given any data
+        bool is_set() const { return this->data() != NULL;}
+
+    private:
+        static Index _empty_cols() {
+            return (PlainMatrix::ColsAtCompileTime == Eigen::Dynamic) ? 0 : Index(PlainMatrix::ColsAtCompileTime);
+        }
+};
+
+typedef MatrixView<FeatureMat> FeatureView;
+typedef MatrixView<const FeatureMat> ConstFeatureView;
+typedef MatrixView<const FacesMat> ConstFacesView;
+typedef MatrixView<Vec3Mat> Vec3View;
+typedef MatrixView<const Vec3Mat> ConstVec3View;
+typedef MatrixView<VecDynFloat> VecView;
+typedef MatrixView<const VecDynFloat> ConstVecView;
+typedef MatrixView<const VecDynInt> ConstIntVecView;
+
+}//namespace registration
+
+#endif // MATRIXVIEW_HPP
@@ -0,0 +1,242 @@
+#include "MemoryAccounting.hpp"
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace registration {
+
+size_t estimate_dense_memory(const size_t numRows, const size_t numCols,
+                             const size_t scalarBytes){
+    return numRows * numCols * scalarBytes;
+}//end estimate_dense_memory()
+
+
+size_t estimate_sparse_memory(const size_t numOuter, const size_t numNonZeros,
+                              const size_t scalarBytes){
+    //# values and inner indices, plus the outer index
+    return numNonZeros * (scalarBytes + sizeof(int)) + (numOuter + 1) * sizeof(int);
+}//end estimate_sparse_memory()
+
+
+size_t estimate_kdtree_memory(const size_t numPoints, const size_t leafSize){
+    /*
+    nanoflann stores a permutation of the point indices and a tree of nodes
+    (32 bytes each). Leaves hold between half and all of 'leafSize' points, so
+    there are about 2*numPoints/(0.75*leafSize) nodes.
+    */
+    const size_t indexBytes = numPoints * sizeof(size_t);
+    const size_t numNodes = 2 * (numPoints * 4 / (3 * std::max(leafSize, size_t(1))) + 1);
+    return indexBytes + numNodes * 32;
+}//end estimate_kdtree_memory()
+
+
+size_t estimate_mesh_memory(const size_t numVertices, const size_t numFaces){
+    /*
+    OpenMesh array kernel with the properties we request:
+    -vertex: point, normal, outgoing halfedge and status (32 bytes)
+    -halfedge: next, previous, vertex and face handles (16 bytes), two per edge
+    -edge: status (4 bytes)
+    -face: halfedge handle, normal and status (20 bytes)
+    A triangle mesh has about 3/2 edges per face.
+    */
+    const size_t numEdges = (3 * numFaces) / 2 + 1;
+    return numVertices * 32 + numEdges * (2 * 16 + 4) + numFaces * 20;
+}//end estimate_mesh_memory()
+
+
+size_t estimate_bvh_memory(const size_t numFaces, const size_t numQueried,
+                           const size_t leafSize){
+    //# Tree nodes (32 bytes), triangle corners and face indices
+    const size_t numNodes = 2 * (2 * numFaces / std::max(leafSize, size_t(1)) + 1);
+    size_t bytes = numNodes * 32 + numFaces * (9 * sizeof(float) + sizeof(int));
+    //# Temporary centroids and ordering while building
+    bytes += numFaces * (3 * sizeof(float) + sizeof(int));
+    //# Outputs: face index, barycentric coordinates and distance per query
+    bytes += numQueried * (sizeof(int) + 4 * sizeof(float));
+    return bytes;
+}//end estimate_bvh_memory()
+
+
+size_t estimate_correspondence_memory(const size_t numQueried, const size_t numSource,
+                                      const size_t numSourceFaces, const size_t numNeighbours,
+                                      const CorrespondenceMemoryModes &modes){
+    const size_t neighbourBytes = sizeof(int) + sizeof(float);
+    size_t bytes = 0;
+    size_t numAffinityElements = numQueried * numNeighbours;
+    if (modes.surfaceMatching) {
+        bytes += estimate_bvh_memory(numSourceFaces, numQueried);
+        numAffinityElements = numQueried * 3;
+    }
+    else {
+        if (modes.positionalSearch) {
+            //## Position copies, position kd-tree and the (2k) candidates
+            bytes += estimate_dense_memory(numQueried + numSource, 3);
+            bytes += estimate_kdtree_memory(numSource);
+            bytes += numQueried * 2 * numNeighbours * neighbourBytes * 2;
+        }
+        else {
+            //## Feature kd-tree and its output
+            bytes += estimate_kdtree_memory(numSource);
+            bytes += numQueried * numNeighbours * neighbourBytes;
+        }
+        //## Neighbours kept for the affinity
+        bytes += numQueried * numNeighbours * neighbourBytes;
+        if (modes.selectiveUpdate) {
+            //## Features and nearest distances at the last query, moved rows
+            bytes += estimate_dense_memory(numQueried, NUM_FEATURES + 1);
+            bytes += numQueried * sizeof(size_t);
+        }
+    }
+    //# Affinity matrix (column major, so one outer index per source element),
+    //# the triplets it's built from and the normalisation temporaries
+    bytes += estimate_sparse_memory(numSource, numAffinityElements);
+    bytes += numAffinityElements * (2 * sizeof(int) + sizeof(float));
+    bytes += estimate_dense_memory(numQueried, NUM_FEATURES + 1);
+    return bytes;
+}//end estimate_correspondence_memory()
+
+
+size_t estimate_symmetric_correspondence_memory(const size_t numFloating, const size_t numTarget,
+                                                const size_t numTargetFaces, const size_t numNeighbours,
+                                                const CorrespondenceMemoryModes &modes){
+    //# Push filter (floating to target) with all the modes
+    size_t bytes = estimate_correspondence_memory(numFloating, numTarget, numTargetFaces,
+                                                  numNeighbours, modes);
+    //# Pull filter (target to floating): no surface matching or selective update
+    CorrespondenceMemoryModes pullModes;
+    pullModes.positionalSearch = modes.positionalSearch;
+    bytes += estimate_correspondence_memory(numTarget, numFloating, 0, numNeighbours, pullModes);
+    //# Pull features and flags, and the fused affinity
+    bytes += estimate_dense_memory(numTarget, NUM_FEATURES + 1);
+    const size_t numPushElements = modes.surfaceMatching ? numFloating * 3 : numFloating * numNeighbours;
+    bytes += estimate_sparse_memory(numTarget, numPushElements + numTarget * numNeighbours);
+    return bytes;
+}//end estimate_symmetric_correspondence_memory()
+
+
+size_t estimate_inlier_memory(const size_t numFloating){
+    //# Positions, kd-tree, 10 neighbours with smoothing weights, the residuals
+    //# and orientation probabilities
+    const size_t numNeighbours = 10;
+    size_t bytes = estimate_dense_memory(numFloating, 3);
+    bytes += estimate_kdtree_memory(numFloating);
+    bytes += numFloating * numNeighbours * (sizeof(int) + 2 * sizeof(float));
+    bytes += estimate_dense_memory(numFloating, 2);
+    return bytes;
+}//end estimate_inlier_memory()
+
+
+size_t estimate_viscoelastic_memory(const size_t numFloating, const size_t numFloatingFaces,
+                                    const size_t numNeighbours,
+                                    const float surfaceArea, const float directRadius){
+    //# Current and old displacement field plus two temporary fields
+    size_t bytes = estimate_dense_memory(numFloating, 4 * 3);
+    //# Positions, kd-tree, neighbours (and the copy of their indices) and
+    //# smoothing weights
+    bytes += estimate_dense_memory(numFloating, 3);
+    bytes += estimate_kdtree_memory(numFloating);
+    bytes += numFloating * numNeighbours * (2 * sizeof(int) + 2 * sizeof(float));
+    //# Copy of the floating mesh to update the normals
+    bytes += estimate_mesh_memory(numFloating, numFloatingFaces);
+    //# Operator of the direct regularisation
+    if (directRadius > 0.0f) {
+        bytes += estimate_regularisation_operator_memory(numFloating, surfaceArea, directRadius);
+    }
+    return bytes;
+}//end estimate_viscoelastic_memory()
+
+
+size_t estimate_regularisation_operator_memory(const size_t numFloating, const float surfaceArea,
+                                               const float radius){
+    //# Nodes within the radius, for nodes spread evenly over the surface (all
+    //# of them if the area is unknown)
+    double numPerRow = double(numFloating);
+    if (surfaceArea > 0.0f) {
+        numPerRow = std::min(numPerRow, std::max(1.0, 3.14159265358979 * double(radius) * double(radius)
+                                                     * double(numFloating) / double(surfaceArea)));
+    }
+    const size_t numNonZeros = size_t(numPerRow * double(numFloating));
+    //# Copy of the positions and its kd-tree for the radius search
+    size_t bytes = estimate_dense_memory(numFloating, 3) + estimate_kdtree_memory(numFloating);
+    //# Radius search results (indices and squared distances) and their copy,
+    //# the triplets, the transposed temporary of setFromTriplets() and the
+    //# operator itself
+    bytes += 2 * (numNonZeros * (sizeof(int) + sizeof(float)) + (numFloating + 1) * sizeof(int));
+    bytes += numNonZeros * (2 * sizeof(int) + sizeof(float));
+    bytes += 2 * estimate_sparse_memory(numFloating, numNonZeros);
+    return bytes;
+}//end estimate_regularisation_operator_memory()
+
+
+float estimate_surface_area(const ConstFeatureView &features, const ConstFacesView &faces){
+    const Eigen::Index numVertices = features.rows();
+    double area = 0.0;
+    for (Eigen::Index f = 0 ; f < faces.rows() ; f++) {
+        const int i0 = faces(f,0), i1 = faces(f,1), i2 = faces(f,2);
+        if ((i0 < 0) || (i1 < 0) || (i2 < 0)
+            || (i0 >= numVertices) || (i1 >= numVertices) || (i2 >= numVertices)) { continue;}
+        const Eigen::Vector3f p0 = features.row(i0).head<3>().transpose();
+        const Eigen::Vector3f edge1 = features.row(i1).head<3>().transpose() - p0;
+        const Eigen::Vector3f edge2 = features.row(i2).head<3>().transpose() - p0;
+        area += 0.5 * double(edge1.cross(edge2).norm());
+    }
+    if ((area <= 0.0) && (numVertices > 0)) {
+        const Eigen::Vector3f extent = features.leftCols<3>().colwise().maxCoeff()
+                                     - features.leftCols<3>().colwise().minCoeff();
+        area = double(extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+    }
+    return float(area);
+}//end estimate_surface_area()
+
+
+size_t estimate_downsampler_memory(const size_t numVertices, const size_t numFaces){
+    //# Mesh with an extra index property, plus a quadric (10 doubles), heap
+    //# position, collapse target and priority per vertex for the decimater
+    return estimate_mesh_memory(numVertices, numFaces) + numVertices * (sizeof(float) + 10 * sizeof(double) + 12);
+}//end estimate_downsampler_memory()
+
+
+size_t estimate_rigid_registration_memory(const size_t numFloating, const size_t numTarget,
+                                          const size_t numTargetFaces, const size_t numNeighbours,
+                                          const bool symmetric, const CorrespondenceMemoryModes &modes){
+    //# Corresponding features and flags, and the inlier weights
+    size_t bytes = estimate_dense_memory(numFloating, NUM_FEATURES + 2);
+    if (symmetric) {
+        bytes += estimate_symmetric_correspondence_memory(numFloating, numTarget, numTargetFaces,
+                                                          numNeighbours, modes);
+    }
+    else {
+        bytes += estimate_correspondence_memory(numFloating, numTarget, numTargetFaces,
+                                                numNeighbours, modes);
+    }
+    bytes += estimate_inlier_memory(numFloating);
+    return bytes;
+}//end estimate_rigid_registration_memory()
+
+
+size_t estimate_nonrigid_registration_memory(const size_t numFloating, const size_t numTarget,
+                                             const size_t numFloatingFaces, const size_t numTargetFaces,
+                                             const size_t numNeighbours, const bool symmetric,
+                                             const CorrespondenceMemoryModes &modes,
+                                             const float surfaceArea, const float directRadius){
+    //# Same filters as the rigid registration, plus the final inlier weights
+    //# and displacement field, and the visco-elastic transformer
+    size_t bytes = estimate_rigid_registration_memory(numFloating, numTarget, numTargetFaces,
+                                                      numNeighbours, symmetric, modes);
+    bytes += estimate_dense_memory(numFloating, 4);
+    bytes += estimate_viscoelastic_memory(numFloating, numFloatingFaces, 10, surfaceArea, directRadius);
+    return bytes;
+}//end estimate_nonrigid_registration_memory()
+
+
+std::string format_memory(const size_t bytes){
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(1);
+    if (bytes >= (size_t(1) << 30)) { stream << double(bytes) / double(size_t(1) << 30) << " GB";}
+    else if (bytes >= (size_t(1) << 20)) { stream << double(bytes) / double(size_t(1) << 20) << " MB";}
+    else if (bytes >= (size_t(1) << 10)) { stream << double(bytes) / double(size_t(1) << 10) << " kB";}
+    else { stream << bytes << " B";}
+    return stream.str();
+}//end format_memory()
+
+}//namespace registration
@@ -0,0 +1,156 @@
+#ifndef MEMORYACCOUNTING_HPP
+#define MEMORYACCOUNTING_HPP
+
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+#include <vector>
+#include <string>
+#include <iostream>
+#include "../global.hpp"
+#include "MatrixView.hpp"
+
+namespace registration {
+
+/*
+# GOAL
+Size tracking of the large buffers of a registration (dense Eigen matrices,
+sparse matrices, kd-trees and meshes), used to report the peak memory usage
+of a registration and to check it against a memory budget before anything is
+allocated.
+
+The filters report the bytes they actually hold with get_memory_usage(). The
+estimate_*() functions predict the same quantities from the sizes of the
+inputs only, so a registration can decide on its modes (or refuse to run)
+before allocating.
+*/
+
+//# Outcome of checking a registration against its memory budget
+enum MemoryStatus {
+    MEMORY_OK = 0,          //fits in the budget (or no budget)
+    MEMORY_REDUCED = 1,     //fits after switching to lower-memory modes
+    MEMORY_OVER_BUDGET = 2  //doesn't fit: the registration was not run
+};
+
+//# Modes of the correspondence filters that cost memory
+struct CorrespondenceMemoryModes {
+    bool surfaceMatching = false;
+    bool positionalSearch = false;
+    bool selectiveUpdate = false;
+};
+
+//# Bytes held by dense and sparse Eigen matrices
+template <typename Derived>
+size_t memory_usage(const Eigen::PlainObjectBase<Derived> &matrix) {
+    return size_t(matrix.size()) * sizeof(typename Derived::Scalar);
+}
+
+template <typename Scalar, int Options, typename StorageIndex>
+size_t memory_usage(const Eigen::SparseMatrix<Scalar, Options, StorageIndex> &matrix) {
+    size_t bytes = size_t(matrix.data().allocatedSize()) * (sizeof(Scalar) + sizeof(StorageIndex));
+    bytes += size_t(matrix.outerSize() + 1) * sizeof(StorageIndex);
+    if (!matrix.isCompressed()) { bytes += size_t(matrix.outerSize()) * sizeof(StorageIndex);}
+    return bytes;
+}
+
+template <typename T>
+size_t memory_usage(const std::vector<T> &vector) {
+    return vector.capacity() * sizeof(T);
+}
+
+//# Estimates
+//## Dense matrix
+size_t estimate_dense_memory(const size_t numRows, const size_t numCols,
+                             const size_t scalarBytes = sizeof(float));
+//## Sparse matrix (compressed)
+size_t estimate_sparse_memory(const size_t numOuter, const size_t numNonZeros,
+                              const size_t scalarBytes = sizeof(float));
+//## nanoflann kd-tree (the points themselves are not copied)
+size_t estimate_kdtree_memory(const size_t numPoints, const size_t leafSize = 15);
+//## OpenMesh TriMesh with vertex and face normals and status
+size_t estimate_mesh_memory(const size_t numVertices, const size_t numFaces);
+//## Bounding volume hierarchy over the target faces (surface matching)
+size_t estimate_bvh_memory(const size_t numFaces, const size_t numQueried,
+                           const size_t leafSize = 4);
+//## CorrespondenceFilter from 'numQueried' floating to 'numSource' target features
+size_t estimate_correspondence_memory(const size_t numQueried, const size_t numSource,
+                                      const size_t numSourceFaces, const size_t numNeighbours,
+                                      const CorrespondenceMemoryModes &modes);
+//## SymmetricCorrespondenceFilter (push and pull filter and the fused affinity)
+size_t estimate_symmetric_correspondence_memory(const size_t numFloating, const size_t numTarget,
+                                                const size_t numTargetFaces, const size_t numNeighbours,
+                                                const CorrespondenceMemoryModes &modes);
+//## InlierDetector
+size_t estimate_inlier_memory(const size_t numFloating);
+//## ViscoElasticTransformer (including its copy of the floating mesh). With
+//## a direct regularisation radius (zero if it's off) the sparse operator over
+//## all nodes within that radius is added, for a mesh of the given area.
+size_t estimate_viscoelastic_memory(const size_t numFloating, const size_t numFloatingFaces,
+                                    const size_t numNeighbours = 10,
+                                    const float surfaceArea = 0.0f, const float directRadius = 0.0f);
+//## Operator of the direct regularisation (including the radius search and
+//## the triplets it is built from)
+size_t estimate_regularisation_operator_memory(const size_t numFloating, const float surfaceArea,
+                                               const float radius);
+//## Area of a mesh: the summed area of its faces, or half the surface of the
+//## bounding box of its positions if the faces don't span an area
+float estimate_surface_area(const ConstFeatureView &features, const ConstFacesView &faces);
+
+//## Downsampler (OpenMesh copy of the full mesh and the quadric decimater)
+size_t estimate_downsampler_memory(const size_t numVertices, const size_t numFaces);
+//## Rigid and nonrigid registration (all the filters and the registration's own buffers)
+size_t estimate_rigid_registration_memory(const size_t numFloating, const size_t numTarget,
+                                          const size_t numTargetFaces, const size_t numNeighbours,
+                                          const bool symmetric, const CorrespondenceMemoryModes &modes);
+size_t estimate_nonrigid_registration_memory(const size_t numFloating, const size_t numTarget,
+                                             const size_t numFloatingFaces, const size_t numTargetFaces,
+                                             const size_t numNeighbours, const bool symmetric,
+                                             const CorrespondenceMemoryModes &modes,
+                                             const float surfaceArea = 0.0f, const float directRadius = 0.0f);
+
+//# Pretty print a number of bytes
+std::string format_memory(const size_t bytes);
+
+/*
+Check a registration against its memory budget (no budget if zero). While the
+estimate doesn't fit, the memory hungry modes are switched off in this order:
+selective update, positional search, surface matching. 'estimate' is called
+with the modes and returns the estimated peak memory in bytes. The estimates
+include the temporary buffers (e.g. the triplets an affinity matrix is built
+from), so they are an upper bound of what get_memory_usage() reports.
+*/
+template <typename Estimator>
+MemoryStatus fit_memory_budget(const size_t memoryBudget, CorrespondenceMemoryModes &ioModes,
+                               const Estimator &estimate, const char * const caller) {
+    if (memoryBudget == 0) { return MEMORY_OK;}
+    size_t estimatedMemory = estimate(ioModes);
+    if (estimatedMemory <= memoryBudget) { return MEMORY_OK;}
+
+    bool * const modes[3] = {&ioModes.selectiveUpdate, &ioModes.positionalSearch, &ioModes.surfaceMatching};
+    const char * const names[3] = {"selective update", "positional search", "surface matching"};
+    for (size_t m = 0 ; (m < 3) && (estimatedMemory > memoryBudget) ; m++) {
+        if (*modes[m] == false) { continue;}
+        //## Only switch a mode off if that saves memory (e.g. the positional
+        //## search isn't used when matching to the surface)
+        *modes[m] = false;
+        const size_t reducedMemory = estimate(ioModes);
+        if (reducedMemory >= estimatedMemory) {
+            *modes[m] = true;
+            continue;
+        }
+        estimatedMemory = reducedMemory;
+        std::cerr << caller << ": switched off " << names[m] << " to fit the memory budget of "
+                  << format_memory(memoryBudget) << " (estimate now " << format_memory(estimatedMemory)
+                  << ")." << std::endl;
+    }
+    if (estimatedMemory > memoryBudget) {
+        std::cerr << caller << ": the estimated memory usage of " << format_memory(estimatedMemory)
+                  << " exceeds the memory budget of " << format_memory(memoryBudget)
+                  << ". The registration was not run." << std::endl;
+        return MEMORY_OVER_BUDGET;
+    }
+    return MEMORY_REDUCED;
+}
+
+}//namespace registration
+
+#endif // MEMORYACCOUNTING_HPP
@@ -3,12 +3,25 @@
 
 #include <Eigen/Dense>
 #include <nanoflann.hpp>
+#include <limits>
+#include <vector>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "../global.hpp"
+#include "Tracer.hpp"
+#include "PerformanceCounters.hpp"
+#include "MemoryAccounting.hpp"
+#include "AutoTuner.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat;
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::VectorXf VecDynFloat;
 
 namespace registration {
 
@@ -25,41 +38,79 @@ class NeighbourFinder
     INPUT
     -inQueriedPoints:
     -inSourcePoints:
+    Both are views (see MatrixView), so they can be e.g. rows of a NumPy
+    array. The kd-tree refers to the source points, so they have to stay
+    where they are until other source points are set.
 
     PARAMETERS
     -numNeighbours(= 3): number of nearest neighbours
-    -leafSize(= 15): should be between 5 and 50 or so
+    -leafSize(= 15): should be between 5 and 50 or so. Taken from the
+    AutoTuner profile when the source points are set.
+    -maxDistance(= 0.0): if larger than zero, only neighbours closer than
+    this distance are searched. The search then stops early for queried points
+    that lie far away from the source points. Neighbours that were not found
+    get index -1 (and the squared maximum distance).
 
     OUTPUT
     -outNeighbourIndices
     -outNeighbourSquaredDistances.
+
+    The queries are done in parallel (OpenMP) with the threads and grain size
+    of the AutoTuner profile.
+
+    RADIUS SEARCH
+    update_radius() searches all neighbours within a radius instead (at most
+    maxNumNeighbours, the nearest ones, if that is larger than zero). The
+    number of neighbours differs per queried element, so the output is stored
+    in compressed sparse row format:
+    -outRadiusOffsets: the neighbours of queried element i are stored at
+    positions outRadiusOffsets[i] up to outRadiusOffsets[i+1] (size M+1),
+    -outRadiusIndices and outRadiusSquaredDistances: the neighbours.
+    The neighbours of each element are sorted by distance only when capped.
+    The queries are done in parallel (OpenMP) and reuse the kd-tree of the
+    source points. The output doesn't depend on the number of threads.
     */
 
     public:
         //NeighbourFinder();
         ~NeighbourFinder(); //destructor
 
-        void set_source_points(const VecMatType * const inQueriedPoints);
-        void set_queried_points(const VecMatType * const _inSourcePoints);
+        typedef MatrixView<const VecMatType> PointsView;
+        void set_source_points(const PointsView &inSourcePoints);
+        void set_queried_points(const PointsView &inQueriedPoints);
         MatDynInt get_indices() const { return _outNeighbourIndices;}
         MatDynFloat get_distances() const { return _outNeighbourSquaredDistances;}
         void set_parameters(const size_t numNeighbours);
+        void set_max_distance(const float maxDistance);
         void update();
+        //## Only query the elements of 'inQueriedPoints' with the given row
+        //## indices. The other rows of the outputs are left untouched.
+        void update_subset(const std::vector<size_t> &queriedIndices);
+        //## Radius search (see above)
+        void update_radius(const float radius, const size_t maxNumNeighbours = 0);
+        VecDynInt get_radius_offsets() const { return _outRadiusOffsets;}
+        VecDynInt get_radius_indices() const { return _outRadiusIndices;}
+        VecDynFloat get_radius_distances() const { return _outRadiusSquaredDistances;}
+        //## Bytes held by the kd-tree and the outputs
+        size_t get_memory_usage() const;
 
     protected:
 
     private:
         //# Inputs
-        const VecMatType * _inQueriedPoints = NULL;
-        const VecMatType * _inSourcePoints = NULL;
+        PointsView _inQueriedPoints;
+        PointsView _inSourcePoints;
 
         //# Outputs
         MatDynInt _outNeighbourIndices;
         MatDynFloat _outNeighbourSquaredDistances;
+        VecDynInt _outRadiusOffsets;
+        VecDynInt _outRadiusIndices;
+        VecDynFloat _outRadiusSquaredDistances;
         //# User parameters
 
         //# Internal Data structures
-        nanoflann::KDTreeEigenMatrixAdaptor<VecMatType> * _kdTree = NULL;
+        nanoflann::KDTreeEigenMatrixAdaptor<PointsView> * _kdTree = NULL;
 
         //# Interal parameters
         size_t _numDimensions = 0;
@@ -67,6 +118,11 @@ class NeighbourFinder
         size_t _numQueriedElements = 0;
         size_t _numNeighbours = 3;
         size_t _leafSize = 15;
+        float _maxDistance = 0.0f;
+
+        //# Internal functions
+        //## Query the kd-tree for the given rows (all rows if NULL)
+        void _query(const std::vector<size_t> * const queriedIndices);
 
 };
 
@@ -88,30 +144,30 @@ NeighbourFinder<VecMatType>::~NeighbourFinder()
 }
 
 template <typename VecMatType>
-void NeighbourFinder<VecMatType>::set_source_points(const VecMatType * const inSourcePoints){
+void NeighbourFinder<VecMatType>::set_source_points(const PointsView &inSourcePoints){
     //# Set input
-    _inSourcePoints = inSourcePoints;
+    _inSourcePoints.reset(inSourcePoints);
 
     //# Update internal parameters
-    _numDimensions = _inSourcePoints->cols();
-    _numSourceElements = _inSourcePoints->rows();
+    _numDimensions = _inSourcePoints.cols();
+    _numSourceElements = _inSourcePoints.rows();
 
     //# Update internal data structures
     //## The kd-tree has to be rebuilt.
     if (_kdTree != NULL) { delete _kdTree; _kdTree = NULL;}
-    _kdTree = new nanoflann::KDTreeEigenMatrixAdaptor<VecMatType>(*_inSourcePoints,
-                                                                _leafSize);
+    _leafSize = AutoTuner::get_profile().leafSize;
+    _kdTree = new nanoflann::KDTreeEigenMatrixAdaptor<PointsView>(_inSourcePoints, _leafSize);
     _kdTree->index->buildIndex();
 }
 
 
 template <typename VecMatType>
-void NeighbourFinder<VecMatType>::set_queried_points(const VecMatType * const inQueriedPoints){
+void NeighbourFinder<VecMatType>::set_queried_points(const PointsView &inQueriedPoints){
     //# Set input
-    _inQueriedPoints = inQueriedPoints;
+    _inQueriedPoints.reset(inQueriedPoints);
 
     //# Update internal parameters
-    _numQueriedElements = _inQueriedPoints->rows();
+    _numQueriedElements = _inQueriedPoints.rows();
 
     //# Adjust internal data structures
     //## The indices and distance matrices have to be resized.
@@ -137,43 +193,175 @@ void NeighbourFinder<VecMatType>::set_parameters(const size_t numNeighbours){
     }
 }
 
+template <typename VecMatType>
+void NeighbourFinder<VecMatType>::set_max_distance(const float maxDistance){
+    _maxDistance = maxDistance;
+    if (_maxDistance < 0.0f) { _maxDistance = 0.0f;}
+}
+
+template <typename VecMatType>
+size_t NeighbourFinder<VecMatType>::get_memory_usage() const{
+    size_t bytes = memory_usage(_outNeighbourIndices) + memory_usage(_outNeighbourSquaredDistances);
+    bytes += memory_usage(_outRadiusOffsets) + memory_usage(_outRadiusIndices);
+    bytes += memory_usage(_outRadiusSquaredDistances);
+    if (_kdTree != NULL) { bytes += estimate_kdtree_memory(_numSourceElements, _leafSize);}
+    return bytes;
+}//end get_memory_usage()
+
 template <typename VecMatType>
 void NeighbourFinder<VecMatType>::update(){
+    _query(NULL);
+}//end update()
+
+template <typename VecMatType>
+void NeighbourFinder<VecMatType>::update_subset(const std::vector<size_t> &queriedIndices){
+    _query(&queriedIndices);
+}//end update_subset()
+
+template <typename VecMatType>
+void NeighbourFinder<VecMatType>::_query(const std::vector<size_t> * const queriedIndices){
+    MESHMONK_TRACE_SCOPE("NeighbourFinder::knn_query");
 
     //# Query the kd-tree
     //## Loop over the queried features
     //### Initialize variables we'll need during the loop
-    unsigned int i = 0;
-    unsigned int j = 0;
-    std::vector<float> queriedFeature(_numDimensions);
-    std::vector<size_t> neighbourIndices(_numNeighbours);
-    std::vector<float> neighbourSquaredDistances(_numNeighbours);
-    nanoflann::KNNResultSet<float> knnResultSet(_numNeighbours);
-
-    //### Execute loop
-    for ( ; i < _numQueriedElements ; ++i ) {
-        //### Initiliaze the knnResultSet
-        knnResultSet.init(&neighbourIndices[0], &neighbourSquaredDistances[0]);
-
-        //### convert input features to 'queriedFeature' std::vector structure
-        //### (required by nanoflann's kd-tree).
-        for (j = 0 ; j < _numDimensions ; ++j) {
-            queriedFeature[j] = (*_inQueriedPoints)(i,j);
+    const size_t numQueries = (queriedIndices != NULL) ? queriedIndices->size() : _numQueriedElements;
+    MESHMONK_COUNT_STAGE("knn_query", numQueries);
+    const bool bounded = (_maxDistance > 0.0f) && (_numNeighbours > 0);
+    const float maxSquaredDistance = bounded ? _maxDistance * _maxDistance
+                                             : std::numeric_limits<float>::max();
+    const TuningProfile profile = AutoTuner::get_profile();
+    const int numThreads = AutoTuner::num_threads(profile);
+    const int chunkSize = AutoTuner::chunk_size(profile, numQueries);
+
+    //### Execute loop (each row of the outputs is written by one thread only)
+    #pragma omp parallel num_threads(numThreads)
+    {
+        std::vector<float> queriedFeature(_numDimensions);
+        std::vector<size_t> neighbourIndices(_numNeighbours);
+        std::vector<float> neighbourSquaredDistances(_numNeighbours);
+        nanoflann::KNNResultSet<float> knnResultSet(_numNeighbours);
+
+        #pragma omp for schedule(dynamic, chunkSize)
+        for (long q = 0 ; q < long(numQueries) ; ++q ) {
+            const size_t i = (queriedIndices != NULL) ? (*queriedIndices)[q] : size_t(q);
+            //### Initiliaze the knnResultSet
+            knnResultSet.init(&neighbourIndices[0], &neighbourSquaredDistances[0]);
+            //### nanoflann prunes against the last (worst) distance of the result
+            //### set, so starting it at the maximum distance bounds the search.
+            if (bounded) { neighbourSquaredDistances[_numNeighbours-1] = maxSquaredDistance;}
+
+            //### convert input features to 'queriedFeature' std::vector structure
+            //### (required by nanoflann's kd-tree).
+            for (size_t j = 0 ; j < _numDimensions ; ++j) {
+                queriedFeature[j] = _inQueriedPoints(i,j);
+            }
+
+            //### Query the kd-tree
+            _kdTree->index->findNeighbors(knnResultSet, &queriedFeature[0],
+                                        nanoflann::SearchParams(32, 0.0001 /*eps*/, true));
+
+            //### Copy the result into the outputs by looping over the k nearest
+            //### neighbours
+            const size_t numNeighboursFound = knnResultSet.size();
+            size_t j = 0;
+            for ( ; j < numNeighboursFound ; ++j) {
+                _outNeighbourIndices(i,j) = neighbourIndices[j];
+                _outNeighbourSquaredDistances(i,j) = neighbourSquaredDistances[j];
+            }
+            for ( ; j < _numNeighbours ; ++j) {
+                _outNeighbourIndices(i,j) = -1;
+                _outNeighbourSquaredDistances(i,j) = maxSquaredDistance;
+            }
+        }
+    }
+}//end _query()
+
+template <typename VecMatType>
+void NeighbourFinder<VecMatType>::update_radius(const float radius, const size_t maxNumNeighbours){
+    if (_kdTree == NULL) {
+        std::cerr << "NeighbourFinder::update_radius() called without source points!" << std::endl;
+        return;
+    }
+    typedef typename VecMatType::Index IndexType;
+    const float squaredRadius = radius * radius;
+
+    //# Query the kd-tree
+    //## The queried elements are split into contiguous blocks (one per
+    //## thread of the profile) that collect their results in their own
+    //## buffers, so no locking is needed and the output order doesn't depend
+    //## on the number of threads. The blocks are shared out with 'omp for',
+    //## so they are all queried even if OpenMP gives a smaller team.
+    const int numThreads = AutoTuner::num_threads(AutoTuner::get_profile());
+    const int numBlocks = std::max(1, numThreads);
+    std::vector<int> offsets(_numQueriedElements + 1, 0);
+    std::vector<std::vector<IndexType> > blockIndices(numBlocks);
+    std::vector<std::vector<float> > blockSquaredDistances(numBlocks);
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        //### Initialize variables we'll need during the loop
+        std::vector<float> queriedFeature(_numDimensions);
+        std::vector<std::pair<IndexType, float> > matches;
+        std::vector<IndexType> cappedIndices(maxNumNeighbours + 1);
+        std::vector<float> cappedSquaredDistances(maxNumNeighbours + 1);
+        nanoflann::KNNResultSet<float, IndexType> cappedResultSet(maxNumNeighbours);
+        nanoflann::SearchParams searchParams;
+        searchParams.sorted = false;
+
+        #pragma omp for schedule(static)
+        for (int block = 0 ; block < numBlocks ; block++) {
+            MESHMONK_TRACE_SCOPE_ARG("NeighbourFinder::radius_query_block", "block", block);
+            const size_t first = _numQueriedElements * block / numBlocks;
+            const size_t last = _numQueriedElements * (block + 1) / numBlocks;
+            std::vector<IndexType> &indices = blockIndices[block];
+            std::vector<float> &squaredDistances = blockSquaredDistances[block];
+
+            for (size_t i = first ; i < last ; i++) {
+                for (size_t j = 0 ; j < _numDimensions ; ++j) {
+                    queriedFeature[j] = _inQueriedPoints(i,j);
+                }
+
+                size_t numFound = 0;
+                if (maxNumNeighbours > 0) {
+                    //### Capped: the nearest neighbours, bounded by the radius
+                    cappedResultSet.init(&cappedIndices[0], &cappedSquaredDistances[0]);
+                    cappedSquaredDistances[maxNumNeighbours-1] = squaredRadius;
+                    _kdTree->index->findNeighbors(cappedResultSet, &queriedFeature[0], searchParams);
+                    numFound = cappedResultSet.size();
+                    indices.insert(indices.end(), cappedIndices.begin(), cappedIndices.begin() + numFound);
+                    squaredDistances.insert(squaredDistances.end(), cappedSquaredDistances.begin(), cappedSquaredDistances.begin() + numFound);
+                }
+                else {
+                    //### Uncapped: all neighbours within the radius
+                    numFound = _kdTree->index->radiusSearch(&queriedFeature[0], squaredRadius, matches, searchParams);
+                    for (size_t m = 0 ; m < numFound ; m++) {
+                        indices.push_back(matches[m].first);
+                        squaredDistances.push_back(matches[m].second);
+                    }
+                }
+                offsets[i+1] = numFound;
+            }
         }
+    }
 
-        //### Query the kd-tree
-//        size_t numNeighboursFound = kdTree.knnSearch(&queriedFeature[0], _numNeighbours, &neighbourIndices[0], &neighbourSquaredDistances[0]);
-        _kdTree->index->findNeighbors(knnResultSet, &queriedFeature[0],
-                                    nanoflann::SearchParams(32, 0.0001 /*eps*/, true));
+    //# Convert the number of neighbours into offsets
+    for (size_t i = 0 ; i < _numQueriedElements ; i++) {
+        offsets[i+1] += offsets[i];
+    }
 
-        //### Copy the result into the outputs by looping over the k nearest
-        //### neighbours
-        for (j = 0 ; j < _numNeighbours ; ++j) {
-            _outNeighbourIndices(i,j) = neighbourIndices[j];
-            _outNeighbourSquaredDistances(i,j) = neighbourSquaredDistances[j];
+    //# Copy the blocks into the outputs (they are already in the right order)
+    _outRadiusOffsets = Eigen::Map<VecDynInt>(offsets.data(), offsets.size());
+    _outRadiusIndices.resize(offsets[_numQueriedElements]);
+    _outRadiusSquaredDistances.resize(offsets[_numQueriedElements]);
+    size_t position = 0;
+    for (int block = 0 ; block < numBlocks ; block++) {
+        for (size_t m = 0 ; m < blockIndices[block].size() ; m++, position++) {
+            _outRadiusIndices[position] = int(blockIndices[block][m]);
+            _outRadiusSquaredDistances[position] = blockSquaredDistances[block][m];
         }
     }
-}//end k_nearest_neighbours()
+}//end update_radius()
 
 } //namespace registration
 
@@ -0,0 +1,257 @@
+#ifndef NEIGHBOURGRAPH_HPP
+#define NEIGHBOURGRAPH_HPP
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <iostream>
+
+typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
+typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
+
+namespace registration {
+
+//# 16 bit floating point weights
+//## bfloat16: the upper half of a float (8 exponent bits, 7 mantissa bits).
+//## Same range as a float, about 3 significant digits.
+struct Bfloat16 {
+    uint16_t bits;
+
+    static Bfloat16 from_float(const float value) {
+        uint32_t floatBits;
+        std::memcpy(&floatBits, &value, sizeof(floatBits));
+        Bfloat16 result;
+        if ((floatBits & 0x7fffffffu) > 0x7f800000u) { result.bits = uint16_t((floatBits >> 16) | 0x0040u); return result;} //NaN
+        //## Round to nearest even
+        floatBits += 0x7fffu + ((floatBits >> 16) & 1u);
+        result.bits = uint16_t(floatBits >> 16);
+        return result;
+    }
+    float to_float() const {
+        const uint32_t floatBits = uint32_t(bits) << 16;
+        float value;
+        std::memcpy(&value, &floatBits, sizeof(value));
+        return value;
+    }
+};
+
+//## IEEE half precision (5 exponent bits, 10 mantissa bits). More precise
+//## than bfloat16, but values below 6.1e-5 lose precision (subnormals) and
+//## values above 65504 overflow.
+struct Float16 {
+    uint16_t bits;
+
+    static Float16 from_float(const float value) {
+        uint32_t floatBits;
+        std::memcpy(&floatBits, &value, sizeof(floatBits));
+        const uint32_t sign = (floatBits >> 16) & 0x8000u;
+        const uint32_t absBits = floatBits & 0x7fffffffu;
+        Float16 result;
+        if (absBits >= 0x7f800000u) { //Inf or NaN
+            result.bits = uint16_t(sign | 0x7c00u | ((absBits > 0x7f800000u) ? 0x0200u : 0u));
+        }
+        else if (absBits >= 0x477ff000u) { //overflows to Inf after rounding
+            result.bits = uint16_t(sign | 0x7c00u);
+        }
+        else if (absBits < 0x38800000u) { //subnormal (or zero)
+            const uint32_t shift = 126u - (absBits >> 23);
+            if (shift > 24u) { result.bits = uint16_t(sign); return result;}
+            const uint32_t mantissa = (absBits & 0x007fffffu) | 0x00800000u;
+            uint32_t halfMantissa = mantissa >> shift;
+            const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+            const uint32_t halfway = 1u << (shift - 1u);
+            if ((remainder > halfway) || ((remainder == halfway) && (halfMantissa & 1u))) { halfMantissa++;}
+            result.bits = uint16_t(sign | halfMantissa);
+        }
+        else { //normal: rebias the exponent and round to nearest even
+            uint32_t halfBits = ((absBits - 0x38000000u) >> 13);
+            const uint32_t remainder = absBits & 0x1fffu;
+            if ((remainder > 0x1000u) || ((remainder == 0x1000u) && (halfBits & 1u))) { halfBits++;}
+            result.bits = uint16_t(sign | halfBits);
+        }
+        return result;
+    }
+    float to_float() const {
+        const uint32_t sign = uint32_t(bits & 0x8000u) << 16;
+        const uint32_t exponent = (bits >> 10) & 0x1fu;
+        uint32_t mantissa = bits & 0x03ffu;
+        uint32_t floatBits = 0;
+        if (exponent == 0x1fu) { floatBits = sign | 0x7f800000u | (mantissa << 13);}
+        else if (exponent != 0) { floatBits = sign | ((exponent + 112u) << 23) | (mantissa << 13);}
+        else if (mantissa != 0) { //subnormal: normalise
+            uint32_t floatExponent = 113u;
+            while ((mantissa & 0x0400u) == 0) { mantissa <<= 1; floatExponent--;}
+            floatBits = sign | (floatExponent << 23) | ((mantissa & 0x03ffu) << 13);
+        }
+        else { floatBits = sign;}
+        float value;
+        std::memcpy(&value, &floatBits, sizeof(value));
+        return value;
+    }
+};
+
+
+template <typename WeightType = Bfloat16, int FixedNeighbours = Eigen::Dynamic>
+class NeighbourGraph
+{
+    /*
+    # GOAL
+    Compact storage of a k-nearest-neighbour graph with a weight per edge,
+    for the smoothing passes that gather over the neighbours of every vertex
+    (e.g. ViscoElasticTransformer).
+
+    Each vertex has one contiguous row: its k neighbour indices (uint32,
+    stored as two 16 bit words) followed by its k weights (16 bit, Bfloat16
+    or Float16). That is 6 bytes per edge instead of 8 (int index plus float
+    weight), and one stream instead of two column-major matrices, where the
+    neighbours of a vertex are numElements apart.
+
+    If FixedNeighbours is given, k is a compile time constant and the loops
+    over the neighbours can be unrolled. Otherwise (Eigen::Dynamic) k is set
+    at runtime.
+
+    # USAGE
+    NeighbourGraph<Bfloat16, 10> graph;
+    graph.assign(neighbourIndices, smoothingWeights);
+    for (size_t j = 0 ; j < graph.num_neighbours() ; j++) {
+        ... graph.index(i,j) ... graph.weight(i,j) ...
+    }
+    */
+
+    public:
+        static const bool isFixed = (FixedNeighbours != Eigen::Dynamic);
+
+        //# Allocate for numElements rows of numNeighbours edges (the contents
+        //# are undefined)
+        void resize(const size_t numElements, const size_t numNeighbours) {
+            if (isFixed && (numNeighbours != size_t(FixedNeighbours))) {
+                std::cerr << "NeighbourGraph: the number of neighbours is fixed to " << FixedNeighbours
+                          << " at compile time, not " << numNeighbours << "!" << std::endl;
+                return;
+            }
+            _numElements = numElements;
+            _numNeighbours = numNeighbours;
+            _data.assign(_numElements * row_words(), 0u);
+        }
+
+        //# Copy a neighbour table (rows: elements, columns: neighbours) and
+        //# its weights
+        void assign(const MatDynInt &neighbourIndices, const MatDynFloat &weights) {
+            resize(neighbourIndices.rows(), neighbourIndices.cols());
+            if (_numElements != size_t(neighbourIndices.rows())) { return;}
+            for (size_t i = 0 ; i < _numElements ; i++) {
+                for (size_t j = 0 ; j < _numNeighbours ; j++) {
+                    set(i, j, uint32_t(neighbourIndices(i,j)), weights(i,j));
+                }
+            }
+        }
+
+        void set(const size_t i, const size_t j, const uint32_t neighbourIndex, const float weight) {
+            uint16_t * const row = &_data[i * row_words()];
+            row[2*j] = uint16_t(neighbourIndex & 0xffffu);
+            row[2*j+1] = uint16_t(neighbourIndex >> 16);
+            row[2*num_neighbours() + j] = WeightType::from_float(weight).bits;
+        }
+
+        size_t num_elements() const { return _numElements;}
+        size_t num_neighbours() const { return isFixed ? size_t(FixedNeighbours) : _numNeighbours;}
+
+        //# Edge access
+        uint32_t index(const size_t i, const size_t j) const {
+            const uint16_t * const row = &_data[i * row_words()];
+            return uint32_t(row[2*j]) | (uint32_t(row[2*j+1]) << 16);
+        }
+        float weight(const size_t i, const size_t j) const {
+            WeightType weight;
+            weight.bits = _data[i * row_words() + 2*num_neighbours() + j];
+            return weight.to_float();
+        }
+
+        //# Bytes held by the graph
+        size_t get_memory_usage() const { return _data.capacity() * sizeof(uint16_t);}
+
+    private:
+        size_t _numElements = 0;
+        size_t _numNeighbours = isFixed ? size_t(FixedNeighbours) : 0;
+        //## Per row: the indices (two 16 bit words each, low word first),
+        //## then the weights
+        std::vector<uint16_t> _data;
+
+        size_t row_words() const { return 3 * num_neighbours();}
+};
+
+
+//# The same edge access on the (uncompressed) index and weight matrices, so
+//# code written for a NeighbourGraph works on both
+class NeighbourTable
+{
+    public:
+        NeighbourTable(const MatDynInt &neighbourIndices, const MatDynFloat &weights)
+            : _neighbourIndices(neighbourIndices), _weights(weights) {}
+
+        size_t num_elements() const { return _neighbourIndices.rows();}
+        size_t num_neighbours() const { return _neighbourIndices.cols();}
+        uint32_t index(const size_t i, const size_t j) const { return uint32_t(_neighbourIndices(i,j));}
+        float weight(const size_t i, const size_t j) const { return _weights(i,j);}
+
+    private:
+        const MatDynInt &_neighbourIndices;
+        const MatDynFloat &_weights;
+};
+
+
+//# Greedy colouring of a neighbour table: two vertices get different colours
+//# if one is a neighbour of the other, so all vertices of one colour can be
+//# updated in place in parallel (multicolour Gauss-Seidel). The vertices of
+//# colour c are outOrder[outOffsets[c]] up to outOrder[outOffsets[c+1]-1].
+//# Returns the number of colours.
+inline size_t colour_neighbour_graph(const MatDynInt &neighbourIndices,
+                                     std::vector<int> &outOrder, std::vector<int> &outOffsets){
+    const size_t numElements = neighbourIndices.rows();
+    const size_t numNeighbours = neighbourIndices.cols();
+
+    //# Reverse edges (the vertices that have i as a neighbour), as offsets and indices
+    std::vector<int> reverseOffsets(numElements + 1, 0);
+    for (size_t i = 0 ; i < numElements ; i++) {
+        for (size_t j = 0 ; j < numNeighbours ; j++) { reverseOffsets[neighbourIndices(i,j) + 1]++;}
+    }
+    for (size_t i = 0 ; i < numElements ; i++) { reverseOffsets[i+1] += reverseOffsets[i];}
+    std::vector<int> reverseIndices(reverseOffsets[numElements]);
+    std::vector<int> fill(reverseOffsets.begin(), reverseOffsets.end() - 1);
+    for (size_t i = 0 ; i < numElements ; i++) {
+        for (size_t j = 0 ; j < numNeighbours ; j++) { reverseIndices[fill[neighbourIndices(i,j)]++] = int(i);}
+    }
+
+    //# Smallest colour not used by a (forward or reverse) neighbour
+    std::vector<int> colours(numElements, -1);
+    std::vector<size_t> usedBy; //last vertex that saw each colour in use
+    size_t numColours = 0;
+    for (size_t i = 0 ; i < numElements ; i++) {
+        for (size_t j = 0 ; j < numNeighbours ; j++) {
+            const int colour = colours[neighbourIndices(i,j)];
+            if (colour >= 0) { usedBy[colour] = i;}
+        }
+        for (int m = reverseOffsets[i] ; m < reverseOffsets[i+1] ; m++) {
+            const int colour = colours[reverseIndices[m]];
+            if (colour >= 0) { usedBy[colour] = i;}
+        }
+        size_t colour = 0;
+        while ((colour < numColours) && (usedBy[colour] == i)) { colour++;}
+        if (colour == numColours) { numColours++; usedBy.push_back(numElements);}
+        colours[i] = int(colour);
+    }
+
+    //# Sort the vertices by colour (keeping their order within a colour)
+    outOffsets.assign(numColours + 1, 0);
+    for (size_t i = 0 ; i < numElements ; i++) { outOffsets[colours[i] + 1]++;}
+    for (size_t c = 0 ; c < numColours ; c++) { outOffsets[c+1] += outOffsets[c];}
+    outOrder.resize(numElements);
+    fill.assign(outOffsets.begin(), outOffsets.end() - 1);
+    for (size_t i = 0 ; i < numElements ; i++) { outOrder[fill[colours[i]]++] = int(i);}
+    return numColours;
+}
+
+}//namespace registration
+
+#endif // NEIGHBOURGRAPH_HPP
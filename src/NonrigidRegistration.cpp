@@ -1,17 +1,20 @@
 #include "NonrigidRegistration.hpp"
+#include "Tracer.hpp"
+#include "AutoTuner.hpp"
+#include "RegistrationPipeline.hpp"
 
 namespace registration {
 
-void NonrigidRegistration::set_input(FeatureMat * const ioFloatingFeatures,
-                            const FeatureMat * const inTargetFeatures,
-                            const FacesMat * const inFloatingFaces,
-                            const VecDynFloat * const inFloatingFlags,
-                            const VecDynFloat * const inTargetFlags){
-    _ioFloatingFeatures = ioFloatingFeatures;
-    _inTargetFeatures = inTargetFeatures;
-    _inFloatingFaces = inFloatingFaces;
-    _inFloatingFlags = inFloatingFlags;
-    _inTargetFlags = inTargetFlags;
+void NonrigidRegistration::set_input(const FeatureView &ioFloatingFeatures,
+                            const ConstFeatureView &inTargetFeatures,
+                            const ConstFacesView &inFloatingFaces,
+                            const ConstVecView &inFloatingFlags,
+                            const ConstVecView &inTargetFlags){
+    _ioFloatingFeatures.reset(ioFloatingFeatures);
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inFloatingFaces.reset(inFloatingFaces);
+    _inFloatingFlags.reset(inFloatingFlags);
+    _inTargetFlags.reset(inTargetFlags);
 }//end set_input()
 
 void NonrigidRegistration::set_parameters(bool symmetric,
@@ -63,81 +66,140 @@ void NonrigidRegistration::set_parameters(bool symmetric,
 }//end set_parameters()
 
 
+void NonrigidRegistration::set_surface_matching(const bool surfaceMatching,
+                                          const ConstFacesView &inTargetFaces){
+    _surfaceMatching = surfaceMatching;
+    _inTargetFaces.reset(inTargetFaces);
+}//end set_surface_matching()
+
+
+CorrespondenceMemoryModes NonrigidRegistration::_configured_modes() const{
+    CorrespondenceMemoryModes modes;
+    modes.surfaceMatching = _surfaceMatching && (_inTargetFaces.is_set());
+    modes.positionalSearch = _positionalSearch;
+    modes.selectiveUpdate = _selectiveUpdate;
+    return modes;
+}//end _configured_modes()
+
+
+size_t NonrigidRegistration::_estimate_memory(const CorrespondenceMemoryModes &modes) const{
+    const size_t numTargetFaces = (_inTargetFaces.is_set()) ? _inTargetFaces.rows() : 0;
+    //# The operator of the direct regularisation grows with the number of
+    //# floating nodes within its radius, so with the sampling density
+    const float floatingArea = _directRegularisation ? estimate_surface_area(_ioFloatingFeatures, _inFloatingFaces) : 0.0f;
+    const float directRadius = _directRegularisation ? _radiusFactor * _sigmaSmoothing : 0.0f;
+    return estimate_nonrigid_registration_memory(_ioFloatingFeatures.rows(), _inTargetFeatures.rows(),
+                                                 _inFloatingFaces.rows(), numTargetFaces,
+                                                 _numNeighbours, _symmetric, modes,
+                                                 floatingArea, directRadius);
+}//end _estimate_memory()
+
+
 void NonrigidRegistration::update(){
+    MESHMONK_TRACE_SCOPE("NonrigidRegistration::update");
 
-    //# Initializes
-    size_t numFloatingVertices = _ioFloatingFeatures->rows();
-    FeatureMat correspondingFeatures = FeatureMat::Zero(numFloatingVertices, registration::NUM_FEATURES);
-    VecDynFloat correspondingFlags = VecDynFloat::Zero(numFloatingVertices);
+    //# Check the memory budget before allocating anything
+    CorrespondenceMemoryModes modes = _configured_modes();
+    _memoryStatus = fit_memory_budget(_memoryBudget, modes,
+                                      [this](const CorrespondenceMemoryModes &m){ return _estimate_memory(m);},
+                                      "NonrigidRegistration");
+    _peakMemory = 0;
+    _numViscousPasses = 0;
+    _numElasticPasses = 0;
+    if (_memoryStatus == MEMORY_OVER_BUDGET) { return;}
 
-    //# Set up the filters
-    //## Correspondence Filter (note: this part should be improved by using inheritance in the correspondence filter classes)
+    //# Pick up (or tune) the performance profile on the floating features
+    AutoTuner::ensure_tuned(_ioFloatingFeatures);
 
-    BaseCorrespondenceFilter* correspondenceFilter = NULL;
-    //std::unique_ptr<BaseCorrespondenceFilter> correspondenceFilter = new SymmetricCorrespondenceFilter;
+    //# Dispatch to the pipeline for the correspondence filter
+    if (_symmetric) { _run<SymmetricCorrespondences>(modes);}
+    else { _run<PushCorrespondences>(modes);}
 
-    if (_symmetric) {
-        correspondenceFilter = new SymmetricCorrespondenceFilter();
-        correspondenceFilter->set_parameters(_numNeighbours, _flagThreshold, _equalizePushPull);
-    }
-    else {
-        correspondenceFilter = new CorrespondenceFilter();
-        correspondenceFilter->set_parameters(_numNeighbours, _flagThreshold);
-    }
-    correspondenceFilter->set_floating_input(_ioFloatingFeatures, _inFloatingFlags);
-    correspondenceFilter->set_target_input(_inTargetFeatures, _inTargetFlags);
-    correspondenceFilter->set_output(&correspondingFeatures, &correspondingFlags);
+}//end update()
 
 
+template <typename CorrespondencePolicy>
+void NonrigidRegistration::_run(const CorrespondenceMemoryModes &modes){
+    //# Set up the pipeline (correspondences, inliers and visco-elastic transformation)
+    RegistrationPipeline<CorrespondencePolicy, GaussianInliers, ViscoElasticTransform> pipeline;
+    pipeline.set_input(_ioFloatingFeatures, _inFloatingFlags, _inTargetFeatures, _inTargetFlags);
+    //## Correspondence Filter
+    CorrespondenceSettings correspondenceSettings;
+    correspondenceSettings.numNeighbours = _numNeighbours;
+    correspondenceSettings.flagThreshold = _flagThreshold;
+    correspondenceSettings.equalizePushPull = _equalizePushPull;
+    correspondenceSettings.modes = modes;
+    correspondenceSettings.maxDistance = _maxDistance;
+    correspondenceSettings.requeryTolerance = _requeryTolerance;
+    pipeline.correspondences().set_settings(correspondenceSettings);
+    pipeline.correspondences().set_target_faces(_inTargetFaces);
     //## Inlier Filter
-    VecDynFloat floatingWeights = VecDynFloat::Ones(numFloatingVertices);
-    InlierDetector inlierDetector;
-    inlierDetector.set_input(_ioFloatingFeatures, &correspondingFeatures,
-                                &correspondingFlags);
-    inlierDetector.set_output(&floatingWeights);
-    inlierDetector.set_parameters(_kappaa, _inlierUseOrientation);
+    pipeline.inliers().set_parameters(_kappaa, _inlierUseOrientation);
+    pipeline.inliers().set_initial_weights(_inInitialInlierWeights);
     //## Transformation Filter
     _numViscousIterations = _numViscousIterationsStart;
     _numElasticIterations = _numElasticIterationsStart;
-    ViscoElasticTransformer transformer;
-    transformer.set_input(&correspondingFeatures, &floatingWeights, _inFloatingFlags, _inFloatingFaces);
-    transformer.set_output(_ioFloatingFeatures);
+    pipeline.transform().set_floating_faces(_inFloatingFaces);
+    pipeline.transform().set_initial_displacement(_inInitialDisplacementField);
+    pipeline.transform().set_neighbour_positions(_inStartPositions);
+    pipeline.transform().set_smoothing_neighbours(_inNeighbourIndices, _inNeighbourSquaredDistances, _inSmoothingWeights);
+    pipeline.transform().set_parameters(10, _sigmaSmoothing, _numViscousIterations, _numElasticIterations);
+    pipeline.transform().transformer().set_incremental_normals(_incrementalNormals, _normalThreshold);
+    pipeline.transform().transformer().set_compact_neighbours(_compactNeighbours);
+    pipeline.transform().transformer().set_convergence(_smoothingTolerance, _smoothingCheckInterval);
+    pipeline.transform().transformer().set_gauss_seidel(_gaussSeidel);
+    pipeline.transform().set_direct_regularisation(_directRegularisation, _radiusFactor);
+    pipeline.initialize();
 
     //# Perform ICP
     time_t timeStart, timePreIteration, timePostIteration, timeEnd;
     timeStart = time(0);
     std::cout << "Starting Nonrigid Registration process..." << std::endl;
-    for (size_t iteration = 0 ; iteration < _numIterations ; iteration++) {
+    if (_startIteration > 0) {
+        std::cout << "Resuming at iteration " << _startIteration+1 << "/" << _numIterations << std::endl;
+    }
+    for (size_t iteration = _startIteration ; iteration < _numIterations ; iteration++) {
         timePreIteration = time(0);
+        MESHMONK_TRACE_SCOPE_ARG("NonrigidRegistration::iteration", "iteration", iteration);
 
         //# Anneal parameters
         _numViscousIterations = int(std::round(_numViscousIterationsStart * std::pow(_viscousAnnealingRate, iteration)));
         if (_numViscousIterations < _numViscousIterationsEnd) { _numViscousIterations = _numViscousIterationsEnd;}
         _numElasticIterations = int(std::round(_numElasticIterationsStart * std::pow(_elasticAnnealingRate, iteration)));
         if (_numElasticIterations < _numElasticIterationsEnd) { _numElasticIterations = _numElasticIterationsEnd;}
+        pipeline.transform().set_parameters(10, _sigmaSmoothing, _numViscousIterations,_numElasticIterations);
 
+        //# Correspondences, inlier detection and transformation
+        pipeline.iterate();
+        size_t numViscousPasses, numElasticPasses;
+        pipeline.transform().transformer().get_smoothing_passes(numViscousPasses, numElasticPasses);
+        _numViscousPasses += numViscousPasses;
+        _numElasticPasses += numElasticPasses;
 
-        //# Correspondences
-        correspondenceFilter->set_floating_input(_ioFloatingFeatures, _inFloatingFlags);
-        correspondenceFilter->set_target_input(_inTargetFeatures, _inTargetFlags);
-        correspondenceFilter->update();
+        //# Keep track of the peak memory usage
+        const size_t memoryUsage = pipeline.get_memory_usage();
+        if (memoryUsage > _peakMemory) { _peakMemory = memoryUsage;}
 
-        //# Inlier Detection
-        inlierDetector.update();
-
-        //# Transformation
-        transformer.set_parameters(10, _sigmaSmoothing, _numViscousIterations,_numElasticIterations);
-        transformer.update();
+        //# Checkpoint (not after the last iteration: the caller has the final state)
+        if ((_checkpointInterval > 0) && _checkpointCallback
+            && ((iteration + 1) % _checkpointInterval == 0) && (iteration + 1 < _numIterations)) {
+            _checkpointCallback(iteration + 1, pipeline.get_weights(), pipeline.transform().get_transformation());
+        }
 
         //# Print info
         timePostIteration = time(0);
         std::cout << "Iteration " << iteration+1 << "/" << _numIterations << " took "<< difftime(timePostIteration, timePreIteration) <<" second(s)."<< std::endl;
+        if (_smoothingTolerance > 0.0f) {
+            std::cout << "  viscous / elastic passes : " << numViscousPasses << "/" << _numViscousIterations
+                      << " / " << numElasticPasses << "/" << _numElasticIterations << std::endl;
+        }
     }
     timeEnd = time(0);
     std::cout << "Nonrigid Registration Completed in " << difftime(timeEnd, timeStart) <<" second(s)."<< std::endl;
 
-    delete correspondenceFilter;
-
-}//end update()
+    //# Keep the final state (used to warm start a next registration)
+    _outInlierWeights = pipeline.get_weights();
+    _outDisplacementField = pipeline.transform().get_transformation();
+}//end _run()
 
 }//namespace registration
@@ -2,6 +2,7 @@
 #define NONRIGIDREGISTRATION_HPP
 
 #include <Eigen/Dense>
+#include <functional>
 #include <stdio.h>
 #include <math.h>
 #include <memory.h>
@@ -11,10 +12,13 @@
 #include "SymmetricCorrespondenceFilter.hpp"
 #include "InlierDetector.hpp"
 #include "ViscoElasticTransformer.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
 typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
 
 namespace registration{
 
@@ -33,6 +37,78 @@ class NonrigidRegistration
     # PARAMETERS
     -numNeighbours(=3):
     number of nearest neighbours
+    -surfaceMatching(=false):
+    match floating vertices to the closest point on the target surface instead
+    of to the nearest target vertices (requires the target faces).
+    -positionalSearch(=false):
+    search correspondences in a 3-D position kd-tree and re-rank them by
+    position and normal instead of searching a 6-D feature kd-tree.
+    -maxDistance(=0.0):
+    if larger than zero, floating features without target features closer
+    than this distance get no correspondence (and flag 0.0f).
+    -selectiveUpdate(=false), requeryTolerance(=0.1):
+    only search new correspondences for floating features that moved more
+    than requeryTolerance times the distance to their nearest neighbour
+    since they were last queried (see CorrespondenceFilter).
+    -incrementalNormals(=false), normalThreshold(=0.01):
+    after each visco-elastic update, only recompute the normals around
+    vertices that moved more than normalThreshold since their normals were
+    last recomputed (see IncrementalNormalUpdater).
+    -compactNeighbours(=false):
+    store the smoothing neighbours of the visco-elastic transformation as a
+    NeighbourGraph with bfloat16 weights (see ViscoElasticTransformer).
+    -smoothingTolerance(=0.0), smoothingCheckInterval(=10):
+    if larger than zero, the viscous and elastic smoothing of each iteration
+    stop early once the smoothed field changes by less than this relative
+    tolerance (checked every smoothingCheckInterval passes, see
+    ViscoElasticTransformer). get_smoothing_passes() returns the total numbers
+    of viscous and elastic passes of the last update().
+    -gaussSeidel(=false):
+    smooth the visco-elastic fields in place, colour by colour (see
+    ViscoElasticTransformer).
+    -directRegularisation(=false), radiusFactor(=3.0):
+    regularise with a single sparse Gaussian operator over all neighbours
+    within radiusFactor*sigmaSmoothing instead of the iterated k-nn smoothing
+    (see ViscoElasticTransformer). The operator is included in the memory
+    estimate.
+
+    # WARM START
+    The inlier weights and the visco-elastic displacement field of a previous
+    registration (e.g. of a coarser pyramid layer) can be given with
+    set_initial_state(). The displacement field must already be applied to
+    ioFloatingFeatures. After update(), get_inlier_weights() and
+    get_displacement_field() return the final state.
+
+    # PREPARED NEIGHBOURS
+    -inNeighbourIndices, inNeighbourSquaredDistances, inSmoothingWeights(=NULL):
+    the 10 smoothing neighbours of every floating node (and optionally their
+    Gaussian weights for sigmaSmoothing and the floating flags), e.g. from a
+    PreparedTemplate. They're used instead of searching the neighbours at the
+    start of the registration (see ViscoElasticTransformer).
+
+    # CHECKPOINTS
+    -startIteration(=0), inStartPositions:
+    resume an interrupted registration: the first startIteration iterations
+    are skipped (the annealing continues where it was). Give its displacement
+    field with set_initial_state() (the inlier weights are recomputed every
+    iteration, so they're not needed), and the floating positions at which it
+    started as inStartPositions: the smoothing neighbours are found in those,
+    as they were in the interrupted registration.
+    -checkpointInterval(=0), checkpointCallback:
+    if larger than zero, checkpointCallback(iteration, inlierWeights,
+    displacementField) is called after every checkpointInterval iterations
+    with the number of iterations done and the current state (ioFloatingFeatures
+    holds the current floating features).
+
+    # MEMORY
+    -memoryBudget(=0):
+    if larger than zero, the memory usage (in bytes) is estimated from the
+    input sizes before anything is allocated. If the estimate exceeds the
+    budget, the memory hungry modes are switched off (see fit_memory_budget()),
+    and if that doesn't suffice the registration isn't run at all and
+    get_memory_status() returns MEMORY_OVER_BUDGET.
+    get_peak_memory() returns the peak number of bytes held by the filters and
+    buffers of the last update().
 
     # OUTPUT
     -outCorrespondingFeatures
@@ -41,11 +117,11 @@ class NonrigidRegistration
 
     public:
 
-        void set_input(FeatureMat * const ioFloatingFeatures,
-                       const FeatureMat * const inTargetFeatures,
-                       const FacesMat * const inFloatingFaces,
-                       const VecDynFloat * const inFloatingFlags,
-                       const VecDynFloat * const inTargetFlags);
+        void set_input(const FeatureView &ioFloatingFeatures,
+                       const ConstFeatureView &inTargetFeatures,
+                       const ConstFacesView &inFloatingFaces,
+                       const ConstVecView &inFloatingFlags,
+                       const ConstVecView &inTargetFlags);
         void set_parameters(bool symmetric,
                             size_t numNeighbours,
                             float flagThreshold,
@@ -58,6 +134,59 @@ class NonrigidRegistration
                             size_t numViscousIterationsEnd,
                             size_t numElasticIterationsStart,
                             size_t numElasticIterationsEnd);
+        void set_surface_matching(const bool surfaceMatching,
+                                  const ConstFacesView &inTargetFaces);
+        void set_positional_search(const bool positionalSearch){ _positionalSearch = positionalSearch;}
+        void set_max_distance(const float maxDistance){ _maxDistance = maxDistance;}
+        void set_selective_update(const bool selectiveUpdate, const float requeryTolerance = 0.1f){
+            _selectiveUpdate = selectiveUpdate;
+            _requeryTolerance = requeryTolerance;
+        }
+        void set_incremental_normals(const bool incrementalNormals, const float normalThreshold = 0.01f){
+            _incrementalNormals = incrementalNormals;
+            _normalThreshold = normalThreshold;
+        }
+        void set_compact_neighbours(const bool compactNeighbours){ _compactNeighbours = compactNeighbours;}
+        void set_smoothing_tolerance(const float smoothingTolerance, const size_t smoothingCheckInterval = 10){
+            _smoothingTolerance = smoothingTolerance;
+            _smoothingCheckInterval = smoothingCheckInterval;
+        }
+        void set_gauss_seidel(const bool gaussSeidel){ _gaussSeidel = gaussSeidel;}
+        void set_direct_regularisation(const bool directRegularisation, const float radiusFactor = 3.0f){
+            _directRegularisation = directRegularisation;
+            _radiusFactor = radiusFactor;
+        }
+        void get_smoothing_passes(size_t &numViscousPasses, size_t &numElasticPasses) const {
+            numViscousPasses = _numViscousPasses;
+            numElasticPasses = _numElasticPasses;
+        }
+        void set_initial_state(const ConstVecView &inInlierWeights,
+                               const Vec3Mat * const inDisplacementField){
+            _inInitialInlierWeights.reset(inInlierWeights);
+            _inInitialDisplacementField = inDisplacementField;
+        }
+        void set_start_iteration(const size_t startIteration, const Vec3Mat * const inStartPositions = NULL){
+            _startIteration = startIteration;
+            _inStartPositions = inStartPositions;
+        }
+        void set_smoothing_neighbours(const MatDynInt * const inNeighbourIndices,
+                                      const MatDynFloat * const inNeighbourSquaredDistances,
+                                      const MatDynFloat * const inSmoothingWeights = NULL){
+            _inNeighbourIndices = inNeighbourIndices;
+            _inNeighbourSquaredDistances = inNeighbourSquaredDistances;
+            _inSmoothingWeights = inSmoothingWeights;
+        }
+        typedef std::function<void(const size_t, const VecDynFloat &, const Vec3Mat &)> CheckpointCallback;
+        void set_checkpoint_callback(const size_t checkpointInterval, const CheckpointCallback &checkpointCallback){
+            _checkpointInterval = checkpointInterval;
+            _checkpointCallback = checkpointCallback;
+        }
+        VecDynFloat get_inlier_weights() const { return _outInlierWeights;}
+        Vec3Mat get_displacement_field() const { return _outDisplacementField;}
+        void set_memory_budget(const size_t memoryBudget){ _memoryBudget = memoryBudget;}
+        size_t estimate_memory() const { return _estimate_memory(_configured_modes());}
+        size_t get_peak_memory() const { return _peakMemory;}
+        MemoryStatus get_memory_status() const { return _memoryStatus;}
 
         void get_annealing_rates(float &viscousAnnealingRate,
                                  float &elasticAnnealingRate){
@@ -80,11 +209,19 @@ class NonrigidRegistration
 
     private:
         //# Inputs/Outputs
-        FeatureMat * _ioFloatingFeatures = NULL;
-        const FeatureMat * _inTargetFeatures = NULL;
-        const FacesMat * _inFloatingFaces;
-        const VecDynFloat * _inFloatingFlags = NULL;
-        const VecDynFloat * _inTargetFlags = NULL;
+        FeatureView _ioFloatingFeatures;
+        ConstFeatureView _inTargetFeatures;
+        ConstFacesView _inFloatingFaces;
+        ConstVecView _inFloatingFlags;
+        ConstVecView _inTargetFlags;
+        ConstVecView _inInitialInlierWeights;
+        const Vec3Mat * _inInitialDisplacementField = NULL;
+        const Vec3Mat * _inStartPositions = NULL;
+        const MatDynInt * _inNeighbourIndices = NULL;
+        const MatDynFloat * _inNeighbourSquaredDistances = NULL;
+        const MatDynFloat * _inSmoothingWeights = NULL;
+        VecDynFloat _outInlierWeights;
+        Vec3Mat _outDisplacementField;
 
         //# User Parameters
         //## Correspondences
@@ -92,6 +229,15 @@ class NonrigidRegistration
         size_t _numNeighbours = 3;
         float _flagThreshold = 0.9f;
         bool _equalizePushPull = false;
+        bool _surfaceMatching = false;
+        ConstFacesView _inTargetFaces;
+        bool _positionalSearch = false;
+        float _maxDistance = 0.0f;
+        bool _selectiveUpdate = false;
+        float _requeryTolerance = 0.1f;
+        bool _incrementalNormals = false;
+        float _normalThreshold = 0.01f;
+        bool _compactNeighbours = false;
         //## Inliers
         float _kappaa = 3.0;
         bool _inlierUseOrientation = true;
@@ -104,15 +250,37 @@ class NonrigidRegistration
         size_t _numElasticIterationsEnd = 1;
         size_t _numViscousIterations = 100;
         size_t _numElasticIterations = 100;
+        float _smoothingTolerance = 0.0f;
+        size_t _smoothingCheckInterval = 10;
+        bool _gaussSeidel = false;
+        bool _directRegularisation = false;
+        float _radiusFactor = 3.0f;
+        //## Checkpoints
+        size_t _startIteration = 0;
+        size_t _checkpointInterval = 0;
+        CheckpointCallback _checkpointCallback;
+        //## Memory
+        size_t _memoryBudget = 0;
 
         //# Internal Data structures
 
         //# Internal Parameters
+        size_t _peakMemory = 0;
+        MemoryStatus _memoryStatus = MEMORY_OK;
+        size_t _numViscousPasses = 0;
+        size_t _numElasticPasses = 0;
         //## Transformation
         float _viscousAnnealingRate = exp(log(float(_numViscousIterationsEnd)/float(_numViscousIterationsStart))/_numIterations);
         float _elasticAnnealingRate = exp(log(float(_numElasticIterationsEnd)/float(_numElasticIterationsStart))/_numIterations);
 
         //# Internal functions
+        //## The correspondence modes as set by the user
+        CorrespondenceMemoryModes _configured_modes() const;
+        //## Estimated peak memory usage with the given modes
+        size_t _estimate_memory(const CorrespondenceMemoryModes &modes) const;
+        //## Run the registration pipeline with the given correspondence policy
+        template <typename CorrespondencePolicy>
+        void _run(const CorrespondenceMemoryModes &modes);
 };
 
 }//namespace registration
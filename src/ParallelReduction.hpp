@@ -0,0 +1,218 @@
+#ifndef PARALLELREDUCTION_HPP
+#define PARALLELREDUCTION_HPP
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace registration {
+
+/*
+# GOAL
+Parallel sums (OpenMP) over the elements of a registration, e.g. the weighted
+centroids in RigidTransformer or the sigma estimate in InlierDetector.
+
+By default every thread sums a contiguous chunk of the elements and the
+partial sums are added in thread order. Floating point addition isn't
+associative, so the result (in the last bits) depends on the number of
+threads.
+
+In deterministic mode (set_deterministic_reductions(true)) the elements are
+split into blocks of REDUCTION_BLOCK_SIZE, whatever the number of threads.
+Each block is summed with Kahan (compensated) summation and the block sums are
+combined pairwise in a fixed tree. The result is then bit-identical for any
+number of threads (and typically more accurate).
+
+parallel_nth_value() selects the n-th smallest of a set of values (like
+std::nth_element) in parallel, e.g. the trimming threshold of InlierDetector.
+Its result is exact, so it doesn't depend on the number of threads.
+*/
+
+const size_t REDUCTION_BLOCK_SIZE = 2048;
+//# Maximum number of blocks for reductions into a vector (normalize_sparse_matrix)
+const size_t REDUCTION_MAX_VECTOR_BLOCKS = 8;
+//# Number of histogram bins of parallel_nth_value()
+const size_t SELECTION_NUM_BINS = 1024;
+
+inline std::atomic<bool> &deterministic_reductions_flag() {
+    static std::atomic<bool> deterministic(false);
+    return deterministic;
+}
+inline void set_deterministic_reductions(const bool deterministic) {
+    deterministic_reductions_flag().store(deterministic);
+}
+inline bool deterministic_reductions() {
+    return deterministic_reductions_flag().load(std::memory_order_relaxed);
+}
+
+inline int reduction_num_threads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+//# Combine partial sums pairwise: (0+1)+(2+3), ... in a fixed order
+template <typename ValueType, typename Allocator>
+ValueType pairwise_combine(std::vector<ValueType, Allocator> &ioPartialSums) {
+    size_t numPartials = ioPartialSums.size();
+    while (numPartials > 1) {
+        const size_t numPairs = numPartials / 2;
+        for (size_t p = 0 ; p < numPairs ; p++) {
+            ioPartialSums[p] = ioPartialSums[2*p] + ioPartialSums[2*p+1];
+        }
+        if (numPartials % 2 == 1) { ioPartialSums[numPairs] = ioPartialSums[numPartials-1];}
+        numPartials = numPairs + (numPartials % 2);
+    }
+    return ioPartialSums[0];
+}
+
+/*
+Sum of term(i) for i = 0 .. numElements-1. ValueType can be a float or a fixed
+size Eigen type; 'zero' is its zero value.
+*/
+template <typename ValueType, typename TermFunction>
+ValueType parallel_sum(const size_t numElements, const ValueType &zero, const TermFunction &term) {
+    typedef std::vector<ValueType, Eigen::aligned_allocator<ValueType> > PartialVector;
+    if (numElements == 0) { return zero;}
+
+    if (deterministic_reductions()) {
+        //# Fixed blocks with compensated sums, combined pairwise
+        const long numBlocks = long((numElements + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE);
+        PartialVector blockSums(numBlocks, zero);
+        #pragma omp parallel for schedule(static)
+        for (long b = 0 ; b < numBlocks ; b++) {
+            const size_t first = size_t(b) * REDUCTION_BLOCK_SIZE;
+            const size_t last = std::min(first + REDUCTION_BLOCK_SIZE, numElements);
+            ValueType sum = zero;
+            ValueType compensation = zero;
+            for (size_t i = first ; i < last ; i++) {
+                const ValueType corrected = ValueType(term(i)) - compensation;
+                const ValueType newSum = sum + corrected;
+                compensation = (newSum - sum) - corrected;
+                sum = newSum;
+            }
+            blockSums[b] = sum;
+        }
+        return pairwise_combine(blockSums);
+    }
+
+    //# One contiguous chunk per thread, added in chunk order. The chunks are
+    //# shared out with 'omp for', so all of them are summed even if OpenMP
+    //# gives a smaller team than requested.
+    const int numChunks = std::max(1, std::min(reduction_num_threads(),
+                                               int((numElements + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE)));
+    PartialVector chunkSums(numChunks, zero);
+    #pragma omp parallel for schedule(static) num_threads(numChunks)
+    for (int c = 0 ; c < numChunks ; c++) {
+        const size_t first = numElements * c / numChunks;
+        const size_t last = numElements * (c + 1) / numChunks;
+        ValueType sum = zero;
+        for (size_t i = first ; i < last ; i++) { sum += term(i);}
+        chunkSums[c] = sum;
+    }
+    ValueType sum = chunkSums[0];
+    for (int c = 1 ; c < numChunks ; c++) { sum += chunkSums[c];}
+    return sum;
+}
+
+/*
+The n-th smallest (n = 0 .. numCandidates-1) of value(i) for i = 0 ..
+numElements-1, where elements with an infinite value aren't candidates.
+Every chunk of the values gets a histogram over their range (in parallel);
+the bin holding the n-th value is found in the summed histograms, and only the
+values in that bin are gathered and partially sorted (std::nth_element).
+Returns infinity if there are no more than n candidates.
+*/
+template <typename ValueFunction>
+float parallel_nth_value(const size_t numElements, const size_t n, const ValueFunction &value) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    //# The values are split into chunks (one per thread) that are shared out
+    //# with 'omp for', so all of them are visited even with a smaller team
+    const int numChunks = std::max(1, std::min(reduction_num_threads(),
+                                               int((numElements + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE)));
+
+    //# 1. Range of the candidate values
+    std::vector<float> chunkMinima(numChunks, infinity);
+    std::vector<float> chunkMaxima(numChunks, -infinity);
+    #pragma omp parallel for schedule(static) num_threads(numChunks)
+    for (int c = 0 ; c < numChunks ; c++) {
+        const size_t first = numElements * c / numChunks;
+        const size_t last = numElements * (c + 1) / numChunks;
+        float minimum = infinity;
+        float maximum = -infinity;
+        for (size_t i = first ; i < last ; i++) {
+            const float v = value(i);
+            if (!std::isfinite(v)) { continue;}
+            minimum = std::min(minimum, v);
+            maximum = std::max(maximum, v);
+        }
+        chunkMinima[c] = minimum;
+        chunkMaxima[c] = maximum;
+    }
+    const float minimum = *std::min_element(chunkMinima.begin(), chunkMinima.end());
+    const float maximum = *std::max_element(chunkMaxima.begin(), chunkMaxima.end());
+    if (!(minimum <= maximum)) { return infinity;}
+    if (minimum == maximum) { return minimum;}
+
+    //# 2. Histograms per chunk, summed
+    const float binScale = float(SELECTION_NUM_BINS) / (maximum - minimum);
+    const auto bin_of = [&](const float v) {
+        return std::min(size_t((v - minimum) * binScale), SELECTION_NUM_BINS - 1);
+    };
+    std::vector<size_t> histograms(size_t(numChunks) * SELECTION_NUM_BINS, 0);
+    #pragma omp parallel for schedule(static) num_threads(numChunks)
+    for (int c = 0 ; c < numChunks ; c++) {
+        const size_t first = numElements * c / numChunks;
+        const size_t last = numElements * (c + 1) / numChunks;
+        size_t * const histogram = &histograms[size_t(c) * SELECTION_NUM_BINS];
+        for (size_t i = first ; i < last ; i++) {
+            const float v = value(i);
+            if (std::isfinite(v)) { histogram[bin_of(v)]++;}
+        }
+    }
+    size_t selectedBin = SELECTION_NUM_BINS;
+    size_t numBelow = 0;
+    for (size_t b = 0 ; b < SELECTION_NUM_BINS ; b++) {
+        size_t count = 0;
+        for (int c = 0 ; c < numChunks ; c++) { count += histograms[size_t(c) * SELECTION_NUM_BINS + b];}
+        if (numBelow + count > n) {
+            selectedBin = b;
+            break;
+        }
+        numBelow += count;
+    }
+    if (selectedBin == SELECTION_NUM_BINS) { return infinity;}
+
+    //# 3. Gather the values of the selected bin and select within them
+    std::vector<std::vector<float> > chunkValues(numChunks);
+    #pragma omp parallel for schedule(static) num_threads(numChunks)
+    for (int c = 0 ; c < numChunks ; c++) {
+        const size_t first = numElements * c / numChunks;
+        const size_t last = numElements * (c + 1) / numChunks;
+        std::vector<float> &values = chunkValues[c];
+        values.reserve(histograms[size_t(c) * SELECTION_NUM_BINS + selectedBin]);
+        for (size_t i = first ; i < last ; i++) {
+            const float v = value(i);
+            if (std::isfinite(v) && (bin_of(v) == selectedBin)) { values.push_back(v);}
+        }
+    }
+    std::vector<float> binValues = chunkValues[0];
+    for (int c = 1 ; c < numChunks ; c++) {
+        binValues.insert(binValues.end(), chunkValues[c].begin(), chunkValues[c].end());
+    }
+    std::nth_element(binValues.begin(), binValues.begin() + (n - numBelow), binValues.end());
+    return binValues[n - numBelow];
+}
+
+}//namespace registration
+
+#endif // PARALLELREDUCTION_HPP
@@ -0,0 +1,277 @@
+#include "PerformanceCounters.hpp"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace registration {
+
+std::atomic<bool> PerformanceCounters::_enabled(false);
+
+namespace {
+    const double cacheLineBytes = 64.0;
+
+    struct StageStats {
+        std::string stage;
+        size_t numCalls;
+        size_t numVertices;
+        double seconds;
+        size_t numCountedCalls;
+        unsigned long long values[PerformanceCounters::NUM_COUNTERS];
+    };
+
+    std::mutex countersMutex;
+    std::vector<StageStats> stageStats;
+    //# Why the counters are unavailable (empty if they are available or
+    //# haven't been tried yet)
+    std::string unavailableReason;
+    //# -1: not tried yet, 0: unavailable, 1: available
+    std::atomic<int> countersState(-1);
+
+    double seconds_now(){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+#ifdef __linux__
+    //# The counters of a single thread, opened as one group (led by the cycle
+    //# counter) the first time the thread reads them.
+    struct ThreadCounters {
+        int fds[PerformanceCounters::NUM_COUNTERS];
+        bool opened;
+        bool available;
+
+        ThreadCounters() : opened(false), available(false) {
+            for (int c = 0 ; c < PerformanceCounters::NUM_COUNTERS ; c++) { fds[c] = -1;}
+        }
+        ~ThreadCounters() {
+            for (int c = 0 ; c < PerformanceCounters::NUM_COUNTERS ; c++) {
+                if (fds[c] >= 0) { close(fds[c]);}
+            }
+        }
+
+        void open(){
+            opened = true;
+            const unsigned long long configs[PerformanceCounters::NUM_COUNTERS] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            for (int c = 0 ; c < PerformanceCounters::NUM_COUNTERS ; c++) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[c];
+                attr.disabled = (c == 0) ? 1 : 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                                 | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                fds[c] = int(syscall(__NR_perf_event_open, &attr, 0 /*this thread*/, -1 /*any cpu*/,
+                                     (c == 0) ? -1 : fds[0], 0));
+                if (fds[c] < 0) {
+                    const int error = errno;
+                    std::lock_guard<std::mutex> lock(countersMutex);
+                    if (unavailableReason.empty()) {
+                        unavailableReason = std::string("perf_event_open failed: ") + std::strerror(error);
+                        if ((error == EACCES) || (error == EPERM)) {
+                            unavailableReason += " (check /proc/sys/kernel/perf_event_paranoid)";
+                        }
+                    }
+                    countersState.store(0);
+                    return;
+                }
+            }
+            ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            available = true;
+            countersState.store(1);
+        }
+
+        bool read_values(unsigned long long values[PerformanceCounters::NUM_COUNTERS]){
+            if (!opened) { open();}
+            if (!available) { return false;}
+            //## Layout for PERF_FORMAT_GROUP: nr, time_enabled, time_running, values[nr]
+            unsigned long long buffer[3 + PerformanceCounters::NUM_COUNTERS];
+            const ssize_t numBytes = ::read(fds[0], buffer, sizeof(buffer));
+            if (numBytes < ssize_t(sizeof(buffer))) { return false;}
+            //## Scale up if the counters were multiplexed with other events
+            double scale = 1.0;
+            if ((buffer[2] > 0) && (buffer[2] < buffer[1])) { scale = double(buffer[1]) / double(buffer[2]);}
+            for (int c = 0 ; c < PerformanceCounters::NUM_COUNTERS ; c++) {
+                values[c] = (unsigned long long)(double(buffer[3 + c]) * scale);
+            }
+            return true;
+        }
+    };
+
+    //# Read the counters of the calling thread
+    bool read_thread(unsigned long long values[PerformanceCounters::NUM_COUNTERS]){
+        thread_local ThreadCounters threadCounters;
+        return threadCounters.read_values(values);
+    }
+#endif
+}//namespace
+
+
+void PerformanceCounters::set_enabled(const bool enabled){
+    _enabled.store(enabled);
+}//end set_enabled()
+
+
+bool PerformanceCounters::counters_available(){
+    if (countersState.load() < 0) {
+        unsigned long long values[NUM_COUNTERS];
+        read(values);
+    }
+    return countersState.load() > 0;
+}//end counters_available()
+
+
+void PerformanceCounters::clear(){
+    std::lock_guard<std::mutex> lock(countersMutex);
+    stageStats.clear();
+}//end clear()
+
+
+bool PerformanceCounters::read(unsigned long long values[NUM_COUNTERS]){
+#ifdef __linux__
+#ifdef _OPENMP
+    //# Outside a parallel region, the stage's parallel loops run on the
+    //# OpenMP threads of the caller: read each of them and sum
+    if (!omp_in_parallel()) {
+        const int numThreads = omp_get_max_threads();
+        std::vector<unsigned long long> threadValues(size_t(numThreads) * NUM_COUNTERS, 0);
+        std::vector<char> threadRead(numThreads, 1);
+        #pragma omp parallel num_threads(numThreads)
+        {
+            const int t = omp_get_thread_num();
+            threadRead[t] = read_thread(&threadValues[size_t(t) * NUM_COUNTERS]) ? 1 : 0;
+        }
+        bool allRead = true;
+        for (int c = 0 ; c < NUM_COUNTERS ; c++) { values[c] = 0;}
+        for (int t = 0 ; t < numThreads ; t++) {
+            allRead = allRead && (threadRead[t] != 0);
+            for (int c = 0 ; c < NUM_COUNTERS ; c++) { values[c] += threadValues[size_t(t) * NUM_COUNTERS + c];}
+        }
+        return allRead;
+    }
+#endif
+    return read_thread(values);
+#else
+    if (countersState.load() < 0) {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        unavailableReason = "hardware counters are only supported on Linux";
+        countersState.store(0);
+    }
+    for (int c = 0 ; c < NUM_COUNTERS ; c++) { values[c] = 0;}
+    return false;
+#endif
+}//end read()
+
+
+void PerformanceCounters::add_sample(const char * const stage, const size_t numVertices,
+                                     const double seconds, const bool hasCounters,
+                                     const unsigned long long values[NUM_COUNTERS]){
+    std::lock_guard<std::mutex> lock(countersMutex);
+    size_t s = 0;
+    while ((s < stageStats.size()) && (stageStats[s].stage != stage)) { s++;}
+    if (s == stageStats.size()) {
+        StageStats stats;
+        stats.stage = stage;
+        stats.numCalls = 0;
+        stats.numVertices = 0;
+        stats.seconds = 0.0;
+        stats.numCountedCalls = 0;
+        for (int c = 0 ; c < NUM_COUNTERS ; c++) { stats.values[c] = 0;}
+        stageStats.push_back(stats);
+    }
+    StageStats &stats = stageStats[s];
+    stats.numCalls++;
+    stats.numVertices += numVertices;
+    stats.seconds += seconds;
+    if (hasCounters) {
+        stats.numCountedCalls++;
+        for (int c = 0 ; c < NUM_COUNTERS ; c++) { stats.values[c] += values[c];}
+    }
+}//end add_sample()
+
+
+void PerformanceCounters::report(std::ostream &out){
+    const bool available = counters_available();
+    std::lock_guard<std::mutex> lock(countersMutex);
+
+    out << "Performance counters per stage" << std::endl;
+    if (!available) {
+        out << " Hardware counters unavailable: " << unavailableReason
+            << ". Only calls and wall time are reported." << std::endl;
+    }
+    out << std::left << std::setw(12) << " stage" << std::right
+        << std::setw(8) << "calls" << std::setw(12) << "time [ms]"
+        << std::setw(12) << "vertices"
+        << std::setw(14) << "Mcycles" << std::setw(8) << "IPC"
+        << std::setw(14) << "LLC misses" << std::setw(14) << "br. misses"
+        << std::setw(14) << "bytes/vertex" << std::endl;
+    out << std::fixed;
+    for (size_t s = 0 ; s < stageStats.size() ; s++) {
+        const StageStats &stats = stageStats[s];
+        out << " " << std::left << std::setw(11) << stats.stage << std::right
+            << std::setw(8) << stats.numCalls
+            << std::setw(12) << std::setprecision(1) << 1000.0 * stats.seconds
+            << std::setw(12) << stats.numVertices;
+        if (stats.numCountedCalls > 0) {
+            const double cycles = double(stats.values[CYCLES]);
+            const double ipc = (cycles > 0.0) ? double(stats.values[INSTRUCTIONS]) / cycles : 0.0;
+            const double bytesPerVertex = (stats.numVertices > 0) ?
+                        cacheLineBytes * double(stats.values[LLC_MISSES]) / double(stats.numVertices) : 0.0;
+            out << std::setw(14) << std::setprecision(1) << cycles / 1.0e6
+                << std::setw(8) << std::setprecision(2) << ipc
+                << std::setw(14) << stats.values[LLC_MISSES]
+                << std::setw(14) << stats.values[BRANCH_MISSES]
+                << std::setw(14) << std::setprecision(1) << bytesPerVertex;
+        }
+        else {
+            out << std::setw(14) << "n/a" << std::setw(8) << "n/a"
+                << std::setw(14) << "n/a" << std::setw(14) << "n/a"
+                << std::setw(14) << "n/a";
+        }
+        out << std::endl;
+    }
+    out.unsetf(std::ios_base::floatfield);
+}//end report()
+
+
+
+StageCounter::StageCounter(const char * const stage, const size_t numVertices)
+    : _stage(stage), _numVertices(numVertices),
+      _active(PerformanceCounters::is_enabled()), _hasCounters(false), _start(0.0) {
+    if (_active) {
+        _start = seconds_now();
+        _hasCounters = PerformanceCounters::read(_values);
+    }
+}//end StageCounter()
+
+
+StageCounter::~StageCounter(){
+    if (!_active) { return;}
+    unsigned long long values[PerformanceCounters::NUM_COUNTERS];
+    const bool hasCounters = _hasCounters && PerformanceCounters::read(values);
+    const double seconds = seconds_now() - _start;
+    if (hasCounters) {
+        for (int c = 0 ; c < PerformanceCounters::NUM_COUNTERS ; c++) {
+            values[c] = (values[c] > _values[c]) ? values[c] - _values[c] : 0;
+        }
+    }
+    PerformanceCounters::add_sample(_stage, _numVertices, seconds, hasCounters, values);
+}//end ~StageCounter()
+
+}//namespace registration
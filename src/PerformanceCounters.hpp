@@ -0,0 +1,114 @@
+#ifndef PERFORMANCECOUNTERS_HPP
+#define PERFORMANCECOUNTERS_HPP
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+namespace registration {
+
+class PerformanceCounters
+{
+    /*
+    # GOAL
+    This class collects hardware performance counters (cycles, instructions,
+    last level cache misses and branch misses) per pipeline stage, so we can
+    tell whether a stage is limited by memory traffic or by computation:
+    -knn_query: kd-tree queries (NeighbourFinder)
+    -affinity: building the sparse affinity matrix (CorrespondenceFilter)
+    -smoothing: the viscous/elastic regularisation (ViscoElasticTransformer).
+    Its vertex count is the number of vertices times the number of passes, so
+    the per vertex figures are per vertex per pass.
+    -normals: recomputing the vertex normals after a deformation
+
+    The counters are read with perf_event_open (Linux only), per thread. A
+    stage started outside a parallel region reads them on every OpenMP thread
+    of the caller (in a parallel region of its own, at its start and end) and
+    sums them, so the work of its parallel loops is included. Its cycles then
+    also include the time those threads wait (spin) between the loops. A
+    stage started inside a parallel region counts the calling thread only
+    (its own share of the work). When the counters can't be opened (other
+    platforms, perf_event_paranoid, virtual machines without a PMU) only the
+    number of calls and the wall time are collected and the report says why.
+
+    Collection is off by default. When it is off, a counted stage costs a
+    single relaxed atomic load.
+
+    # USAGE
+    PerformanceCounters::set_enabled(true);
+    ... run a registration ...
+    PerformanceCounters::report(std::cout);
+
+    # REPORT
+    Per stage: calls, wall time, cycles, IPC (instructions per cycle), LLC
+    misses, branch misses and the bytes touched per vertex. The latter is
+    estimated as the number of LLC misses times the size of a cache line
+    (64 bytes), divided by the number of vertices processed in that stage.
+    */
+
+    public:
+        static void set_enabled(const bool enabled);
+        static bool is_enabled() { return _enabled.load(std::memory_order_relaxed);}
+        //# Whether the hardware counters could be opened on this machine
+        static bool counters_available();
+        //# Remove all collected samples
+        static void clear();
+        //# Print the summary table
+        static void report(std::ostream &out);
+
+        //# Raw counter values (indices given by the Counter enum)
+        enum Counter { CYCLES = 0, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+        //# Read the counters of the calling thread, summed with those of its
+        //# OpenMP threads if called outside a parallel region. Returns false if
+        //# they are unavailable.
+        static bool read(unsigned long long values[NUM_COUNTERS]);
+        //# Add a sample to a stage
+        static void add_sample(const char * const stage, const size_t numVertices,
+                               const double seconds, const bool hasCounters,
+                               const unsigned long long values[NUM_COUNTERS]);
+
+    private:
+        static std::atomic<bool> _enabled;
+};
+
+
+
+class StageCounter
+{
+    /*
+    # GOAL
+    Adds the counters and wall time from its construction until its
+    destruction to a stage of the PerformanceCounters, if collection is
+    enabled at construction.
+    */
+
+    public:
+        StageCounter(const char * const stage, const size_t numVertices);
+        ~StageCounter();
+
+    private:
+        StageCounter(const StageCounter&);
+        StageCounter& operator=(const StageCounter&);
+
+        const char * _stage;
+        size_t _numVertices;
+        bool _active;
+        bool _hasCounters;
+        double _start;
+        unsigned long long _values[PerformanceCounters::NUM_COUNTERS];
+};
+
+}//namespace registration
+
+
+
+#define MESHMONK_COUNTER_CONCAT_INNER(a, b) a##b
+#define MESHMONK_COUNTER_CONCAT(a, b) MESHMONK_COUNTER_CONCAT_INNER(a, b)
+#ifdef MESHMONK_NO_COUNTERS
+#define MESHMONK_COUNT_STAGE(stage, numVertices)
+#else
+#define MESHMONK_COUNT_STAGE(stage, numVertices) \
+    registration::StageCounter MESHMONK_COUNTER_CONCAT(stageCounter, __LINE__)(stage, size_t(numVertices))
+#endif
+
+#endif // PERFORMANCECOUNTERS_HPP
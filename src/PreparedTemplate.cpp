@@ -0,0 +1,295 @@
+#include "PreparedTemplate.hpp"
+#include "BinaryStream.hpp"
+#include "Downsampler.hpp"
+#include "NeighbourFinder.hpp"
+#include "ViscoElasticTransformer.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace registration {
+
+namespace {
+    const char preparedTemplateMagic[8] = {'M', 'M', 'P', 'R', 'E', 'P', '0', '2'};
+
+    void write_matching(std::ofstream &file, const ScaleShiftMatching &matching){
+        write_size(file, matching.numLowNodes);
+        write_matrix(file, matching.indexPairs);
+        write_matrix(file, matching.newIndices);
+        write_matrix(file, matching.interpolationMatches);
+        write_matrix(file, matching.interpolationWeights);
+    }
+
+    bool read_matching(std::ifstream &file, ScaleShiftMatching &outMatching){
+        return read_size(file, outMatching.numLowNodes)
+               && read_matrix(file, outMatching.indexPairs)
+               && read_matrix(file, outMatching.newIndices)
+               && read_matrix(file, outMatching.interpolationMatches)
+               && read_matrix(file, outMatching.interpolationWeights);
+    }
+
+    size_t matching_memory_usage(const ScaleShiftMatching &matching){
+        return memory_usage(matching.indexPairs) + memory_usage(matching.newIndices)
+               + memory_usage(matching.interpolationMatches) + memory_usage(matching.interpolationWeights);
+    }
+}//namespace
+
+
+void PreparedTemplate::set_input(const ConstFeatureView &inFeatures,
+                                 const ConstFacesView &inFaces,
+                                 const ConstVecView &inFlags){
+    _inFeatures.reset(inFeatures);
+    _inFaces.reset(inFaces);
+    _inFlags.reset(inFlags);
+}//end set_input()
+
+
+void PreparedTemplate::set_parameters(const size_t numPyramidLayers,
+                                      const float downsampleStart,
+                                      const float downsampleEnd,
+                                      const float sigma){
+    _numPyramidLayers = numPyramidLayers;
+    _downsampleStart = downsampleStart;
+    _downsampleEnd = downsampleEnd;
+    _sigma = sigma;
+}//end set_parameters()
+
+
+void PreparedTemplate::update(){
+    MESHMONK_TRACE_SCOPE("PreparedTemplate::update");
+    _layers.clear();
+    _outputMatching = ScaleShiftMatching();
+    //# Safety check
+    if ((!_inFeatures.is_set()) || (!_inFaces.is_set()) || (!_inFlags.is_set())
+        || (_inFlags.rows() != _inFeatures.rows())) {
+        std::cerr << "PreparedTemplate needs the features, faces and flags of the template!" << std::endl;
+        return;
+    }
+    _numElements = _inFeatures.rows();
+    _numFaces = _inFaces.rows();
+    _facesChecksum = _checksum(_inFaces);
+    _edgeLengths = _edge_lengths(_inFeatures, _inFaces);
+    _flags = _inFlags;
+
+    //# Prepare the pyramid layers
+    _layers.resize(_numPyramidLayers);
+    FeatureMat oldLayerFeatures;
+    for (size_t i = 0 ; i < _numPyramidLayers ; i++) {
+        MESHMONK_TRACE_SCOPE_ARG("PreparedTemplate::layer", "layer", i);
+        PreparedLayer &layer = _layers[i];
+
+        //## Decimate the template like the pyramid registration does
+        FeatureMat layerFeatures;
+        VecDynFloat layerFlags;
+        Downsampler downsampler;
+        downsampler.set_input(_inFeatures, _inFaces, _inFlags);
+        downsampler.set_output(layerFeatures, layer.faces, layerFlags, layer.originalIndices);
+        downsampler.set_parameters(pyramid_downsample_ratio(_downsampleStart, _downsampleEnd, i, _numPyramidLayers));
+        downsampler.update();
+
+        //## Smoothing neighbours and their weights
+        if (size_t(layerFeatures.rows()) >= _numSmoothingNeighbours) {
+            const Vec3Mat layerPositions = layerFeatures.leftCols(3);
+            NeighbourFinder<Vec3Mat> neighbourFinder;
+            neighbourFinder.set_source_points(&layerPositions);
+            neighbourFinder.set_queried_points(&layerPositions);
+            neighbourFinder.set_parameters(_numSmoothingNeighbours);
+            neighbourFinder.update();
+            layer.neighbourIndices = neighbourFinder.get_indices();
+            layer.neighbourSquaredDistances = neighbourFinder.get_distances();
+            ViscoElasticTransformer::compute_smoothing_weights(layer.neighbourIndices, layer.neighbourSquaredDistances,
+                                                               layerFlags, _sigma, layer.smoothingWeights);
+        }
+
+        //## Matching with the previous layer
+        if (i > 0) {
+            FeatureMat shiftedFeatures = layerFeatures;
+            ScaleShifter scaleShifter;
+            scaleShifter.set_input(oldLayerFeatures, _layers[i-1].originalIndices, layer.originalIndices);
+            scaleShifter.set_output(shiftedFeatures);
+            scaleShifter.update();
+            layer.matching = scaleShifter.get_matching();
+        }
+        oldLayerFeatures = layerFeatures;
+    }
+
+    //# Matching of the last layer with the full template
+    if (_numPyramidLayers > 0) {
+        VecDynInt originalIndices = VecDynInt::Zero(_numElements);
+        for (size_t j = 0 ; j < _numElements ; j++){ originalIndices(j) = j; }
+        FeatureMat shiftedFeatures = _inFeatures;
+        ScaleShifter scaleShifter;
+        scaleShifter.set_input(oldLayerFeatures, _layers.back().originalIndices, originalIndices);
+        scaleShifter.set_output(shiftedFeatures);
+        scaleShifter.update();
+        _outputMatching = scaleShifter.get_matching();
+    }
+}//end update()
+
+
+bool PreparedTemplate::fits(const ConstFeatureView &inFeatures, const ConstFacesView &inFaces,
+                            const size_t numPyramidLayers, const float downsampleStart,
+                            const float downsampleEnd) const{
+    if (!((_layers.size() == numPyramidLayers) && (numPyramidLayers > 0)
+          && (size_t(inFeatures.rows()) == _numElements) && (size_t(inFaces.rows()) == _numFaces)
+          && (_downsampleStart == downsampleStart) && (_downsampleEnd == downsampleEnd)
+          && (_checksum(inFaces) == _facesChecksum))) {
+        return false;
+    }
+    //# Same topology: compare the geometry (edge lengths don't change with a
+    //# rigid move, up to rounding)
+    const VecDynFloat edgeLengths = _edge_lengths(inFeatures, inFaces);
+    if ((edgeLengths.size() != _edgeLengths.size()) || (_edgeLengths.size() == 0)) { return false;}
+    const float tolerance = _edgeLengthTolerance * _edgeLengths.mean();
+    return ((edgeLengths - _edgeLengths).cwiseAbs().maxCoeff() <= tolerance);
+}//end fits()
+
+
+bool PreparedTemplate::has_smoothing_weights(const ConstVecView &inFlags, const float sigma) const{
+    return (std::abs(_sigma - sigma) <= 0.0001f * _sigma) && (inFlags.rows() == _flags.rows())
+           && (inFlags == _flags);
+}//end has_smoothing_weights()
+
+
+size_t PreparedTemplate::get_memory_usage() const{
+    size_t memory = memory_usage(_flags) + memory_usage(_edgeLengths) + matching_memory_usage(_outputMatching);
+    for (size_t i = 0 ; i < _layers.size() ; i++) {
+        const PreparedLayer &layer = _layers[i];
+        memory += memory_usage(layer.originalIndices) + memory_usage(layer.faces)
+                  + memory_usage(layer.neighbourIndices) + memory_usage(layer.neighbourSquaredDistances)
+                  + memory_usage(layer.smoothingWeights) + matching_memory_usage(layer.matching);
+    }
+    return memory;
+}//end get_memory_usage()
+
+
+bool PreparedTemplate::save(const std::string &path) const{
+    //# Written to a temporary file first and renamed (workers may load it meanwhile)
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "PreparedTemplate::save(): couldn't write " << temporaryPath << "." << std::endl;
+            return false;
+        }
+        file.write(preparedTemplateMagic, sizeof(preparedTemplateMagic));
+        write_size(file, _numElements);
+        write_size(file, _numFaces);
+        write_size(file, _facesChecksum);
+        VecDynFloat parameters(3);
+        parameters << _downsampleStart, _downsampleEnd, _sigma;
+        write_matrix(file, parameters);
+        write_matrix(file, _edgeLengths);
+        write_matrix(file, _flags);
+        write_size(file, _layers.size());
+        for (size_t i = 0 ; i < _layers.size() ; i++) {
+            const PreparedLayer &layer = _layers[i];
+            write_matrix(file, layer.originalIndices);
+            write_matrix(file, layer.faces);
+            write_matrix(file, layer.neighbourIndices);
+            write_matrix(file, layer.neighbourSquaredDistances);
+            write_matrix(file, layer.smoothingWeights);
+            write_matching(file, layer.matching);
+        }
+        write_matching(file, _outputMatching);
+        file.flush();
+        if (!file) {
+            std::cerr << "PreparedTemplate::save(): couldn't write " << temporaryPath << "." << std::endl;
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "PreparedTemplate::save(): couldn't rename " << temporaryPath << " to " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}//end save()
+
+
+bool PreparedTemplate::load(const std::string &path){
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open()) { return false;}
+    char magic[sizeof(preparedTemplateMagic)];
+    if (!file.read(magic, sizeof(magic)) || (std::memcmp(magic, preparedTemplateMagic, sizeof(magic)) != 0)) {
+        std::cerr << "PreparedTemplate::load(): " << path << " isn't a meshmonk prepared template." << std::endl;
+        return false;
+    }
+    size_t numElements = 0;
+    size_t numFaces = 0;
+    size_t facesChecksum = 0;
+    size_t numLayers = 0;
+    VecDynFloat parameters;
+    VecDynFloat edgeLengths;
+    VecDynFloat flags;
+    bool complete = read_size(file, numElements) && read_size(file, numFaces) && read_size(file, facesChecksum)
+                    && read_matrix(file, parameters) && (parameters.rows() == 3)
+                    && read_matrix(file, edgeLengths) && (size_t(edgeLengths.rows()) == 3 * numFaces)
+                    && read_matrix(file, flags) && (size_t(flags.rows()) == numElements)
+                    && read_size(file, numLayers);
+    std::vector<PreparedLayer> layers;
+    if (complete) { layers.resize(numLayers);}
+    for (size_t i = 0 ; complete && (i < numLayers) ; i++) {
+        PreparedLayer &layer = layers[i];
+        complete = read_matrix(file, layer.originalIndices) && read_matrix(file, layer.faces)
+                   && read_matrix(file, layer.neighbourIndices) && read_matrix(file, layer.neighbourSquaredDistances)
+                   && read_matrix(file, layer.smoothingWeights) && read_matching(file, layer.matching)
+                   && (layer.neighbourIndices.rows() == layer.neighbourSquaredDistances.rows())
+                   && (layer.smoothingWeights.rows() == layer.neighbourIndices.rows());
+    }
+    ScaleShiftMatching outputMatching;
+    complete = complete && read_matching(file, outputMatching);
+    if (!complete || (numLayers == 0)) {
+        std::cerr << "PreparedTemplate::load(): " << path << " is damaged." << std::endl;
+        return false;
+    }
+    _numElements = numElements;
+    _numFaces = numFaces;
+    _facesChecksum = facesChecksum;
+    _numPyramidLayers = numLayers;
+    _downsampleStart = parameters[0];
+    _downsampleEnd = parameters[1];
+    _sigma = parameters[2];
+    _edgeLengths = edgeLengths;
+    _flags = flags;
+    _layers.swap(layers);
+    _outputMatching = outputMatching;
+    return true;
+}//end load()
+
+
+size_t PreparedTemplate::_checksum(const ConstFacesView &faces){
+    //# FNV-1a over the vertex indices, to recognise the template's topology
+    uint64_t hash = 14695981039346656037ULL;
+    for (long i = 0 ; i < faces.size() ; i++) {
+        hash ^= uint64_t(uint32_t(faces.data()[i]));
+        hash *= 1099511628211ULL;
+    }
+    return size_t(hash);
+}//end _checksum()
+
+
+VecDynFloat PreparedTemplate::_edge_lengths(const ConstFeatureView &features, const ConstFacesView &faces){
+    //# The three edges of every face, in the order of its corners
+    VecDynFloat edgeLengths(3 * faces.rows());
+    for (long f = 0 ; f < faces.rows() ; f++) {
+        for (long c = 0 ; c < 3 ; c++) {
+            const int first = faces(f,c);
+            const int second = faces(f,(c + 1) % 3);
+            if ((first < 0) || (second < 0) || (first >= features.rows()) || (second >= features.rows())) {
+                edgeLengths[3*f + c] = -1.0f;
+                continue;
+            }
+            edgeLengths[3*f + c] = (features.block<1,3>(second,0) - features.block<1,3>(first,0)).norm();
+        }
+    }
+    return edgeLengths;
+}//end _edge_lengths()
+
+}//namespace registration
@@ -0,0 +1,140 @@
+#ifndef PREPAREDTEMPLATE_HPP
+#define PREPAREDTEMPLATE_HPP
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include "../global.hpp"
+#include "ScaleShifter.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::VectorXi VecDynInt;
+typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
+typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+
+namespace registration {
+
+//# Everything a pyramid registration derives from the floating mesh alone,
+//# for one pyramid layer
+struct PreparedLayer
+{
+    VecDynInt originalIndices; //of the vertices kept by the decimation
+    FacesMat faces;
+    MatDynInt neighbourIndices; //smoothing neighbours (in the rest positions)
+    MatDynFloat neighbourSquaredDistances;
+    MatDynFloat smoothingWeights; //for the template flags and sigma
+    ScaleShiftMatching matching; //from the previous layer (empty for the first one)
+};
+
+
+class PreparedTemplate
+{
+    /*
+    # GOAL
+    A PyramidNonrigidRegistration spends part of its time on work that only
+    depends on the floating mesh: decimating it for every pyramid layer,
+    searching the smoothing neighbours of every layer and their weights, and
+    matching the vertices of consecutive layers (ScaleShifter). When the same
+    template is registered to many scans, this work can be done once.
+    update() does it, and save() / load() keep it on disk, so batch jobs can
+    share it.
+
+    The decimation keeps the positions and normals of the vertices it doesn't
+    remove, so a layer is stored by the original indices of its vertices; the
+    features and flags of a layer are gathered from the floating mesh when it
+    is registered. That mesh may have been moved rigidly (e.g. by a rigid
+    registration, without scaling): the neighbours, distances and matchings
+    don't change. fits() recognises the mesh by its faces and by the lengths
+    of their edges (which a rigid move keeps), so another mesh with the same
+    topology (e.g. a mapped scan) doesn't fit.
+
+    # INPUTS
+    -inFeatures, inFaces, inFlags: the template (floating mesh)
+
+    # PARAMETERS
+    -numPyramidLayers(=3), downsampleStart(=90), downsampleEnd(=0):
+    the pyramid of the floating mesh, as in PyramidNonrigidRegistration.
+    -sigma(=3.0): the sigma of the visco-elastic smoothing weights.
+
+    # OUTPUT
+    -a layer (get_layer()) per pyramid layer, and the matching of the last
+    layer to the full mesh (get_output_matching()).
+
+    # USAGE
+    PreparedTemplate prepared;
+    prepared.set_input(&templateFeatures, &templateFaces, &templateFlags);
+    prepared.set_parameters(numPyramidLayers, downsampleFloatStart, downsampleFloatEnd, transformSigma);
+    prepared.update();
+    prepared.save("template.prep");
+    ...
+    pyramidRegistration.set_prepared_template(&prepared);
+    */
+
+    public:
+        void set_input(const ConstFeatureView &inFeatures,
+                       const ConstFacesView &inFaces,
+                       const ConstVecView &inFlags);
+        void set_parameters(const size_t numPyramidLayers = 3,
+                            const float downsampleStart = 90.0f,
+                            const float downsampleEnd = 0.0f,
+                            const float sigma = 3.0f);
+        void update();
+
+        //## Binary file (see BinaryStream.hpp). load() returns false if the
+        //## file doesn't exist or is damaged.
+        bool save(const std::string &path) const;
+        bool load(const std::string &path);
+
+        //## Whether it was prepared for this mesh (up to a rigid move) and pyramid
+        bool fits(const ConstFeatureView &inFeatures, const ConstFacesView &inFaces,
+                  const size_t numPyramidLayers, const float downsampleStart, const float downsampleEnd) const;
+        //## Whether its smoothing weights can be used for these flags and sigma
+        bool has_smoothing_weights(const ConstVecView &inFlags, const float sigma) const;
+
+        size_t get_num_layers() const { return _layers.size();}
+        const PreparedLayer &get_layer(const size_t layer) const { return _layers[layer];}
+        const ScaleShiftMatching &get_output_matching() const { return _outputMatching;}
+        size_t get_memory_usage() const;
+
+    protected:
+
+    private:
+        //# Inputs
+        ConstFeatureView _inFeatures;
+        ConstFacesView _inFaces;
+        ConstVecView _inFlags;
+
+        //# User parameters
+        size_t _numPyramidLayers = 3;
+        float _downsampleStart = 90.0f;
+        float _downsampleEnd = 0.0f;
+        float _sigma = 3.0f;
+
+        //# Prepared data
+        size_t _numElements = 0;
+        size_t _numFaces = 0;
+        size_t _facesChecksum = 0;
+        VecDynFloat _edgeLengths; //of the edges of every face, to recognise the geometry
+        VecDynFloat _flags;
+        std::vector<PreparedLayer> _layers;
+        ScaleShiftMatching _outputMatching;
+
+        //# Internal parameters
+        //## Number of smoothing neighbours of the NonrigidRegistration
+        const size_t _numSmoothingNeighbours = 10;
+        //## Largest difference in edge length (relative to the mean edge
+        //## length) of a mesh that fits
+        const float _edgeLengthTolerance = 0.001f;
+
+        //# Internal functions
+        static size_t _checksum(const ConstFacesView &faces);
+        static VecDynFloat _edge_lengths(const ConstFeatureView &features, const ConstFacesView &faces);
+};
+
+}//namespace registration
+
+#endif // PREPAREDTEMPLATE_HPP
@@ -1,19 +1,23 @@
 #include "PyramidNonrigidRegistration.hpp"
+#include "Tracer.hpp"
+#include "AutoTuner.hpp"
+#include "BinaryStream.hpp"
+#include <algorithm>
 
 namespace registration {
 
-void PyramidNonrigidRegistration::set_input(FeatureMat &ioFloatingFeatures,
-                                       const FeatureMat &inTargetFeatures,
-                                       const FacesMat &inFloatingFaces,
-                                       const FacesMat &inTargetFaces,
-                                       const VecDynFloat &inFloatingFlags,
-                                       const VecDynFloat &inTargetFlags){
-    _ioFloatingFeatures = &ioFloatingFeatures;
-    _inTargetFeatures = &inTargetFeatures;
-    _inFloatingFaces = &inFloatingFaces;
-    _inTargetFaces = &inTargetFaces;
-    _inFloatingFlags = &inFloatingFlags;
-    _inTargetFlags = &inTargetFlags;
+void PyramidNonrigidRegistration::set_input(const FeatureView &ioFloatingFeatures,
+                                       const ConstFeatureView &inTargetFeatures,
+                                       const ConstFacesView &inFloatingFaces,
+                                       const ConstFacesView &inTargetFaces,
+                                       const ConstVecView &inFloatingFlags,
+                                       const ConstVecView &inTargetFlags){
+    _ioFloatingFeatures.reset(ioFloatingFeatures);
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inFloatingFaces.reset(inFloatingFaces);
+    _inTargetFaces.reset(inTargetFaces);
+    _inFloatingFlags.reset(inFloatingFlags);
+    _inTargetFlags.reset(inTargetFlags);
 }//end set_input()
 
 void PyramidNonrigidRegistration::set_parameters(size_t numIterations /*= 60*/,
@@ -99,7 +103,150 @@ void PyramidNonrigidRegistration::set_parameters(size_t numIterations /*= 60*/,
 }//end set_parameters()
 
 
+float PyramidNonrigidRegistration::_downsample_ratio(const float start, const float end,
+                                                     const size_t layer) const{
+    return pyramid_downsample_ratio(start, end, layer, _numPyramidLayers);
+}//end _downsample_ratio()
+
+
+CorrespondenceMemoryModes PyramidNonrigidRegistration::_configured_modes() const{
+    CorrespondenceMemoryModes modes;
+    modes.surfaceMatching = _correspondencesSurfaceMatching;
+    modes.positionalSearch = _correspondencesPositionalSearch;
+    modes.selectiveUpdate = _correspondencesSelectiveUpdate;
+    return modes;
+}//end _configured_modes()
+
+
+size_t PyramidNonrigidRegistration::_estimate_memory(const CorrespondenceMemoryModes &modes) const{
+    const size_t numFloating = _ioFloatingFeatures.rows();
+    const size_t numTarget = _inTargetFeatures.rows();
+    const size_t numFloatingFaces = _inFloatingFaces.rows();
+    const size_t numTargetFaces = _inTargetFaces.rows();
+    //# The downsampler holds a copy of the largest full resolution mesh
+    const size_t downsamplerMemory = std::max(estimate_downsampler_memory(numFloating, numFloatingFaces),
+                                              estimate_downsampler_memory(numTarget, numTargetFaces));
+    //# The operator of the direct regularisation: downsampling keeps the
+    //# surface, so every layer has (about) the area of the full mesh
+    const float floatingArea = _directRegularisation ? estimate_surface_area(_ioFloatingFeatures, _inFloatingFaces) : 0.0f;
+    const float directRadius = _directRegularisation ? _radiusFactor * _transformSigma : 0.0f;
+
+    size_t peakMemory = 0;
+    for (size_t i = 0 ; i < _numPyramidLayers ; i++) {
+        //## Remaining elements after downsampling
+        const float floatingFraction = 1.0f - _downsample_ratio(_downsampleFloatStart, _downsampleFloatEnd, i);
+        const float targetFraction = 1.0f - _downsample_ratio(_downsampleTargetStart, _downsampleTargetEnd, i);
+        const size_t layerFloating = size_t(std::ceil(floatingFraction * numFloating));
+        const size_t layerFloatingFaces = size_t(std::ceil(floatingFraction * numFloatingFaces));
+        const size_t layerTarget = size_t(std::ceil(targetFraction * numTarget));
+        const size_t layerTargetFaces = size_t(std::ceil(targetFraction * numTargetFaces));
+
+        //## Features, flags and original indices of this and the previous
+        //## layer, the faces, and the warm start weights and field
+        size_t layerMemory = 2 * estimate_dense_memory(layerFloating, NUM_FEATURES + 2);
+        layerMemory += estimate_dense_memory(layerFloatingFaces + layerTargetFaces, 3, sizeof(int));
+        layerMemory += estimate_dense_memory(layerTarget, NUM_FEATURES + 1);
+        if (_warmStart) { layerMemory += 2 * estimate_dense_memory(layerFloating, 4);}
+
+        //## Either the downsampler or the registration is running
+        const size_t registrationMemory = estimate_nonrigid_registration_memory(layerFloating, layerTarget,
+                                                    layerFloatingFaces, layerTargetFaces,
+                                                    _correspondencesNumNeighbours, _correspondencesSymmetric, modes,
+                                                    floatingArea, directRadius);
+        layerMemory += std::max(downsamplerMemory, registrationMemory);
+        if (layerMemory > peakMemory) { peakMemory = layerMemory;}
+    }
+    return peakMemory;
+}//end _estimate_memory()
+
+
+size_t PyramidNonrigidRegistration::_compute_fingerprint(const CorrespondenceMemoryModes &modes,
+                                                        const bool prepared) const{
+    //# The inputs
+    uint64_t hash = fingerprint_matrix(_ioFloatingFeatures);
+    hash = fingerprint_matrix(_inFloatingFaces, hash);
+    hash = fingerprint_matrix(_inFloatingFlags, hash);
+    hash = fingerprint_matrix(_inTargetFeatures, hash);
+    hash = fingerprint_matrix(_inTargetFaces, hash);
+    hash = fingerprint_matrix(_inTargetFlags, hash);
+
+    //# The parameters (with the modes that were used, which depend on the
+    //# memory budget)
+    VecDynFloat parameters(31);
+    parameters << float(_numIterations), float(_numPyramidLayers),
+                  _downsampleFloatStart, _downsampleTargetStart, _downsampleFloatEnd, _downsampleTargetEnd,
+                  float(_correspondencesSymmetric), float(_correspondencesNumNeighbours),
+                  _correspondencesFlagThreshold, float(_correspondencesEqualizePushPull),
+                  float(modes.surfaceMatching), float(modes.positionalSearch), _correspondencesMaxDistance,
+                  float(modes.selectiveUpdate), _correspondencesRequeryTolerance,
+                  float(_incrementalNormals), _normalThreshold, float(_compactNeighbours), float(_warmStart),
+                  _inlierKappa, float(_inlierUseOrientation), _transformSigma,
+                  float(_transformNumViscousIterationsStart), float(_transformNumViscousIterationsEnd),
+                  float(_transformNumElasticIterationsStart), float(_transformNumElasticIterationsEnd),
+                  _smoothingTolerance, float(_smoothingCheckInterval), float(_gaussSeidel),
+                  float(_directRegularisation), _radiusFactor;
+    hash = fingerprint_matrix(parameters, hash);
+    const unsigned char usesPreparedTemplate = prepared ? 1 : 0;
+    return size_t(fingerprint_bytes(&usesPreparedTemplate, 1, hash));
+}//end _compute_fingerprint()
+
+
+bool PyramidNonrigidRegistration::_load_checkpoint(RegistrationCheckpoint &outCheckpoint) const{
+    if (!_resume || _checkpointPath.empty()) { return false;}
+    if (!load_checkpoint(_checkpointPath, outCheckpoint)) { return false;}
+    if ((outCheckpoint.numInputElements != size_t(_ioFloatingFeatures.rows()))
+        || (outCheckpoint.numIterations != _numIterations)
+        || (outCheckpoint.numPyramidLayers != _numPyramidLayers)
+        || (outCheckpoint.fingerprint != _fingerprint)
+        || (outCheckpoint.layer > _numPyramidLayers)
+        || ((outCheckpoint.layer == 0) && (outCheckpoint.iteration == 0))) {
+        std::cerr << "PyramidNonrigidRegistration: the checkpoint " << _checkpointPath
+                  << " belongs to another registration. Starting over." << std::endl;
+        return false;
+    }
+    return true;
+}//end _load_checkpoint()
+
+
+void PyramidNonrigidRegistration::_save_checkpoint(const size_t layer, const size_t iteration,
+                                                   const FeatureMat &floatingFeatures, const VecDynInt &originalIndices,
+                                                   const VecDynFloat &inlierWeights, const Vec3Mat &displacementField,
+                                                   const Vec3Mat &startPositions,
+                                                   const size_t numViscousIterations, const size_t numElasticIterations) const{
+    MESHMONK_TRACE_SCOPE("PyramidNonrigidRegistration::save_checkpoint");
+    RegistrationCheckpoint checkpoint;
+    checkpoint.layer = layer;
+    checkpoint.iteration = iteration;
+    checkpoint.numViscousIterations = numViscousIterations;
+    checkpoint.numElasticIterations = numElasticIterations;
+    checkpoint.numInputElements = _ioFloatingFeatures.rows();
+    checkpoint.numIterations = _numIterations;
+    checkpoint.numPyramidLayers = _numPyramidLayers;
+    checkpoint.fingerprint = _fingerprint;
+    checkpoint.floatingFeatures = floatingFeatures;
+    checkpoint.originalIndices = originalIndices;
+    checkpoint.inlierWeights = inlierWeights;
+    checkpoint.displacementField = displacementField;
+    checkpoint.startPositions = startPositions;
+    save_checkpoint(_checkpointPath, checkpoint);
+}//end _save_checkpoint()
+
+
 void PyramidNonrigidRegistration::update(){
+    MESHMONK_TRACE_SCOPE("PyramidNonrigidRegistration::update");
+
+    //# Check the memory budget before allocating anything
+    CorrespondenceMemoryModes modes = _configured_modes();
+    _memoryStatus = fit_memory_budget(_memoryBudget, modes,
+                                      [this](const CorrespondenceMemoryModes &m){ return _estimate_memory(m);},
+                                      "PyramidNonrigidRegistration");
+    _peakMemory = 0;
+    _numViscousPasses = 0;
+    _numElasticPasses = 0;
+    if (_memoryStatus == MEMORY_OVER_BUDGET) { return;}
+
+    //# Pick up (or tune) the performance profile on the floating features
+    AutoTuner::ensure_tuned(_ioFloatingFeatures);
 
     //# Initialize the floating features, their original indices and the faces.
     /*
@@ -108,39 +255,84 @@ void PyramidNonrigidRegistration::update(){
     of the floating mesh of the previous pyramid scale are transferred to the current pyramid
     scale.
     */
-    size_t numFloatingFeatures = _ioFloatingFeatures->rows();
+    size_t numFloatingFeatures = _ioFloatingFeatures.rows();
     FeatureMat floatingFeatures;
     FacesMat floatingFaces;
     VecDynInt floatingOriginalIndices;
     FeatureMat oldFloatingFeatures;
     VecDynInt oldFloatingOriginalIndices;
+    VecDynFloat oldInlierWeights;
+
+    //# Use the prepared template if it was prepared for this floating mesh
+    const bool prepared = (_preparedTemplate != NULL)
+                          && _preparedTemplate->fits(_ioFloatingFeatures, _inFloatingFaces, _numPyramidLayers,
+                                                     _downsampleFloatStart, _downsampleFloatEnd);
+    if ((_preparedTemplate != NULL) && !prepared) {
+        std::cerr << "PyramidNonrigidRegistration: the prepared template doesn't fit the floating mesh or pyramid. It's ignored." << std::endl;
+    }
+    const bool preparedWeights = prepared && _preparedTemplate->has_smoothing_weights(_inFloatingFlags, _transformSigma);
+
+    //# Resume from a checkpoint
+    /*
+    At a layer boundary, the checkpoint holds the result of the previous layer.
+    Within a layer, it holds the state after some of the layer's iterations,
+    which is put in place once the layer's meshes are downsampled again.
+    */
+    if (!_checkpointPath.empty()) { _fingerprint = _compute_fingerprint(modes, prepared);}
+    RegistrationCheckpoint checkpoint;
+    _resumed = _load_checkpoint(checkpoint);
+    size_t startLayer = 0;
+    if (_resumed) {
+        std::cout << "Resuming from " << _checkpointPath << " at pyramid layer " << checkpoint.layer
+                  << ", iteration " << checkpoint.iteration << std::endl;
+        startLayer = checkpoint.layer;
+        if (checkpoint.iteration == 0) {
+            floatingFeatures = checkpoint.floatingFeatures;
+            floatingOriginalIndices = checkpoint.originalIndices;
+            oldFloatingFeatures = checkpoint.floatingFeatures;
+            oldFloatingOriginalIndices = checkpoint.originalIndices;
+            oldInlierWeights = checkpoint.inlierWeights;
+        }
+    }
 
     //# Start Pyramid Nonrigid Registration
-    for (size_t i = 0 ; i < _numPyramidLayers ; i++){
+    size_t i = startLayer;
+    while (i < _numPyramidLayers) {
+        MESHMONK_TRACE_SCOPE_ARG("PyramidNonrigidRegistration::layer", "layer", i);
 
         //# Downsample Floating Mesh
         //## Determine the downsample ratio for the current pyramid layer
-        float downsampleRatio = _downsampleFloatStart;
-        if (_numPyramidLayers > 1) {
-            downsampleRatio = float(std::round(_downsampleFloatStart - i * std::round((_downsampleFloatStart-_downsampleFloatEnd)/(_numPyramidLayers-1.0))));
-        }
-        downsampleRatio /= 100.0f;
+        float downsampleRatio = _downsample_ratio(_downsampleFloatStart, _downsampleFloatEnd, i);
         std::cout<< " DOWNSAMPLE RATIO       : " << downsampleRatio << std::endl;
-        //## Set up Downsampler
         Downsampler downsampler;
         VecDynFloat floatingFlags;
-        downsampler.set_input(_ioFloatingFeatures, _inFloatingFaces, _inFloatingFlags);
-        downsampler.set_output(floatingFeatures, floatingFaces, floatingFlags, floatingOriginalIndices);
-        downsampler.set_parameters(downsampleRatio);
-        downsampler.update();
+        size_t floatingDownsampleMemory = 0;
+        if (prepared) {
+            //## The decimation keeps the features of the remaining vertices,
+            //## so the layer is gathered from the floating mesh
+            const PreparedLayer &layer = _preparedTemplate->get_layer(i);
+            floatingOriginalIndices = layer.originalIndices;
+            floatingFaces = layer.faces;
+            const size_t numLayerFeatures = floatingOriginalIndices.rows();
+            floatingFeatures.resize(numLayerFeatures, NUM_FEATURES);
+            floatingFlags.resize(numLayerFeatures);
+            for (size_t j = 0 ; j < numLayerFeatures ; j++) {
+                floatingFeatures.row(j) = _ioFloatingFeatures.row(floatingOriginalIndices[j]);
+                floatingFlags[j] = _inFloatingFlags[floatingOriginalIndices[j]];
+            }
+        }
+        else {
+            //## Set up Downsampler
+            downsampler.set_input(_ioFloatingFeatures, _inFloatingFaces, _inFloatingFlags);
+            downsampler.set_output(floatingFeatures, floatingFaces, floatingFlags, floatingOriginalIndices);
+            downsampler.set_parameters(downsampleRatio);
+            downsampler.update();
+            floatingDownsampleMemory = estimate_downsampler_memory(_ioFloatingFeatures.rows(), _inFloatingFaces.rows());
+        }
 
         //# Downsample Target Mesh
         //## Determine the downsample ratio for the current pyramid layer
-        downsampleRatio = _downsampleTargetStart;
-        if (_numPyramidLayers > 1){
-            downsampleRatio = float(std::round(_downsampleTargetStart - i * std::round((_downsampleTargetStart-_downsampleTargetEnd)/(_numPyramidLayers-1.0))));
-        }
-        downsampleRatio /= 100.0f;
+        downsampleRatio = _downsample_ratio(_downsampleTargetStart, _downsampleTargetEnd, i);
         //## Set up Downsampler
         FeatureMat targetFeatures;
         FacesMat targetFaces;
@@ -149,14 +341,43 @@ void PyramidNonrigidRegistration::update(){
         downsampler.set_output(targetFeatures, targetFaces, targetFlags);
         downsampler.set_parameters(downsampleRatio);
         downsampler.update();
+        const size_t targetDownsampleMemory = estimate_downsampler_memory(_inTargetFeatures.rows(), _inTargetFaces.rows());
 
         //# Transfer floating mesh properties from previous pyramid scale to the current one.
-        if (i > 0) {
+        VecDynFloat inlierWeights;
+        Vec3Mat displacementField;
+        const bool resumeLayer = _resumed && (i == startLayer) && (checkpoint.iteration > 0);
+        if (resumeLayer) {
+            //## The checkpoint was taken within this layer
+            if ((floatingOriginalIndices.size() != checkpoint.originalIndices.size())
+                || (floatingOriginalIndices != checkpoint.originalIndices)) {
+                std::cerr << "PyramidNonrigidRegistration: the checkpoint " << _checkpointPath
+                          << " doesn't match the downsampled meshes. Starting over." << std::endl;
+                _resumed = false;
+                i = 0;
+                continue;
+            }
+            floatingFeatures = checkpoint.floatingFeatures;
+            displacementField = checkpoint.displacementField;
+        }
+        else if (i > 0) {
+            //## The downsampled positions are still the original ones here
+            const Vec3Mat originalPositions = floatingFeatures.leftCols(3);
+
             //## Scale up
             ScaleShifter scaleShifter;
             scaleShifter.set_input(oldFloatingFeatures, oldFloatingOriginalIndices, floatingOriginalIndices);
             scaleShifter.set_output(floatingFeatures);
+            if (prepared) { scaleShifter.set_matching(_preparedTemplate->get_layer(i).matching);}
             scaleShifter.update();
+
+            //## Carry the inlier weights and the displacement field up as well.
+            //## The displacement of each node is simply its shifted position
+            //## minus its original position.
+            if (_warmStart) {
+                scaleShifter.shift_field(oldInlierWeights, inlierWeights);
+                displacementField = floatingFeatures.leftCols(3) - originalPositions;
+            }
         }
 
         //# Registration
@@ -168,19 +389,80 @@ void PyramidNonrigidRegistration::update(){
                                             _iterationsPerLayer, _transformSigma,
                                             _viscousIterationsIntervals[i], _viscousIterationsIntervals[i+1],
                                             _elasticIterationsIntervals[i], _elasticIterationsIntervals[i+1]);
+        nonrigidRegistration.set_surface_matching(modes.surfaceMatching, &targetFaces);
+        nonrigidRegistration.set_positional_search(modes.positionalSearch);
+        nonrigidRegistration.set_max_distance(_correspondencesMaxDistance);
+        nonrigidRegistration.set_selective_update(modes.selectiveUpdate, _correspondencesRequeryTolerance);
+        nonrigidRegistration.set_incremental_normals(_incrementalNormals, _normalThreshold);
+        nonrigidRegistration.set_compact_neighbours(_compactNeighbours);
+        nonrigidRegistration.set_smoothing_tolerance(_smoothingTolerance, _smoothingCheckInterval);
+        nonrigidRegistration.set_gauss_seidel(_gaussSeidel);
+        nonrigidRegistration.set_direct_regularisation(_directRegularisation, _radiusFactor);
+        if (prepared && (_preparedTemplate->get_layer(i).neighbourIndices.rows() > 0)) {
+            const PreparedLayer &layer = _preparedTemplate->get_layer(i);
+            nonrigidRegistration.set_smoothing_neighbours(&layer.neighbourIndices, &layer.neighbourSquaredDistances,
+                                                          preparedWeights ? &layer.smoothingWeights : NULL);
+        }
+        Vec3Mat startPositions;
+        if (resumeLayer) {
+            startPositions = checkpoint.startPositions;
+            nonrigidRegistration.set_initial_state(NULL, &displacementField);
+            nonrigidRegistration.set_start_iteration(checkpoint.iteration, &startPositions);
+        }
+        else if (_warmStart && (i > 0)) {
+            nonrigidRegistration.set_initial_state(&inlierWeights, &displacementField);
+        }
+        if (!_checkpointPath.empty() && (_checkpointInterval > 0)) {
+            if (!resumeLayer) { startPositions = floatingFeatures.leftCols(3);}
+            nonrigidRegistration.set_checkpoint_callback(_checkpointInterval,
+                [&](const size_t iteration, const VecDynFloat &currentWeights, const Vec3Mat &currentField){
+                    float numViscousIterations, numElasticIterations;
+                    nonrigidRegistration.get_viscoelastic_iterations(numViscousIterations, numElasticIterations);
+                    _save_checkpoint(i, iteration, floatingFeatures, floatingOriginalIndices,
+                                     currentWeights, currentField, startPositions,
+                                     size_t(numViscousIterations), size_t(numElasticIterations));
+                });
+        }
         nonrigidRegistration.update();
+        size_t numViscousPasses, numElasticPasses;
+        nonrigidRegistration.get_smoothing_passes(numViscousPasses, numElasticPasses);
+        _numViscousPasses += numViscousPasses;
+        _numElasticPasses += numElasticPasses;
+
+        //# Keep track of the peak memory usage: the buffers of this layer (and
+        //# of the previous one) plus the downsampler or the registration
+        const size_t layerMemory = memory_usage(floatingFeatures) + memory_usage(floatingFaces)
+                                 + memory_usage(floatingFlags) + memory_usage(floatingOriginalIndices)
+                                 + memory_usage(oldFloatingFeatures) + memory_usage(oldFloatingOriginalIndices)
+                                 + memory_usage(oldInlierWeights) + memory_usage(inlierWeights)
+                                 + memory_usage(displacementField) + memory_usage(startPositions)
+                                 + memory_usage(targetFeatures)
+                                 + memory_usage(targetFaces) + memory_usage(targetFlags);
+        const size_t stageMemory = std::max(std::max(floatingDownsampleMemory, targetDownsampleMemory),
+                                            nonrigidRegistration.get_peak_memory());
+        if (layerMemory + stageMemory > _peakMemory) { _peakMemory = layerMemory + stageMemory;}
 
         //# Copy the result in temporary variables for use in the next pyramid scale
         oldFloatingFeatures = FeatureMat(floatingFeatures);
         oldFloatingOriginalIndices = VecDynInt(floatingOriginalIndices);
+        oldInlierWeights = nonrigidRegistration.get_inlier_weights();
+
+        //# Checkpoint at the layer boundary
+        if (!_checkpointPath.empty()) {
+            _save_checkpoint(i + 1, 0, floatingFeatures, floatingOriginalIndices,
+                             oldInlierWeights, nonrigidRegistration.get_displacement_field(), Vec3Mat(), 0, 0);
+        }
+        i++;
     }// Pyramid iteratations
 
     //# Copy result to output
+    MESHMONK_TRACE_SCOPE("PyramidNonrigidRegistration::copy_output");
     VecDynInt originalIndices = VecDynInt::Zero(numFloatingFeatures);
     for (size_t j = 0 ; j < numFloatingFeatures ; j++){ originalIndices(j) = j; }
     ScaleShifter scaleShifter;
     scaleShifter.set_input(floatingFeatures, floatingOriginalIndices, originalIndices);
-    scaleShifter.set_output(*_ioFloatingFeatures);
+    scaleShifter.set_output(_ioFloatingFeatures);
+    if (prepared) { scaleShifter.set_matching(_preparedTemplate->get_output_matching());}
     scaleShifter.update();
 
 }//end update()
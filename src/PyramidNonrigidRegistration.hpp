@@ -10,11 +10,16 @@
 #include "NonrigidRegistration.hpp"
 #include "Downsampler.hpp"
 #include "ScaleShifter.hpp"
+#include "MemoryAccounting.hpp"
+#include "Checkpoint.hpp"
+#include "PreparedTemplate.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::VectorXi VecDynInt;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
 typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type float
 
 namespace registration{
 
@@ -33,6 +38,77 @@ class PyramidNonrigidRegistration
     # PARAMETERS
     -numNeighbours(=3):
     number of nearest neighbours
+    -surfaceMatching(=false):
+    match floating vertices to the closest point on the (downsampled) target
+    surface of each layer instead of to the nearest target vertices.
+    -positionalSearch(=false):
+    search correspondences in a 3-D position kd-tree and re-rank them by
+    position and normal instead of searching a 6-D feature kd-tree.
+    -maxDistance(=0.0):
+    if larger than zero, floating features without target features closer
+    than this distance get no correspondence (and flag 0.0f).
+    -selectiveUpdate(=false), requeryTolerance(=0.1):
+    only search new correspondences for floating features that moved more
+    than requeryTolerance times the distance to their nearest neighbour
+    since they were last queried (see CorrespondenceFilter).
+    -incrementalNormals(=false), normalThreshold(=0.01):
+    after each visco-elastic update, only recompute the normals around
+    vertices that moved more than normalThreshold since their normals were
+    last recomputed (see IncrementalNormalUpdater).
+    -compactNeighbours(=false):
+    store the smoothing neighbours of the visco-elastic transformation as a
+    NeighbourGraph with bfloat16 weights (see ViscoElasticTransformer).
+    -smoothingTolerance(=0.0), smoothingCheckInterval(=10):
+    stop the visco-elastic smoothing early once it converged (see
+    NonrigidRegistration). get_smoothing_passes() returns the total numbers of
+    viscous and elastic passes of all layers of the last update().
+    -gaussSeidel(=false):
+    smooth the visco-elastic fields in place, colour by colour (see
+    ViscoElasticTransformer).
+    -directRegularisation(=false), radiusFactor(=3.0):
+    regularise every layer with a single sparse Gaussian operator over all
+    neighbours within radiusFactor*transformSigma (see NonrigidRegistration).
+    -warmStart(=false):
+    carry the inlier weights and the visco-elastic displacement field of each
+    layer up to the next (finer) layer with the ScaleShifter interpolation,
+    instead of starting each layer from uniform weights and a zero field.
+
+    # CHECKPOINTS
+    -checkpointPath(=""), checkpointInterval(=0), resume(=false):
+    if a path is given, the state of the registration (see
+    RegistrationCheckpoint) is written to it after every pyramid layer, and
+    also after every checkpointInterval iterations within a layer if that's
+    larger than zero. If resume is true and the path holds a checkpoint of the
+    same registration, update() continues from it instead of starting over
+    (get_resumed() tells whether it did). The downsampling is deterministic,
+    so the layers are rebuilt exactly as before the interruption.
+    A checkpoint is only resumed if it was written for the same input meshes
+    (features, faces and flags of both) and the same parameters; its
+    fingerprint is compared. The checkpoint after the last layer is kept, so
+    resuming a finished registration returns its result without running it.
+
+    # PREPARED TEMPLATE
+    -preparedTemplate(=NULL):
+    the layers, smoothing neighbours and layer matchings of the floating mesh,
+    prepared once with PreparedTemplate (e.g. when one template is registered
+    to many scans). If it fits the floating mesh and the floating pyramid, the
+    floating mesh isn't decimated and no smoothing neighbours or matchings are
+    searched; its smoothing weights are used if they were computed for the
+    same flags and transformSigma. The smoothing neighbours are those of the
+    rest positions of each layer (not those at the start of the layer, which
+    differ a little with a warm start). A template that doesn't fit is
+    ignored.
+
+    # MEMORY
+    -memoryBudget(=0):
+    if larger than zero, the memory usage (in bytes) of every pyramid layer is
+    estimated from the input sizes and downsample ratios before anything is
+    allocated. If the largest estimate exceeds the budget, the memory hungry
+    modes are switched off for all layers (see fit_memory_budget()), and if
+    that doesn't suffice the registration isn't run at all and
+    get_memory_status() returns MEMORY_OVER_BUDGET.
+    get_peak_memory() returns the peak number of bytes held by the layers,
+    the downsampler's mesh copy and the nonrigid registrations.
 
     # OUTPUT
     -outCorrespondingFeatures
@@ -41,12 +117,12 @@ class PyramidNonrigidRegistration
 
     public:
 
-        void set_input(FeatureMat &ioFloatingFeatures,
-                       const FeatureMat &inTargetFeatures,
-                       const FacesMat &inFloatingFaces,
-                       const FacesMat &inTargetFaces,
-                       const VecDynFloat &inFloatingFlags,
-                       const VecDynFloat &inTargetFlags);
+        void set_input(const FeatureView &ioFloatingFeatures,
+                       const ConstFeatureView &inTargetFeatures,
+                       const ConstFacesView &inFloatingFaces,
+                       const ConstFacesView &inTargetFaces,
+                       const ConstVecView &inFloatingFlags,
+                       const ConstVecView &inTargetFlags);
 
         void set_parameters(size_t numIterations = 60,
                             size_t numPyramidLayers = 3,
@@ -65,6 +141,44 @@ class PyramidNonrigidRegistration
                             size_t transformNumViscousIterationsEnd = 1,
                             size_t transformNumElasticIterationsStart = 200,
                             size_t transformNumElasticIterationsEnd = 1);
+        void set_surface_matching(const bool surfaceMatching){ _correspondencesSurfaceMatching = surfaceMatching;}
+        void set_positional_search(const bool positionalSearch){ _correspondencesPositionalSearch = positionalSearch;}
+        void set_max_distance(const float maxDistance){ _correspondencesMaxDistance = maxDistance;}
+        void set_warm_start(const bool warmStart){ _warmStart = warmStart;}
+        void set_selective_update(const bool selectiveUpdate, const float requeryTolerance = 0.1f){
+            _correspondencesSelectiveUpdate = selectiveUpdate;
+            _correspondencesRequeryTolerance = requeryTolerance;
+        }
+        void set_incremental_normals(const bool incrementalNormals, const float normalThreshold = 0.01f){
+            _incrementalNormals = incrementalNormals;
+            _normalThreshold = normalThreshold;
+        }
+        void set_compact_neighbours(const bool compactNeighbours){ _compactNeighbours = compactNeighbours;}
+        void set_smoothing_tolerance(const float smoothingTolerance, const size_t smoothingCheckInterval = 10){
+            _smoothingTolerance = smoothingTolerance;
+            _smoothingCheckInterval = smoothingCheckInterval;
+        }
+        void set_gauss_seidel(const bool gaussSeidel){ _gaussSeidel = gaussSeidel;}
+        void set_direct_regularisation(const bool directRegularisation, const float radiusFactor = 3.0f){
+            _directRegularisation = directRegularisation;
+            _radiusFactor = radiusFactor;
+        }
+        void get_smoothing_passes(size_t &numViscousPasses, size_t &numElasticPasses) const {
+            numViscousPasses = _numViscousPasses;
+            numElasticPasses = _numElasticPasses;
+        }
+        void set_checkpoint(const std::string &checkpointPath, const size_t checkpointInterval = 0,
+                            const bool resume = false){
+            _checkpointPath = checkpointPath;
+            _checkpointInterval = checkpointInterval;
+            _resume = resume;
+        }
+        bool get_resumed() const { return _resumed;}
+        void set_prepared_template(const PreparedTemplate * const preparedTemplate){ _preparedTemplate = preparedTemplate;}
+        void set_memory_budget(const size_t memoryBudget){ _memoryBudget = memoryBudget;}
+        size_t estimate_memory() const { return _estimate_memory(_configured_modes());}
+        size_t get_peak_memory() const { return _peakMemory;}
+        MemoryStatus get_memory_status() const { return _memoryStatus;}
 
         void update();
 
@@ -72,12 +186,12 @@ class PyramidNonrigidRegistration
 
     private:
         //# Inputs/Outputs
-        FeatureMat * _ioFloatingFeatures = NULL;
-        const FeatureMat * _inTargetFeatures = NULL;
-        const FacesMat * _inFloatingFaces;
-        const FacesMat * _inTargetFaces;
-        const VecDynFloat * _inFloatingFlags = NULL;
-        const VecDynFloat * _inTargetFlags = NULL;
+        FeatureView _ioFloatingFeatures;
+        ConstFeatureView _inTargetFeatures;
+        ConstFacesView _inFloatingFaces;
+        ConstFacesView _inTargetFaces;
+        ConstVecView _inFloatingFlags;
+        ConstVecView _inTargetFlags;
 
         //# User Parameters
         //## Correspondences
@@ -91,6 +205,15 @@ class PyramidNonrigidRegistration
         size_t _correspondencesNumNeighbours = 5;
         float _correspondencesFlagThreshold = 0.9f;
         bool _correspondencesEqualizePushPull = false;
+        bool _correspondencesSurfaceMatching = false;
+        bool _correspondencesPositionalSearch = false;
+        float _correspondencesMaxDistance = 0.0f;
+        bool _correspondencesSelectiveUpdate = false;
+        float _correspondencesRequeryTolerance = 0.1f;
+        bool _incrementalNormals = false;
+        float _normalThreshold = 0.01f;
+        bool _compactNeighbours = false;
+        bool _warmStart = false;
         float _inlierKappa = 4.0f;
         bool _inlierUseOrientation = true;
         float _transformSigma = 3.0f;
@@ -98,6 +221,19 @@ class PyramidNonrigidRegistration
         size_t _transformNumViscousIterationsEnd = 1;
         size_t _transformNumElasticIterationsStart = 200;
         size_t _transformNumElasticIterationsEnd = 1;
+        float _smoothingTolerance = 0.0f;
+        size_t _smoothingCheckInterval = 10;
+        bool _gaussSeidel = false;
+        bool _directRegularisation = false;
+        float _radiusFactor = 3.0f;
+        //## Checkpoints
+        std::string _checkpointPath;
+        size_t _checkpointInterval = 0;
+        bool _resume = false;
+        //## Prepared template
+        const PreparedTemplate * _preparedTemplate = NULL;
+        //## Memory
+        size_t _memoryBudget = 0;
 
         //# Internal Data structures
 
@@ -108,7 +244,32 @@ class PyramidNonrigidRegistration
         float _elasticAnnealingRate = exp(log(float(_transformNumElasticIterationsEnd)/float(_transformNumElasticIterationsStart))/_numIterations);
         std::vector<int> _viscousIterationsIntervals;
         std::vector<int> _elasticIterationsIntervals;
+        size_t _peakMemory = 0;
+        MemoryStatus _memoryStatus = MEMORY_OK;
+        bool _resumed = false;
+        size_t _fingerprint = 0;
+        size_t _numViscousPasses = 0;
+        size_t _numElasticPasses = 0;
+
         //# Internal functions
+        //## Fraction of the vertices removed in a pyramid layer
+        float _downsample_ratio(const float start, const float end, const size_t layer) const;
+        //## The correspondence modes as set by the user
+        CorrespondenceMemoryModes _configured_modes() const;
+        //## Estimated peak memory usage with the given modes
+        size_t _estimate_memory(const CorrespondenceMemoryModes &modes) const;
+        //## Fingerprint of the inputs and of the parameters that change the
+        //## result, to recognise the checkpoints of this registration
+        size_t _compute_fingerprint(const CorrespondenceMemoryModes &modes, const bool prepared) const;
+        //## Load the checkpoint to resume from. Returns false if there is none
+        //## (or it belongs to another registration).
+        bool _load_checkpoint(RegistrationCheckpoint &outCheckpoint) const;
+        //## Write the state before 'iteration' of pyramid layer 'layer'
+        void _save_checkpoint(const size_t layer, const size_t iteration,
+                              const FeatureMat &floatingFeatures, const VecDynInt &originalIndices,
+                              const VecDynFloat &inlierWeights, const Vec3Mat &displacementField,
+                              const Vec3Mat &startPositions,
+                              const size_t numViscousIterations, const size_t numElasticIterations) const;
 };
 
 }//namespace registration
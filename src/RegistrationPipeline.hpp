@@ -0,0 +1,378 @@
+#ifndef REGISTRATIONPIPELINE_HPP
+#define REGISTRATIONPIPELINE_HPP
+
+#include <Eigen/Dense>
+#include "../global.hpp"
+#include "CorrespondenceFilter.hpp"
+#include "SymmetricCorrespondenceFilter.hpp"
+#include "InlierDetector.hpp"
+#include "RigidTransformer.hpp"
+#include "AffineTransformer.hpp"
+#include "ViscoElasticTransformer.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
+
+typedef Eigen::VectorXf VecDynFloat;
+typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
+typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::Matrix4f Mat4Float;
+
+namespace registration {
+
+/*
+# GOAL
+A registration pipeline (correspondences -> inlier weights -> transformation)
+whose stages are chosen at compile time:
+
+    RegistrationPipeline<CorrespondencePolicy, InlierPolicy, TransformPolicy>
+
+Each policy holds its filter by value, so all calls are resolved at compile
+time (no BaseCorrespondenceFilter pointer and no virtual dispatch) and can be
+inlined into the iteration. The pipeline owns the buffers the stages share
+(corresponding features and flags, inlier weights) instead of the caller
+wiring raw pointers between separately allocated matrices.
+
+RigidRegistration, AffineRegistration and NonrigidRegistration instantiate
+the pipeline for the symmetric and the push-only correspondences and only
+dispatch on the runtime settings.
+
+# LIMITATIONS
+The stages are not fused: every iteration the correspondence stage writes
+the full corresponding features (and flags) to the shared buffers, and the
+inlier stage reads them again to compute the residuals. So per iteration
+the corresponding features make a round trip through memory (2 x 28 bytes
+per floating node) that a fused correspondence/residual kernel would avoid.
+Only the passes within a stage are fused (see GaussianInliers). The inlier
+weights themselves can't be computed in the correspondence loop: the sigma
+of the inlier model is estimated from all residuals, so it needs every
+correspondence first.
+
+# POLICIES
+Correspondences (PushCorrespondences, SymmetricCorrespondences),
+inliers (GaussianInliers) and transformations (RigidTransform,
+AffineTransform, ViscoElasticTransform) all provide:
+-bind(PipelineData &data): connect the stage to the shared buffers,
+-update(): run the stage,
+-get_memory_usage(): bytes held by the stage.
+
+# USAGE
+RegistrationPipeline<PushCorrespondences, GaussianInliers, RigidTransform> pipeline;
+pipeline.set_input(&floatingFeatures, &floatingFlags, &targetFeatures, &targetFlags);
+pipeline.correspondences().set_settings(settings);
+pipeline.inliers().set_parameters(kappa, useOrientation);
+pipeline.transform().set_parameters(useScaling);
+pipeline.initialize();
+for (...) { pipeline.iterate();}
+*/
+
+//# Buffers shared by the stages of a pipeline
+struct PipelineData {
+    //## Inputs
+    FeatureView floatingFeatures; //transformed in place
+    ConstVecView floatingFlags;
+    ConstFeatureView targetFeatures;
+    ConstVecView targetFlags;
+    //## Owned by the pipeline
+    FeatureMat correspondingFeatures;
+    VecDynFloat correspondingFlags;
+    VecDynFloat weights;
+};
+
+
+//#######################################################################
+//# Correspondence policies
+//#######################################################################
+//# Settings of the correspondence filters
+struct CorrespondenceSettings {
+    size_t numNeighbours = 3;
+    float flagThreshold = 0.9f;
+    bool equalizePushPull = false;  //symmetric filter only
+    CorrespondenceMemoryModes modes;
+    float maxDistance = 0.0f;
+    float requeryTolerance = 0.1f;
+};
+
+//## The filters don't share the signature of set_parameters()
+inline void set_correspondence_parameters(CorrespondenceFilter &filter,
+                                          const CorrespondenceSettings &settings) {
+    filter.set_parameters(settings.numNeighbours, settings.flagThreshold);
+}
+inline void set_correspondence_parameters(SymmetricCorrespondenceFilter &filter,
+                                          const CorrespondenceSettings &settings) {
+    filter.set_parameters(settings.numNeighbours, settings.flagThreshold, settings.equalizePushPull);
+}
+
+template <typename Filter>
+class FilterCorrespondences
+{
+    public:
+        void set_settings(const CorrespondenceSettings &settings) { _settings = settings;}
+        //## Required for surface matching
+        void set_target_faces(const ConstFacesView &inTargetFaces) { _inTargetFaces.reset(inTargetFaces);}
+        Filter &filter() { return _filter;}
+
+        void bind(PipelineData &data) {
+            set_correspondence_parameters(_filter, _settings);
+            if (_settings.modes.surfaceMatching) {
+                _filter.set_target_faces(_inTargetFaces);
+                _filter.set_surface_matching(true);
+            }
+            if (_settings.modes.positionalSearch) {
+                _filter.set_positional_search(true);
+            }
+            _filter.set_max_distance(_settings.maxDistance);
+            _filter.set_selective_update(_settings.modes.selectiveUpdate, _settings.requeryTolerance);
+            _filter.set_floating_input(data.floatingFeatures, data.floatingFlags);
+            _filter.set_target_input(data.targetFeatures, data.targetFlags);
+            _filter.set_output(&data.correspondingFeatures, &data.correspondingFlags);
+        }
+        //## The inputs were bound once: the floating features are updated in
+        //## place and the target doesn't change, so there's no need to rebuild
+        //## the target kd-tree every iteration.
+        void update() { _filter.update();}
+        size_t get_memory_usage() const { return _filter.get_memory_usage();}
+
+    private:
+        Filter _filter;
+        CorrespondenceSettings _settings;
+        ConstFacesView _inTargetFaces;
+};
+
+typedef FilterCorrespondences<CorrespondenceFilter> PushCorrespondences;
+typedef FilterCorrespondences<SymmetricCorrespondenceFilter> SymmetricCorrespondences;
+
+
+//#######################################################################
+//# Inlier policies
+//#######################################################################
+class GaussianInliers
+{
+    /*
+    Inlier weights from the residuals (InlierDetector): the residuals are
+    computed once per update and the probability and sigma passes of the
+    expectation maximisation are fused. With set_trimming() the detector
+    keeps the best fraction of the residuals instead (trimmed model).
+    The residuals are computed from the corresponding features the
+    correspondence stage wrote, in a pass of their own (see LIMITATIONS
+    above).
+    */
+    public:
+        void set_parameters(const float kappa, const bool useOrientation) {
+            _kappa = kappa;
+            _useOrientation = useOrientation;
+        }
+        void set_initial_weights(const ConstVecView &inInitialWeights) {
+            _inInitialWeights.reset(inInitialWeights);
+        }
+        void set_trimming(const float trimFraction, const float trimRamp = 0.0f) {
+            _trimFraction = trimFraction;
+            _trimRamp = trimRamp;
+        }
+        InlierDetector &detector() { return _detector;}
+
+        void bind(PipelineData &data) {
+            _detector.set_input(data.floatingFeatures, &data.correspondingFeatures, &data.correspondingFlags);
+            _detector.set_output(&data.weights);
+            _detector.set_parameters(_kappa, _useOrientation);
+            _detector.set_trimming(_trimFraction, _trimRamp);
+            if (_inInitialWeights.is_set()) { _detector.set_initial_weights(_inInitialWeights);}
+        }
+        void update() { _detector.update();}
+        size_t get_memory_usage() const { return _detector.get_memory_usage();}
+
+    private:
+        InlierDetector _detector;
+        float _kappa = 3.0f;
+        bool _useOrientation = true;
+        float _trimFraction = 0.0f;
+        float _trimRamp = 0.0f;
+        ConstVecView _inInitialWeights;
+};
+
+
+//#######################################################################
+//# Transformation policies
+//#######################################################################
+class RigidTransform
+{
+    //# Rigid (or similarity) transformation, accumulated over the iterations
+    public:
+        void set_parameters(const bool useScaling) { _useScaling = useScaling;}
+        //## The transformation the iterations are accumulated onto
+        void set_initial_transformation(const Mat4Float &transformationMatrix) {
+            _transformationMatrix = transformationMatrix;
+        }
+        Mat4Float get_transformation() const { return _transformationMatrix;}
+        RigidTransformer &transformer() { return _transformer;}
+
+        void bind(PipelineData &data) {
+            _transformer.set_input(&data.correspondingFeatures, &data.weights);
+            _transformer.set_output(data.floatingFeatures);
+            _transformer.set_parameters(_useScaling);
+        }
+        void update() {
+            _transformer.update();
+            _transformationMatrix = _transformer.get_transformation() * _transformationMatrix;
+        }
+        size_t get_memory_usage() const { return 0;}
+
+    private:
+        RigidTransformer _transformer;
+        bool _useScaling = false;
+        Mat4Float _transformationMatrix = Mat4Float::Identity();
+};
+
+
+class AffineTransform
+{
+    //# Affine transformation, accumulated over the iterations
+    public:
+        void set_parameters(const float regularisation) { _regularisation = regularisation;}
+        //## The transformation the iterations are accumulated onto
+        void set_initial_transformation(const Mat4Float &transformationMatrix) {
+            _transformationMatrix = transformationMatrix;
+        }
+        Mat4Float get_transformation() const { return _transformationMatrix;}
+        AffineTransformer &transformer() { return _transformer;}
+
+        void bind(PipelineData &data) {
+            _transformer.set_input(&data.correspondingFeatures, &data.weights);
+            _transformer.set_output(data.floatingFeatures);
+            _transformer.set_parameters(_regularisation);
+        }
+        void update() {
+            _transformer.update();
+            _transformationMatrix = _transformer.get_transformation() * _transformationMatrix;
+        }
+        size_t get_memory_usage() const { return 0;}
+
+    private:
+        AffineTransformer _transformer;
+        float _regularisation = 0.0f;
+        Mat4Float _transformationMatrix = Mat4Float::Identity();
+};
+
+
+class ViscoElasticTransform
+{
+    //# Nonrigid transformation (visco-elastic displacement field)
+    public:
+        void set_floating_faces(const ConstFacesView &inFloatingFaces) { _inFloatingFaces.reset(inFloatingFaces);}
+        void set_initial_displacement(const Vec3Mat * const inDisplacementField) {
+            _inInitialDisplacementField = inDisplacementField;
+        }
+        //## Set before every update (the numbers of iterations are annealed)
+        void set_parameters(const size_t numNeighbours, const float sigma,
+                            const size_t viscousIterations, const size_t elasticIterations) {
+            _transformer.set_parameters(numNeighbours, sigma, viscousIterations, elasticIterations);
+        }
+        //## Regularise with a single Gaussian operator (see ViscoElasticTransformer)
+        void set_direct_regularisation(const bool directRegularisation, const float radiusFactor = 3.0f) {
+            _transformer.set_direct_regularisation(directRegularisation, radiusFactor);
+        }
+        void set_neighbour_positions(const Vec3Mat * const inNeighbourPositions) {
+            _inNeighbourPositions = inNeighbourPositions;
+        }
+        void set_smoothing_neighbours(const MatDynInt * const inIndices, const MatDynFloat * const inSquaredDistances,
+                                      const MatDynFloat * const inSmoothingWeights = NULL) {
+            _inNeighbourIndices = inIndices;
+            _inNeighbourSquaredDistances = inSquaredDistances;
+            _inSmoothingWeights = inSmoothingWeights;
+        }
+        Vec3Mat get_transformation() const { return _transformer.get_transformation();}
+        ViscoElasticTransformer &transformer() { return _transformer;}
+
+        void bind(PipelineData &data) {
+            _transformer.set_input(&data.correspondingFeatures, &data.weights, data.floatingFlags, _inFloatingFaces);
+            _transformer.set_output(data.floatingFeatures);
+            if (_inInitialDisplacementField != NULL) {
+                _transformer.set_initial_displacement(*_inInitialDisplacementField);
+            }
+            if (_inNeighbourPositions != NULL) {
+                _transformer.set_neighbour_positions(*_inNeighbourPositions);
+            }
+            if ((_inNeighbourIndices != NULL) && (_inNeighbourSquaredDistances != NULL)) {
+                _transformer.set_smoothing_neighbours(*_inNeighbourIndices, *_inNeighbourSquaredDistances,
+                                                      _inSmoothingWeights);
+            }
+        }
+        void update() { _transformer.update();}
+        size_t get_memory_usage() const { return _transformer.get_memory_usage();}
+
+    private:
+        ViscoElasticTransformer _transformer;
+        ConstFacesView _inFloatingFaces;
+        const Vec3Mat * _inInitialDisplacementField = NULL;
+        const Vec3Mat * _inNeighbourPositions = NULL;
+        const MatDynInt * _inNeighbourIndices = NULL;
+        const MatDynFloat * _inNeighbourSquaredDistances = NULL;
+        const MatDynFloat * _inSmoothingWeights = NULL;
+};
+
+
+//#######################################################################
+//# Pipeline
+//#######################################################################
+template <typename CorrespondencePolicy, typename InlierPolicy, typename TransformPolicy>
+class RegistrationPipeline
+{
+    public:
+        RegistrationPipeline() {}
+
+        void set_input(const FeatureView &ioFloatingFeatures, const ConstVecView &inFloatingFlags,
+                       const ConstFeatureView &inTargetFeatures, const ConstVecView &inTargetFlags) {
+            _data.floatingFeatures.reset(ioFloatingFeatures);
+            _data.floatingFlags.reset(inFloatingFlags);
+            _data.targetFeatures.reset(inTargetFeatures);
+            _data.targetFlags.reset(inTargetFlags);
+        }
+
+        //# The stages (to set their parameters before initialize())
+        CorrespondencePolicy &correspondences() { return _correspondences;}
+        InlierPolicy &inliers() { return _inliers;}
+        TransformPolicy &transform() { return _transform;}
+
+        //# Allocate the shared buffers and bind the stages to them
+        void initialize() {
+            const size_t numFloatingElements = _data.floatingFeatures.rows();
+            _data.correspondingFeatures = FeatureMat::Zero(numFloatingElements, NUM_FEATURES);
+            _data.correspondingFlags = VecDynFloat::Zero(numFloatingElements);
+            _data.weights = VecDynFloat::Ones(numFloatingElements);
+            _correspondences.bind(_data);
+            _inliers.bind(_data);
+            _transform.bind(_data);
+        }
+
+        //# One iteration: correspondences, inlier weights and transformation
+        void iterate() {
+            _correspondences.update();
+            _inliers.update();
+            _transform.update();
+        }
+
+        const VecDynFloat &get_weights() const { return _data.weights;}
+        const FeatureMat &get_corresponding_features() const { return _data.correspondingFeatures;}
+        const VecDynFloat &get_corresponding_flags() const { return _data.correspondingFlags;}
+
+        //# Bytes held by the shared buffers and the stages
+        size_t get_memory_usage() const {
+            return memory_usage(_data.correspondingFeatures) + memory_usage(_data.correspondingFlags)
+                   + memory_usage(_data.weights) + _correspondences.get_memory_usage()
+                   + _inliers.get_memory_usage() + _transform.get_memory_usage();
+        }
+
+    private:
+        //# The stages hold pointers into _data, so the pipeline can't be copied
+        RegistrationPipeline(const RegistrationPipeline&);
+        RegistrationPipeline& operator=(const RegistrationPipeline&);
+
+        PipelineData _data;
+        CorrespondencePolicy _correspondences;
+        InlierPolicy _inliers;
+        TransformPolicy _transform;
+};
+
+}//namespace registration
+
+#endif // REGISTRATIONPIPELINE_HPP
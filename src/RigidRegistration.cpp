@@ -1,15 +1,18 @@
 #include "RigidRegistration.hpp"
+#include "Tracer.hpp"
+#include "AutoTuner.hpp"
+#include "RegistrationPipeline.hpp"
 
 namespace registration {
 
-void RigidRegistration::set_input(FeatureMat * const ioFloatingFeatures,
-                            const FeatureMat * const inTargetFeatures,
-                            const VecDynFloat * const inFloatingFlags,
-                            const VecDynFloat * const inTargetFlags){
-    _ioFloatingFeatures = ioFloatingFeatures;
-    _inTargetFeatures = inTargetFeatures;
-    _inFloatingFlags = inFloatingFlags;
-    _inTargetFlags = inTargetFlags;
+void RigidRegistration::set_input(const FeatureView &ioFloatingFeatures,
+                            const ConstFeatureView &inTargetFeatures,
+                            const ConstVecView &inFloatingFlags,
+                            const ConstVecView &inTargetFlags){
+    _ioFloatingFeatures.reset(ioFloatingFeatures);
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inFloatingFlags.reset(inFloatingFlags);
+    _inTargetFlags.reset(inTargetFlags);
 }//end set_input()
 
 void RigidRegistration::set_parameters(bool symmetric, size_t numNeighbours,
@@ -27,43 +30,70 @@ void RigidRegistration::set_parameters(bool symmetric, size_t numNeighbours,
 }//end set_parameters()
 
 
+void RigidRegistration::set_surface_matching(const bool surfaceMatching,
+                                          const ConstFacesView &inTargetFaces){
+    _surfaceMatching = surfaceMatching;
+    _inTargetFaces.reset(inTargetFaces);
+}//end set_surface_matching()
+
+
+CorrespondenceMemoryModes RigidRegistration::_configured_modes() const{
+    CorrespondenceMemoryModes modes;
+    modes.surfaceMatching = _surfaceMatching && (_inTargetFaces.is_set());
+    modes.positionalSearch = _positionalSearch;
+    return modes;
+}//end _configured_modes()
+
+
+size_t RigidRegistration::_estimate_memory(const CorrespondenceMemoryModes &modes) const{
+    const size_t numTargetFaces = (_inTargetFaces.is_set()) ? _inTargetFaces.rows() : 0;
+    return estimate_rigid_registration_memory(_ioFloatingFeatures.rows(), _inTargetFeatures.rows(),
+                                              numTargetFaces, _numNeighbours, _symmetric, modes);
+}//end _estimate_memory()
+
+
 void RigidRegistration::update(){
+    MESHMONK_TRACE_SCOPE("RigidRegistration::update");
 
-    //# Initializes
-    size_t numFloatingVertices = _ioFloatingFeatures->rows();
-    FeatureMat correspondingFeatures = FeatureMat::Zero(numFloatingVertices, registration::NUM_FEATURES);
-    VecDynFloat correspondingFlags = VecDynFloat::Zero(numFloatingVertices);
+    //# Check the memory budget before allocating anything
+    CorrespondenceMemoryModes modes = _configured_modes();
+    _memoryStatus = fit_memory_budget(_memoryBudget, modes,
+                                      [this](const CorrespondenceMemoryModes &m){ return _estimate_memory(m);},
+                                      "RigidRegistration");
+    _peakMemory = 0;
+    if (_memoryStatus == MEMORY_OVER_BUDGET) { return;}
 
-    //# Set up the filters
-    //## Correspondence Filter (note: this part should be improved by using inheritance in the correspondence filter classes)
+    //# Pick up (or tune) the performance profile on the floating features
+    AutoTuner::ensure_tuned(_ioFloatingFeatures);
 
-    BaseCorrespondenceFilter* correspondenceFilter = NULL;
-    //std::unique_ptr<BaseCorrespondenceFilter> correspondenceFilter = new SymmetricCorrespondenceFilter;
+    //# Dispatch to the pipeline for the correspondence filter
+    if (_symmetric) { _run<SymmetricCorrespondences>(modes);}
+    else { _run<PushCorrespondences>(modes);}
 
-    if (_symmetric) {
-        correspondenceFilter = new SymmetricCorrespondenceFilter();
-        correspondenceFilter->set_parameters(_numNeighbours, _flagThreshold, _equalizePushPull);
-    }
-    else {
-        correspondenceFilter = new CorrespondenceFilter();
-        correspondenceFilter->set_parameters(_numNeighbours, _flagThreshold);
-    }
-    correspondenceFilter->set_floating_input(_ioFloatingFeatures, _inFloatingFlags);
-    correspondenceFilter->set_target_input(_inTargetFeatures, _inTargetFlags);
-    correspondenceFilter->set_output(&correspondingFeatures, &correspondingFlags);
+}//end update()
 
+
+template <typename CorrespondencePolicy>
+void RigidRegistration::_run(const CorrespondenceMemoryModes &modes){
+    //# Set up the pipeline (correspondences, inliers and rigid transformation)
+    RegistrationPipeline<CorrespondencePolicy, GaussianInliers, RigidTransform> pipeline;
+    pipeline.set_input(_ioFloatingFeatures, _inFloatingFlags, _inTargetFeatures, _inTargetFlags);
+    //## Correspondence Filter
+    CorrespondenceSettings correspondenceSettings;
+    correspondenceSettings.numNeighbours = _numNeighbours;
+    correspondenceSettings.flagThreshold = _flagThreshold;
+    correspondenceSettings.equalizePushPull = _equalizePushPull;
+    correspondenceSettings.modes = modes;
+    correspondenceSettings.maxDistance = _maxDistance;
+    pipeline.correspondences().set_settings(correspondenceSettings);
+    pipeline.correspondences().set_target_faces(_inTargetFaces);
     //## Inlier Filter
-    VecDynFloat floatingWeights = VecDynFloat::Ones(numFloatingVertices);
-    InlierDetector inlierDetector;
-    inlierDetector.set_input(_ioFloatingFeatures, &correspondingFeatures,
-                                &correspondingFlags);
-    inlierDetector.set_output(&floatingWeights);
-    inlierDetector.set_parameters(_kappaa, _inlierUseOrientation);
+    pipeline.inliers().set_parameters(_kappaa, _inlierUseOrientation);
+    pipeline.inliers().set_trimming(_trimFraction, _trimRamp);
     //## Transformation Filter
-    RigidTransformer rigidTransformer;
-    rigidTransformer.set_input(&correspondingFeatures, &floatingWeights);
-    rigidTransformer.set_output(_ioFloatingFeatures);
-    rigidTransformer.set_parameters(_useScaling);
+    pipeline.transform().set_parameters(_useScaling);
+    pipeline.transform().set_initial_transformation(_transformationMatrix);
+    pipeline.initialize();
 
     //# Perform ICP
     time_t timeStart, timePreIteration, timePostIteration, timeEnd;
@@ -71,20 +101,13 @@ void RigidRegistration::update(){
     std::cout << "Starting Rigid Registration process..." << std::endl;
     for (size_t iteration = 0 ; iteration < _numIterations ; iteration++) {
         timePreIteration = time(0);
-        //# Correspondences
-        correspondenceFilter->set_floating_input(_ioFloatingFeatures, _inFloatingFlags);
-        correspondenceFilter->set_target_input(_inTargetFeatures, _inTargetFlags);
-        correspondenceFilter->update();
-
-        //# Inlier Detection
-        inlierDetector.update();
+        MESHMONK_TRACE_SCOPE_ARG("RigidRegistration::iteration", "iteration", iteration);
+        //# Correspondences, inlier detection and transformation
+        pipeline.iterate();
 
-        //# Transformation
-        rigidTransformer.update();
-
-        //# Update final transformation matrix
-        Mat4Float currentTransform = rigidTransformer.get_transformation();
-        _transformationMatrix = currentTransform * _transformationMatrix;
+        //# Keep track of the peak memory usage
+        const size_t memoryUsage = pipeline.get_memory_usage();
+        if (memoryUsage > _peakMemory) { _peakMemory = memoryUsage;}
 
         //# Print info
         timePostIteration = time(0);
@@ -93,8 +116,8 @@ void RigidRegistration::update(){
     timeEnd = time(0);
     std::cout << "Rigid Registration Completed in " << difftime(timeEnd, timeStart) <<" second(s)."<< std::endl;
 
-    delete correspondenceFilter;
-
-}//end update()
+    //# Update final transformation matrix
+    _transformationMatrix = pipeline.transform().get_transformation();
+}//end _run()
 
 }//namespace registration
@@ -10,10 +10,13 @@
 #include "SymmetricCorrespondenceFilter.hpp"
 #include "InlierDetector.hpp"
 #include "RigidTransformer.hpp"
+#include "MemoryAccounting.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
 typedef Eigen::Matrix4f Mat4Float;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
 
 namespace registration{
 
@@ -32,6 +35,30 @@ class RigidRegistration
     # PARAMETERS
     -numNeighbours(=3):
     number of nearest neighbours
+    -surfaceMatching(=false):
+    match floating vertices to the closest point on the target surface instead
+    of to the nearest target vertices (requires the target faces).
+    -positionalSearch(=false):
+    search correspondences in a 3-D position kd-tree and re-rank them by
+    position and normal instead of searching a 6-D feature kd-tree.
+    -maxDistance(=0.0):
+    if larger than zero, floating features without target features closer
+    than this distance get no correspondence (and flag 0.0f).
+    -trimFraction(=0.0), trimRamp(=0.0):
+    if the fraction is larger than zero, the inlier weights come from the
+    trimmed model (the best trimFraction of the residuals are inliers, see
+    InlierDetector) instead of the gaussian one; kappaa isn't used then. It is
+    much cheaper, and usually enough for a rigid pre-alignment.
+
+    # MEMORY
+    -memoryBudget(=0):
+    if larger than zero, the memory usage (in bytes) is estimated from the
+    input sizes before anything is allocated. If the estimate exceeds the
+    budget, the memory hungry modes are switched off (see fit_memory_budget()),
+    and if that doesn't suffice the registration isn't run at all and
+    get_memory_status() returns MEMORY_OVER_BUDGET.
+    get_peak_memory() returns the peak number of bytes held by the filters and
+    buffers of the last update().
 
     # OUTPUT
     -outCorrespondingFeatures
@@ -40,15 +67,27 @@ class RigidRegistration
 
     public:
 
-        void set_input(FeatureMat * const ioFloatingFeatures,
-                       const FeatureMat * const inTargetFeatures,
-                       const VecDynFloat * const inFloatingFlags,
-                       const VecDynFloat * const inTargetFlags);
+        void set_input(const FeatureView &ioFloatingFeatures,
+                       const ConstFeatureView &inTargetFeatures,
+                       const ConstVecView &inFloatingFlags,
+                       const ConstVecView &inTargetFlags);
         void set_parameters(bool symmetric, size_t numNeighbours,
                             float flagThreshold, bool equalizePushPull,
                             float kappaa, bool inlierUseOrientation,
                             size_t numIterations, bool useScaling);
+        void set_surface_matching(const bool surfaceMatching,
+                                  const ConstFacesView &inTargetFaces);
+        void set_positional_search(const bool positionalSearch){ _positionalSearch = positionalSearch;}
+        void set_max_distance(const float maxDistance){ _maxDistance = maxDistance;}
+        void set_trimming(const float trimFraction, const float trimRamp = 0.0f){
+            _trimFraction = trimFraction;
+            _trimRamp = trimRamp;
+        }
         Mat4Float get_transformation() const {return _transformationMatrix;}
+        void set_memory_budget(const size_t memoryBudget){ _memoryBudget = memoryBudget;}
+        size_t estimate_memory() const { return _estimate_memory(_configured_modes());}
+        size_t get_peak_memory() const { return _peakMemory;}
+        MemoryStatus get_memory_status() const { return _memoryStatus;}
 
         void update();
 
@@ -56,10 +95,10 @@ class RigidRegistration
 
     private:
         //# Inputs/Outputs
-        FeatureMat * _ioFloatingFeatures = NULL;
-        const FeatureMat * _inTargetFeatures = NULL;
-        const VecDynFloat * _inFloatingFlags = NULL;
-        const VecDynFloat * _inTargetFlags = NULL;
+        FeatureView _ioFloatingFeatures;
+        ConstFeatureView _inTargetFeatures;
+        ConstVecView _inFloatingFlags;
+        ConstVecView _inTargetFlags;
 
         //# User Parameters
         //## Correspondences
@@ -67,19 +106,36 @@ class RigidRegistration
         size_t _numNeighbours = 3;
         float _flagThreshold = 0.9f;
         bool _equalizePushPull = false;
+        bool _surfaceMatching = false;
+        ConstFacesView _inTargetFaces;
+        bool _positionalSearch = false;
+        float _maxDistance = 0.0f;
         //## Inliers
         float _kappaa = 3.0;
         bool _inlierUseOrientation = true;
+        float _trimFraction = 0.0f;
+        float _trimRamp = 0.0f;
         //## Transformation
         size_t _numIterations = 10;
         bool _useScaling = false;
+        //## Memory
+        size_t _memoryBudget = 0;
 
         //# Internal Data structures
         Mat4Float _transformationMatrix = Mat4Float::Identity();
 
         //# Internal Parameters
+        size_t _peakMemory = 0;
+        MemoryStatus _memoryStatus = MEMORY_OK;
 
         //# Internal functions
+        //## The correspondence modes as set by the user
+        CorrespondenceMemoryModes _configured_modes() const;
+        //## Estimated peak memory usage with the given modes
+        size_t _estimate_memory(const CorrespondenceMemoryModes &modes) const;
+        //## Run the registration pipeline with the given correspondence policy
+        template <typename CorrespondencePolicy>
+        void _run(const CorrespondenceMemoryModes &modes);
 };
 
 }//namespace registration
@@ -1,16 +1,18 @@
 #include "RigidTransformer.hpp"
+#include "Tracer.hpp"
+#include "ParallelReduction.hpp"
 
 
 
 namespace registration{
 
 
-void RigidTransformer::set_input(const FeatureMat * const inCorrespondingFeatures, const VecDynFloat * const inWeights){
-    _inCorrespondingFeatures = inCorrespondingFeatures;
-    _inWeights = inWeights;
+void RigidTransformer::set_input(const ConstFeatureView &inCorrespondingFeatures, const ConstVecView &inWeights){
+    _inCorrespondingFeatures.reset(inCorrespondingFeatures);
+    _inWeights.reset(inWeights);
 }
-void RigidTransformer::set_output(FeatureMat * const ioFeatures){
-    _ioFeatures = ioFeatures;
+void RigidTransformer::set_output(const FeatureView &ioFeatures){
+    _ioFeatures.reset(ioFeatures);
 }
 void RigidTransformer::set_parameters(bool scaling){
     _scaling = scaling;
@@ -21,15 +23,15 @@ void RigidTransformer::_update_transformation() {
 
 
     //# Info & Initialization
-    _numElements = _ioFeatures->rows();
-    _numFeatures = _ioFeatures->cols();
+    _numElements = _ioFeatures.rows();
+    _numFeatures = _ioFeatures.cols();
     MatDynFloat floatingPositions = MatDynFloat::Zero(3, _numElements);
     MatDynFloat correspondingPositions = MatDynFloat::Zero(3, _numElements);
 
     //## Tranpose the data if necessary
     if ((_numElements > _numFeatures) && (_numFeatures == NUM_FEATURES)) { //this should normally be the case
-        floatingPositions = _ioFeatures->leftCols(3).transpose();
-        correspondingPositions = _inCorrespondingFeatures->leftCols(3).transpose();
+        floatingPositions = _ioFeatures.leftCols(3).transpose();
+        correspondingPositions = _inCorrespondingFeatures.leftCols(3).transpose();
     }
     else {
         std::cerr << "Warning: input of rigid transformation expects rows to correspond with elements, not features, and to have more elements than features per element." << std::endl;
@@ -40,21 +42,28 @@ void RigidTransformer::_update_transformation() {
     Vec3Float floatingCentroid = Vec3Float::Zero();
     Vec3Float correspondingCentroid = Vec3Float::Zero();
     float sumWeights = 0.0;
-    //### Weigh and sum all features
-    for (size_t i = 0 ; i < _numElements ; i++) {
-        floatingCentroid += (*_inWeights)[i] * floatingPositions.col(i).segment(0,3);
-        correspondingCentroid += (*_inWeights)[i] * correspondingPositions.col(i).segment(0,3);
-        sumWeights += (*_inWeights)[i];
-    }
+    //### Weigh and sum all features (both positions and the weight in one sum)
+    typedef Eigen::Matrix<float, 7, 1> CentroidSum;
+    const CentroidSum centroidSum = parallel_sum(_numElements, CentroidSum(CentroidSum::Zero()),
+        [&](const size_t i) {
+            CentroidSum term;
+            term << _inWeights[i] * floatingPositions.col(i).segment(0,3),
+                    _inWeights[i] * correspondingPositions.col(i).segment(0,3),
+                    _inWeights[i];
+            return term;
+        });
+    floatingCentroid = centroidSum.segment(0,3);
+    correspondingCentroid = centroidSum.segment(3,3);
+    sumWeights = centroidSum[6];
     //### Divide by total weight
     floatingCentroid /= sumWeights;
     correspondingCentroid /= sumWeights;
 
     //## 2. Compute the Cross Variance matrix
-    Mat3Float crossVarianceMatrix = Mat3Float::Zero();
-    for(size_t i = 0 ; i < _numElements ; i++) {
-        crossVarianceMatrix += (*_inWeights)[i] * floatingPositions.col(i) * correspondingPositions.col(i).transpose();
-    }
+    Mat3Float crossVarianceMatrix = parallel_sum(_numElements, Mat3Float(Mat3Float::Zero()),
+        [&](const size_t i) {
+            return Mat3Float(_inWeights[i] * floatingPositions.col(i) * correspondingPositions.col(i).transpose());
+        });
     crossVarianceMatrix = crossVarianceMatrix / sumWeights - floatingCentroid*correspondingCentroid.transpose();
 
     //## 3. Compute the Anti-Symmetric matrix
@@ -109,19 +118,19 @@ void RigidTransformer::_update_transformation() {
     //## 8. Estimate scale (if required)
     float scaleFactor = 1.0; //>1 to grow ; <1 to shrink
     if (_scaling == true){
-        float numerator = 0.0;
-        float denominator = 0.0;
-        for (size_t i = 0 ; i < _numElements ; i++){
-            //### Center and rotate the floating position
-            Vec3Float newFloatingPos = rotMatTemp * (floatingPositions.block<3,1>(0,i) - floatingCentroid.segment(0, 3));
-            //### Center the corresponding position
-            Vec3Float newCorrespondingPos = correspondingPositions.block<3,1>(0,i) - correspondingCentroid.segment(0, 3);
-
-            //### Increment numerator and denominator
-            numerator += (*_inWeights)[i] * newCorrespondingPos.transpose() * newFloatingPos;
-            denominator += (*_inWeights)[i] * newFloatingPos.transpose() * newFloatingPos;
-        }
-        scaleFactor = numerator / denominator;
+        //### Sum of the numerator (first) and denominator (second element)
+        const Eigen::Vector2f scaleSums = parallel_sum(_numElements, Eigen::Vector2f(Eigen::Vector2f::Zero()),
+            [&](const size_t i) {
+                //### Center and rotate the floating position
+                Vec3Float newFloatingPos = rotMatTemp * (floatingPositions.block<3,1>(0,i) - floatingCentroid.segment(0, 3));
+                //### Center the corresponding position
+                Vec3Float newCorrespondingPos = correspondingPositions.block<3,1>(0,i) - correspondingCentroid.segment(0, 3);
+
+                //### Increment numerator and denominator
+                return Eigen::Vector2f(_inWeights[i] * newCorrespondingPos.dot(newFloatingPos),
+                                       _inWeights[i] * newFloatingPos.dot(newFloatingPos));
+            });
+        scaleFactor = scaleSums[0] / scaleSums[1];
     }
 
 
@@ -143,26 +152,28 @@ void RigidTransformer::_update_transformation() {
     //### stands right in the multiplication with rotationMatrix.
     _transformationMatrix = scaledRotationMatrix * translationMatrix;
 
-    //# Apply the transformation
-    //## initialize a homogeneous vector in a [x y z 1] representation
-    Vec4Float vector4d = Vec4Float::Ones();
-    for (size_t i = 0 ; i < _numElements ; i++) {
+    //# Apply the transformation (independently per element, so in parallel)
+    #pragma omp parallel for
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        //## initialize a homogeneous vector in a [x y z 1] representation
+        Vec4Float vector4d = Vec4Float::Ones();
         //## Transform the position
         //### Extract position from feature matrix
         vector4d.segment(0, 3) = floatingPositions.block<3,1>(0,i);
         //### Apply transformation to the position
         vector4d = _transformationMatrix * vector4d;
-        _ioFeatures->block<1,3>(i,0) = vector4d.segment(0, 3);
+        _ioFeatures.block<1,3>(i,0) = vector4d.segment(0, 3);
         //## Rotate the vertex normals
         //### Extract normal from feature matrix
-        vector4d.segment(0, 3) = _ioFeatures->block<1,3>(i,3);
+        vector4d.segment(0, 3) = _ioFeatures.block<1,3>(i,3);
         //### Apply rotation to the normal
         vector4d = rotationMatrix * vector4d;
-        _ioFeatures->block<1,3>(i,3) = vector4d.segment(0, 3);
+        _ioFeatures.block<1,3>(i,3) = vector4d.segment(0, 3);
     }
 }
 
 void RigidTransformer::update() {
+    MESHMONK_TRACE_SCOPE("RigidTransformer::update");
     _update_transformation();
 }//end update
 
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <iostream>
 #include "../global.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::VectorXf VecDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat; //matrix MxN of type float
@@ -40,8 +41,8 @@ class RigidTransformer
     */
     public:
 
-        void set_input(const FeatureMat * const inCorrespondingFeatures, const VecDynFloat * const inWeights);
-        void set_output(FeatureMat * const ioFeatures);
+        void set_input(const ConstFeatureView &inCorrespondingFeatures, const ConstVecView &inWeights);
+        void set_output(const FeatureView &ioFeatures);
         void set_parameters(bool scaling);
         Mat4Float get_transformation() const {return _transformationMatrix;}
         void update();
@@ -50,9 +51,9 @@ class RigidTransformer
 
     private:
         //# Inputs
-        FeatureMat * _ioFeatures = NULL;
-        const FeatureMat * _inCorrespondingFeatures = NULL;
-        const VecDynFloat * _inWeights = NULL;
+        FeatureView _ioFeatures;
+        ConstFeatureView _inCorrespondingFeatures;
+        ConstVecView _inWeights;
 
         //# Outputs
         //_ioFeatures is used as both an input (to compute the transformation) and output
@@ -1,36 +1,39 @@
 #include "ScaleShifter.hpp"
+#include "Tracer.hpp"
 
 namespace registration {
 
 
 
-void ScaleShifter::set_input(const FeatureMat &inLowFeatures,
-                            const VecDynInt &inLowOriginalIndices,
-                            const VecDynInt &inHighOriginalIndices){
-    _inLowFeatures = &inLowFeatures;
-    _inLowOriginalIndices = &inLowOriginalIndices;
-    _inHighOriginalIndices = &inHighOriginalIndices;
+void ScaleShifter::set_input(const ConstFeatureView &inLowFeatures,
+                            const ConstIntVecView &inLowOriginalIndices,
+                            const ConstIntVecView &inHighOriginalIndices){
+    _inLowFeatures.reset(inLowFeatures);
+    _inLowOriginalIndices.reset(inLowOriginalIndices);
+    _inHighOriginalIndices.reset(inHighOriginalIndices);
 
-    _numLowNodes = _inLowFeatures->rows();
+    _numLowNodes = _inLowFeatures.rows();
 
     _numMatchingNodes = 0;
     _numNewNodes = 0;
 
     _matchingIndexPairs.clear();
     _newIndices.clear();
+    _matchingSet = false;
 }//end set_input()
 
 
-void ScaleShifter::set_output(FeatureMat &outHighFeatures){
-    _outHighFeatures = &outHighFeatures;
+void ScaleShifter::set_output(const FeatureView &outHighFeatures){
+    _outHighFeatures.reset(outHighFeatures);
 
-    _numHighNodes = _outHighFeatures->rows();
+    _numHighNodes = _outHighFeatures.rows();
 
     _numMatchingNodes = 0;
     _numNewNodes = 0;
 
     _matchingIndexPairs.clear();
     _newIndices.clear();
+    _matchingSet = false;
 }//end set_output()
 
 
@@ -42,7 +45,7 @@ void ScaleShifter::_find_matching_and_new_indices(){
     //## Loop over the low sampled indices
     for (size_t i = 0 ; i < _numLowNodes ; i++){
         //## Get the original index
-        int originalIndex = (*_inLowOriginalIndices)[i];
+        int originalIndex = _inLowOriginalIndices[i];
         //## Make a pair of the original index with its current index
         std::pair<int,int> indexPair(originalIndex,i);
         //## Save it into the list of index pairs.
@@ -52,7 +55,7 @@ void ScaleShifter::_find_matching_and_new_indices(){
     //## Loop over the high sampled indices
     for (size_t i = 0 ; i < _numHighNodes ; i++){
         //## Get the original index
-        int originalIndex = (*_inHighOriginalIndices)[i];
+        int originalIndex = _inHighOriginalIndices[i];
         //## Make a pair of the original index with its current index
         std::pair<int,int> indexPair(originalIndex,i);
         //## Save it into the list of index pairs.
@@ -126,12 +129,11 @@ void ScaleShifter::_find_matching_and_new_indices(){
 }//end find_matching_and_new_indices()
 
 
-void ScaleShifter::_interpolate_new_nodes(){
+void ScaleShifter::_compute_interpolation(){
     /*
-    The goal is here to interpolate the positions for the new nodes of
-    the high sampled mesh. We'll do that by weighted k-nn. Therefor,
-    we can reuse the CorrespondenceFilter class, which will gives us
-    the 1/d_squared weighted average of k neighbouring positions.
+    The goal is here to find, for the new nodes of the high sampled mesh, the
+    interpolation of their deformation. We'll do that by weighted k-nn, with
+    the 1/d_squared weighted average of k neighbouring matching nodes.
 
     So we will set up a k-nn finder. The source points should be the nodes
     that match between the high and low sampled mesh, but with the feature
@@ -139,9 +141,9 @@ void ScaleShifter::_interpolate_new_nodes(){
     unchanged by the registration process). The queried points are of course
     the new nodes of the high sampled mesh.
 
-    After the nearest neighbours are found (using the old feature values of
-    the high sampled mesh!), we then interpolate their feature values by
-    weighted averaging of the features of the low sampled mesh.
+    The neighbours are found using the old feature values of the high sampled
+    mesh, so the interpolation only depends on the high sampled mesh and can
+    be kept (see get_matching()).
     */
 
     //# Set up Source and Queried Points
@@ -156,7 +158,7 @@ void ScaleShifter::_interpolate_new_nodes(){
         //## of those nodes of the high sampled mesh that are also present in
         //## the low sampled mesh.
         int matchingIndex = _matchingIndexPairs[i].first;
-        matchingNodesOldFeatures.row(i) = _outHighFeatures->row(matchingIndex);
+        matchingNodesOldFeatures.row(i) = _outHighFeatures.row(matchingIndex);
     }
 
     //# Set up Queried Points
@@ -165,14 +167,17 @@ void ScaleShifter::_interpolate_new_nodes(){
         //## Get the index of the new nodes of the high sampled mesh. We are skipping
         //## all the nodes for which a match was found in the low sampled mesh.
         int newIndex = _newIndices[i];
-        newNodesOldFeatures.row(i) = _outHighFeatures->row(newIndex);
+        newNodesOldFeatures.row(i) = _outHighFeatures.row(newIndex);
     }
 
     //# Set up a k-nn finder
+    size_t k = 3; //k = 3
+    _interpolationMatches = IntegerMat::Zero(_numNewNodes, k);
+    _interpolationWeights = FloatMat::Zero(_numNewNodes, k);
+    if ((_numNewNodes == 0) || (_numMatchingNodes == 0)) { return;}
     NeighbourFinder<FeatureMat> neighbourFinder;
     neighbourFinder.set_source_points(&matchingNodesOldFeatures);
     neighbourFinder.set_queried_points(&newNodesOldFeatures);
-    size_t k = 3; //k = 3
     neighbourFinder.set_parameters(k);
 
     //# Get the indices and squared distances to the nearest neighbours
@@ -181,36 +186,13 @@ void ScaleShifter::_interpolate_new_nodes(){
     const FloatMat neighbourSquaredDistances = neighbourFinder.get_distances();
 
 
-    //# Set up the deformation field
-    //## Initialization
-    Vec3Mat deformationField = Vec3Mat::Zero(_numHighNodes, 3);
-    Vec3Float deformation = Vec3Float::Zero();
-    Vec3Float oldPosition = Vec3Float::Zero();
-    Vec3Float newPosition = Vec3Float::Zero();
-    //## Loop over the matching nodes
-    for (size_t i = 0 ; i < _numMatchingNodes ; i++){
-        //## Get the index pairs
-        int highIndex = _matchingIndexPairs[i].first;
-        int lowIndex = _matchingIndexPairs[i].second;
-        //## Get the features and compute the differences
-        oldPosition = (_outHighFeatures->row(highIndex)).head(3);
-        newPosition = (_inLowFeatures->row(lowIndex)).head(3);
-        deformation = newPosition - oldPosition;
-        deformationField.row(highIndex) = deformation;
-    }
-
-
-
-
-    //# Compute the weighted average deformation for the new nodes
+    //# Compute the interpolation weights for the new nodes
     //## Initialization
     Vec3Float newNodeOldNormal = Vec3Float::Zero();
     //## Loop over the indices of the new nodes
     for (size_t i = 0 ; i < _numNewNodes ; i++) {
         const int newNodeIndex = _newIndices[i];
-        newNodeOldNormal = _outHighFeatures->row(newNodeIndex).tail(3);
-        //## Initialize the deformation of the current new node to zero
-        deformationField.row(newNodeIndex).setZero();
+        newNodeOldNormal = _outHighFeatures.row(newNodeIndex).tail(3);
         float sumWeights = 0.0f;
         //## Loop over each found neighbour
         for ( size_t j = 0 ; j < k ; j++) {
@@ -220,7 +202,7 @@ void ScaleShifter::_interpolate_new_nodes(){
 
             //### The neighbourIndex now points to a row of matchingNodesOldFeatures.
             //### We need to find the matching index that points to the right row
-            //### of the low sampled mesh.
+            //### of the high sampled mesh.
             const int matchingHighNeighbourIndex = _matchingIndexPairs[neighbourIndex].first;
 
             //### For numerical stability, check if the distance is very small
@@ -231,7 +213,7 @@ void ScaleShifter::_interpolate_new_nodes(){
             float weight = 1.0f / distanceSquared;
 
             //### Incorporate the orientation
-            Vec3Float neighbourOldNormal = _outHighFeatures->row(matchingHighNeighbourIndex).tail(3);
+            Vec3Float neighbourOldNormal = _outHighFeatures.row(matchingHighNeighbourIndex).tail(3);
             float dotProduct = newNodeOldNormal.dot(neighbourOldNormal);
             float orientationWeight = dotProduct / 2.0f + 0.5f;
             weight *= orientationWeight;
@@ -243,24 +225,87 @@ void ScaleShifter::_interpolate_new_nodes(){
             if (weight < eps2) {weight = eps2;}
             if (weight > 1.0f) {weight = 1.0f;}
 
-            //### Weigh the matching features of the low sampled mesh
-            deformationField.row(newNodeIndex) += weight * deformationField.row(matchingHighNeighbourIndex);
+            //### Remember the matching pair and the weight
+            _interpolationMatches(i,j) = neighbourIndex;
+            _interpolationWeights(i,j) = weight;
             sumWeights += weight;
         }
         //### Normalize
-        deformationField.row(newNodeIndex) /= sumWeights;
+        _interpolationWeights.row(i) /= sumWeights;
     }
+}//end _compute_interpolation()
 
 
-    //# Deform the new nodes
+void ScaleShifter::_interpolate_new_nodes(){
+    //# Set up the deformation field of the matching nodes
+    //## Initialization
+    Vec3Mat deformationField = Vec3Mat::Zero(_numHighNodes, 3);
+    Vec3Float deformation = Vec3Float::Zero();
+    Vec3Float oldPosition = Vec3Float::Zero();
+    Vec3Float newPosition = Vec3Float::Zero();
+    //## Loop over the matching nodes
+    for (size_t i = 0 ; i < _numMatchingNodes ; i++){
+        //## Get the index pairs
+        int highIndex = _matchingIndexPairs[i].first;
+        int lowIndex = _matchingIndexPairs[i].second;
+        //## Get the features and compute the differences
+        oldPosition = (_outHighFeatures.row(highIndex)).head(3);
+        newPosition = (_inLowFeatures.row(lowIndex)).head(3);
+        deformation = newPosition - oldPosition;
+        deformationField.row(highIndex) = deformation;
+    }
+
+    //# Compute the weighted average deformation for the new nodes and deform them
     for (size_t i = 0 ; i < _numNewNodes ; i++) {
         const int newNodeIndex = _newIndices[i];
-
-        (_outHighFeatures->row(newNodeIndex)).head(3) += deformationField.row(newNodeIndex);
+        deformation = Vec3Float::Zero();
+        for (size_t j = 0 ; j < size_t(_interpolationMatches.cols()) ; j++) {
+            const int matchingHighNeighbourIndex = _matchingIndexPairs[_interpolationMatches(i,j)].first;
+            deformation += _interpolationWeights(i,j) * deformationField.row(matchingHighNeighbourIndex).transpose();
+        }
+        (_outHighFeatures.row(newNodeIndex)).head(3) += deformation.transpose();
     }
 }//end _interpolate_new_nodes()
 
 
+ScaleShiftMatching ScaleShifter::get_matching() const{
+    ScaleShiftMatching matching;
+    matching.numLowNodes = _numLowNodes;
+    matching.indexPairs = IntegerMat::Zero(_numMatchingNodes, 2);
+    for (size_t i = 0 ; i < _numMatchingNodes ; i++) {
+        matching.indexPairs(i,0) = _matchingIndexPairs[i].first;
+        matching.indexPairs(i,1) = _matchingIndexPairs[i].second;
+    }
+    matching.newIndices = Eigen::Map<const VecDynInt>(_newIndices.data(), _numNewNodes);
+    matching.interpolationMatches = _interpolationMatches;
+    matching.interpolationWeights = _interpolationWeights;
+    return matching;
+}//end get_matching()
+
+
+bool ScaleShifter::set_matching(const ScaleShiftMatching &matching){
+    //# Safety check: the matching has to be made for meshes of these sizes
+    if ((matching.numLowNodes != _numLowNodes)
+        || (size_t(matching.indexPairs.rows() + matching.newIndices.rows()) != _numHighNodes)
+        || (matching.interpolationMatches.rows() != matching.newIndices.rows())
+        || (matching.interpolationWeights.rows() != matching.newIndices.rows())) {
+        std::cerr << "The matching given to the ScaleShifter doesn't fit the meshes. It's computed again." << std::endl;
+        return false;
+    }
+    _matchingIndexPairs.resize(matching.indexPairs.rows());
+    for (size_t i = 0 ; i < _matchingIndexPairs.size() ; i++) {
+        _matchingIndexPairs[i] = std::pair<int,int>(matching.indexPairs(i,0), matching.indexPairs(i,1));
+    }
+    _newIndices.assign(matching.newIndices.data(), matching.newIndices.data() + matching.newIndices.rows());
+    _interpolationMatches = matching.interpolationMatches;
+    _interpolationWeights = matching.interpolationWeights;
+    _numMatchingNodes = _matchingIndexPairs.size();
+    _numNewNodes = _newIndices.size();
+    _matchingSet = true;
+    return true;
+}//end set_matching()
+
+
 void ScaleShifter::_copy_matching_nodes(){
     //# Copy the features of the lowly sampled mesh into the features
     //# of the matching nodes of the highly sampled mesh.
@@ -269,14 +314,54 @@ void ScaleShifter::_copy_matching_nodes(){
         int highIndex = _matchingIndexPairs[i].first;
         int lowIndex = _matchingIndexPairs[i].second;
         //## copy the features of the low mesh into the features of the high mesh
-        _outHighFeatures->row(highIndex) = _inLowFeatures->row(lowIndex);
+        _outHighFeatures.row(highIndex) = _inLowFeatures.row(lowIndex);
     }
 }//end _copy_matching_nodes()
 
+template <typename FieldType>
+void ScaleShifter::_shift_field(const FieldType &inLowField, FieldType &outHighField) const{
+    //# Safety check
+    if (size_t(inLowField.rows()) != _numLowNodes) {
+        std::cerr << "The field shifted by the ScaleShifter should have one row per node of the low sampled mesh!" << std::endl;
+        return;
+    }
+    outHighField = FieldType::Zero(_numHighNodes, inLowField.cols());
+
+    //# Copy the values of the matching nodes
+    for (size_t i = 0 ; i < _numMatchingNodes ; i++){
+        outHighField.row(_matchingIndexPairs[i].first) = inLowField.row(_matchingIndexPairs[i].second);
+    }
+
+    //# Interpolate the values of the new nodes with the weights used for the features
+    for (size_t i = 0 ; i < _numNewNodes ; i++) {
+        const int newNodeIndex = _newIndices[i];
+        for (size_t j = 0 ; j < size_t(_interpolationMatches.cols()) ; j++) {
+            const int lowIndex = _matchingIndexPairs[_interpolationMatches(i,j)].second;
+            outHighField.row(newNodeIndex) += _interpolationWeights(i,j) * inLowField.row(lowIndex);
+        }
+    }
+}//end _shift_field()
+
+
+void ScaleShifter::shift_field(const VecDynFloat &inLowField, VecDynFloat &outHighField) const{
+    _shift_field(inLowField, outHighField);
+}
+
+
+void ScaleShifter::shift_field(const Vec3Mat &inLowField, Vec3Mat &outHighField) const{
+    _shift_field(inLowField, outHighField);
+}
+
+
 void ScaleShifter::update(){
+    MESHMONK_TRACE_SCOPE("ScaleShifter::update");
 
-    //# Build the list of matching indices
-    _find_matching_and_new_indices();
+    //# Build the list of matching indices and the interpolation of the new
+    //# nodes (unless a matching was set)
+    if (!_matchingSet) {
+        _find_matching_and_new_indices();
+        _compute_interpolation();
+    }
 
     //# Interpolate the features of new nodes
     _interpolate_new_nodes();
@@ -10,6 +10,7 @@
 #include "../global.hpp"
 #include "helper_functions.hpp"
 #include "NeighbourFinder.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::Vector3f Vec3Float;
 typedef Eigen::VectorXf VecDynFloat;
@@ -25,6 +26,19 @@ typedef OpenMesh::TriMesh_ArrayKernelT<MyTraits>  TriMesh;
 namespace registration{
 
 
+//# The matches and interpolation weights of a ScaleShifter, which only depend
+//# on the original indices of both meshes and the features of the higher
+//# sampled one. They can be kept and set again (see PreparedTemplate).
+struct ScaleShiftMatching
+{
+    size_t numLowNodes = 0;
+    IntegerMat indexPairs; //(high index, low index) of each matching node
+    VecDynInt newIndices; //high indices of the new nodes
+    IntegerMat interpolationMatches; //for each new node, rows of indexPairs it is interpolated from
+    FloatMat interpolationWeights; //and their (normalized) interpolation weights
+};
+
+
 /*
 ScaleShifter class.
 
@@ -38,28 +52,39 @@ Because both meshes are a subsampled version of the same original mesh, matches
 original indices of each element. Therefor, the ScaleShifter expects the original indices for each mesh as input:
 -inLowOriginalIndices for the original indices of the (lower sampled) mesh of the previous scale.
 -inHighOriginalIndicies for the original indices of the (higher sampled) mesh of the current scale.
+
+After update(), any other per-node field of the lower sampled mesh (e.g. inlier weights) can be transferred to the
+higher sampled mesh with shift_field(). It uses the same matches and interpolation weights as the features.
+
+get_matching() returns the matches and interpolation weights after update(). Setting them with set_matching() (after
+set_input() and set_output(), for meshes with the same original indices and higher sampled features) skips their
+computation in update().
 */
 
 class ScaleShifter
 {
     public:
 
-        void set_input(const FeatureMat &inLowFeatures,
-                       const VecDynInt &inLowOriginalIndices,
-                       const VecDynInt &inHighOriginalIndices);
-        void set_output(FeatureMat &outHighFeatures);
+        void set_input(const ConstFeatureView &inLowFeatures,
+                       const ConstIntVecView &inLowOriginalIndices,
+                       const ConstIntVecView &inHighOriginalIndices);
+        void set_output(const FeatureView &outHighFeatures);
         void update();
+        ScaleShiftMatching get_matching() const;
+        bool set_matching(const ScaleShiftMatching &matching);
+        void shift_field(const VecDynFloat &inLowField, VecDynFloat &outHighField) const;
+        void shift_field(const Vec3Mat &inLowField, Vec3Mat &outHighField) const;
 
     protected:
 
     private:
         //# Inputs
-        const FeatureMat * _inLowFeatures = NULL;
-        const VecDynInt *_inLowOriginalIndices = NULL;
-        const VecDynInt *_inHighOriginalIndices = NULL;
+        ConstFeatureView _inLowFeatures;
+        ConstIntVecView _inLowOriginalIndices;
+        ConstIntVecView _inHighOriginalIndices;
 
         //# Outputs
-        FeatureMat * _outHighFeatures;
+        FeatureView _outHighFeatures;
 
 
         //# User Parameters
@@ -67,17 +92,26 @@ class ScaleShifter
         //# Internal Data structures
         std::vector<std::pair<int,int> > _matchingIndexPairs;
         std::vector<int> _newIndices;
+        //## For each new node, the matching pairs (indices into
+        //## _matchingIndexPairs) it is interpolated from and their
+        //## (normalized) interpolation weights.
+        IntegerMat _interpolationMatches;
+        FloatMat _interpolationWeights;
 
         //# Internal Parameters
         size_t _numLowNodes = 0;
         size_t _numHighNodes = 0;
         size_t _numMatchingNodes = 0;
         size_t _numNewNodes = 0;
+        bool _matchingSet = false;
 
         //# Internal functions
         void _find_matching_and_new_indices();
+        void _compute_interpolation();
         void _interpolate_new_nodes();
         void _copy_matching_nodes();
+        template <typename FieldType>
+        void _shift_field(const FieldType &inLowField, FieldType &outHighField) const;
 };
 
 }//namespace registration
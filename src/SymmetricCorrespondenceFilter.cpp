@@ -1,32 +1,33 @@
 #include "SymmetricCorrespondenceFilter.hpp"
+#include "Tracer.hpp"
 
 namespace registration {
 
 
-void SymmetricCorrespondenceFilter::set_floating_input(const FeatureMat * const inFloatingFeatures,
-                                                       const VecDynFloat * const inFloatingFlags)
+void SymmetricCorrespondenceFilter::set_floating_input(const ConstFeatureView &inFloatingFeatures,
+                                                       const ConstVecView &inFloatingFlags)
 {
     //# Set input
-    _inFloatingFeatures = inFloatingFeatures;
-    _inFloatingFlags = inFloatingFlags;
+    _inFloatingFeatures.reset(inFloatingFeatures);
+    _inFloatingFlags.reset(inFloatingFlags);
 
     //# Update internal parameters
-    _numFloatingElements = _inFloatingFeatures->rows();
+    _numFloatingElements = _inFloatingFeatures.rows();
 
     //# Update the push and pull filters
     _pushFilter.set_floating_input(_inFloatingFeatures, _inFloatingFlags);
     _pullFilter.set_target_input(_inFloatingFeatures, _inFloatingFlags);
 }
 
-void SymmetricCorrespondenceFilter::set_target_input(const FeatureMat * const inTargetFeatures,
-                                            const VecDynFloat * const inTargetFlags)
+void SymmetricCorrespondenceFilter::set_target_input(const ConstFeatureView &inTargetFeatures,
+                                            const ConstVecView &inTargetFlags)
 {
     //# Set input
-    _inTargetFeatures = inTargetFeatures;
-    _inTargetFlags = inTargetFlags;
+    _inTargetFeatures.reset(inTargetFeatures);
+    _inTargetFlags.reset(inTargetFlags);
 
     //# Update internal parameters
-    _numTargetElements = _inTargetFeatures->rows();
+    _numTargetElements = _inTargetFeatures.rows();
 
     //# Update the push and pull filters
     _pushFilter.set_target_input(_inTargetFeatures, _inTargetFlags);
@@ -46,6 +47,35 @@ void SymmetricCorrespondenceFilter::set_parameters(const size_t numNeighbours,
     _pullFilter.set_affinity_normalization(false);
 }
 
+void SymmetricCorrespondenceFilter::set_target_faces(const ConstFacesView &inTargetFaces)
+{
+    _pushFilter.set_target_faces(inTargetFaces);
+}
+
+void SymmetricCorrespondenceFilter::set_surface_matching(const bool surfaceMatching)
+{
+    _pushFilter.set_surface_matching(surfaceMatching);
+}
+
+void SymmetricCorrespondenceFilter::set_positional_search(const bool positionalSearch,
+                                                          const size_t numCandidates)
+{
+    _pushFilter.set_positional_search(positionalSearch, numCandidates);
+    _pullFilter.set_positional_search(positionalSearch, numCandidates);
+}
+
+void SymmetricCorrespondenceFilter::set_max_distance(const float maxDistance)
+{
+    _pushFilter.set_max_distance(maxDistance);
+    _pullFilter.set_max_distance(maxDistance);
+}
+
+void SymmetricCorrespondenceFilter::set_selective_update(const bool selectiveUpdate,
+                                                         const float requeryTolerance)
+{
+    _pushFilter.set_selective_update(selectiveUpdate, requeryTolerance);
+}
+
 void SymmetricCorrespondenceFilter::_update_push_and_pull() {
 
     //# Compute the push and pull affinity
@@ -68,9 +98,13 @@ void SymmetricCorrespondenceFilter::_update_push_and_pull() {
 
 
 void SymmetricCorrespondenceFilter::update() {
+    MESHMONK_TRACE_SCOPE("SymmetricCorrespondenceFilter::update");
     //# Update the I/O for the push- and pull-filters
+    //## The target of the push filter was set in set_target_input(). Setting
+    //## it again would rebuild its kd-tree (and clear its cached neighbours)
+    //## for nothing. The target of the pull filter are the floating features,
+    //## which have moved, so its kd-tree does have to be rebuilt.
     _pushFilter.set_floating_input(_inFloatingFeatures, _inFloatingFlags);
-    _pushFilter.set_target_input(_inTargetFeatures, _inTargetFlags);
     _pullFilter.set_floating_input(_inTargetFeatures, _inTargetFlags);
     _pullFilter.set_target_input(_inFloatingFeatures, _inFloatingFlags);
 
@@ -92,15 +126,15 @@ void SymmetricCorrespondenceFilter::update() {
     BaseCorrespondenceFilter::_affinity_to_correspondences();
 
     //# Merge the just computed corresponding flags with the corresponding pull flags.
-    (*BaseCorrespondenceFilter::_ioCorrespondingFlags) = (*BaseCorrespondenceFilter::_ioCorrespondingFlags).cwiseProduct(correspondingPullFlags);
+    BaseCorrespondenceFilter::_ioCorrespondingFlags = BaseCorrespondenceFilter::_ioCorrespondingFlags.cwiseProduct(correspondingPullFlags);
 
     //# Make these final flags binary again
     for (size_t i = 0 ; i < _numFloatingElements ; i++) {
-        if ((*BaseCorrespondenceFilter::_ioCorrespondingFlags)[i] > BaseCorrespondenceFilter::_flagThreshold){
-            (*BaseCorrespondenceFilter::_ioCorrespondingFlags)[i] = 1.0f;
+        if (BaseCorrespondenceFilter::_ioCorrespondingFlags[i] > BaseCorrespondenceFilter::_flagThreshold){
+            BaseCorrespondenceFilter::_ioCorrespondingFlags[i] = 1.0f;
         }
         else {
-            (*BaseCorrespondenceFilter::_ioCorrespondingFlags)[i] = 0.0f;
+            BaseCorrespondenceFilter::_ioCorrespondingFlags[i] = 0.0f;
         }
     }
 
@@ -17,6 +17,7 @@ typedef Eigen::SparseMatrix<float, 0, int> SparseMat;
 typedef Eigen::Triplet<float> Triplet;
 typedef Eigen::Matrix< int, Eigen::Dynamic, Eigen::Dynamic> MatDynInt; //matrix MxN of type unsigned int
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
+typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
 
 namespace registration {
 
@@ -45,6 +46,21 @@ class SymmetricCorrespondenceFilter: public BaseCorrespondenceFilter
     -flagThreshold(=0.9):
     threshold that the weighted corresponding flag needs to make in order to be flagged as 1.0.
     Otherwise, it receives flag 0.0f.
+    -surfaceMatching(=false):
+    the push direction matches floating elements to the closest point on the
+    target surface instead of to target vertices (see CorrespondenceFilter).
+    The pull direction keeps matching target vertices to floating vertices.
+    -positionalSearch(=false):
+    both directions search a 3-D position kd-tree and re-rank the candidates
+    by position and normal (see CorrespondenceFilter).
+    -maxDistance(=0.0):
+    if larger than zero, both directions ignore features further away than
+    this distance (see CorrespondenceFilter).
+    -selectiveUpdate(=false), requeryTolerance(=0.1):
+    the push direction only queries the floating features again that moved
+    enough since their last query (see CorrespondenceFilter). The pull
+    direction searches in the moving floating features, so it always has to
+    query everything again.
 
     # OUTPUT
     -outCorrespondingFeatures
@@ -55,13 +71,23 @@ class SymmetricCorrespondenceFilter: public BaseCorrespondenceFilter
         //CorrespondenceFilter(); //default constructor
         //~CorrespondenceFilter(); //destructor
 
-        void set_floating_input(const FeatureMat * const inFloatingFeatures,
-                                const VecDynFloat * const inFloatingFlags);
-        void set_target_input(const FeatureMat * const inTargetFeatures,
-                            const VecDynFloat * const inTargetFlags);
+        void set_floating_input(const ConstFeatureView &inFloatingFeatures,
+                                const ConstVecView &inFloatingFlags);
+        void set_target_input(const ConstFeatureView &inTargetFeatures,
+                            const ConstVecView &inTargetFlags);
         void set_parameters(const size_t numNeighbours,
                             const float flagThreshold,
                             const bool _equalizePushPull);
+        void set_target_faces(const ConstFacesView &inTargetFaces);
+        void set_surface_matching(const bool surfaceMatching = true);
+        void set_positional_search(const bool positionalSearch = true,
+                                   const size_t numCandidates = 0);
+        void set_max_distance(const float maxDistance);
+        void set_selective_update(const bool selectiveUpdate = true,
+                                  const float requeryTolerance = 0.1f);
+        size_t get_memory_usage() const {
+            return memory_usage(_affinity) + _pushFilter.get_memory_usage() + _pullFilter.get_memory_usage();
+        }
         void update();
 
     protected:
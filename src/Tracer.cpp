@@ -0,0 +1,107 @@
+#include "Tracer.hpp"
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+namespace registration {
+
+std::atomic<bool> Tracer::_enabled(false);
+std::chrono::steady_clock::time_point Tracer::_origin = std::chrono::steady_clock::now();
+std::vector<Tracer::Event> Tracer::_events;
+
+namespace {
+    //# Protects the event list and the thread ids. Spans are recorded at stage
+    //# granularity (a handful per iteration), so a single lock is cheap enough.
+    std::mutex tracerMutex;
+    int tracerNumThreads = 0;
+}
+
+void Tracer::set_enabled(const bool enabled){
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    if (enabled && !_enabled.load()) {
+        _origin = std::chrono::steady_clock::now();
+    }
+    _enabled.store(enabled);
+}//end set_enabled()
+
+
+void Tracer::clear(){
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    _events.clear();
+}//end clear()
+
+
+size_t Tracer::get_num_events(){
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    return _events.size();
+}//end get_num_events()
+
+
+double Tracer::now(){
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _origin).count();
+}//end now()
+
+
+int Tracer::_thread_id(){
+    //# Called with the lock held
+    thread_local int threadId = -1;
+    if (threadId < 0) { threadId = tracerNumThreads++;}
+    return threadId;
+}//end _thread_id()
+
+
+void Tracer::record(const char * const name, const double startMicroseconds,
+                    const double durationMicroseconds,
+                    const char * const argName, const long argValue){
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    Event event;
+    event.name = name;
+    event.argName = argName;
+    event.argValue = argValue;
+    event.start = startMicroseconds;
+    event.duration = durationMicroseconds;
+    event.threadId = _thread_id();
+    _events.push_back(event);
+}//end record()
+
+
+bool Tracer::write(const std::string &filename){
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    std::ofstream file(filename.c_str());
+    if (!file) {
+        std::cerr << "Tracer::write(): could not open " << filename << " for writing!" << std::endl;
+        return false;
+    }
+
+    //# Chrome trace-event format: complete ("X") events with timestamps and
+    //# durations in microseconds. The names are string literals from within the
+    //# library, so they don't need escaping.
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file.precision(3);
+    file << std::fixed;
+    for (int t = 0 ; t < tracerNumThreads ; t++) {
+        if (t > 0) { file << ",\n";}
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+             << ",\"args\":{\"name\":\"meshmonk thread " << t << "\"}}";
+    }
+    for (size_t i = 0 ; i < _events.size() ; i++) {
+        const Event &event = _events[i];
+        if ((i > 0) || (tracerNumThreads > 0)) { file << ",\n";}
+        file << "{\"name\":\"" << event.name << "\",\"cat\":\"meshmonk\",\"ph\":\"X\""
+             << ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+             << ",\"pid\":1,\"tid\":" << event.threadId;
+        if (event.argName != NULL) {
+            file << ",\"args\":{\"" << event.argName << "\":" << event.argValue << "}";
+        }
+        file << "}";
+    }
+    file << "\n]}\n";
+
+    if (!file) {
+        std::cerr << "Tracer::write(): failed writing " << filename << "!" << std::endl;
+        return false;
+    }
+    return true;
+}//end write()
+
+}//namespace registration
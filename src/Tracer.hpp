@@ -0,0 +1,124 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace registration {
+
+class Tracer
+{
+    /*
+    # GOAL
+    This class records a timeline of the stages of a registration run (which
+    thread executed which stage, when and for how long) and writes it as a
+    Chrome trace-event JSON file. The file can be opened in chrome://tracing
+    or https://ui.perfetto.dev to see how the stages of the rigid, nonrigid and
+    pyramid registrations and their filters line up.
+
+    Tracing is off by default. When it is off, a traced scope costs a single
+    relaxed atomic load. Defining MESHMONK_NO_TRACING at compile time removes
+    the traced scopes altogether.
+
+    # USAGE
+    Tracer::set_enabled(true);
+    ... run a registration ...
+    Tracer::write("trace.json");
+
+    Inside the library, stages are traced with the MESHMONK_TRACE_SCOPE(name)
+    and MESHMONK_TRACE_SCOPE_ARG(name, argName, argValue) macros. The name
+    (and argument name) must be string literals.
+    */
+
+    public:
+        //# Enable or disable recording. Enabling (re)starts the clock.
+        static void set_enabled(const bool enabled);
+        static bool is_enabled() { return _enabled.load(std::memory_order_relaxed);}
+        //# Remove all recorded events
+        static void clear();
+        //# Number of recorded events
+        static size_t get_num_events();
+        //# Write all recorded events to a Chrome trace-event JSON file.
+        //# Returns false if the file couldn't be written.
+        static bool write(const std::string &filename);
+
+        //# Record a completed span (timestamps in microseconds since the
+        //# tracer was enabled).
+        static void record(const char * const name, const double startMicroseconds,
+                           const double durationMicroseconds,
+                           const char * const argName, const long argValue);
+        //# Microseconds since the tracer was enabled.
+        static double now();
+
+    private:
+        struct Event {
+            const char * name;
+            const char * argName;
+            long argValue;
+            double start;
+            double duration;
+            int threadId;
+        };
+
+        static std::atomic<bool> _enabled;
+        static std::chrono::steady_clock::time_point _origin;
+        static std::vector<Event> _events;
+
+        //# Small consecutive id for the calling thread
+        static int _thread_id();
+};
+
+
+
+class TraceScope
+{
+    /*
+    # GOAL
+    Records a span from its construction until its destruction, if the
+    Tracer is enabled at construction.
+    */
+
+    public:
+        explicit TraceScope(const char * const name,
+                            const char * const argName = NULL,
+                            const long argValue = 0)
+            : _name(name), _argName(argName), _argValue(argValue),
+              _active(Tracer::is_enabled()), _start(0.0) {
+            if (_active) { _start = Tracer::now();}
+        }
+        ~TraceScope() {
+            if (_active) {
+                Tracer::record(_name, _start, Tracer::now() - _start, _argName, _argValue);
+            }
+        }
+
+    private:
+        TraceScope(const TraceScope&);
+        TraceScope& operator=(const TraceScope&);
+
+        const char * _name;
+        const char * _argName;
+        long _argValue;
+        bool _active;
+        double _start;
+};
+
+}//namespace registration
+
+
+
+#define MESHMONK_TRACE_CONCAT_INNER(a, b) a##b
+#define MESHMONK_TRACE_CONCAT(a, b) MESHMONK_TRACE_CONCAT_INNER(a, b)
+#ifdef MESHMONK_NO_TRACING
+#define MESHMONK_TRACE_SCOPE(name)
+#define MESHMONK_TRACE_SCOPE_ARG(name, argName, argValue)
+#else
+#define MESHMONK_TRACE_SCOPE(name) \
+    registration::TraceScope MESHMONK_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define MESHMONK_TRACE_SCOPE_ARG(name, argName, argValue) \
+    registration::TraceScope MESHMONK_TRACE_CONCAT(traceScope, __LINE__)(name, argName, long(argValue))
+#endif
+
+#endif // TRACER_HPP
@@ -1,35 +1,89 @@
 #include "ViscoElasticTransformer.hpp"
+#include "Tracer.hpp"
+#include "PerformanceCounters.hpp"
+#include "AutoTuner.hpp"
 
 namespace registration {
 
+constexpr float ViscoElasticTransformer::_minWeight;
 
 
-void ViscoElasticTransformer::set_input(const FeatureMat * const inCorrespondingFeatures,
-                                        const VecDynFloat * const inWeights,
-                                        const VecDynFloat * const inFlags,
-                                        const FacesMat * const inFloatingFaces){
-    _inCorrespondingFeatures = inCorrespondingFeatures;
-    _inWeights = inWeights;
-    _inFlags = inFlags;
-    _inFloatingFaces = inFloatingFaces;
+void ViscoElasticTransformer::set_input(const ConstFeatureView &inCorrespondingFeatures,
+                                        const ConstVecView &inWeights,
+                                        const ConstVecView &inFlags,
+                                        const ConstFacesView &inFloatingFaces){
+    _inCorrespondingFeatures.reset(inCorrespondingFeatures);
+    _inWeights.reset(inWeights);
+    _inFlags.reset(inFlags);
+    _inFloatingFaces.reset(inFloatingFaces);
+    _normalUpdater.set_input(_inFloatingFaces);
     _flagsOutdated = true; //if the user sets new flags, we need to update our smoothing weights.
 }//end set_input()
 
 
-void ViscoElasticTransformer::set_output(FeatureMat * const ioFloatingFeatures){
-    _ioFloatingFeatures = ioFloatingFeatures;
+void ViscoElasticTransformer::set_output(const FeatureView &ioFloatingFeatures){
+    _ioFloatingFeatures.reset(ioFloatingFeatures);
     _neighboursOutdated = true; //if the user sets new floating Features, we need to update our neighbours, and hence our smoothing weights.
     _flagsOutdated = true;
 
-    _numElements = _ioFloatingFeatures->rows();
+    _numElements = _ioFloatingFeatures.rows();
     _displacementField = Vec3Mat::Zero(_numElements,3);
     _oldDisplacementField = Vec3Mat::Zero(_numElements,3);
     _smoothingWeights = MatDynFloat::Zero(_numElements,_numNeighbours);
+    _neighbourPositions = Vec3Mat();
+    _neighboursPrepared = false;
 
-    convert_matrices_to_mesh(*_ioFloatingFeatures, *_inFloatingFaces, _floatingMesh); //NOTE: We should do actually really be doing this EVERY TIME the user provides a different floating mesh to this class.
+    convert_matrices_to_mesh(_ioFloatingFeatures, _inFloatingFaces, _floatingMesh); //NOTE: We should do actually really be doing this EVERY TIME the user provides a different floating mesh to this class.
+    _normalUpdater.set_output(_ioFloatingFeatures);
 
 }//end set_output()
 
+void ViscoElasticTransformer::set_initial_displacement(const Vec3Mat &inDisplacementField){
+    if (size_t(inDisplacementField.rows()) != _numElements) {
+        std::cerr << "The initial displacement field in ViscoElasticTransformer should have one row per floating feature!" << std::endl;
+        return;
+    }
+    //# The floating features are already displaced by this field, so the old
+    //# field equals the new one (nothing gets applied twice).
+    _displacementField = inDisplacementField;
+    _oldDisplacementField = inDisplacementField;
+}//end set_initial_displacement()
+
+void ViscoElasticTransformer::set_neighbour_positions(const Vec3Mat &inPositions){
+    if (size_t(inPositions.rows()) != _numElements) {
+        std::cerr << "The neighbour positions in ViscoElasticTransformer should have one row per floating feature!" << std::endl;
+        return;
+    }
+    _neighbourPositions = inPositions;
+    _neighboursOutdated = !_neighboursPrepared;
+    _flagsOutdated = true;
+}//end set_neighbour_positions()
+
+void ViscoElasticTransformer::set_smoothing_neighbours(const MatDynInt &inIndices, const MatDynFloat &inSquaredDistances,
+                                                       const MatDynFloat * const inSmoothingWeights){
+    if ((size_t(inIndices.rows()) != _numElements) || (size_t(inIndices.cols()) != _numNeighbours)
+        || (inSquaredDistances.rows() != inIndices.rows()) || (inSquaredDistances.cols() != inIndices.cols())) {
+        std::cerr << "The smoothing neighbours in ViscoElasticTransformer should have one row per floating feature and one column per neighbour!" << std::endl;
+        return;
+    }
+    _neighbourIndices = inIndices;
+    _neighbourSquaredDistances = inSquaredDistances;
+    _colouringOutdated = true;
+    _neighboursPrepared = true;
+    _neighboursOutdated = false;
+    _operatorOutdated = true;
+    //# Smoothing weights computed for these flags and sigma can be used as they are
+    if ((inSmoothingWeights != NULL) && (inSmoothingWeights->rows() == inIndices.rows())
+        && (inSmoothingWeights->cols() == inIndices.cols())) {
+        _smoothingWeights = *inSmoothingWeights;
+        if (_compactNeighbours) { _update_compact_graph();}
+        _flagsOutdated = false;
+    }
+    else {
+        _flagsOutdated = true;
+    }
+}//end set_smoothing_neighbours()
+
 void ViscoElasticTransformer::set_parameters(size_t numNeighbours, float sigma,
                                             size_t viscousIterations,
                                             size_t elasticIterations)
@@ -37,9 +91,11 @@ void ViscoElasticTransformer::set_parameters(size_t numNeighbours, float sigma,
     if (_numNeighbours != numNeighbours) {
         _neighboursOutdated = true; //if number of requested neighbours changes, we need to update the neighbours and weights
         _flagsOutdated = true;
+        _neighboursPrepared = false;
     }
     if (std::abs(_sigma - sigma) > 0.0001 * _sigma) {
         _flagsOutdated = true; //if sigma changes, we need to update the weights
+        _operatorOutdated = true;
         _smoothingWeights = MatDynFloat::Zero(_numElements,_numNeighbours);
     }
     _numNeighbours = numNeighbours;
@@ -49,23 +105,89 @@ void ViscoElasticTransformer::set_parameters(size_t numNeighbours, float sigma,
 }
 
 
+void ViscoElasticTransformer::set_direct_regularisation(const bool directRegularisation,
+                                                        const float radiusFactor)
+{
+    if ((_radiusFactor != radiusFactor) || (directRegularisation && !_directRegularisation)) {
+        _operatorOutdated = true;
+    }
+    _directRegularisation = directRegularisation;
+    _radiusFactor = radiusFactor;
+}
+
+
+void ViscoElasticTransformer::set_incremental_normals(const bool incrementalNormals,
+                                                     const float normalThreshold)
+{
+    //# Start from a full update of the normals when switching it on
+    if (incrementalNormals && !_incrementalNormals) { _normalUpdater.invalidate();}
+    _incrementalNormals = incrementalNormals;
+    _normalUpdater.set_parameters(normalThreshold);
+}
+
+
+void ViscoElasticTransformer::set_compact_neighbours(const bool compactNeighbours)
+{
+    //# The graph is filled with the smoothing weights
+    if (compactNeighbours && !_compactNeighbours) { _flagsOutdated = true;}
+    if (!compactNeighbours) {
+        _compactGraph10 = NeighbourGraph<Bfloat16, 10>();
+        _compactGraph = NeighbourGraph<Bfloat16>();
+    }
+    _compactNeighbours = compactNeighbours;
+}
+
+
+void ViscoElasticTransformer::set_convergence(const float convergenceTolerance,
+                                              const size_t convergenceInterval)
+{
+    _convergenceTolerance = (convergenceTolerance > 0.0f) ? convergenceTolerance : 0.0f;
+    _convergenceInterval = (convergenceInterval > 0) ? convergenceInterval : 1;
+}
+
+
+bool ViscoElasticTransformer::_converged(const size_t iteration, Vec3Mat &ioCheckedField,
+                                         const Vec3Mat &field) const{
+    //# Relative change of the field (in the Frobenius norm) since the previous
+    //# check, which is then replaced by the current field
+    if ((_convergenceTolerance <= 0.0f) || ((iteration + 1) % _convergenceInterval != 0)) { return false;}
+    const float squaredChange = (field - ioCheckedField).squaredNorm();
+    if (squaredChange <= _convergenceTolerance * _convergenceTolerance * field.squaredNorm()) { return true;}
+    ioCheckedField = field;
+    return false;
+}//end _converged()
+
+
+Vec3Mat ViscoElasticTransformer::_neighbour_positions() const{
+    if (size_t(_neighbourPositions.rows()) == _numElements) { return _neighbourPositions;}
+    return _ioFloatingFeatures.leftCols(3);
+}//end _neighbour_positions()
+
+
 //## Update the neighbour finder
 void ViscoElasticTransformer::_update_neighbours(){
-    Vec3Mat floatingPositions = _ioFloatingFeatures->leftCols(3);
-    _neighbourFinder.set_source_points(&floatingPositions);
-    _neighbourFinder.set_queried_points(&floatingPositions);
-    _neighbourFinder.set_parameters(_numNeighbours);
-    _neighbourFinder.update();
+    Vec3Mat floatingPositions = _neighbour_positions();
+    NeighbourFinder<Vec3Mat> neighbourFinder;
+    neighbourFinder.set_source_points(&floatingPositions);
+    neighbourFinder.set_queried_points(&floatingPositions);
+    neighbourFinder.set_parameters(_numNeighbours);
+    neighbourFinder.update();
+    _neighbourIndices = neighbourFinder.get_indices();
+    _neighbourSquaredDistances = neighbourFinder.get_distances();
+    _colouringOutdated = true;
 }//end _update_neighbours()
 
 
 //## Update the weights used for smoothing
-void ViscoElasticTransformer::_update_smoothing_weights(){
+void ViscoElasticTransformer::compute_smoothing_weights(const MatDynInt &inNeighbourIndices,
+                                                        const MatDynFloat &inNeighbourSquaredDistances,
+                                                        const ConstVecView &inFlags, const float sigma,
+                                                        MatDynFloat &outSmoothingWeights){
     /*
     The smoothing weights are the weights assigned to each vertex neighbour which
     will be used during the smoothing of the vector fields.
 
-    The weight is a combination of the user inputted flags (_inFlags) and a
+    The weight is a combination of the user inputted flags (inFlags) and a
     gaussian weight based on the distance to each neighbour.
 
     Therefor, we initialize the smoothing weights as the squared distances to each neighbour.
@@ -76,46 +198,250 @@ void ViscoElasticTransformer::_update_smoothing_weights(){
     */
 
     //# Initialize the smoothing weights as the squared distances to the neighbouring nodes.
-    _smoothingWeights = _neighbourFinder.get_distances();
-    MatDynInt neighbourIndices = _neighbourFinder.get_indices();
+    outSmoothingWeights = inNeighbourSquaredDistances;
+    const size_t numElements = inNeighbourIndices.rows();
+    const size_t numNeighbours = inNeighbourIndices.cols();
 
     //# Loop over each neighbour and compute its smoothing weight
     //## 1) compute gaussian weights based on the distance to each neighbour
     bool printedWarning = false;
-    for (size_t i = 0 ; i < _numElements ; i++){
+    for (size_t i = 0 ; i < numElements ; i++){
         float sumWeight = 0.0f;
-        for (size_t j = 0 ; j < _numNeighbours ; j++){
+        for (size_t j = 0 ; j < numNeighbours ; j++){
             //## Get the distance to the neighbour
-            const float distanceSquared = _smoothingWeights(i,j); //smoothing weight still equals the squared distance here
+            const float distanceSquared = outSmoothingWeights(i,j); //smoothing weight still equals the squared distance here
             //## Compute the gaussian weight
-            const float gaussianWeight = std::exp(-0.5f * distanceSquared / std::pow(_sigma, 2.0f));
+            const float gaussianWeight = std::exp(-0.5f * distanceSquared / std::pow(sigma, 2.0f));
             //## Combine the gaussian weight with the user defined flag
-            const size_t neighbourIndex = neighbourIndices(i,j);
-            const float neighbourFlag = (*_inFlags)[neighbourIndex];
+            const size_t neighbourIndex = inNeighbourIndices(i,j);
+            const float neighbourFlag = inFlags[neighbourIndex];
             float combinedWeight = neighbourFlag * gaussianWeight;
             // rescale the combined weight between [eps,1.0] instead of [0.0,1.0]. If we wouldn't do this,
             // all the nodes with inlierWeight equal to 0.0 would end up with a deformation vector
             // of length 0.0.
             combinedWeight = (1.0f - _minWeight) * combinedWeight + _minWeight;
 
-            //## insert the combined weight into _smoothingWeights
-            _smoothingWeights(i,j) = combinedWeight;
+            //## insert the combined weight into outSmoothingWeights
+            outSmoothingWeights(i,j) = combinedWeight;
             sumWeight += combinedWeight;
         }
         //## normalize each row of weights
         if (sumWeight > 0.000001f){
-            _smoothingWeights.row(i) /= sumWeight;
+            outSmoothingWeights.row(i) /= sumWeight;
         }
         else if (!printedWarning) {
             std::cout << "Sum of smoothing weights in ViscoElastic Transformer should never be smaller than epsilon." << std::endl;
             printedWarning = true;
         }
     }
+}//end compute_smoothing_weights()
+
+
+void ViscoElasticTransformer::_update_smoothing_weights(){
+    compute_smoothing_weights(_neighbourIndices, _neighbourSquaredDistances, _inFlags, _sigma, _smoothingWeights);
+    if (_compactNeighbours) { _update_compact_graph();}
 }//end _update_smoothing_weights()
 
 
+void ViscoElasticTransformer::_update_compact_graph(){
+    if (_numNeighbours == 10) {
+        _compactGraph10.assign(_neighbourIndices, _smoothingWeights);
+        _compactGraph = NeighbourGraph<Bfloat16>();
+    }
+    else {
+        _compactGraph.assign(_neighbourIndices, _smoothingWeights);
+        _compactGraph10 = NeighbourGraph<Bfloat16, 10>();
+    }
+}//end _update_compact_graph()
+
+
+template <typename Graph>
+void ViscoElasticTransformer::_smooth_over_graph(const Graph &graph, const Vec3Mat &inField, Vec3Mat &outField,
+                                                 const int numThreads, const int chunkSize) const{
+    #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        Vec3Float vectorAverage = Vec3Float::Zero();
+        float sumWeights = 0.0f;
+        for (size_t j = 0 ; j < graph.num_neighbours() ; j++) {
+            const size_t neighbourIndex = graph.index(i,j);
+            float weight = _inWeights[neighbourIndex] * graph.weight(i,j);
+            weight = (1.0f - _minWeight) * weight + _minWeight;
+            sumWeights += weight;
+            vectorAverage += weight * inField.row(neighbourIndex).transpose();
+        }
+        outField.row(i) = vectorAverage / sumWeights;
+    }
+}//end _smooth_over_graph()
+
+
+void ViscoElasticTransformer::_smooth_compactly(const Vec3Mat &inField, Vec3Mat &outField,
+                                                const int numThreads, const int chunkSize) const{
+    if (_numNeighbours == 10) { _smooth_over_graph(_compactGraph10, inField, outField, numThreads, chunkSize);}
+    else { _smooth_over_graph(_compactGraph, inField, outField, numThreads, chunkSize);}
+}//end _smooth_compactly()
+
+
+template <typename Graph>
+void ViscoElasticTransformer::_sweep_over_graph(const Graph &graph, Vec3Mat &ioField,
+                                                const int numThreads, const int chunkSize) const{
+    //# The vertices of a colour only read vertices of other colours (and
+    //# themselves), so each colour can be updated in place in parallel
+    for (size_t c = 0 ; c + 1 < _colourOffsets.size() ; c++) {
+        #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+        for (long m = _colourOffsets[c] ; m < long(_colourOffsets[c+1]) ; m++) {
+            const size_t i = _colourOrder[m];
+            Vec3Float vectorAverage = Vec3Float::Zero();
+            float sumWeights = 0.0f;
+            for (size_t j = 0 ; j < graph.num_neighbours() ; j++) {
+                const size_t neighbourIndex = graph.index(i,j);
+                float weight = _inWeights[neighbourIndex] * graph.weight(i,j);
+                weight = (1.0f - _minWeight) * weight + _minWeight;
+                sumWeights += weight;
+                vectorAverage += weight * ioField.row(neighbourIndex).transpose();
+            }
+            ioField.row(i) = vectorAverage / sumWeights;
+        }
+    }
+}//end _sweep_over_graph()
+
+
+void ViscoElasticTransformer::_smooth_in_place(Vec3Mat &ioField, const int numThreads, const int chunkSize) const{
+    if (!_compactNeighbours) { _sweep_over_graph(NeighbourTable(_neighbourIndices, _smoothingWeights), ioField, numThreads, chunkSize);}
+    else if (_numNeighbours == 10) { _sweep_over_graph(_compactGraph10, ioField, numThreads, chunkSize);}
+    else { _sweep_over_graph(_compactGraph, ioField, numThreads, chunkSize);}
+}//end _smooth_in_place()
+
+
+template <typename Graph>
+void ViscoElasticTransformer::_diffuse_over_graph(const Graph &graph, const Vec3Mat &inField,
+                                                  const int numThreads, const int chunkSize){
+    #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+    for (long i = 0 ; i < long(_numElements) ; i++) {
+        const float inlierWeight = _inWeights[i];
+        if (inlierWeight > 0.8) { continue;}
+        Vec3Float vectorAverage = Vec3Float::Zero();
+        float sumWeights = 0.0f;
+        for (size_t j = 0 ; j < graph.num_neighbours() ; j++) {
+            const float weight = graph.weight(i,j);
+            sumWeights += weight;
+            vectorAverage += weight * inField.row(graph.index(i,j)).transpose();
+        }
+        vectorAverage /= sumWeights;
+        _displacementField.row(i) *= inlierWeight;
+        _displacementField.row(i) += (1.0f-inlierWeight) * vectorAverage;
+    }
+}//end _diffuse_over_graph()
+
+
+void ViscoElasticTransformer::_diffuse_compactly(const Vec3Mat &inField,
+                                                 const int numThreads, const int chunkSize){
+    if (_numNeighbours == 10) { _diffuse_over_graph(_compactGraph10, inField, numThreads, chunkSize);}
+    else { _diffuse_over_graph(_compactGraph, inField, numThreads, chunkSize);}
+}//end _diffuse_compactly()
+
+
+
+//## Update the Gaussian operator used for direct regularisation
+void ViscoElasticTransformer::_update_regularisation_operator(){
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::regularisation_operator");
+    /*
+    Row i of the operator holds, for every floating node j within
+    _radiusFactor*_sigma of node i, the Gaussian weight of their distance
+    combined with the user inputted flag of j (in the same way as the k-nn
+    smoothing weights). The rows are not normalised: the operator is applied as
+    a normalised convolution (see _regularise_directly()).
+
+    The operator is built on the same (initial) floating positions as the k-nn
+    neighbours, so it only has to be rebuilt when those neighbours are.
+    */
+
+    //# Radius search in the floating positions
+    const Vec3Mat floatingPositions = _neighbour_positions();
+    NeighbourFinder<Vec3Mat> radiusFinder;
+    radiusFinder.set_source_points(&floatingPositions);
+    radiusFinder.set_queried_points(&floatingPositions);
+    radiusFinder.update_radius(_radiusFactor * _sigma);
+    const VecDynInt offsets = radiusFinder.get_radius_offsets();
+    const VecDynInt indices = radiusFinder.get_radius_indices();
+    const VecDynFloat squaredDistances = radiusFinder.get_radius_distances();
+
+    //# Build the operator
+    std::vector<Triplet> operatorElements;
+    operatorElements.reserve(indices.size());
+    float sumDirectVariance = 0.0f;
+    for (size_t i = 0 ; i < _numElements ; i++) {
+        float sumWeights = 0.0f;
+        float variance = 0.0f;
+        for (int m = offsets[i] ; m < offsets[i+1] ; m++) {
+            const size_t neighbourIndex = indices[m];
+            const float distanceSquared = squaredDistances[m];
+            //## Gaussian weight combined with the flag (as in _update_smoothing_weights())
+            const float gaussianWeight = std::exp(-0.5f * distanceSquared / (_sigma * _sigma));
+            float combinedWeight = _inFlags[neighbourIndex] * gaussianWeight;
+            combinedWeight = (1.0f - _minWeight) * combinedWeight + _minWeight;
+            operatorElements.push_back(Triplet(i, neighbourIndex, combinedWeight));
+
+            sumWeights += gaussianWeight;
+            variance += gaussianWeight * distanceSquared;
+        }
+        if (sumWeights > 0.0f) { sumDirectVariance += variance / sumWeights;}
+    }
+    _regularisationOperator = RowSparseMat(_numElements, _numElements);
+    _regularisationOperator.setFromTriplets(operatorElements.begin(), operatorElements.end());
+
+    //# Compare the smoothing variance of one operator pass with that of one
+    //# k-nn iteration (both measured on the same mesh, so this accounts for
+    //# the sampling density and the truncation of the Gaussian).
+    const MatDynFloat &neighbourSquaredDistances = _neighbourSquaredDistances;
+    float sumNeighbourVariance = 0.0f;
+    for (size_t i = 0 ; i < _numElements ; i++) {
+        float sumWeights = 0.0f;
+        float variance = 0.0f;
+        for (size_t j = 0 ; j < _numNeighbours ; j++) {
+            const float distanceSquared = neighbourSquaredDistances(i,j);
+            const float gaussianWeight = std::exp(-0.5f * distanceSquared / (_sigma * _sigma));
+            sumWeights += gaussianWeight;
+            variance += gaussianWeight * distanceSquared;
+        }
+        if (sumWeights > 0.0f) { sumNeighbourVariance += variance / sumWeights;}
+    }
+    _directPassRatio = (sumDirectVariance > 0.0f) ? sumNeighbourVariance / sumDirectVariance : 1.0f;
+}//end _update_regularisation_operator()
+
+
+size_t ViscoElasticTransformer::_numDirectPasses(const size_t numIterations) const{
+    //# The variances of repeated smoothing steps add up, so n k-nn iterations
+    //# correspond to n * ratio operator passes (but at least one pass if any
+    //# smoothing was requested).
+    if (numIterations == 0) { return 0;}
+    size_t numPasses = size_t(std::round(float(numIterations) * _directPassRatio));
+    if (numPasses < 1) { numPasses = 1;}
+    return numPasses;
+}//end _numDirectPasses()
+
+
+void ViscoElasticTransformer::_regularise_directly(Vec3Mat &ioField, const size_t numPasses) const{
+    /*
+    Normalised convolution: the field is weighted with the (rescaled) inlier
+    weights before applying the operator, and divided by the operator applied
+    to those weights afterwards. This is what the k-nn iterations do as well,
+    but with all neighbours within the operator radius at once.
+    */
+    if (numPasses == 0) { return;}
+    MESHMONK_COUNT_STAGE("smoothing", _numElements * numPasses);
+    const VecDynFloat inlierWeights = ((1.0f - _minWeight) * _inWeights.array() + _minWeight).matrix();
+    const VecDynFloat sumWeights = _regularisationOperator * inlierWeights;
+    Vec3Mat weightedField;
+    for (size_t it = 0 ; it < numPasses ; it++) {
+        weightedField = ioField.array().colwise() * inlierWeights.array();
+        ioField = _regularisationOperator * weightedField;
+        ioField = ioField.array().colwise() / sumWeights.array();
+    }
+}//end _regularise_directly()
+
 
 void ViscoElasticTransformer::_update_viscously(){
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::viscous");
     /*
     Viscosity is obtained by incrementing the displacement field with a regularized force field.
 
@@ -132,10 +458,10 @@ void ViscoElasticTransformer::_update_viscously(){
 
     //# 1) Determine the force field (difference between current floating and corresponding
     //# Features).
-    Vec3Mat forceField = _inCorrespondingFeatures->leftCols(3) - _ioFloatingFeatures->leftCols(3);
+    Vec3Mat forceField = _inCorrespondingFeatures.leftCols(3) - _ioFloatingFeatures.leftCols(3);
     //## Each differential vector is multiplied with the corresponding inlier weight.
     //## That ensures that patches of outliers don't move unless pulled along by surrounding inliers.
-    forceField = forceField.array().colwise() * (*_inWeights).array(); //this multiplies each row by the corresponding inlier weight
+    forceField = forceField.array().colwise() * _inWeights.array(); //this multiplies each row by the corresponding inlier weight
 
     //# 2) Regularize the force field through iterative weighted averaging.
     /*
@@ -149,11 +475,43 @@ void ViscoElasticTransformer::_update_viscously(){
     */
     //## Initialize the regularized force field and get the neighbour indices
     Vec3Mat regularizedForceField = forceField;
-    MatDynInt neighbourIndices = _neighbourFinder.get_indices();
+    MatDynInt neighbourIndices;
+    if (!_compactNeighbours) { neighbourIndices = _neighbourIndices;}
+
+    //## Direct regularisation with the Gaussian operator
+    if (_directRegularisation) {
+        _numViscousPasses = _numDirectPasses(_viscousIterations);
+        _regularise_directly(regularizedForceField, _numViscousPasses);
+        _oldDisplacementField = _displacementField;
+        _displacementField += regularizedForceField;
+        return;
+    }
 
-    //## Start iterative loop
+    //## Start iterative loop (the vertices of a pass are smoothed in parallel
+    //## with the threads and grain size of the AutoTuner profile). It stops
+    //## early once the force field converged (if a tolerance was given).
+    const TuningProfile profile = AutoTuner::get_profile();
+    const int numThreads = AutoTuner::num_threads(profile);
+    const int chunkSize = AutoTuner::chunk_size(profile, _numElements);
+    _numViscousPasses = 0;
+    Vec3Mat checkedField;
+    if (_convergenceTolerance > 0.0f) { checkedField = forceField;}
     for (size_t it = 0 ; it < _viscousIterations ; it++){
-        for (size_t i = 0 ; i < _numElements ; i++) {
+        MESHMONK_COUNT_STAGE("smoothing", _numElements);
+        _numViscousPasses++;
+        if (_gaussSeidel) {
+            _smooth_in_place(regularizedForceField, numThreads, chunkSize);
+            if (_converged(it, checkedField, regularizedForceField)) { break;}
+            continue;
+        }
+        if (_compactNeighbours) {
+            _smooth_compactly(forceField, regularizedForceField, numThreads, chunkSize);
+            if (_converged(it, checkedField, regularizedForceField)) { break;}
+            forceField = regularizedForceField;
+            continue;
+        }
+        #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+        for (long i = 0 ; i < long(_numElements) ; i++) {
             //## For the current displacement, compute the weighted average of the neighbouring
             //## vectors.
             Vec3Float vectorAverage = Vec3Float::Zero();
@@ -163,7 +521,7 @@ void ViscoElasticTransformer::_update_viscously(){
                 // get neighbour index
                 size_t neighbourIndex = neighbourIndices(i,j);
                 // get neighbour weight and vector
-                float weight = (*_inWeights)[neighbourIndex] * _smoothingWeights(i,j);
+                float weight = _inWeights[neighbourIndex] * _smoothingWeights(i,j);
                 neighbourVector = forceField.row(neighbourIndex);
                 // rescale the weight between [eps,1.0] instead of [0.0,1.0]. If we wouldn't do this,
                 // all the nodes with inlierWeight equal to 0.0 would end up with a deformation vector
@@ -177,6 +535,7 @@ void ViscoElasticTransformer::_update_viscously(){
 
             regularizedForceField.row(i) = vectorAverage / sumWeights;
         }
+        if (_converged(it, checkedField, regularizedForceField)) { break;}
         forceField = regularizedForceField;
     }
 
@@ -191,18 +550,47 @@ void ViscoElasticTransformer::_update_viscously(){
 
 
 void ViscoElasticTransformer::_update_elastically(){
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::elastic");
+
+    //# Direct regularisation with the Gaussian operator
+    if (_directRegularisation) {
+        _numElasticPasses = _numDirectPasses(_elasticIterations);
+        _regularise_directly(_displacementField, _numElasticPasses);
+        return;
+    }
 
     //# Get the neighbour indices
     Vec3Mat unregulatedDisplacementField;
-    MatDynInt neighbourIndices = _neighbourFinder.get_indices();
-
-    //## Start iterative loop
+    MatDynInt neighbourIndices;
+    if (!_compactNeighbours) { neighbourIndices = _neighbourIndices;}
+
+    //## Start iterative loop (stops early once the displacement field
+    //## converged, if a tolerance was given)
+    const TuningProfile profile = AutoTuner::get_profile();
+    const int numThreads = AutoTuner::num_threads(profile);
+    const int chunkSize = AutoTuner::chunk_size(profile, _numElements);
+    _numElasticPasses = 0;
+    Vec3Mat checkedField;
+    if (_convergenceTolerance > 0.0f) { checkedField = _displacementField;}
     for (size_t it = 0 ; it < _elasticIterations ; it++){
+        MESHMONK_COUNT_STAGE("smoothing", _numElements);
+        _numElasticPasses++;
+        if (_gaussSeidel) {
+            _smooth_in_place(_displacementField, numThreads, chunkSize);
+            if (_converged(it, checkedField, _displacementField)) { break;}
+            continue;
+        }
         //## Copy the displacement field into a temporary variable.
         unregulatedDisplacementField = _displacementField;
+        if (_compactNeighbours) {
+            _smooth_compactly(unregulatedDisplacementField, _displacementField, numThreads, chunkSize);
+            if (_converged(it, checkedField, _displacementField)) { break;}
+            continue;
+        }
 
         //## Loop over each unregularized displacement vector and smooth it.
-        for (size_t i = 0 ; i < _numElements ; i++) {
+        #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+        for (long i = 0 ; i < long(_numElements) ; i++) {
             //## For the current displacement, compute the weighted average of the neighbouring
             //## vectors.
             Vec3Float vectorAverage = Vec3Float::Zero();
@@ -212,7 +600,7 @@ void ViscoElasticTransformer::_update_elastically(){
                 // get neighbour index
                 size_t neighbourIndex = neighbourIndices(i,j);
                 // get neighbour weight and vector
-                float weight = (*_inWeights)[neighbourIndex] * _smoothingWeights(i,j);
+                float weight = _inWeights[neighbourIndex] * _smoothingWeights(i,j);
                 neighbourVector = unregulatedDisplacementField.row(neighbourIndex);
                 // rescale the weight between [eps,1.0] instead of [0.0,1.0]. If we wouldn't do this,
                 // all the nodes with inlierWeight equal to 0.0 would end up with a deformation vector
@@ -226,28 +614,39 @@ void ViscoElasticTransformer::_update_elastically(){
 
             _displacementField.row(i) = vectorAverage / sumWeights;
         }
+        if (_converged(it, checkedField, _displacementField)) { break;}
     }
 }
 
 
 void ViscoElasticTransformer::_update_outlier_transformation(){
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::outliers");
     //# The transformation for the outliers is updated via a diffusion process.
     //## The transformation field for inliers is kept the same, but diffuses into
     //## outlier areas via diffusion.
 
     //# Get the neighbour indices
     Vec3Mat temporaryDisplacementField;
-    MatDynInt neighbourIndices = _neighbourFinder.get_indices();
+    MatDynInt neighbourIndices;
+    if (!_compactNeighbours) { neighbourIndices = _neighbourIndices;}
 
     //## Start iterative loop
+    const TuningProfile profile = AutoTuner::get_profile();
+    const int numThreads = AutoTuner::num_threads(profile);
+    const int chunkSize = AutoTuner::chunk_size(profile, _numElements);
     for (size_t it = 0 ; it < _outlierDiffusionIterations ; it++){
         //## Copy the displacement field into a temporary field.
         temporaryDisplacementField = _displacementField;
+        if (_compactNeighbours) {
+            _diffuse_compactly(temporaryDisplacementField, numThreads, chunkSize);
+            continue;
+        }
 
         //## Loop over the displacement vectors of the outliers (with inlier weight < 0.8).
-        for (size_t i = 0 ; i < _numElements ; i++) {
+        #pragma omp parallel for schedule(static, chunkSize) num_threads(numThreads)
+        for (long i = 0 ; i < long(_numElements) ; i++) {
             //## Check if the current element is an inlier
-            float inlierWeight = (*_inWeights)[i];
+            float inlierWeight = _inWeights[i];
             if (inlierWeight > 0.8) {
                 //### Current element is an inlier, go to next iteration
                 //continue;
@@ -295,16 +694,24 @@ void ViscoElasticTransformer::_apply_transformation(){
     //# Displace each current floating position by the difference between
     //# the old and new displacement fields.
     for (size_t i = 0 ; i < _numElements ; i++) {
-        _ioFloatingFeatures->row(i).head(3) += (_displacementField.row(i) - _oldDisplacementField.row(i));
+        _ioFloatingFeatures.row(i).head(3) += (_displacementField.row(i) - _oldDisplacementField.row(i));
     }
 
     //# Update the floating surface normals
-    update_normals_for_altered_positions(_floatingMesh, *_ioFloatingFeatures);
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::normals");
+    MESHMONK_COUNT_STAGE("normals", _numElements);
+    if (_incrementalNormals) {
+        _normalUpdater.update();
+    }
+    else {
+        update_normals_for_altered_positions(_floatingMesh, _ioFloatingFeatures);
+    }
 }
 
 
 
 void ViscoElasticTransformer::update(){
+    MESHMONK_TRACE_SCOPE("ViscoElasticTransformer::update");
 
     if (_neighboursOutdated == true) {
         _update_neighbours();
@@ -314,6 +721,15 @@ void ViscoElasticTransformer::update(){
     if (_flagsOutdated == true) {
         _update_smoothing_weights();
         _flagsOutdated = false;
+        _operatorOutdated = true;
+    }
+    if (_directRegularisation && _operatorOutdated) {
+        _update_regularisation_operator();
+        _operatorOutdated = false;
+    }
+    if (_gaussSeidel && _colouringOutdated) {
+        colour_neighbour_graph(_neighbourIndices, _colourOrder, _colourOffsets);
+        _colouringOutdated = false;
     }
     //# update the transformation
     _update_transformation();
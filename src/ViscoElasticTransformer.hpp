@@ -2,11 +2,15 @@
 #define VISCOELASTICTRANSFORMER_HPP
 
 #include <Eigen/Dense>
+#include <Eigen/SparseCore>
 #include "NeighbourFinder.hpp"
 #include <iostream>
 #include <OpenMesh/Core/IO/MeshIO.hh>
 #include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
 #include "helper_functions.hpp"
+#include "IncrementalNormalUpdater.hpp"
+#include "NeighbourGraph.hpp"
+#include "MatrixView.hpp"
 
 typedef Eigen::Vector3f Vec3Float;
 typedef Eigen::VectorXf VecDynFloat;
@@ -14,6 +18,8 @@ typedef Eigen::Matrix< float, Eigen::Dynamic, 3> Vec3Mat; //matrix Mx3 of type f
 typedef Eigen::Matrix< float, Eigen::Dynamic, Eigen::Dynamic> MatDynFloat;
 typedef Eigen::Matrix< float, Eigen::Dynamic, registration::NUM_FEATURES> FeatureMat; //matrix Mx6 of type float
 typedef Eigen::Matrix< int, Eigen::Dynamic, 3> FacesMat;
+typedef Eigen::SparseMatrix<float, Eigen::RowMajor, int> RowSparseMat;
+typedef Eigen::Triplet<float> Triplet;
 typedef OpenMesh::DefaultTraits MyTraits;
 typedef OpenMesh::TriMesh_ArrayKernelT<MyTraits>  TriMesh;
 
@@ -21,16 +27,114 @@ namespace registration{
 
 class ViscoElasticTransformer
 {
+    /*
+    # GOAL
+    Nonrigid transformation of the floating features towards the corresponding
+    features. The force field (corresponding minus floating positions) is
+    regularised (viscous part) and added to the displacement field, which is
+    regularised itself as well (elastic part).
+
+    # PARAMETERS
+    -numNeighbours(=10), sigma(=3.0):
+    the regularisation averages each vector with its numNeighbours nearest
+    neighbours (Gaussian weights of width sigma). Repeating this approximates
+    a Gaussian smoothing, but a wide one needs many iterations.
+    -viscousIterations, elasticIterations:
+    number of regularisation iterations of the force and displacement field.
+    -convergenceTolerance(=0.0), convergenceInterval(=10):
+    if larger than zero, the viscous and elastic regularisation stop before
+    their number of iterations once the last convergenceInterval iterations
+    changed the regularised field by less than convergenceTolerance times its
+    norm (so it's only checked every convergenceInterval iterations). get_smoothing_passes() returns
+    the numbers of iterations (or operator passes) of the last update.
+    -directRegularisation(=false), radiusFactor(=3.0):
+    instead, build a single sparse operator with explicit Gaussian weights
+    (width sigma) over all neighbours within radiusFactor*sigma, and apply it
+    as a normalised convolution with the inlier weights. The number of
+    iterations is converted into the number of operator passes that give the
+    same smoothing variance, so far fewer passes are needed. The operator is
+    cached as long as the floating mesh, the flags and sigma don't change.
+    -incrementalNormals(=false), normalThreshold(=0.01):
+    after each update, only recompute the normals around vertices that moved
+    more than normalThreshold since their normals were last recomputed (see
+    IncrementalNormalUpdater), instead of all normals of the floating mesh.
+    -compactNeighbours(=false):
+    smooth over a NeighbourGraph (32 bit indices and bfloat16 weights in one
+    row per vertex) instead of the index and weight matrices. The weights are
+    rounded to about 3 significant digits.
+    -gaussSeidel(=false):
+    smooth the viscous and elastic fields in place (multicolour Gauss-Seidel)
+    instead of from a copy of the previous iteration (Jacobi). The neighbour
+    graph is coloured once per set of neighbours (colour_neighbour_graph());
+    the vertices of one colour don't neighbour each other and are smoothed in
+    parallel, one colour after the other. There is no copy of the field per
+    iteration, and an iteration already uses the updated neighbours, so it
+    smooths more than a Jacobi iteration (with the same number of iterations
+    the fields come out smoother).
+
+    # PREPARED NEIGHBOURS
+    The smoothing neighbours (and their smoothing weights) only depend on the
+    floating mesh, so they can be computed once for a template and set with
+    set_smoothing_neighbours() (see PreparedTemplate) instead of being
+    searched for every registration.
+    */
+
     public:
 
-        void set_input(const FeatureMat * const inCorrespondingFeatures,
-                       const VecDynFloat * const inWeights,
-                       const VecDynFloat * const inFlags,
-                       const FacesMat * const inFloatingFaces);
-        void set_output(FeatureMat * const ioFloatingFeatures);
+        void set_input(const ConstFeatureView &inCorrespondingFeatures,
+                       const ConstVecView &inWeights,
+                       const ConstVecView &inFlags,
+                       const ConstFacesView &inFloatingFaces);
+        void set_output(const FeatureView &ioFloatingFeatures);
         void set_parameters(size_t numNeighbours = 10, float sigma = 3.0,
                             size_t viscousIterations = 10, size_t elasticIterations = 10);
+        void set_direct_regularisation(const bool directRegularisation = true,
+                                       const float radiusFactor = 3.0f);
+        void set_incremental_normals(const bool incrementalNormals = true,
+                                     const float normalThreshold = 0.01f);
+        void set_compact_neighbours(const bool compactNeighbours = true);
+        void set_convergence(const float convergenceTolerance = 0.0f, const size_t convergenceInterval = 10);
+        void set_gauss_seidel(const bool gaussSeidel = true){ _gaussSeidel = gaussSeidel;}
+        void get_smoothing_passes(size_t &numViscousPasses, size_t &numElasticPasses) const {
+            numViscousPasses = _numViscousPasses;
+            numElasticPasses = _numElasticPasses;
+        }
+        void get_direct_passes(size_t &numViscousPasses, size_t &numElasticPasses) const {
+            numViscousPasses = _numDirectPasses(_viscousIterations);
+            numElasticPasses = _numDirectPasses(_elasticIterations);
+        }
+        //## Start from a displacement field that was already applied to the
+        //## floating features (e.g. from a coarser pyramid layer). Call after set_output().
+        void set_initial_displacement(const Vec3Mat &inDisplacementField);
+        //## Find the smoothing neighbours in these positions instead of in the
+        //## current floating positions (e.g. the positions at which an
+        //## interrupted registration started). Call after set_output().
+        void set_neighbour_positions(const Vec3Mat &inPositions);
+        //## Use these smoothing neighbours (numNeighbours per floating feature)
+        //## instead of searching them. The smoothing weights are used as well if
+        //## given (they must have been computed for the same flags and sigma,
+        //## with compute_smoothing_weights()). Call after set_output() and
+        //## set_parameters().
+        void set_smoothing_neighbours(const MatDynInt &inIndices, const MatDynFloat &inSquaredDistances,
+                                      const MatDynFloat * const inSmoothingWeights = NULL);
+        //## Gaussian smoothing weights of the neighbours, combined with the flags
+        //## of the neighbours and normalised per row
+        static void compute_smoothing_weights(const MatDynInt &inNeighbourIndices,
+                                              const MatDynFloat &inNeighbourSquaredDistances,
+                                              const ConstVecView &inFlags, const float sigma,
+                                              MatDynFloat &outSmoothingWeights);
         Vec3Mat get_transformation() const {return _displacementField;}
+        //## Bytes held by the fields, neighbours, mesh copy and operator
+        size_t get_memory_usage() const {
+            return memory_usage(_displacementField) + memory_usage(_oldDisplacementField)
+                   + memory_usage(_neighbourIndices) + memory_usage(_neighbourSquaredDistances)
+                   + memory_usage(_smoothingWeights)
+                   + estimate_mesh_memory(_floatingMesh.n_vertices(), _floatingMesh.n_faces())
+                   + memory_usage(_regularisationOperator) + _normalUpdater.get_memory_usage()
+                   + memory_usage(_neighbourPositions)
+                   + _compactGraph.get_memory_usage() + _compactGraph10.get_memory_usage()
+                   + memory_usage(_colourOrder) + memory_usage(_colourOffsets);
+        }
         void update();
 
     protected:
@@ -38,13 +142,13 @@ class ViscoElasticTransformer
     private:
         //# Inputs
         //##_ioFeatures is used as both an input (to compute the transformation) and output
-        const FeatureMat * _inCorrespondingFeatures = NULL;
-        const VecDynFloat * _inWeights = NULL;
-        const VecDynFloat * _inFlags = NULL;
-        const FacesMat * _inFloatingFaces = NULL;
+        ConstFeatureView _inCorrespondingFeatures;
+        ConstVecView _inWeights;
+        ConstVecView _inFlags;
+        ConstFacesView _inFloatingFaces;
 
         //# Outputs
-        FeatureMat * _ioFloatingFeatures = NULL;
+        FeatureView _ioFloatingFeatures;
 
 
         //# User Parameters
@@ -53,25 +157,84 @@ class ViscoElasticTransformer
         size_t _viscousIterations = 0;
         size_t _elasticIterations = 0;
         size_t _outlierDiffusionIterations = 15;
+        bool _directRegularisation = false;
+        float _radiusFactor = 3.0f;
+        bool _incrementalNormals = false;
+        bool _compactNeighbours = false;
+        float _convergenceTolerance = 0.0f;
+        size_t _convergenceInterval = 10;
+        bool _gaussSeidel = false;
 
         //# Internal Data structures
         Vec3Mat _displacementField;
         Vec3Mat _oldDisplacementField;
-        NeighbourFinder<Vec3Mat> _neighbourFinder;
+        Vec3Mat _neighbourPositions;
+        MatDynInt _neighbourIndices;
+        MatDynFloat _neighbourSquaredDistances;
         MatDynFloat _smoothingWeights;
         TriMesh _floatingMesh;
+        IncrementalNormalUpdater _normalUpdater;
+        //## Compact neighbours and smoothing weights: with the number of
+        //## neighbours fixed at compile time for the default of 10, otherwise
+        //## set at runtime. Only one of them is filled.
+        NeighbourGraph<Bfloat16, 10> _compactGraph10;
+        NeighbourGraph<Bfloat16> _compactGraph;
+        //## Direct regularisation: Gaussian operator and the ratio between the
+        //## smoothing variance of one k-nn iteration and one operator pass.
+        RowSparseMat _regularisationOperator;
+        float _directPassRatio = 1.0f;
+        //## Gauss-Seidel: the vertices sorted by colour, and where each colour starts
+        std::vector<int> _colourOrder;
+        std::vector<int> _colourOffsets;
 
         //# Internal Parameters
         size_t _numElements = 0;
         bool _neighboursOutdated = true;
         bool _flagsOutdated = true;
-        const float _minWeight = 0.00001f;
+        bool _operatorOutdated = true;
+        bool _neighboursPrepared = false;
+        bool _colouringOutdated = true;
+        size_t _numViscousPasses = 0;
+        size_t _numElasticPasses = 0;
+        static constexpr float _minWeight = 0.00001f;
 
         //# Internal functions
+        //## Whether the regularisation converged with this iteration (only
+        //## checked every _convergenceInterval iterations, against the field
+        //## of the previous check)
+        bool _converged(const size_t iteration, Vec3Mat &ioCheckedField, const Vec3Mat &field) const;
+        //## Positions in which the neighbours are found
+        Vec3Mat _neighbour_positions() const;
         //## Update the neighbour finder
         void _update_neighbours();
         //## Update the weights used for smoothing
         void _update_smoothing_weights();
+        //## Update the Gaussian operator used for direct regularisation
+        void _update_regularisation_operator();
+        //## Number of operator passes equivalent to a number of k-nn iterations
+        size_t _numDirectPasses(const size_t numIterations) const;
+        //## Regularise a vector field with the Gaussian operator
+        void _regularise_directly(Vec3Mat &ioField, const size_t numPasses) const;
+        //## Fill the compact neighbour graph from the smoothing weights
+        void _update_compact_graph();
+        //## One smoothing pass over the compact graph (as the passes in
+        //## _update_viscously() and _update_elastically())
+        void _smooth_compactly(const Vec3Mat &inField, Vec3Mat &outField,
+                               const int numThreads, const int chunkSize) const;
+        template <typename Graph>
+        void _smooth_over_graph(const Graph &graph, const Vec3Mat &inField, Vec3Mat &outField,
+                                const int numThreads, const int chunkSize) const;
+        //## One in-place (Gauss-Seidel) smoothing pass, colour by colour, over
+        //## the compact graph or the neighbour matrices
+        void _smooth_in_place(Vec3Mat &ioField, const int numThreads, const int chunkSize) const;
+        template <typename Graph>
+        void _sweep_over_graph(const Graph &graph, Vec3Mat &ioField,
+                               const int numThreads, const int chunkSize) const;
+        //## One outlier diffusion pass over the compact graph
+        void _diffuse_compactly(const Vec3Mat &inField, const int numThreads, const int chunkSize);
+        template <typename Graph>
+        void _diffuse_over_graph(const Graph &graph, const Vec3Mat &inField,
+                                 const int numThreads, const int chunkSize);
         //## Update the displacement field in a viscous manner
         void _update_viscously();
         //## Update the displacement field in an elastic manner
@@ -1,5 +1,8 @@
 
 #include "helper_functions.hpp"
+#include "NeighbourFinder.hpp"
+#include "ParallelReduction.hpp"
+#include <algorithm>
 
 namespace registration {
 
@@ -62,23 +65,51 @@ void normalize_sparse_matrix(SparseMat &ioMat) {
     */
 
     //# Normalize the rows of the affinity matrix
-    //## Initialize a vector that will contain the sum of each row
+    //## The matrix is stored column by column, so the columns are split into
+    //## blocks that each sum their elements into their own row sums. The
+    //## number of blocks is the number of threads, or, for deterministic
+    //## reductions, only depends on the number of columns (see
+    //## ParallelReduction.hpp).
     const size_t numRows = ioMat.rows();
-    std::vector<float> sumRows(numRows, 0.0f);
+    const long numCols = ioMat.outerSize();
+    const long numColBlocks = (numCols + long(REDUCTION_BLOCK_SIZE) - 1) / long(REDUCTION_BLOCK_SIZE);
+    long numBlocks = deterministic_reductions() ? std::min(long(REDUCTION_MAX_VECTOR_BLOCKS), numColBlocks)
+                                                : std::min(long(reduction_num_threads()), numColBlocks);
+    if (numBlocks < 1) { numBlocks = 1;}
+    std::vector<std::vector<float> > blockSumRows(numBlocks);
 
     //## Loop over the rows and compute the total sum of its elements
-    for (size_t i = 0 ; i < ioMat.outerSize() ; i++) {
-        for (SparseMat::InnerIterator innerIt(ioMat,i) ; innerIt ; ++innerIt) {
-            //### Get index of current row we're in
-            const unsigned int currentRowIndex = innerIt.row();
-            //### Add current element to the sum of this row.
-            const float currentElement = innerIt.value();
-            sumRows[currentRowIndex] += currentElement;
+    #pragma omp parallel for schedule(static)
+    for (long b = 0 ; b < numBlocks ; b++) {
+        std::vector<float> &sumRows = blockSumRows[b];
+        sumRows.assign(numRows, 0.0f);
+        for (long i = numCols * b / numBlocks ; i < numCols * (b + 1) / numBlocks ; i++) {
+            for (SparseMat::InnerIterator innerIt(ioMat,i) ; innerIt ; ++innerIt) {
+                //### Get index of current row we're in
+                const unsigned int currentRowIndex = innerIt.row();
+                //### Add current element to the sum of this row.
+                const float currentElement = innerIt.value();
+                sumRows[currentRowIndex] += currentElement;
+            }
+        }
+    }
+    //## Combine the blocks (pairwise, in a fixed order)
+    std::vector<float> &sumRows = blockSumRows[0];
+    if (numBlocks > 1) {
+        #pragma omp parallel
+        {
+            std::vector<float> partialSums(numBlocks);
+            #pragma omp for
+            for (long r = 0 ; r < long(numRows) ; r++) {
+                for (long b = 0 ; b < numBlocks ; b++) { partialSums[b] = blockSumRows[b][r];}
+                sumRows[r] = pairwise_combine(partialSums);
+            }
         }
     }
 
     //## Loop over the rows and divide each row by the sum of its elements
-    for (size_t i = 0 ; i < ioMat.outerSize() ; i++) {
+    #pragma omp parallel for
+    for (long i = 0 ; i < numCols ; i++) {
         for (SparseMat::InnerIterator innerIt(ioMat,i) ; innerIt ; ++innerIt) {
             //### Get index and sum of the current row we're in
             const unsigned int currentRowIndex = innerIt.row();
@@ -112,88 +143,49 @@ void radius_nearest_neighbours(const VecMatType &inQueriedPoints,
 
     PARAMETERS
     -paramRadius(= 3.0): the radius in which neighbours are queried
-    -paramLeafsize(= 15): should be between 5 and 50 or so
+    -paramLeafsize(= 15): unused, the kd-tree of NeighbourFinder is used.
 
     OUTPUT
     -outNeighbourIndices
     -outNeighbourSquaredDistances.
     NOTE: Not for every queried elements, the same number of neighbours will be
     found. So, 'empty' elements in the output are represented by '-1'.
-
+    Hot paths should use NeighbourFinder::update_radius() directly, which
+    keeps the kd-tree and outputs the neighbours in compressed sparse row
+    format instead of this padded dense matrix.
     */
 
-    //# Info and Initialization
-    const size_t dimension = inSourcePoints.cols();
-    typedef nanoflann::KDTreeEigenMatrixAdaptor<VecMatType>  NanoKDTree;
-    const size_t numSourceElements = inSourcePoints.rows();
-    const size_t numQueriedElements = inQueriedPoints.rows();
+    //# Radius search
+    NeighbourFinder<VecMatType> neighbourFinder;
+    neighbourFinder.set_source_points(&inSourcePoints);
+    neighbourFinder.set_queried_points(&inQueriedPoints);
+    neighbourFinder.update_radius(paramRadius);
+    const VecDynInt offsets = neighbourFinder.get_radius_offsets();
+    const VecDynInt indices = neighbourFinder.get_radius_indices();
+    const VecDynFloat squaredDistances = neighbourFinder.get_radius_distances();
 
-
-    //# Construct kd-tree
-    NanoKDTree kdTree(dimension, inSourcePoints, paramLeafsize);
-    kdTree.index->buildIndex();
-
-    //# Query the kd-tree
-    //## Loop over the queried features
-    //### Initialize variables we'll need during the loop
-    std::vector<float> queriedFeature(dimension);
-    std::vector< std::vector<size_t> > neighbourIndices;
-    std::vector< std::vector<float> > neighbourSquaredDistances;
-    size_t maxNumNeighboursFound = 0;
-
-    //### Execute loop
-    for (size_t i = 0 ; i < numQueriedElements ; ++i ) {
-        //### convert input features to 'queriedFeature' std::vector structure
-        //### (required by nanoflann's kd-tree).
-        for (size_t j = 0 ; j < dimension ; ++j) {
-            queriedFeature[j] = inQueriedPoints(i,j);
-        }
-
-        //### Query the kd-tree
-        nanoflann::SearchParams searchParams;
-        std::vector<std::pair<size_t, float> > resultIndexAndDistancePairs;
-        nanoflann::RadiusResultSet<float,size_t> resultSet(paramRadius,resultIndexAndDistancePairs);
-        const size_t nMatches = kdTree.index->radiusSearchCustomCallback(&queriedFeature[0],resultSet,searchParams);
-        std::cout << "Number of matches: " << nMatches << std::endl;
-
-        //### Copy the result into neighbourIndices and neighbourSquaredDistances
-        //### by first copying it into single std::vector<float/int> and then
-        //### copying that std::vector into those std::vector<std::vector<>>.
-        std::vector<size_t> indices;
-        std::vector<float> squaredDistances;
-        for (size_t j = 0 ; j < nMatches ; ++j) {
-            indices.push_back(resultIndexAndDistancePairs[j].first);
-            squaredDistances.push_back(resultIndexAndDistancePairs[j].second);
-        }
-        neighbourIndices.push_back(indices);
-        neighbourSquaredDistances.push_back(squaredDistances);
-
-
-        //### Check if we found more neighbours than before
-        if (nMatches > maxNumNeighboursFound) {
-            maxNumNeighboursFound = nMatches;
-        }
+    //# Copy results into the padded output
+    const size_t numQueriedElements = inQueriedPoints.rows();
+    int maxNumNeighboursFound = 0;
+    for (size_t i = 0 ; i < numQueriedElements ; i++) {
+        maxNumNeighboursFound = std::max(maxNumNeighboursFound, offsets[i+1] - offsets[i]);
     }
-
-    //# Copy results into output
-    //## Now that we have found all the neighbours and know what the maximum
-    //## number of neighbours found was, we can finally initialize the output
-    //## matrix size.
     outNeighbourIndices = -1 * MatDynInt::Ones(numQueriedElements, maxNumNeighboursFound);
     outNeighbourSquaredDistances = -1.0 * MatDynFloat::Ones(numQueriedElements, maxNumNeighboursFound);
-
-    //## Loop over results
-    for (size_t i = 0 ; i < numQueriedElements ; i++ ) {
-        int numNeighbours = neighbourIndices[i].size();
-
-        //### Loop over neighbours
-        for (size_t j = 0 ; j < numNeighbours ; j++ ) {
-            outNeighbourIndices(i,j) = neighbourIndices[i][j];
-            outNeighbourSquaredDistances(i,j) = neighbourSquaredDistances[i][j];
+    for (size_t i = 0 ; i < numQueriedElements ; i++) {
+        for (int m = offsets[i] ; m < offsets[i+1] ; m++) {
+            outNeighbourIndices(i, m - offsets[i]) = indices[m];
+            outNeighbourSquaredDistances(i, m - offsets[i]) = squaredDistances[m];
         }
     }
+}//end radius_nearest_neighbours()
 
-}//end k_nearest_neighbours()
+template void radius_nearest_neighbours<FeatureMat>(const FeatureMat &, const FeatureMat &,
+                                                    MatDynInt &, MatDynFloat &,
+                                                    const float, const size_t);
+template void radius_nearest_neighbours<Vec3Mat>(const Vec3Mat &, const Vec3Mat &,
+                                                 MatDynInt &, MatDynFloat &,
+                                                 const float, const size_t);
 
 
 
@@ -349,8 +341,8 @@ void convert_mesh_to_matrices(const TriMesh &inMesh,
 }
 
 
-void convert_matrices_to_mesh(const Vec3Mat &inPositions,
-                                const FacesMat &inFaces,
+void convert_matrices_to_mesh(const ConstVec3View &inPositions,
+                                const ConstFacesView &inFaces,
                                 TriMesh &outMesh){
     /*
     GOAL
@@ -385,8 +377,8 @@ void convert_matrices_to_mesh(const Vec3Mat &inPositions,
 
 }
 
-void convert_matrices_to_mesh(const FeatureMat &inFeatures,
-                            const FacesMat &inFaces,
+void convert_matrices_to_mesh(const ConstFeatureView &inFeatures,
+                            const ConstFacesView &inFaces,
                             TriMesh &outMesh) {
     /*
     GOAL
@@ -452,7 +444,7 @@ void convert_matrices_to_mesh(const FeatureMat &inFeatures,
 
 
 
-void update_normals_safely(const FeatureMat &features, TriMesh &mesh){
+void update_normals_safely(const ConstFeatureView &features, TriMesh &mesh){
     /*
     GOAL
     Before updating the normals we're gonna check the current average normal.
@@ -523,9 +515,9 @@ void update_normals_safely(const FeatureMat &features, TriMesh &mesh){
     }
 }
 
-void convert_matrices_to_mesh(const FeatureMat &inFeatures,
-                            const FacesMat &inFaces,
-                            const VecDynFloat &inFlags,
+void convert_matrices_to_mesh(const ConstFeatureView &inFeatures,
+                            const ConstFacesView &inFaces,
+                            const ConstVecView &inFlags,
                             TriMesh &outMesh) {
     /*
     GOAL
@@ -783,7 +775,7 @@ void convert_eigen_to_openmesh(const FeatureMat &inFeatures,
 //}
 
 void update_normals_for_altered_positions(TriMesh &ioMesh,
-                                        FeatureMat &ioFeatures){
+                                        FeatureView ioFeatures){
     /*
     GOAL
     This function takes the positions that are in the first three columns of
@@ -854,9 +846,9 @@ void update_normals_for_altered_positions(TriMesh &ioMesh,
 
 }
 
-void update_normals_for_altered_positions(const Vec3Mat &inPositions,
-                                        const FacesMat &inFaces,
-                                        Vec3Mat &outNormals){
+void update_normals_for_altered_positions(const ConstVec3View &inPositions,
+                                        const ConstFacesView &inFaces,
+                                        Vec3View outNormals){
     /*
     GOAL
     This function takes the positions and faces, creates a mesh internally,
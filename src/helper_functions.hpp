@@ -10,6 +10,7 @@
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
 #include "../global.hpp"
+#include "MatrixView.hpp"
 
 typedef OpenMesh::TriMesh_ArrayKernelT<>  TriMesh;
 typedef Eigen::SparseMatrix<float, 0, int> SparseMat;
@@ -52,17 +53,17 @@ void convert_mesh_to_matrices(const TriMesh &inMesh,
                                 FacesMat &outFaces,
                                 VecDynFloat &outFlags);
 
-void convert_matrices_to_mesh(const Vec3Mat &inPositions,
-                                const FacesMat &inFaces,
+void convert_matrices_to_mesh(const ConstVec3View &inPositions,
+                                const ConstFacesView &inFaces,
                                 TriMesh &outMesh);
 
-void convert_matrices_to_mesh(const FeatureMat &inFeatures,
-                                const FacesMat &inFaces,
+void convert_matrices_to_mesh(const ConstFeatureView &inFeatures,
+                                const ConstFacesView &inFaces,
                                 TriMesh &outMesh);
 
-void convert_matrices_to_mesh(const FeatureMat &inFeatures,
-                                const FacesMat &inFaces,
-                                const VecDynFloat &inFlags,
+void convert_matrices_to_mesh(const ConstFeatureView &inFeatures,
+                                const ConstFacesView &inFaces,
+                                const ConstVecView &inFlags,
                                 TriMesh &outMesh);
 
 
@@ -88,13 +89,13 @@ void convert_matrices_to_mesh(const FeatureMat &inFeatures,
 
 
 void update_normals_for_altered_positions(TriMesh &ioMesh,
-                                        FeatureMat &ioFeatures);
+                                        FeatureView ioFeatures);
 
-void update_normals_for_altered_positions(const Vec3Mat &inPositions,
-                                        const FacesMat &inFaces,
-                                        Vec3Mat &outNormals);
+void update_normals_for_altered_positions(const ConstVec3View &inPositions,
+                                        const ConstFacesView &inFaces,
+                                        Vec3View outNormals);
 
-void update_normals_safely(const FeatureMat &features, TriMesh &mesh);
+void update_normals_safely(const ConstFeatureView &features, TriMesh &mesh);
 
 }//namespace registration
 #endif // HELPER_FUNCTIONS_HPP_INCLUDED